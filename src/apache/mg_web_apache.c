@@ -151,12 +151,14 @@ static void *        mg_merge_server_conf          (apr_pool_t *p, void *server1
 static void          mg_register_hooks             (apr_pool_t *p);
 int                  mg_check_file_type            (MGWEBAPACHE *pwebapache, char *type);
 int                  mg_parse_table                (void *rec, const char *key, const char *value);
+int                  mg_index_table                (void *rec, const char *key, const char *value);
 
 static void          mg_websocket_handshake        (MGWEBAPACHE *pwebapache, const char *key);
 static void          mg_websocket_parse_protocol   (MGWEBAPACHE *pwebapache, const char *sec_websocket_protocol);
 static size_t        mg_websocket_protocol_count   (MGWEBAPACHE *pwebapache);
 static const char *  mg_websocket_protocol_index   (MGWEBAPACHE *pwebapache, const size_t index);
 static void          mg_websocket_protocol_set     (MGWEBAPACHE *pwebapache, const char *protocol);
+static size_t        mg_websocket_send_frame       (MGWEB *pweb, unsigned char *header, size_t header_size, unsigned char *buffer, size_t buffer_size);
 
 
 #if defined(_WIN32)
@@ -857,6 +859,32 @@ int mg_parse_table(void *rec, const char *key, const char *value)
 }
 
 
+/* CMT68 index the request headers in one pass over headers_in */
+int mg_index_table(void *rec, const char *key, const char *value)
+{
+   MGWEB *pweb;
+
+   if (!rec || !key || !value) {
+      return 1;
+   }
+   pweb = (MGWEB *) rec;
+   mg_index_request_header(pweb, (char *) key, (int) strlen(key), (char *) value, (int) strlen(value), 0);
+
+   return 1;
+}
+
+
+int mg_get_request_headers(MGWEB *pweb)
+{
+   MGWEBAPACHE *pwebapache;
+
+   pwebapache = (MGWEBAPACHE *) pweb->pweb_server;
+   apr_table_do(mg_index_table, (void *) pweb, pwebapache->r->headers_in, NULL);
+
+   return CACHE_SUCCESS;
+}
+
+
 int mg_get_cgi_variable(MGWEB *pweb, char *name, char *pbuffer, int *pbuffer_size)
 {
    int rc, len;
@@ -1321,7 +1349,7 @@ __except (EXCEPTION_EXECUTE_HANDLER) {
 int mg_submit_headers(MGWEB *pweb)
 {
    int n, status, ctsize, cookie_no;
-   char *pa, *pz, *p1, *p2, *ct, *reason;
+   char *pa, *pz, *pe, *p1, *p2, *ct, *reason;
    MGWEBAPACHE *pwebapache;
 
 #ifdef _WIN32
@@ -1335,9 +1363,10 @@ __try {
    mg_log_buffer(pweb->plog, pweb, pweb->response_headers, (int) strlen(pweb->response_headers), "mgweb: headers", 0);
 */
    pa = pweb->response_headers;
+   pe = pa + strlen(pa); /* CMT69 */
 
    for (n = 0; ;n ++) {
-      pz = strstr(pa, "\r\n");
+      pz = mg_scan_find(pa, (int) (pe - pa), "\r\n", 2);
       if (!pz)
          break;
 
@@ -1537,6 +1566,11 @@ int mg_websocket_init(MGWEB *pweb)
    /* Set the expected acceptance response */
    mg_websocket_handshake(pwebapache, pweb->pwsock->sec_websocket_key);
 
+   /* CMT80 Confirm the extensions accepted (permessage-deflate) */
+   if (pweb->pwsock->sec_websocket_extensions[0] != '\0') {
+      apr_table_setn(pwebapache->r->headers_out, "Sec-WebSocket-Extensions", pweb->pwsock->sec_websocket_extensions);
+   }
+
    /* Handle the WebSocket protocol */
    if (pweb->pwsock->sec_websocket_protocol[0] != '\0') {
       /* Parse the WebSocket protocol entry */
@@ -1851,17 +1885,55 @@ size_t mg_websocket_write_block(MGWEB *pweb, int type, unsigned char *buffer, si
    mg_log_buffer(pweb->plog, pweb, header, pos, bufferx, 0);
 }
 */
-      mg_websocket_write(pweb, (char *) header, (int) pos); /* Header */
+      written = mg_websocket_send_frame(pweb, header, pos, buffer, (size_t) payload_length); /* CMT82 a close frame has set 'closing' by now */
+   }
 
-      if (payload_length > 0) {
-         if (mg_websocket_write(pweb, (char *) buffer, (int) buffer_size) > 0) { /* Payload Data */
-            written = buffer_size;
-         }
+   return written;
+}
+
+
+/* CMT79 write a frame whose header has already been created: used to send one message to all of a channel's subscribers */
+size_t mg_websocket_write_frame(MGWEB *pweb, unsigned char *header, size_t header_size, unsigned char *buffer, size_t buffer_size)
+{
+   size_t written;
+
+   written = 0;
+   if (!pweb->pwsock->closing) {
+      written = mg_websocket_send_frame(pweb, header, header_size, buffer, buffer_size);
+   }
+
+   return written;
+}
+
+
+/* CMT81 header and payload are passed to the output filters in one brigade so that the core filter sends them with one write */
+/* CMT82 the caller has checked that the WebSocket is not closing */
+static size_t mg_websocket_send_frame(MGWEB *pweb, unsigned char *header, size_t header_size, unsigned char *buffer, size_t buffer_size)
+{
+   size_t written;
+   apr_bucket *bucket;
+   MGWEBAPACHE *pwebapache;
+
+   pwebapache = (MGWEBAPACHE *) pweb->pweb_server;
+
+   written = 0;
+
+   if ((pwebapache->r != NULL) && (pwebapache->obb != NULL)) {
+      pwebapache->of = pwebapache->r->connection->output_filters;
+
+      bucket = apr_bucket_transient_create((const char *) header, (apr_size_t) header_size, pwebapache->obb->bucket_alloc); /* Header */
+      APR_BRIGADE_INSERT_TAIL(pwebapache->obb, bucket);
+
+      if (buffer_size > 0) {
+         bucket = apr_bucket_transient_create((const char *) buffer, (apr_size_t) buffer_size, pwebapache->obb->bucket_alloc); /* Payload Data */
+         APR_BRIGADE_INSERT_TAIL(pwebapache->obb, bucket);
+         written = buffer_size;
       }
 
       if (ap_fflush(pwebapache->of, pwebapache->obb) != APR_SUCCESS) {
          written = 0;
       }
+      apr_brigade_cleanup(pwebapache->obb); /* the transient buckets must not outlive the caller's buffers */
    }
 
    return written;
@@ -0,0 +1,1728 @@
+/*
+   ----------------------------------------------------------------------------
+   | mg_web_bench                                                             |
+   | Description: Benchmark harness for the mg_web core                       |
+   | Author:      Chris Munt cmunt@mgateway.com                               |
+   |                         chris.e.munt@gmail.com                           |
+   | Copyright (c) 2019-2025 MGateway Ltd                                     |
+   | Surrey UK.                                                               |
+   | All rights reserved.                                                     |
+   |                                                                          |
+   | http://www.mgateway.com                                                  |
+   |                                                                          |
+   | Licensed under the Apache License, Version 2.0 (the "License"); you may  |
+   | not use this file except in compliance with the License.                 |
+   | You may obtain a copy of the License at                                  |
+   |                                                                          |
+   | http://www.apache.org/licenses/LICENSE-2.0                               |
+   |                                                                          |
+   | Unless required by applicable law or agreed to in writing, software      |
+   | distributed under the License is distributed on an "AS IS" BASIS,        |
+   | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. |
+   | See the License for the specific language governing permissions and      |
+   | limitations under the License.                                           |
+   |                                                                          |
+   ----------------------------------------------------------------------------
+*/
+
+/*
+   CMT76 A standalone benchmark for the mg_web core (UNIX only).
+
+   This program stands in for both ends of a real deployment:
+
+   1) A stub web server module implementing the interface functions that the
+      Apache, Nginx and IIS modules provide (mg_get_cgi_variable, mg_client_read,
+      mg_client_write, mg_submit_headers etc...).  Requests are driven straight into
+      mg_web() by a pool of load threads; the response is counted and discarded.
+
+   2) A mock DB Server listening on a local port and speaking the %zmgsis
+      network protocol: the handshake, ping, and the web function command with
+      responses returned either in one block or in stream mode 1 (blocked) or 2 (ASCII).
+
+   The mg_web code paths between the two (connection pooling, request framing,
+   response parsing, chunking etc...) are exactly those used in production.
+
+   CMT81 The 'frames' workload measures the WebSocket framing code on its own:
+   masked client frames of 128 Bytes, 4 KB and 1 MB are fed through
+   mg_websocket_incoming_frame() in the blocks read by the web server modules,
+   and the unmasked messages are forwarded to a socket that is read and discarded.
+   CMT82 A client close frame is then passed through mg_websocket_data_framing()
+   to check that the server's closing handshake reaches the client.
+
+   CMT82 The 'cgi' workload measures the lookup of request headers as CGI variables:
+   by the web server module's mg_get_cgi_variable() (a walk of the request headers
+   for each variable, as the Apache and Nginx modules do) and from the per-request
+   header index (mg_index_request_headers() then mg_get_request_variable()).
+   The 'locations' workload measures finding the longest matching location for
+   10, 100 and 1000 configured locations: by a scan of the list and from the radix
+   tree index built by mg_parse_config().
+*/
+
+#include "mg_websys.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#include "mg_web.h"
+#include "mg_websocket.h"
+
+#define MG_BENCH_FUNCTION     "web^%zmgweb"
+#define MG_BENCH_LOCATION     "/bench"
+#define MG_BENCH_MP_LOCATION  "/bench/mp" /* CMT82 location with server affinity taken from a multipart/form-data field */
+#define MG_BENCH_MP_BOUNDARY  "----mgwebbench7MA4YWxkTrZu0gW"
+#define MG_BENCH_MP_VARIABLE  "mgserver"
+#define MG_BENCH_ZV           "IRIS for UNIX (mg_web_bench mock DB Server) 2023.1 (Build 229U)"
+#define MG_BENCH_FILL_SIZE    65536
+#define MG_BENCH_STREAM_CHUNK 8192
+#define MG_BENCH_FRAME_BYTES  67108864 /* CMT81 payload sent for each message size in the 'frames' workload */
+#define MG_BENCH_LOOKUPS      200000   /* CMT82 requests (or locations) looked up in the 'cgi' and 'locations' workloads */
+
+
+typedef struct tagMGBENCHLOAD {
+   char *               name;
+   char *               method;
+   unsigned long        request_size;
+   unsigned long        response_size;
+   int                  stream;
+   int                  multipart;
+} MGBENCHLOAD, *LPMGBENCHLOAD;
+
+
+/* CMT82 a request header presented by the stub web server module */
+typedef struct tagMGBENCHHDR {
+   char *               name;
+   char *               value;
+} MGBENCHHDR, *LPMGBENCHHDR;
+
+
+typedef struct tagMGWEBBENCH {
+   MGBENCHLOAD *        pload;
+   char                 script_name[128];
+   char                 content_length[32];
+   unsigned long        read_total;
+   unsigned long        write_total;
+   int                  status;
+} MGWEBBENCH, *LPMGWEBBENCH;
+
+
+typedef struct tagMGBENCHTHREAD {
+   pthread_t            thread_id;
+   MGBENCHLOAD *        pload;
+   int                  requests;
+   int                  errors;
+   long long *          latency;
+} MGBENCHTHREAD, *LPMGBENCHTHREAD;
+
+
+/* Workloads: request payload and response body sizes in Bytes */
+static MGBENCHLOAD mg_bench_load[] = {
+   {"small",     "GET",  0,       64,     0, 0},
+   {"large",     "GET",  0,       262144, 0, 0},
+   {"stream1",   "GET",  0,       262144, 1, 0},
+   {"stream2",   "GET",  0,       262144, 2, 0},
+   {"upload",    "POST", 1048576, 64,     0, 0},
+   {"multipart", "POST", 1048576, 64,     0, 1}, /* CMT82 */
+   {NULL,        NULL,   0,       0,      0, 0}
+};
+
+/* CMT82 the request headers of a typical browser request */
+static MGBENCHHDR mg_bench_headers[] = {
+   {"Host",                      "localhost"},
+   {"User-Agent",                "mg_web_bench"},
+   {"Accept",                    "text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8"},
+   {"Accept-Language",           "en-GB,en;q=0.9"},
+   {"Accept-Encoding",           "gzip, deflate, br"},
+   {"Connection",                "keep-alive"},
+   {"Referer",                   "http://localhost/bench/index.html"},
+   {"Cookie",                    "MGWSESSION=0123456789abcdef0123456789abcdef; theme=dark; _ga=GA1.1.1234567890.1700000000"},
+   {"Upgrade-Insecure-Requests", "1"},
+   {"Sec-Fetch-Dest",            "document"},
+   {"Sec-Fetch-Mode",            "navigate"},
+   {"Sec-Fetch-Site",            "same-origin"},
+   {"Sec-Fetch-User",            "?1"},
+   {"Cache-Control",             "max-age=0"},
+   {"DNT",                       "1"},
+   {"Priority",                  "u=0, i"},
+   {NULL,                        NULL}
+};
+
+/* CMT82 the variables looked up for each request in the 'cgi' workload: the Accept header (SSE detection) and those commonly configured */
+static char * mg_bench_cgi_names[] = {
+   "HTTP_ACCEPT",
+   "HTTP_HOST",
+   "HTTP_USER_AGENT",
+   "HTTP_ACCEPT_LANGUAGE",
+   "HTTP_COOKIE",
+   "HTTP_REFERER",
+   "HTTP_X_FORWARDED_FOR",
+   "HTTP*",
+   NULL
+};
+
+static char          mg_bench_fill[MG_BENCH_FILL_SIZE];
+static char *        mg_bench_multipart = NULL; /* CMT82 */
+static int           mg_bench_verbose = 0;
+static unsigned char *mg_bench_ws_in = NULL; /* CMT82 frame returned by the next mg_websocket_frame_read() */
+static int           mg_bench_ws_in_len = 0;
+static unsigned char mg_bench_ws_out[64];   /* CMT82 frames written to the client */
+static int           mg_bench_ws_out_len = 0;
+
+static MGBENCHLOAD * mg_bench_find_load            (char *name, int name_len);
+static int           mg_bench_run                  (MGBENCHLOAD *pload, int threads, int requests);
+static int           mg_bench_multipart_body       (unsigned long size);
+static int           mg_bench_scan                 (int threads, int requests);
+static void *        mg_bench_load_thread          (void *arg);
+static int           mg_bench_request              (MGBENCHLOAD *pload);
+static int           mg_bench_compare              (const void *a, const void *b);
+static int           mg_bench_dbserver_start       (void);
+static void *        mg_bench_dbserver_listen      (void *arg);
+static void *        mg_bench_dbserver_connection  (void *arg);
+static int           mg_bench_dbserver_command     (int sockfd, unsigned char *buffer, unsigned long size);
+static int           mg_bench_dbserver_respond     (int sockfd, MGBENCHLOAD *pload, unsigned long requestno, int ok);
+static int           mg_bench_recv                 (int sockfd, unsigned char *buffer, unsigned long size);
+static int           mg_bench_send                 (int sockfd, unsigned char *buffer, unsigned long size);
+static int           mg_bench_frames               (void);
+static int           mg_bench_frames_run           (MGWEB *pweb, size_t message_size);
+static int           mg_bench_frames_verify        (size_t message_size);
+static int           mg_bench_frames_close         (MGWEB *pweb);
+static size_t        mg_websocket_send_frame       (MGWEB *pweb, unsigned char *header, size_t header_size, unsigned char *buffer, size_t buffer_size);
+static void *        mg_bench_frames_drain         (void *arg);
+static int           mg_bench_cgi                  (void);
+static int           mg_bench_cgi_lookup           (MGWEB *pweb, int indexed, char *pbuffer, int *pfound);
+static int           mg_bench_locations            (void);
+static int           mg_bench_locations_run        (int no_locations);
+static int           mg_bench_find_header          (char *name, char **pvalue);
+
+
+int main(int argc, char *argv[])
+{
+   int n, port, threads, requests, multiplex, max_connections, rc, errors;
+   char *workload;
+   char conf_file[256], log_file[256];
+   FILE *fp;
+   MGBENCHLOAD *pload;
+
+   workload = "all";
+   threads = 8;
+   requests = 1000;
+   multiplex = 0;
+   max_connections = 0;
+
+   for (n = 1; n < argc; n ++) {
+      if (!strcmp(argv[n], "-w") && (n + 1) < argc) {
+         workload = argv[++ n];
+      }
+      else if (!strcmp(argv[n], "-t") && (n + 1) < argc) {
+         threads = (int) strtol(argv[++ n], NULL, 10);
+      }
+      else if (!strcmp(argv[n], "-n") && (n + 1) < argc) {
+         requests = (int) strtol(argv[++ n], NULL, 10);
+      }
+      else if (!strcmp(argv[n], "-m") && (n + 1) < argc) {
+         multiplex = (int) strtol(argv[++ n], NULL, 10);
+      }
+      else if (!strcmp(argv[n], "-c") && (n + 1) < argc) {
+         max_connections = (int) strtol(argv[++ n], NULL, 10);
+      }
+      else if (!strcmp(argv[n], "-v")) {
+         mg_bench_verbose = 1;
+      }
+      else {
+         printf("usage: %s [-w small|large|stream1|stream2|upload|multipart|all|scan|frames|cgi|locations] [-t threads] [-n requests per thread] [-m multiplex] [-c max_connections] [-v]\n", argv[0]);
+         return 1;
+      }
+   }
+   if (threads < 1) {
+      threads = 1;
+   }
+   if (requests < 1) {
+      requests = 1;
+   }
+   if (strcmp(workload, "all") && strcmp(workload, "scan") && strcmp(workload, "frames") && strcmp(workload, "cgi") && strcmp(workload, "locations") && !mg_bench_find_load(workload, (int) strlen(workload))) {
+      printf("mg_web_bench: unknown workload: %s\n", workload);
+      return 1;
+   }
+
+   signal(SIGPIPE, SIG_IGN);
+   memset((void *) mg_bench_fill, 'x', MG_BENCH_FILL_SIZE);
+
+   if (!strcmp(workload, "frames")) { /* CMT81 */
+      rc = mg_bench_frames();
+      return (rc ? 2 : 0);
+   }
+   if (!strcmp(workload, "cgi")) { /* CMT82 */
+      rc = mg_bench_cgi();
+      return (rc ? 2 : 0);
+   }
+   if (!strcmp(workload, "locations")) { /* CMT82 */
+      rc = mg_bench_locations();
+      return (rc ? 2 : 0);
+   }
+
+   for (pload = mg_bench_load; pload->name; pload ++) { /* CMT82 */
+      if (pload->multipart && mg_bench_multipart_body(pload->request_size) != 0) {
+         printf("mg_web_bench: cannot create the multipart/form-data request payload\n");
+         return 1;
+      }
+   }
+
+   port = mg_bench_dbserver_start();
+   if (port < 0) {
+      printf("mg_web_bench: cannot start the mock DB Server\n");
+      return 1;
+   }
+
+   sprintf(conf_file, "/tmp/mg_web_bench_%d.conf", (int) getpid());
+   sprintf(log_file, "/tmp/mg_web_bench_%d.log", (int) getpid());
+   fp = fopen(conf_file, "w");
+   if (!fp) {
+      printf("mg_web_bench: cannot create the configuration file: %s\n", conf_file);
+      return 1;
+   }
+   fprintf(fp, "timeout 30\n");
+   fprintf(fp, "<server bench>\n");
+   fprintf(fp, "  type IRIS\n");
+   fprintf(fp, "  host 127.0.0.1\n");
+   fprintf(fp, "  tcp_port %d\n", port);
+   if (max_connections > 0) {
+      fprintf(fp, "  max_connections %d\n", max_connections);
+   }
+   if (multiplex > 1) {
+      fprintf(fp, "  multiplex %d\n", multiplex);
+   }
+   fprintf(fp, "</server>\n");
+   fprintf(fp, "<server bench2>\n"); /* CMT82 the multipart workload selects this server through its server affinity variable */
+   fprintf(fp, "  type IRIS\n");
+   fprintf(fp, "  host 127.0.0.1\n");
+   fprintf(fp, "  tcp_port %d\n", port);
+   fprintf(fp, "</server>\n");
+   fprintf(fp, "<location %s>\n", MG_BENCH_LOCATION);
+   fprintf(fp, "  function %s\n", MG_BENCH_FUNCTION);
+   fprintf(fp, "  servers bench\n");
+   fprintf(fp, "</location>\n");
+   fprintf(fp, "<location %s>\n", MG_BENCH_MP_LOCATION);
+   fprintf(fp, "  function %s\n", MG_BENCH_FUNCTION);
+   fprintf(fp, "  servers bench bench2\n");
+   fprintf(fp, "  server_affinity variable:%s\n", MG_BENCH_MP_VARIABLE);
+   fprintf(fp, "</location>\n");
+   fclose(fp);
+
+   strcpy(mg_system.config_file, conf_file);
+   strcpy(mg_system.log.log_file, log_file);
+   mg_worker_init();
+
+   if (mg_system.config_error[0]) {
+      printf("mg_web_bench: configuration error: %s\n", mg_system.config_error);
+      mg_worker_exit();
+      unlink(conf_file);
+      return 1;
+   }
+
+   printf("mg_web_bench: mg_web v%s; DB Server port %d; threads=%d; requests per thread=%d; multiplex=%d; max_connections=%d\n", DBX_VERSION, port, threads, requests, multiplex, max_connections);
+   printf("%-9s %9s %7s %11s %9s %9s %9s %9s %9s\n", "workload", "requests", "errors", "req/s", "p50 us", "p90 us", "p99 us", "p99.9 us", "max us");
+
+   errors = 0;
+   if (!strcmp(workload, "scan")) { /* CMT82 */
+      errors = mg_bench_scan(threads, requests);
+   }
+   for (pload = mg_bench_load; pload->name; pload ++) {
+      if (strcmp(workload, "all") && strcmp(workload, pload->name)) {
+         continue;
+      }
+      mg_bench_request(pload); /* warm up the connection pool */
+      rc = mg_bench_run(pload, threads, requests);
+      if (rc != 0) {
+         errors ++;
+      }
+   }
+
+   mg_worker_exit();
+   unlink(conf_file);
+   if (mg_bench_multipart) {
+      free((void *) mg_bench_multipart);
+   }
+   if (errors) {
+      printf("mg_web_bench: errors were recorded: see %s\n", log_file);
+   }
+   else {
+      unlink(log_file);
+   }
+
+   return (errors ? 2 : 0);
+}
+
+
+static MGBENCHLOAD * mg_bench_find_load(char *name, int name_len)
+{
+   MGBENCHLOAD *pload;
+
+   for (pload = mg_bench_load; pload->name; pload ++) {
+      if ((int) strlen(pload->name) == name_len && !strncmp(pload->name, name, name_len)) {
+         return pload;
+      }
+   }
+   return NULL;
+}
+
+
+/* CMT82 build the multipart/form-data payload: a file section whose filler is rich in '-' (each one a candidate for the boundary scan) followed by the server affinity field */
+
+static int mg_bench_multipart_body(unsigned long size)
+{
+   unsigned long n, head_len, tail_len, seed;
+   char head[512], tail[256];
+   static const char filler[] = "-----abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+
+   sprintf(head, "--%s\r\nContent-Disposition: form-data; name=\"file\"; filename=\"bench.bin\"\r\nContent-Type: application/octet-stream\r\n\r\n", MG_BENCH_MP_BOUNDARY);
+   sprintf(tail, "\r\n--%s\r\nContent-Disposition: form-data; name=\"%s\"\r\n\r\n1\r\n--%s--\r\n", MG_BENCH_MP_BOUNDARY, MG_BENCH_MP_VARIABLE, MG_BENCH_MP_BOUNDARY);
+   head_len = (unsigned long) strlen(head);
+   tail_len = (unsigned long) strlen(tail);
+   if (size < (head_len + tail_len)) {
+      return -1;
+   }
+   if (mg_bench_multipart) {
+      return 0;
+   }
+   mg_bench_multipart = (char *) malloc(size);
+   if (!mg_bench_multipart) {
+      return -1;
+   }
+
+   memcpy((void *) mg_bench_multipart, (void *) head, head_len);
+   seed = 12345;
+   for (n = head_len; n < (size - tail_len); n ++) {
+      seed = (seed * 1103515245 + 12345) & 0x7fffffff;
+      mg_bench_multipart[n] = filler[(seed >> 16) % (sizeof(filler) - 1)];
+   }
+   memcpy((void *) (mg_bench_multipart + (size - tail_len)), (void *) tail, tail_len);
+
+   return 0;
+}
+
+
+/* CMT82 run the multipart workload (and a streamed response) with each of the byte scanners in turn */
+
+static int mg_bench_scan(int threads, int requests)
+{
+   int level, errors;
+   MGBENCHLOAD *pload;
+   static const char *scan_name[3] = {"scalar", "sse2", "avx2"};
+
+   errors = 0;
+   for (level = MG_SCAN_SCALAR; level <= MG_SCAN_AVX2; level ++) {
+      if (mg_scan_init(level) != level) {
+         printf("scanner: %s (not available)\n", scan_name[level]);
+         continue;
+      }
+      printf("scanner: %s\n", scan_name[level]);
+      for (pload = mg_bench_load; pload->name; pload ++) {
+         if (!pload->multipart && strcmp(pload->name, "stream2")) {
+            continue;
+         }
+         mg_bench_request(pload);
+         if (mg_bench_run(pload, threads, requests) != 0) {
+            errors ++;
+         }
+      }
+   }
+   mg_scan_init(-1);
+
+   return errors;
+}
+
+
+static int mg_bench_run(MGBENCHLOAD *pload, int threads, int requests)
+{
+   int n, i, total, errors;
+   long long time_start, time_elapsed;
+   long long *latency;
+   double rate;
+   MGBENCHTHREAD *pthr;
+
+   pthr = (MGBENCHTHREAD *) calloc(threads, sizeof(MGBENCHTHREAD));
+   latency = (long long *) malloc(sizeof(long long) * threads * requests);
+   if (!pthr || !latency) {
+      printf("mg_web_bench: memory allocation error\n");
+      return -1;
+   }
+
+   time_start = mg_time_usecs();
+   for (n = 0; n < threads; n ++) {
+      pthr[n].pload = pload;
+      pthr[n].requests = requests;
+      pthr[n].errors = 0;
+      pthr[n].latency = latency + (n * requests);
+      pthread_create(&(pthr[n].thread_id), NULL, mg_bench_load_thread, (void *) &pthr[n]);
+   }
+   errors = 0;
+   for (n = 0; n < threads; n ++) {
+      pthread_join(pthr[n].thread_id, NULL);
+      errors += pthr[n].errors;
+   }
+   time_elapsed = mg_time_usecs() - time_start;
+
+   total = threads * requests;
+   qsort((void *) latency, (size_t) total, sizeof(long long), mg_bench_compare);
+   rate = time_elapsed > 0 ? ((double) total * 1000000.0) / (double) time_elapsed : 0;
+
+   printf("%-9s %9d %7d %11.0f", pload->name, total, errors, rate);
+   for (i = 0; i < 4; i ++) {
+      static const double pct[4] = {0.50, 0.90, 0.99, 0.999};
+      n = (int) (pct[i] * (double) total);
+      if (n >= total) {
+         n = total - 1;
+      }
+      printf(" %9lld", latency[n]);
+   }
+   printf(" %9lld\n", latency[total - 1]);
+
+   free((void *) latency);
+   free((void *) pthr);
+
+   return (errors ? -1 : 0);
+}
+
+
+static void * mg_bench_load_thread(void *arg)
+{
+   int n;
+   long long time_start;
+   MGBENCHTHREAD *pthr;
+
+   pthr = (MGBENCHTHREAD *) arg;
+
+   for (n = 0; n < pthr->requests; n ++) {
+      time_start = mg_time_usecs();
+      if (mg_bench_request(pthr->pload) != 0) {
+         pthr->errors ++;
+      }
+      pthr->latency[n] = mg_time_usecs() - time_start;
+   }
+
+   return NULL;
+}
+
+
+/* Serve one request through mg_web() in the way that the web server modules do */
+
+static int mg_bench_request(MGBENCHLOAD *pload)
+{
+   int rc, server_no;
+   MGWEB *pweb;
+   MGWEBBENCH webbench, *pwebbench;
+
+   pwebbench = &webbench;
+   pwebbench->pload = pload;
+   sprintf(pwebbench->script_name, "%s/%s.mgw", pload->multipart ? MG_BENCH_MP_LOCATION : MG_BENCH_LOCATION, pload->name);
+   sprintf(pwebbench->content_length, "%lu", pload->request_size);
+   pwebbench->read_total = 0;
+   pwebbench->write_total = 0;
+   pwebbench->status = 0;
+
+   pweb = mg_obtain_request_memory((void *) pwebbench, pload->request_size, 0, MG_WS_APACHE);
+   if (!pweb) {
+      return -1;
+   }
+   pweb->http_version_major = 1;
+   pweb->http_version_minor = 1;
+   pweb->pweb_server = (void *) pwebbench;
+   pweb->evented = 0;
+   pweb->wserver_chunks_response = 0;
+
+   mg_web(pweb);
+
+   server_no = pweb->server_no;
+   mg_release_request_memory(pweb);
+
+   rc = 0;
+   if (pload->multipart && server_no != 1) { /* CMT82 the server affinity variable was not found in the payload */
+      rc = -1;
+      if (mg_bench_verbose) {
+         printf("mg_web_bench: %s: server_no=%d (expected 1)\n", pload->name, server_no);
+      }
+   }
+   if (pwebbench->status != 200 || pwebbench->write_total < pload->response_size) {
+      rc = -1;
+      if (mg_bench_verbose) {
+         printf("mg_web_bench: %s: status=%d; response Bytes=%lu (expected %lu)\n", pload->name, pwebbench->status, pwebbench->write_total, pload->response_size);
+      }
+   }
+
+   return rc;
+}
+
+
+static int mg_bench_compare(const void *a, const void *b)
+{
+   long long la, lb;
+
+   la = *((const long long *) a);
+   lb = *((const long long *) b);
+
+   return (la > lb) - (la < lb);
+}
+
+
+/* CMT81 WebSocket framing: client to DB Server */
+
+static int mg_bench_frames(void)
+{
+   int n, rc, errors, sv[2], bufsize;
+   pthread_t drain_thread;
+   MGWEB web, *pweb;
+   MGWEBSOCK wsock;
+   DBXCON con;
+   static const size_t message_size[3] = {128, 4096, 1048576};
+
+   if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+      printf("mg_web_bench: cannot create a socket pair\n");
+      return -1;
+   }
+   bufsize = 1048576;
+   setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, (void *) &bufsize, sizeof(bufsize));
+   setsockopt(sv[1], SOL_SOCKET, SO_RCVBUF, (void *) &bufsize, sizeof(bufsize));
+   pthread_create(&drain_thread, NULL, mg_bench_frames_drain, (void *) (long) sv[1]);
+
+   memset((void *) &web, 0, sizeof(MGWEB));
+   memset((void *) &wsock, 0, sizeof(MGWEBSOCK));
+   memset((void *) &con, 0, sizeof(DBXCON));
+   pweb = &web;
+   pweb->plog = &(mg_system.log);
+   pweb->pwsock = &wsock;
+   pweb->pcon = &con;
+   wsock.protocol_version = 13;
+   con.cli_socket = sv[0];
+   con.connected = 1;
+
+   printf("mg_web_bench: mg_web v%s; WebSocket framing (client to DB Server); %d MB of payload for each message size\n", DBX_VERSION, MG_BENCH_FRAME_BYTES / 1048576);
+   printf("%-8s %9s %7s %11s %9s\n", "message", "frames", "errors", "frames/s", "MB/s");
+
+   errors = 0;
+   for (n = 0; n < 3; n ++) {
+      rc = mg_bench_frames_run(pweb, message_size[n]);
+      if (rc != 0) {
+         errors ++;
+      }
+   }
+   if (mg_bench_frames_close(pweb) != 0) {
+      errors ++;
+   }
+
+   close(sv[0]);
+   pthread_join(drain_thread, NULL);
+   close(sv[1]);
+
+   return (errors ? -1 : 0);
+}
+
+
+static int mg_bench_frames_run(MGWEB *pweb, size_t message_size)
+{
+   int n, frames, errors;
+   size_t i, pos, frame_size, block_size;
+   long long time_start, time_elapsed;
+   double rate;
+   unsigned char *frame;
+   char name[32];
+   MGWSRSTATE read_state;
+   MGWSFDATA control_frame = { 0, NULL, 1, 8, UTF8_VALID, 0, 0, 0 };
+   MGWSFDATA message_frame = { 0, NULL, 1, 0, UTF8_VALID, 0, 0, 0 };
+   static const unsigned char mask[4] = {0x37, 0xfa, 0x21, 0x3d};
+
+   frame = (unsigned char *) malloc(message_size + 16);
+   if (!frame) {
+      printf("mg_web_bench: memory allocation error\n");
+      return -1;
+   }
+
+   /* one masked binary frame, as sent by a browser */
+   pos = 0;
+   frame[pos ++] = MG_WS_FRAME_SET_FIN(1) | MG_WS_FRAME_SET_OPCODE(MG_WS_OPCODE_BINARY);
+   if (message_size < 126) {
+      frame[pos ++] = MG_WS_FRAME_SET_MASK(1) | (unsigned char) message_size;
+   }
+   else if (message_size < 65536) {
+      frame[pos ++] = MG_WS_FRAME_SET_MASK(1) | 126;
+      frame[pos ++] = MG_WS_FRAME_SET_LENGTH(message_size, 1);
+      frame[pos ++] = MG_WS_FRAME_SET_LENGTH(message_size, 0);
+   }
+   else {
+      frame[pos ++] = MG_WS_FRAME_SET_MASK(1) | 127;
+      for (n = 7; n >= 0; n --) {
+         frame[pos ++] = MG_WS_FRAME_SET_LENGTH((mg_uint64_t) message_size, n);
+      }
+   }
+   memcpy((void *) (frame + pos), (void *) mask, 4);
+   pos += 4;
+   for (i = 0; i < message_size; i ++) {
+      frame[pos + i] = mg_bench_fill[i % MG_BENCH_FILL_SIZE] ^ mask[i & 3];
+   }
+   frame_size = pos + message_size;
+
+   memset((void *) &read_state, 0, sizeof(MGWSRSTATE));
+   read_state.framing_state = MG_WS_DATA_FRAMING_START;
+   read_state.opcode = 0xFF;
+   read_state.control_frame = control_frame;
+   read_state.message_frame = message_frame;
+   read_state.frame = &(read_state.control_frame);
+   read_state.status_code = MG_WS_STATUS_CODE_OK;
+
+   frames = (int) (MG_BENCH_FRAME_BYTES / message_size);
+   errors = 0;
+   if (mg_bench_frames_verify(message_size) != 0) {
+      errors ++;
+   }
+
+   time_start = mg_time_usecs();
+   for (n = 0; n < frames; n ++) {
+      for (pos = 0; pos < frame_size; pos += block_size) { /* in the blocks read by the web server modules */
+         block_size = frame_size - pos;
+         if (block_size > MG_WS_BLOCK_DATA_SIZE) {
+            block_size = MG_WS_BLOCK_DATA_SIZE;
+         }
+         mg_websocket_incoming_frame(pweb, &read_state, (char *) (frame + pos), (mg_int64_t) block_size);
+      }
+      if (read_state.framing_state != MG_WS_DATA_FRAMING_START) {
+         errors ++;
+         break;
+      }
+   }
+   time_elapsed = mg_time_usecs() - time_start;
+
+   rate = time_elapsed > 0 ? ((double) n * 1000000.0) / (double) time_elapsed : 0;
+   if (message_size >= 1048576)
+      sprintf(name, "%luMB", (unsigned long) (message_size / 1048576));
+   else if (message_size >= 1024)
+      sprintf(name, "%luKB", (unsigned long) (message_size / 1024));
+   else
+      sprintf(name, "%luB", (unsigned long) message_size);
+   printf("%-8s %9d %7d %11.0f %9.1f\n", name, n, errors, rate, (rate * (double) message_size) / 1048576.0);
+
+   if (read_state.message_frame.application_data) {
+      free(read_state.message_frame.application_data);
+   }
+   if (read_state.control_frame.application_data) {
+      free(read_state.control_frame.application_data);
+   }
+   free((void *) frame);
+
+   return (errors ? -1 : 0);
+}
+
+
+/* check mg_websocket_unmask() against a byte at a time: from an odd position in the payload and with the buffers out of alignment */
+
+static int mg_bench_frames_verify(size_t message_size)
+{
+   int rc;
+   size_t i;
+   unsigned int seed;
+   unsigned char *src, *dst;
+   static const unsigned char mask[4] = {0x37, 0xfa, 0x21, 0x3d};
+   const mg_int64_t mask_offset = 3;
+
+   src = (unsigned char *) malloc((message_size + 1) * 2);
+   if (!src) {
+      printf("mg_web_bench: memory allocation error\n");
+      return -1;
+   }
+   dst = src + message_size + 1;
+
+   seed = 12345;
+   for (i = 0; i < message_size; i ++) {
+      seed = (seed * 1103515245) + 12345;
+      src[i + 1] = (unsigned char) (seed >> 16);
+   }
+   mg_websocket_unmask(dst, src + 1, message_size, (unsigned char *) mask, mask_offset);
+
+   rc = 0;
+   for (i = 0; i < message_size; i ++) {
+      if (dst[i] != (unsigned char) (src[i + 1] ^ mask[(mask_offset + i) & 3])) {
+         printf("mg_web_bench: unmasked payload differs from the reference at byte %lu of %lu\n", (unsigned long) i, (unsigned long) message_size);
+         rc = -1;
+         break;
+      }
+   }
+   free((void *) src);
+
+   return rc;
+}
+
+
+/* CMT82 the client closes the WebSocket: the server must answer with a close frame (status 1000) and write nothing after it */
+
+static int mg_bench_frames_close(MGWEB *pweb)
+{
+   int rc;
+   unsigned char frame[8];
+   static const unsigned char mask[4] = {0x37, 0xfa, 0x21, 0x3d};
+   static const unsigned char reply[4] = {0x88, 0x02, 0x03, 0xe8};
+
+   frame[0] = MG_WS_FRAME_SET_FIN(1) | MG_WS_FRAME_SET_OPCODE(MG_WS_OPCODE_CLOSE);
+   frame[1] = MG_WS_FRAME_SET_MASK(1) | 2;
+   memcpy((void *) (frame + 2), (void *) mask, 4);
+   frame[6] = 0x03 ^ mask[0];
+   frame[7] = 0xe8 ^ mask[1];
+
+   pweb->pwsock->closing = 0;
+   mg_bench_ws_out_len = 0;
+   mg_bench_ws_in = frame;
+   mg_bench_ws_in_len = (int) sizeof(frame);
+   mg_websocket_data_framing(pweb);
+   mg_websocket_write_block(pweb, MG_WS_MESSAGE_TYPE_CLOSE, (unsigned char *) "", 0); /* as the relay does when the DB Server closes */
+
+   rc = 0;
+   if (mg_bench_ws_out_len != (int) sizeof(reply) || memcmp((void *) mg_bench_ws_out, (void *) reply, sizeof(reply))) {
+      printf("mg_web_bench: the server's close frame was not written to the client (%d Bytes written)\n", mg_bench_ws_out_len);
+      rc = -1;
+   }
+   printf("%-8s %9d %7d\n", "close", 1, rc ? 1 : 0);
+
+   return rc;
+}
+
+
+/* the DB Server's side of the WebSocket: messages are read and discarded */
+
+static void * mg_bench_frames_drain(void *arg)
+{
+   int sockfd;
+   ssize_t n;
+   unsigned char buffer[65536];
+
+   sockfd = (int) (long) arg;
+   for (;;) {
+      n = recv(sockfd, (void *) buffer, sizeof(buffer), 0);
+      if (n < 0 && errno == EINTR) {
+         continue;
+      }
+      if (n <= 0) {
+         break;
+      }
+   }
+
+   return NULL;
+}
+
+
+/* CMT82 request header lookup: the web server module's mg_get_cgi_variable() against the per-request header index */
+
+static int mg_bench_cgi(void)
+{
+   int n, indexed, errors, found, found_ref, len, len_ref;
+   long long time_start, time_elapsed;
+   double rate, rate_ref;
+   char *buffer_ref;
+   MGWEB *pweb;
+   MGWEBBENCH webbench;
+
+   memset((void *) &webbench, 0, sizeof(MGWEBBENCH));
+   webbench.pload = mg_bench_load;
+   strcpy(webbench.script_name, MG_BENCH_LOCATION "/small.mgw");
+
+   pweb = mg_obtain_request_memory((void *) &webbench, 0, 0, MG_WS_APACHE);
+   buffer_ref = (char *) malloc(65536);
+   if (!pweb || !buffer_ref) {
+      printf("mg_web_bench: memory allocation error\n");
+      return -1;
+   }
+   pweb->pweb_server = (void *) &webbench;
+
+   /* both methods must produce the same CGI variables */
+   errors = 0;
+   len_ref = mg_bench_cgi_lookup(pweb, 0, buffer_ref, &found_ref);
+   len = mg_bench_cgi_lookup(pweb, 1, NULL, &found);
+   if (len != len_ref || found != found_ref || memcmp((void *) pweb->input_buf.buf_addr, (void *) buffer_ref, (size_t) len)) {
+      errors ++;
+   }
+
+   printf("mg_web_bench: mg_web v%s; request header lookup; %d request headers; %d variables looked up for each request\n", DBX_VERSION, (int) (sizeof(mg_bench_headers) / sizeof(MGBENCHHDR)) - 1, (int) (sizeof(mg_bench_cgi_names) / sizeof(char *)) - 1);
+   printf("%-8s %9s %7s %11s %9s %9s\n", "method", "requests", "errors", "req/s", "ns/req", "speedup");
+
+   rate_ref = 0;
+   for (indexed = 0; indexed < 2; indexed ++) {
+      time_start = mg_time_usecs();
+      for (n = 0; n < MG_BENCH_LOOKUPS; n ++) {
+         mg_bench_cgi_lookup(pweb, indexed, NULL, &found);
+      }
+      time_elapsed = mg_time_usecs() - time_start;
+      rate = time_elapsed > 0 ? ((double) MG_BENCH_LOOKUPS * 1000000.0) / (double) time_elapsed : 0;
+      if (!indexed) {
+         rate_ref = rate;
+      }
+      printf("%-8s %9d %7d %11.0f %9.0f %8.2fx\n", indexed ? "index" : "module", MG_BENCH_LOOKUPS, errors, rate, rate > 0 ? 1000000000.0 / rate : 0, rate_ref > 0 ? rate / rate_ref : 0);
+   }
+
+   free((void *) buffer_ref);
+   mg_release_request_memory(pweb);
+
+   return (errors ? -1 : 0);
+}
+
+
+/* look up each variable as mg_get_all_cgi_variables() does, returning the length of the CGI block built (which is copied to pbuffer if supplied) */
+
+static int mg_bench_cgi_lookup(MGWEB *pweb, int indexed, char *pbuffer, int *pfound)
+{
+   int n, rc, lenv;
+   char value[4096];
+
+   pweb->input_buf.len_used = 0;
+   if (indexed) {
+      pweb->hdr_status = 0;
+      mg_index_request_headers(pweb);
+   }
+
+   *pfound = 0;
+   for (n = 0; mg_bench_cgi_names[n]; n ++) {
+      lenv = (int) sizeof(value);
+      if (indexed) {
+         rc = mg_get_request_variable(pweb, mg_bench_cgi_names[n], value, &lenv);
+      }
+      else {
+         rc = mg_get_cgi_variable(pweb, mg_bench_cgi_names[n], value, &lenv);
+      }
+      if (rc == MG_CGI_SUCCESS) {
+         mg_add_cgi_variable(pweb, mg_bench_cgi_names[n], (int) strlen(mg_bench_cgi_names[n]), value, lenv);
+         (*pfound) ++;
+      }
+   }
+
+   if (pbuffer) {
+      memcpy((void *) pbuffer, (void *) pweb->input_buf.buf_addr, (size_t) pweb->input_buf.len_used);
+   }
+
+   return (int) pweb->input_buf.len_used;
+}
+
+
+/* CMT82 longest matching location: a scan of the configured locations against the radix tree index */
+
+static int mg_bench_locations(void)
+{
+   int n, errors;
+   static const int no_locations[3] = {10, 100, 1000};
+
+   printf("mg_web_bench: mg_web v%s; location lookup; %d lookups for each number of locations\n", DBX_VERSION, MG_BENCH_LOOKUPS);
+   printf("%-9s %9s %7s %11s %11s %9s\n", "locations", "lookups", "errors", "scan ns", "index ns", "speedup");
+
+   errors = 0;
+   for (n = 0; n < 3; n ++) {
+      if (mg_bench_locations_run(no_locations[n]) != 0) {
+         errors ++;
+      }
+   }
+
+   return (errors ? -1 : 0);
+}
+
+
+static int mg_bench_locations_run(int no_locations)
+{
+   int n, i, errors, len, len_max, len_found, ok;
+   long long time_start, time_scan, time_index;
+   char *names, *keys, *pkey, *pname;
+   void *pvalue, *pvalue_max;
+   MGRTNODE *pindex;
+
+   /* locations are configured in pairs: /appNNNN and /appNNNN/api */
+   names = (char *) malloc((size_t) no_locations * 32);
+   keys = (char *) malloc((size_t) MG_BENCH_LOOKUPS * 64);
+   pindex = mg_rtree_create();
+   if (!names || !keys || !pindex) {
+      printf("mg_web_bench: memory allocation error\n");
+      return -1;
+   }
+   ok = 1;
+   for (n = 0; n < no_locations && ok; n ++) {
+      pname = names + (n * 32);
+      sprintf(pname, "/app%04d%s", n / 2, (n & 1) ? "/api" : "");
+      if (mg_rtree_insert(pindex, pname, (int) strlen(pname), (void *) pname, n) != CACHE_SUCCESS) {
+         ok = 0;
+      }
+   }
+   for (i = 0; i < MG_BENCH_LOOKUPS; i ++) {
+      sprintf(keys + (i * 64), "/app%04d%s/customer/get.mgw", (int) (((unsigned long) i * 7919) % (unsigned long) ((no_locations + 1) / 2)), (i & 1) ? "/api" : "");
+   }
+
+   /* the scan used before the index (and still used if the index cannot be built) */
+   errors = ok ? 0 : 1;
+   len_found = 0;
+   time_start = mg_time_usecs();
+   for (i = 0; i < MG_BENCH_LOOKUPS; i ++) {
+      pkey = keys + (i * 64);
+      len_max = 0;
+      pvalue_max = NULL;
+      for (n = 0; n < no_locations; n ++) {
+         pname = names + (n * 32);
+         len = (int) strlen(pname);
+         if (!strncmp(pkey, pname, len) && len > len_max) {
+            len_max = len;
+            pvalue_max = (void *) pname;
+         }
+      }
+      len_found += len_max;
+      if (!pvalue_max) {
+         errors ++;
+      }
+   }
+   time_scan = mg_time_usecs() - time_start;
+
+   time_start = mg_time_usecs();
+   for (i = 0; i < MG_BENCH_LOOKUPS; i ++) {
+      pkey = keys + (i * 64);
+      len_found -= mg_rtree_lookup(pindex, pkey, (int) strlen(pkey), 0, &pvalue);
+      if (!pvalue) {
+         errors ++;
+      }
+   }
+   time_index = mg_time_usecs() - time_start;
+   if (len_found != 0) { /* the two methods disagree */
+      errors ++;
+   }
+
+   printf("%-9d %9d %7d %11.1f %11.1f %8.2fx\n", no_locations, MG_BENCH_LOOKUPS, errors, ((double) time_scan * 1000.0) / (double) MG_BENCH_LOOKUPS, ((double) time_index * 1000.0) / (double) MG_BENCH_LOOKUPS, time_index > 0 ? (double) time_scan / (double) time_index : 0);
+
+   mg_rtree_free(pindex);
+   free((void *) keys);
+   free((void *) names);
+
+   return (errors ? -1 : 0);
+}
+
+
+/* Functions responsible for communicating with the (stub) web server follow */
+
+int mg_get_request_headers(MGWEB *pweb)
+{
+   char *pval;
+   MGBENCHHDR *phdr;
+   MGWEBBENCH *pwebbench;
+
+   pwebbench = (MGWEBBENCH *) pweb->pweb_server;
+
+   for (phdr = mg_bench_headers; phdr->name; phdr ++) {
+      mg_index_request_header(pweb, phdr->name, (int) strlen(phdr->name), phdr->value, (int) strlen(phdr->value), 0);
+   }
+   if (pwebbench->pload->request_size) { /* CMT82 the request payload headers, as the web server presents them */
+      pval = pwebbench->pload->multipart ? "multipart/form-data; boundary=" MG_BENCH_MP_BOUNDARY : "application/octet-stream";
+      mg_index_request_header(pweb, "Content-Type", 12, pval, (int) strlen(pval), 0);
+      mg_index_request_header(pweb, "Content-Length", 14, pwebbench->content_length, (int) strlen(pwebbench->content_length), 0);
+   }
+
+   return CACHE_SUCCESS;
+}
+
+
+/* CMT82 find a request header from its CGI name in the way that the Apache and Nginx modules do */
+
+static int mg_bench_find_header(char *name, char **pvalue)
+{
+   int n;
+   char vname[64];
+   MGBENCHHDR *phdr;
+
+   for (phdr = mg_bench_headers; phdr->name; phdr ++) {
+      if (strlen(phdr->name) > 60) {
+         continue;
+      }
+      strcpy(vname, phdr->name);
+      mg_ucase(vname);
+      for (n = 0; vname[n]; n ++) {
+         if (vname[n] == '-')
+            vname[n] = '_';
+      }
+      if (!strcmp(vname, name + 5)) {
+         *pvalue = phdr->value;
+         return 1;
+      }
+   }
+
+   return 0;
+}
+
+
+int mg_get_cgi_variable(MGWEB *pweb, char *name, char *pbuffer, int *pbuffer_size)
+{
+   int rc, len;
+   char *pval;
+   MGWEBBENCH *pwebbench;
+
+   pwebbench = (MGWEBBENCH *) pweb->pweb_server;
+   pval = NULL;
+
+   if (!strcmp(name, "HTTP*")) {
+      MGBENCHHDR *phdr;
+      char vname[64];
+
+      for (phdr = mg_bench_headers; phdr->name; phdr ++) {
+         if (strlen(phdr->name) > 56) {
+            continue;
+         }
+         strcpy(vname, "HTTP_");
+         strcpy(vname + 5, phdr->name);
+         mg_ucase(vname);
+         for (len = 5; vname[len]; len ++) {
+            if (vname[len] == '-')
+               vname[len] = '_';
+         }
+         mg_add_cgi_variable(pweb, vname, (int) strlen(vname), phdr->value, (int) strlen(phdr->value));
+      }
+      return MG_CGI_LIST;
+   }
+   else if (!strcmp(name, "REQUEST_METHOD")) {
+      pval = pwebbench->pload->method;
+   }
+   else if (!strcmp(name, "SCRIPT_NAME") || !strcmp(name, "URL")) {
+      pval = pwebbench->script_name;
+   }
+   else if (!strcmp(name, "QUERY_STRING")) {
+      pval = "";
+   }
+   else if (!strcmp(name, "SERVER_PROTOCOL")) {
+      pval = "HTTP/1.1";
+   }
+   else if (!strcmp(name, "CONTENT_LENGTH")) {
+      if (pwebbench->pload->request_size) {
+         pval = pwebbench->content_length;
+      }
+   }
+   else if (!strcmp(name, "CONTENT_TYPE")) {
+      if (pwebbench->pload->multipart) { /* CMT82 */
+         pval = "multipart/form-data; boundary=" MG_BENCH_MP_BOUNDARY;
+      }
+      else if (pwebbench->pload->request_size) {
+         pval = "application/octet-stream";
+      }
+   }
+   else if (!strncmp(name, "HTTP_", 5)) {
+      mg_bench_find_header(name, &pval);
+   }
+   else if (!strcmp(name, "SERVER_NAME")) {
+      pval = "localhost";
+   }
+   else if (!strcmp(name, "SERVER_PORT")) {
+      pval = "80";
+   }
+   else if (!strcmp(name, "REMOTE_ADDR")) {
+      pval = "127.0.0.1";
+   }
+   else if (!strcmp(name, "SERVER_SOFTWARE")) {
+      pval = "mg_web_bench/" DBX_VERSION;
+   }
+
+   rc = MG_CGI_SUCCESS;
+   if (pval) {
+      len = (int) strlen(pval);
+      if (len < (*pbuffer_size)) {
+         strcpy(pbuffer, pval);
+         *pbuffer_size = len;
+      }
+      else {
+         rc = MG_CGI_TOOLONG;
+      }
+   }
+   else {
+      *pbuffer_size = 0;
+      rc = MG_CGI_UNDEFINED;
+   }
+
+   return rc;
+}
+
+
+int mg_client_gone(MGWEB *pweb)
+{
+   (void) pweb;
+   return 0;
+}
+
+
+int mg_client_read(MGWEB *pweb, unsigned char *pbuffer, int buffer_size)
+{
+   int result;
+   MGWEBBENCH *pwebbench;
+
+   pwebbench = (MGWEBBENCH *) pweb->pweb_server;
+
+   result = (int) (pwebbench->pload->request_size - pwebbench->read_total);
+   if (result > buffer_size) {
+      result = buffer_size;
+   }
+   if (result > 0) {
+      if (pwebbench->pload->multipart) { /* CMT82 */
+         memcpy((void *) pbuffer, (void *) (mg_bench_multipart + pwebbench->read_total), (size_t) result);
+      }
+      else {
+         memset((void *) pbuffer, 'u', (size_t) result);
+      }
+      pwebbench->read_total += result;
+   }
+   else {
+      result = 0;
+   }
+   if (pwebbench->read_total >= pwebbench->pload->request_size) {
+      pweb->request_read_status = 1;
+   }
+
+   return result;
+}
+
+
+int mg_client_write(MGWEB *pweb, unsigned char *pbuffer, int buffer_size, int context)
+{
+   MGWEBBENCH *pwebbench;
+
+   (void) pbuffer;
+   (void) context;
+   pwebbench = (MGWEBBENCH *) pweb->pweb_server;
+   if (buffer_size > 0) {
+      pwebbench->write_total += buffer_size;
+   }
+
+   return 0;
+}
+
+
+int mg_client_write_now(MGWEB *pweb, unsigned char *pbuffer, int buffer_size)
+{
+   MGWEBBENCH *pwebbench;
+
+   (void) pbuffer;
+   pwebbench = (MGWEBBENCH *) pweb->pweb_server;
+   if (buffer_size > 0) {
+      pwebbench->write_total += buffer_size;
+   }
+
+   return buffer_size;
+}
+
+
+int mg_suppress_headers(MGWEB *pweb)
+{
+   (void) pweb;
+   return 0;
+}
+
+
+int mg_submit_headers(MGWEB *pweb)
+{
+   char *p;
+   MGWEBBENCH *pwebbench;
+
+   pwebbench = (MGWEBBENCH *) pweb->pweb_server;
+
+   pwebbench->status = 0;
+   if (pweb->response_headers) {
+      p = strstr(pweb->response_headers, " ");
+      if (p) {
+         pwebbench->status = (int) strtol(p + 1, NULL, 10);
+      }
+   }
+
+   return 0;
+}
+
+
+/* WebSockets are not exercised by this harness */
+
+int mg_websocket_init(MGWEB *pweb)
+{
+   (void) pweb;
+   return -1;
+}
+
+
+int mg_websocket_create_lock(MGWEB *pweb)
+{
+   (void) pweb;
+   return 0;
+}
+
+
+int mg_websocket_destroy_lock(MGWEB *pweb)
+{
+   (void) pweb;
+   return 0;
+}
+
+
+int mg_websocket_lock(MGWEB *pweb)
+{
+   (void) pweb;
+   return 0;
+}
+
+
+int mg_websocket_unlock(MGWEB *pweb)
+{
+   (void) pweb;
+   return 0;
+}
+
+
+int mg_websocket_frame_init(MGWEB *pweb)
+{
+   (void) pweb;
+   return 0;
+}
+
+
+int mg_websocket_frame_read(MGWEB *pweb, MGWSRSTATE *pread_state)
+{
+   unsigned char *frame;
+
+   if (!mg_bench_ws_in) {
+      return -1;
+   }
+   frame = mg_bench_ws_in;
+   mg_bench_ws_in = NULL;
+   mg_websocket_incoming_frame(pweb, pread_state, (char *) frame, (mg_int64_t) mg_bench_ws_in_len);
+
+   return 0;
+}
+
+
+int mg_websocket_frame_exit(MGWEB *pweb)
+{
+   (void) pweb;
+   return 0;
+}
+
+
+size_t mg_websocket_read_block(MGWEB *pweb, char *buffer, size_t bufsiz)
+{
+   (void) pweb;
+   (void) buffer;
+   (void) bufsiz;
+   return 0;
+}
+
+
+size_t mg_websocket_read(MGWEB *pweb, char *buffer, size_t bufsiz)
+{
+   (void) pweb;
+   (void) buffer;
+   (void) bufsiz;
+   return 0;
+}
+
+
+size_t mg_websocket_queue_block(MGWEB *pweb, int type, unsigned char *buffer, size_t buffer_size, short locked)
+{
+   (void) pweb;
+   (void) type;
+   (void) buffer;
+   (void) buffer_size;
+   (void) locked;
+   return 0;
+}
+
+
+/* CMT82 the web server modules' output path: frames are collected in mg_bench_ws_out */
+
+size_t mg_websocket_write_block(MGWEB *pweb, int type, unsigned char *buffer, size_t buffer_size)
+{
+   unsigned char header[32];
+   size_t pos, written;
+   mg_uint64_t payload_length;
+
+   written = 0;
+   payload_length = (mg_uint64_t) ((buffer != NULL) ? buffer_size : 0);
+
+   if (!pweb->pwsock->closing) {
+      pos = mg_websocket_create_header(pweb, type, header, payload_length);
+      written = mg_websocket_send_frame(pweb, header, pos, buffer, (size_t) payload_length);
+   }
+
+   return written;
+}
+
+
+size_t mg_websocket_write_frame(MGWEB *pweb, unsigned char *header, size_t header_size, unsigned char *buffer, size_t buffer_size)
+{
+   size_t written;
+
+   written = 0;
+   if (!pweb->pwsock->closing) {
+      written = mg_websocket_send_frame(pweb, header, header_size, buffer, buffer_size);
+   }
+
+   return written;
+}
+
+
+static size_t mg_websocket_send_frame(MGWEB *pweb, unsigned char *header, size_t header_size, unsigned char *buffer, size_t buffer_size)
+{
+   mg_websocket_write(pweb, (char *) header, (int) header_size);
+   if (buffer_size > 0) {
+      mg_websocket_write(pweb, (char *) buffer, (int) buffer_size);
+   }
+
+   return buffer_size;
+}
+
+
+int mg_websocket_write(MGWEB *pweb, char *buffer, int len)
+{
+   (void) pweb;
+   if (len > 0 && (mg_bench_ws_out_len + len) <= (int) sizeof(mg_bench_ws_out)) {
+      memcpy((void *) (mg_bench_ws_out + mg_bench_ws_out_len), (void *) buffer, (size_t) len);
+      mg_bench_ws_out_len += len;
+   }
+
+   return len;
+}
+
+
+int mg_websocket_exit(MGWEB *pweb)
+{
+   (void) pweb;
+   return 0;
+}
+
+
+/* Mock DB Server follows */
+
+static int mg_bench_dbserver_start(void)
+{
+   int sockfd, on;
+   socklen_t len;
+   struct sockaddr_in addr;
+   pthread_t thread_id;
+   pthread_attr_t attr;
+
+   sockfd = socket(AF_INET, SOCK_STREAM, 0);
+   if (sockfd < 0) {
+      return -1;
+   }
+   on = 1;
+   setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, (const char *) &on, sizeof(on));
+
+   memset((void *) &addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   addr.sin_port = 0; /* let the system choose a free port */
+   if (bind(sockfd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(sockfd, 128) < 0) {
+      close(sockfd);
+      return -1;
+   }
+   len = sizeof(addr);
+   if (getsockname(sockfd, (struct sockaddr *) &addr, &len) < 0) {
+      close(sockfd);
+      return -1;
+   }
+
+   pthread_attr_init(&attr);
+   pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+   if (pthread_create(&thread_id, &attr, mg_bench_dbserver_listen, (void *) (long) sockfd) != 0) {
+      close(sockfd);
+      return -1;
+   }
+
+   return (int) ntohs(addr.sin_port);
+}
+
+
+static void * mg_bench_dbserver_listen(void *arg)
+{
+   int sockfd, clifd, on;
+   pthread_t thread_id;
+   pthread_attr_t attr;
+
+   sockfd = (int) (long) arg;
+   pthread_attr_init(&attr);
+   pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+   for (;;) {
+      clifd = accept(sockfd, NULL, NULL);
+      if (clifd < 0) {
+         if (errno == EINTR) {
+            continue;
+         }
+         break;
+      }
+      on = 1;
+      setsockopt(clifd, IPPROTO_TCP, TCP_NODELAY, (const char *) &on, sizeof(on));
+      if (pthread_create(&thread_id, &attr, mg_bench_dbserver_connection, (void *) (long) clifd) != 0) {
+         close(clifd);
+      }
+   }
+
+   return NULL;
+}
+
+
+/* One thread per DB Server connection, as with a %zmgsis child process */
+
+static void * mg_bench_dbserver_connection(void *arg)
+{
+   int sockfd, n, mux;
+   unsigned long size, alloc;
+   unsigned char head[8];
+   unsigned char *buffer;
+   char *p;
+   char hello[256], zv[256];
+
+   sockfd = (int) (long) arg;
+
+   /* handshake: dbx1~<uci>~<idle timeout>[~mux=<n>]\n */
+   for (n = 0; n < (int) (sizeof(hello) - 1); n ++) {
+      if (mg_bench_recv(sockfd, (unsigned char *) hello + n, 1) != 0) {
+         close(sockfd);
+         return NULL;
+      }
+      if (hello[n] == '\n') {
+         break;
+      }
+   }
+   hello[n] = '\0';
+   mux = 0;
+   p = strstr(hello, "~mux=");
+   if (p) {
+      mux = (int) strtol(p + 5, NULL, 10);
+   }
+   if (mux > 1) {
+      sprintf(zv, "%s~mux=%d", MG_BENCH_ZV, mux);
+   }
+   else {
+      strcpy(zv, MG_BENCH_ZV);
+   }
+   size = (unsigned long) strlen(zv);
+   mg_add_block_size(head, 0, size, 0, DBX_DTYPE_STR8);
+   if (mg_bench_send(sockfd, head, 5) != 0 || mg_bench_send(sockfd, (unsigned char *) zv, size) != 0) {
+      close(sockfd);
+      return NULL;
+   }
+
+   alloc = 0;
+   buffer = NULL;
+   for (;;) {
+      if (mg_bench_recv(sockfd, head, 5) != 0) {
+         break;
+      }
+      if (head[4] == DBX_CMND_PING) {
+         unsigned char reply[20];
+
+         memset((void *) reply, 0, sizeof(reply));
+         mg_add_block_size(reply, 0, 15, DBX_DSORT_DATA, DBX_DTYPE_STR8);
+         if (mg_bench_send(sockfd, reply, 20) != 0) {
+            break;
+         }
+         continue;
+      }
+      size = mg_get_size(head);
+      if (size < DBX_IBUFFER_OFFSET) {
+         break;
+      }
+      if (size > alloc) {
+         alloc = size + 4096;
+         buffer = (unsigned char *) realloc((void *) buffer, alloc);
+         if (!buffer) {
+            break;
+         }
+      }
+      memcpy((void *) buffer, (void *) head, 5);
+      if (mg_bench_recv(sockfd, buffer + 5, size - 5) != 0) {
+         break;
+      }
+      if (mg_bench_dbserver_command(sockfd, buffer, size) != 0) {
+         break;
+      }
+   }
+
+   if (buffer) {
+      free((void *) buffer);
+   }
+   close(sockfd);
+
+   return NULL;
+}
+
+
+/* Decode a web function request and send the response for the workload named in SCRIPT_NAME */
+
+static int mg_bench_dbserver_command(int sockfd, unsigned char *buffer, unsigned long size)
+{
+   int sort, type, request_long, ok;
+   unsigned long offset, end, len, requestno, content;
+   unsigned char head[8], discard[8192];
+   char *p, *pz;
+   MGBENCHLOAD *pload;
+
+   pload = NULL;
+   requestno = 0;
+   request_long = 0;
+   content = 0;
+
+   /* routine, ctx, then the cgi block enclosing the CGI variables, system variables and content */
+   offset = DBX_IBUFFER_OFFSET;
+   offset += (mg_get_block_size(buffer, offset, &sort, &type) + 5);
+   if (offset + 10 > size) {
+      return -1;
+   }
+   offset += (mg_get_block_size(buffer, offset, &sort, &type) + 5);
+   if (offset + 5 > size) {
+      return -1;
+   }
+   end = offset + 5 + mg_get_block_size(buffer, offset, &sort, &type);
+   if (end > size) {
+      return -1;
+   }
+   for (offset += 5; offset + 5 <= end; offset += (len + 5)) {
+      len = mg_get_block_size(buffer, offset, &sort, &type);
+      p = (char *) (buffer + offset + 5);
+      if (sort == DBX_DSORT_EOD) {
+         break;
+      }
+      if (sort == DBX_DSORT_WEBCGI && len > 12 && !strncmp(p, "SCRIPT_NAME=", 12)) {
+         pz = p + len;
+         for (p += 12; pz > p && *(pz - 1) != '/'; pz --)
+            ;
+         p = pz;
+         pz = (char *) (buffer + offset + 5 + len);
+         if (pz - p > 4 && !strncmp(pz - 4, ".mgw", 4)) {
+            pload = mg_bench_find_load(p, (int) ((pz - 4) - p));
+         }
+      }
+      else if (sort == DBX_DSORT_WEBSYS && len == 7 && !strncmp(p, "no=", 3)) {
+         requestno = mg_get_size((unsigned char *) p + 3);
+      }
+      else if (sort == DBX_DSORT_WEBSYS && len == 14 && !strncmp(p, "key=", 4)) {
+         request_long = mg_get_size((unsigned char *) p + 4) ? 1 : 0;
+      }
+      else if (sort == DBX_DSORT_WEBCONTENT) {
+         content += len;
+      }
+   }
+
+   /* long requests: the content follows the request frame in blocks, terminated by EOD */
+   if (request_long) {
+      for (;;) {
+         if (mg_bench_recv(sockfd, head, 5) != 0) {
+            return -1;
+         }
+         len = mg_get_block_size(head, 0, &sort, &type);
+         if (sort == DBX_DSORT_EOD) {
+            break;
+         }
+         content += len;
+         while (len > 0) {
+            end = len > sizeof(discard) ? sizeof(discard) : len;
+            if (mg_bench_recv(sockfd, discard, end) != 0) {
+               return -1;
+            }
+            len -= end;
+         }
+      }
+   }
+
+   ok = (pload && content == pload->request_size) ? 1 : 0;
+
+   return mg_bench_dbserver_respond(sockfd, pload, requestno, ok);
+}
+
+
+static int mg_bench_dbserver_respond(int sockfd, MGBENCHLOAD *pload, unsigned long requestno, int ok)
+{
+   int stream;
+   unsigned long body, len, sent;
+   unsigned char head[16];
+   char headers[256];
+
+   stream = 0;
+   body = 0;
+   if (ok) {
+      stream = pload->stream;
+      body = pload->response_size;
+      sprintf(headers, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nCache-Control: no-store\r\n\r\n");
+   }
+   else {
+      sprintf(headers, "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\n\r\n");
+   }
+
+   memset((void *) head, 0, sizeof(head));
+   mg_set_size(head + 5, requestno);
+   if (stream == 0) {
+      len = (unsigned long) strlen(headers) + body;
+      mg_add_block_size(head, 0, len + 5, DBX_DSORT_DATA, DBX_DTYPE_STR8);
+      if (mg_bench_send(sockfd, head, 10) != 0 || mg_bench_send(sockfd, (unsigned char *) headers, (unsigned long) strlen(headers)) != 0) {
+         return -1;
+      }
+      for (sent = 0; sent < body; sent += len) {
+         len = (body - sent) > MG_BENCH_FILL_SIZE ? MG_BENCH_FILL_SIZE : (body - sent);
+         if (mg_bench_send(sockfd, (unsigned char *) mg_bench_fill, len) != 0) {
+            return -1;
+         }
+      }
+      return 0;
+   }
+
+   /* stream mode 1: blocks prefixed by a 4 Byte length; mode 2: ASCII; both end with MG_STREAM_EOS */
+   mg_add_block_size(head, 0, 0, DBX_DSORT_DATA, DBX_DTYPE_STR8);
+   head[9] = (unsigned char) stream;
+   if (mg_bench_send(sockfd, head, 10) != 0) {
+      return -1;
+   }
+   if (stream == 1) {
+      mg_set_size(head, (unsigned long) strlen(headers));
+      if (mg_bench_send(sockfd, head, 4) != 0) {
+         return -1;
+      }
+   }
+   if (mg_bench_send(sockfd, (unsigned char *) headers, (unsigned long) strlen(headers)) != 0) {
+      return -1;
+   }
+   for (sent = 0; sent < body; sent += len) {
+      len = (body - sent) > MG_BENCH_STREAM_CHUNK ? MG_BENCH_STREAM_CHUNK : (body - sent);
+      if (stream == 1) {
+         mg_set_size(head, len);
+         if (mg_bench_send(sockfd, head, 4) != 0) {
+            return -1;
+         }
+      }
+      if (mg_bench_send(sockfd, (unsigned char *) mg_bench_fill, len) != 0) {
+         return -1;
+      }
+   }
+
+   return mg_bench_send(sockfd, (unsigned char *) MG_STREAM_EOS, 4);
+}
+
+
+static int mg_bench_recv(int sockfd, unsigned char *buffer, unsigned long size)
+{
+   ssize_t n;
+
+   while (size > 0) {
+      n = recv(sockfd, (void *) buffer, (size_t) size, 0);
+      if (n < 0 && errno == EINTR) {
+         continue;
+      }
+      if (n <= 0) {
+         return -1;
+      }
+      buffer += n;
+      size -= (unsigned long) n;
+   }
+   return 0;
+}
+
+
+static int mg_bench_send(int sockfd, unsigned char *buffer, unsigned long size)
+{
+   ssize_t n;
+
+   while (size > 0) {
+      n = send(sockfd, (void *) buffer, (size_t) size, 0);
+      if (n < 0 && errno == EINTR) {
+         continue;
+      }
+      if (n <= 0) {
+         return -1;
+      }
+      buffer += n;
+      size -= (unsigned long) n;
+   }
+   return 0;
+}
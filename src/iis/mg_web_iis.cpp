@@ -82,6 +82,7 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpReserved)
       case DLL_THREAD_DETACH:
          break;
       case DLL_PROCESS_DETACH:
+         mg_system.loader_lock = 1; /* CMT82 do not wait for threads to finish while the loader lock is held */
          mg_worker_exit();
          break;
    }
@@ -246,6 +247,9 @@ public:
 
    void Terminate()
    {
+      /* CMT82 stop the connection pool maintenance thread here rather than in DllMain() */
+      mg_pool_maintenance_stop(MG_POOL_STOP_WAIT);
+
       /* Remove the class from memory. */
       delete this;
    }
@@ -273,6 +277,53 @@ HRESULT __declspec(dllexport) RegisterModule(DWORD dwServerVersion, IHttpModuleR
 #endif
 
 
+/* CMT68 index the request headers in one pass over ALL_HTTP */
+int mg_get_request_headers(MGWEB *pweb)
+{
+   char *pbuf, *pa, *pz, *pv;
+   HRESULT hr;
+   DWORD size;
+   PCSTR buff = NULL;
+   IHttpContext * phttp_context;
+
+	phttp_context = (IHttpContext *) ((MGWEBIIS *) pweb->pweb_server)->phttp_context;
+   size = 0;
+   hr = phttp_context->GetServerVariable("ALL_HTTP", (PCSTR *) &buff, (DWORD *) &size);
+   if (FAILED(hr) || !buff) {
+      return CACHE_FAILURE;
+   }
+
+   /* take a copy for the life of the request: the names and values are terminated in place */
+   size = (DWORD) strlen(buff);
+   pbuf = (char *) phttp_context->AllocateRequestMemory(size + 1);
+   if (!pbuf) {
+      return CACHE_FAILURE;
+   }
+   memcpy((void *) pbuf, (void *) buff, (size_t) size);
+   pbuf[size] = '\0';
+
+   pa = pbuf;
+   while (*pa) {
+      pz = strstr(pa, "\n");
+      if (pz) {
+         *pz = '\0';
+      }
+      pv = strstr(pa, ":");
+      if (pv) {
+         *pv = '\0';
+         pv ++;
+         mg_index_request_header(pweb, pa, (int) strlen(pa), pv, (int) strlen(pv), 1);
+      }
+      if (!pz) {
+         break;
+      }
+      pa = (pz + 1);
+   }
+
+   return CACHE_SUCCESS;
+}
+
+
 int mg_get_cgi_variable(MGWEB *pweb, char *name, char *pbuffer, int *pbuffer_size)
 {
    short phase;
@@ -693,7 +744,7 @@ int mg_submit_headers(MGWEB *pweb)
 {
    short phase;
    int n, status;
-   char *pa, *pz, *p1, *p2;
+   char *pa, *pz, *pe, *p1, *p2;
    HRESULT hr;
    PCSTR reason;
 
@@ -711,10 +762,11 @@ __try {
 
    phase = 1;
    pa = pweb->response_headers;
+   pe = pa + strlen(pa); /* CMT69 */
 
    for (n = 0; ;n ++) {
       phase = 2;
-      pz = strstr(pa, "\r\n");
+      pz = mg_scan_find(pa, (int) (pe - pa), "\r\n", 2);
       if (!pz)
          break;
 
@@ -1055,6 +1107,38 @@ mg_websocket_queue_block_exit:
 }
 
 
+/* CMT81 small frames are sent with one write */
+/* CMT82 the caller has checked that the WebSocket is not closing */
+static size_t mg_websocket_send_frame(MGWEB *pweb, unsigned char *header, size_t header_size, unsigned char *buffer, size_t buffer_size)
+{
+   size_t written;
+   unsigned char frame[MG_WS_FRAME_COALESCE_SIZE];
+
+   written = 0;
+
+   if ((header_size + buffer_size) <= MG_WS_FRAME_COALESCE_SIZE) {
+      memcpy((void *) frame, (void *) header, header_size);
+      if (buffer_size > 0) {
+         memcpy((void *) (frame + header_size), (void *) buffer, buffer_size);
+      }
+      if (mg_websocket_write(pweb, (char *) frame, (int) (header_size + buffer_size)) > 0 && buffer_size > 0) {
+         written = buffer_size;
+      }
+      return written;
+   }
+
+   mg_websocket_write(pweb, (char *) header, (int) header_size); /* Header */
+
+   if (buffer_size > 0) {
+      if (mg_websocket_write(pweb, (char *) buffer, (int) buffer_size) > 0) { /* Payload Data */
+         written = buffer_size;
+      }
+   }
+
+   return written;
+}
+
+
 size_t mg_websocket_write_block(MGWEB *pweb, int type, unsigned char *buffer, size_t buffer_size)
 {
    unsigned char header[32];
@@ -1069,13 +1153,20 @@ size_t mg_websocket_write_block(MGWEB *pweb, int type, unsigned char *buffer, si
 
       pos = mg_websocket_create_header(pweb, type, header, payload_length);
 
-      mg_websocket_write(pweb, (char *) header, (int) pos); /* Header */
+      written = mg_websocket_send_frame(pweb, header, pos, buffer, (size_t) payload_length); /* CMT82 a close frame has set 'closing' by now */
+   }
 
-      if (payload_length > 0) {
-         if (mg_websocket_write(pweb, (char *) buffer, (int) buffer_size) > 0) { /* Payload Data */
-            written = buffer_size;
-         }
-      }
+   return written;
+}
+
+/* CMT79 write a frame whose header has already been created: used to send one message to all of a channel's subscribers */
+size_t mg_websocket_write_frame(MGWEB *pweb, unsigned char *header, size_t header_size, unsigned char *buffer, size_t buffer_size)
+{
+   size_t written;
+
+   written = 0;
+   if (!pweb->pwsock->closing) {
+      written = mg_websocket_send_frame(pweb, header, header_size, buffer, buffer_size);
    }
 
    return written;
@@ -1083,6 +1174,7 @@ size_t mg_websocket_write_block(MGWEB *pweb, int type, unsigned char *buffer, si
 
 
 
+
 int mg_websocket_write(MGWEB *pweb, char *buffer, int len)
 {
    int rc;
@@ -254,6 +254,129 @@ Version 2.8.43f 30 October 2025: CMT55
 
 Version 2.8.43g 2 November 2025: CMT56
    Correct the order in which network errors are written to the event log.
+
+Version 2.8.44 17 October 2026: CMT57
+   Give each DB Server its own pool of connections.
+   - Obtaining and releasing a connection no longer involves a search of the global connection list under the global lock.
+   - Idle connections are held on a per-server stack, so requests for different DB Servers no longer contend with each other.
+
+Version 2.8.44a 17 October 2026: CMT58
+   Replace the one-second polling loop used to queue requests once a DB Server's 'max_connections' limit is reached.
+   - Queued requests now wait in a first-in-first-out queue held for each DB Server and are woken as soon as a connection is released.
+   - A released connection is handed directly to the request at the head of the queue.
+   - The queue depth, number of queued requests, number of queue timeouts and the average/maximum wait times (in milliseconds) are reported in the status output.
+
+Version 2.8.44b 17 October 2026: CMT59
+   Introduce a DB Server configuration parameter (min_connections) to maintain a minimum number of ready connections in the pool.
+   - Example: min_connections 4
+   - A background thread, started when the web server worker initializes, opens these connections ahead of demand and replaces any that are lost.
+   - The same thread pings idle connections that are nearing the DB Server's 'idle_timeout', and closes those that are surplus to the 'min_connections' setting, so requests no longer have to create a fresh connection on account of an idle timeout.
+   - The thread is only started if at least one network based DB Server defines 'min_connections' or 'idle_timeout'.
+
+Version 2.8.44c 17 October 2026: CMT60
+   - Create one SSL_CTX for each TLS configuration and share it between all connections using it.
+   - Offer the last TLS session negotiated with each DB Server for resumption when opening a new connection.
+
+Version 2.8.44d 17 October 2026: CMT61
+   - Use poll() in place of select() to wait for responses from the DB Server and for connections to complete (UNIX).
+
+Version 2.8.44e 17 October 2026: CMT62
+   - Write log messages through a per-process ring buffer drained by a background thread.
+   - Introduce the log_buffer_size global configuration parameter.
+
+Version 2.8.44f 17 October 2026: CMT63
+   - Retain request and response extension memory blocks on size-classed free lists for reuse.
+   - Introduce the buffer_pool_size global configuration parameter.
+
+Version 2.8.44g 17 October 2026: CMT64
+   - Nginx: requests may be processed by a fixed-size pool of worker threads owned by the module (MGWEBWorkerThreads directive).
+   - Nginx: requests are rejected with 503 (or the custompage_dbserver_busy page) when the worker thread queue is full.
+   - Nginx: responses for requests processed by the worker thread pool are sent from the nginx event loop.
+
+Version 2.8.44h 17 October 2026: CMT65
+   - Nginx: responses for requests processed by the worker thread pool are streamed to the client through two fixed-size buffers (MGWEBStreamBufferSize directive).
+   - Nginx: the worker thread waits for nginx to release a stream buffer before reusing it (backpressure).
+
+Version 2.8.44i 17 October 2026: CMT66
+   - Cache the resolved addresses for each DB Server host name, with a configurable time to live (dns_cache_ttl global and DB Server parameter).
+   - Expired entries are refreshed by a background thread while the cached addresses continue to be used.
+   - Addresses are interleaved by family (IPv6/IPv4) and, on UNIX systems, a connection to the next address is started if the previous attempt has not completed within 250ms (happy eyeballs).
+
+Version 2.8.44j 17 October 2026: CMT67
+   - Select the location for a request, and the WebSocket function for a WebSocket name, through a radix tree index built when the configuration is read.
+
+Version 2.8.44k 17 October 2026: CMT68
+   - Index the HTTP request headers in a single pass at the start of each request and serve HTTP_* CGI variables, the cookie and the SSE check from the index.
+
+Version 2.8.44l 17 October 2026: CMT69
+   - Add SIMD byte scanners (SSE2, with AVX2 selected at run time, and a scalar fallback) and use them for the multipart boundary search, the line breaks in response headers and the partial boundary at the end of each chunk of a long request.
+
+Version 2.8.44m 17 October 2026: CMT70
+   - Send the frame for a long request together with its first chunk of content, and the EOD marker with its last chunk, using scatter-gather I/O (writev/WSASend), with buffers coalesced into full records for TLS connections.
+
+Version 2.8.44n 17 October 2026: CMT71
+   - Introduce an optional per-location cache for responses that the DB Server marks as cacheable with Cache-Control (response\_cache and response\_cache\_vary).
+
+Version 2.8.44o 17 October 2026: CMT72
+   - Allow several requests to share one network connection to a DB Server (multiplex), negotiated with the DB Server at connection time and with responses matched to requests by request number.
+
+Version 2.8.44p 17 October 2026: CMT73
+   - Introduce an optional scoreboard held in shared memory (global parameter 'scoreboard on') so that DB Server offline status is shared immediately by all worker processes and the status report can show connection and request totals for the whole web server.
+
+Version 2.8.44q 17 October 2026: CMT74
+   - Introduce a metrics report in Prometheus format (/metrics under the mg_web administration location) with request, error, failover and in-flight counts, connection pool usage and latency histograms for each DB Server and location.
+
+Version 2.8.44r 17 October 2026: CMT75
+   - Introduce optional per-request phase timing (global parameter 'request_timing'): for a sample of requests the time spent waiting for a connection, connecting, sending the request, waiting for the DB Server and relaying the response is written to the event log and/or returned in a Server-Timing response header.
+
+Version 2.8.44s 17 October 2026: CMT76
+   - Introduce a standalone benchmark (src/bench/mg_web_bench.c) that drives the mg_web core through a stub web server module against a mock DB Server and reports throughput and latency percentiles for small, large, streamed (modes 1 and 2) and upload workloads.
+
+Version 2.8.44t 17 October 2026: CMT77
+   - Introduce an optional shared relay for WebSocket traffic from the DB Server (global parameter 'websocket_relay'): a small pool of threads per worker process waits on all WebSocket DB Server connections (using epoll) instead of one blocked thread per WebSocket (Linux only).
+
+Version 2.8.44u 17 October 2026: CMT78
+   - Introduce an optional event-driven relay for Server-Sent Events (global parameter 'sse_relay'): web server modules that can complete a request from another thread (Nginx) hand SSE streams to a small pool of threads serving all streams from one epoll set (Linux only).
+   - Send an SSE comment to clients after a configurable period of inactivity (global parameter 'sse_heartbeat').
+   - Close finished SSE streams as soon as the DB Server has closed its side of the connection instead of always waiting 10 seconds.
+
+Version 2.8.44v 17 October 2026: CMT79
+   - Introduce WebSocket channels (option 'channel' on a 'websocket' mapping): clients requesting the same URL share one DB Server connection, and each message it sends is framed once and written to all subscribed clients.
+
+Version 2.8.44w 17 October 2026: CMT80
+   - Introduce optional WebSocket compression (permessage-deflate, RFC 7692) for the Apache and Nginx modules (global parameters 'websocket_deflate', 'websocket_deflate_window_bits', 'websocket_deflate_memory_level' and 'websocket_deflate_context_takeover'): built with DBX_WITH_ZLIB set to 1 in mg_websys.h, zlib being loaded at run time.
+
+Version 2.8.44x 17 October 2026: CMT81
+   - Unmask WebSocket messages from the client a word (or, where available, an SSE2 vector) at a time instead of one Byte at a time.
+   - Keep the buffer used to assemble WebSocket messages from the client between messages (up to 64 KB) instead of allocating and freeing it for each message.
+   - Send the header and payload of each WebSocket frame to the client with one write.
+   - Add a WebSocket framing workload to the benchmark (mg_web_bench -w frames).
+
+Version 2.8.44y 17 October 2026: CMT82
+   - Measure queue and DB Server response timeouts with the monotonic clock (mg_time_msecs()) so that changes to the system time do not affect them.
+   - Join the connection pool maintenance thread in mg_worker_exit() before destroying the pools instead of waiting a maximum of 10 seconds for it to stop.
+   - The CGI variables gathered for a request (mg_get_all_cgi_variables()) are checked against the space left in the request memory, keeping MG_CGI_TAIL_RESERVE Bytes for the markers that follow them. The request memory keeps a 128000 Byte reserve for the request headers (MG_MBLOCK_HEADER_RESERVE).
+   - Nginx: hold the request (r->main->blocked) while it is queued for, or being processed by, the worker thread pool and while an SSE stream is being relayed, so that nginx cannot free it if the client disconnects.
+   - Take the DB Server addresses for IPv4-only builds from the address cache instead of calling gethostbyname() for each connection.
+   - Add request header lookup (mg_web_bench -w cgi) and location lookup (mg_web_bench -w locations) workloads to the benchmark.
+   - Add a multipart/form-data upload workload (mg_web_bench -w multipart) and a mode that runs it with each byte scanner (mg_web_bench -w scan).
+   - Response cache: parse the Vary header without strtok() and count stale hits only under hits_stale.
+   - Do not multiplex long requests (mg_execute_request_long) on a DB Server connection: the connection write lock would be held while the payload is streamed from the client.
+   - Scoreboard: keep the connection counts of each worker process in its own slot (summed when read) and reclaim the slots of processes that have died, so that totals, the number of processes and the removal of the segment are not upset by a process that exits without closing.
+   - Metrics: label every series with the process_id of the worker process that produced it.
+   - Add a makefile for the benchmark (src/bench/Makefile).
+   - The WebSocket relay threads no longer write to clients: the data read from the DB Server is passed to a pool of writer threads, and reading is suspended for a client with 256KB waiting.
+   - WebSocket channels: write to the subscribers from a copy of the subscriber list taken under the channel's lock (each copied subscriber is referenced until written), and never take the channel's lock with mg_global_mutex held.
+   - WebSocket: initialize every field of the frame state at the start of a session (and in the benchmark), and mark the parameters of the compression functions as used when zlib is not included.
+   - Benchmark: check the unmasked WebSocket payload against a byte at a time reference for each message size, from an odd position in the payload.
+   - WebSocket: send the server's close frames again (closing handshake, DB Server closed, channel closed). mg_websocket_write_block() passed the close frame to mg_websocket_write_frame(), which discards frames once mg_websocket_create_header() has marked the WebSocket as closing.
+   - Resolve a DB Server's host name when its first connection is made instead of at worker initialization (which, for IIS, runs under the loader lock). mg_worker_exit() stops the address cache refreshes and waits for those running before freeing the DB Servers (leaving them allocated if a refresh does not finish in time).
+   - Nginx: the worker pool threads no longer call nginx functions. Memory for a pooled request comes from the heap (freed with the request pool) and the response headers are copied, to be applied to the request in the event loop before they are sent. The worker pool threads are joined at shutdown.
+   - The connection pool maintenance thread sleeps on an event (Windows) or condition variable (UNIX) so that mg_worker_exit() can stop it at once, and mg_worker_exit() waits a maximum of 10 seconds for it (leaving the pools and DB Servers allocated if it is still running). Under the IIS loader lock (DllMain) it is not waited for: the IIS module stops it when its module factory is terminated. Connection retries (mg_connect()) are abandoned once the thread has been asked to stop.
+   - The number of requests served by a connection is incremented atomically (mg_connection_add_request()): requests sharing a multiplexed connection can finish at the same time.
+   - The last subscriber to leave a WebSocket channel interrupts the publisher's read (socket shutdown and, for UNIX, the interrupt pipe) and waits for the reader thread to finish before the publisher's connection is cleaned up and released. The reader also checks for the channel stopping every MG_WSCHANNEL_READ_TIMEOUT seconds.
+   - When the WebSocket relay is stopped, slots left marked as in use by stopped threads are released so that mg_websocket_relay_remove() is not left waiting. The relay is freed only when no call to mg_websocket_relay_add() or mg_websocket_relay_remove() still refers to it (maximum wait MG_WS_RELAY_STOP_WAIT).
+   - The asynchronous log writer's status and buffer use are read and changed only under its lock. The writer sleeps on a condition variable (woken by mg_log_enqueue() when the buffer is half full, or by mg_log_stop()) and is no longer detached. mg_log_stop() waits a maximum of MG_LOG_STOP_WAIT milliseconds for the writer to finish and then joins it. If the writer has not finished by then, it frees the buffer itself.
 */
 
 
@@ -263,17 +386,34 @@ Version 2.8.43g 2 November 2025: CMT56
 #include "mg_webstatus.h"
 #include "mg_webtls.h"
 
+#if defined(MG_SCAN_SIMD) /* CMT69 */
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include <immintrin.h>
+#endif
+
 
 #if !defined(_WIN32)
 extern int errno;
 #endif
 
-MGSYS                mg_system         = {0, 0, 0, 0, 0, 0, "", "", "", "", NULL, NULL, NULL, NULL, NULL, NULL, "", {NULL}, {"", "", "", 0, 0, 0, 0, 0, 0, 0, 0, 0, "", ""}};
+MGSYS                mg_system         = {0, 0, 0, 0, 0, 0, "", "", "", "", NULL, NULL, NULL, NULL, NULL, NULL, "", {NULL}, {"", "", "", 0, 0, 0, 0, 0, 0, 0, 0, 0, "", ""},
+                                          0, {0}, 0, 0, {MG_LOCK_INITIALIZER, MG_COND_INITIALIZER, 0, NULL, 0, 0, 0, 0, 0, 0, NULL, {0}},
+                                          0, {MG_LOCK_INITIALIZER, 0, 0, 0, 0, 0, {0}, {NULL}},
+                                          0, 0, 0, 0, 0, 0, 0, 0, NULL, 0, "",
+#if defined(_WIN32)
+                                          NULL,
+#endif
+                                          0, 0, NULL, 0, 0, 0, NULL, NULL, 0, 0, 0, 0, 0, 0}; /* CMT82 */
 static NETXSOCK      netx_so           = {0, 0, 0, 0, 0, 0, 0, {'\0'}};
 DBXCON *             mg_connection     = NULL;
 
 MGSRV *              mg_server         = NULL;
 MGPATH *             mg_path           = NULL;
+MGRTNODE *           mg_path_index     = NULL; /* CMT67 */
+const long long      mg_metrics_bounds[MG_METRICS_BUCKETS - 1] = {1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000}; /* CMT74 histogram bucket upper bounds (microseconds) */
+static int           mg_scan_level     = -1; /* CMT69 */
 MGTLS *              mg_tls            = NULL; /* v2.3.21 */
 
 MG_MALLOC            mg_ext_malloc     = NULL;
@@ -295,6 +435,19 @@ CRITICAL_SECTION     mg_global_mutex;
 pthread_mutex_t      mg_global_mutex   = PTHREAD_MUTEX_INITIALIZER;
 #endif
 
+/* CMT82 signalled to stop the connection pool maintenance thread without waiting for the end of its sleep */
+#if defined(_WIN32)
+static HANDLE           mg_pool_stop_event = NULL;
+#else
+static pthread_mutex_t  mg_pool_stop_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   mg_pool_stop_cond  = PTHREAD_COND_INITIALIZER;
+#endif
+
+/* CMT82 gethostbyname() is not reentrant */
+#if !defined(_WIN32) && !defined(NETX_IPV6)
+static pthread_mutex_t  mg_dns_mutex   = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
 
 int mg_web(MGWEB *pweb)
 {
@@ -641,10 +794,57 @@ __except (EXCEPTION_EXECUTE_HANDLER) {
 }
 
 
+/* CMT74 measure the request for the metrics report (CMT75 and time its phases if sampled) */
 int mg_web_process(MGWEB *pweb)
 {
    DBX_TRACE_INIT(0)
-   int rc, len, len1, get, get1, close_connection, failover_no;
+   int rc;
+
+#ifdef _WIN32
+__try {
+#endif
+
+   mg_metrics_request_start(pweb);
+   mg_timing_request_start(pweb); /* CMT75 */
+   rc = mg_web_process_ex(pweb);
+   if (pweb->pwsock && pweb->pwsock->pchannel) { /* CMT79 a channel's first subscriber failed before starting the publisher */
+      mg_websocket_channel_abort(pweb);
+   }
+   if (pweb->pwsock) { /* CMT80 release the compression state of a WebSocket */
+      mg_websocket_deflate_free(&(pweb->pwsock->deflate));
+   }
+   mg_timing_request_end(pweb);
+   mg_metrics_request_end(pweb);
+
+   return rc;
+
+#ifdef _WIN32
+}
+__except (EXCEPTION_EXECUTE_HANDLER) {
+
+   DWORD code;
+   char bufferx[256];
+
+   __try {
+      code = GetExceptionCode();
+      sprintf_s(bufferx, 255, "Exception caught in f:mg_web_process: %x:%d", code, DBX_TRACE_VAR);
+      mg_log_event(pweb->plog, pweb, bufferx, "Error Condition", 0);
+   }
+   __except (EXCEPTION_EXECUTE_HANDLER) {
+      ;
+   }
+
+   return 0;
+}
+#endif
+}
+
+
+int mg_web_process_ex(MGWEB *pweb)
+{
+   DBX_TRACE_INIT(0)
+   int rc, len, get, get1, close_connection, failover_no;
+   long long time_start;
    unsigned char *p;
    char buffer[256], info[256];
    DBXVAL *pval;
@@ -660,6 +860,17 @@ __try {
       return mg_admin(pweb);
    }
 
+   pweb->rcache_status = 0;
+   if (pweb->ppath->prcache && !pweb->sse && !pweb->pwsock) { /* CMT71 */
+      if (mg_rcache_lookup(pweb) == CACHE_SUCCESS) {
+         return CACHE_SUCCESS;
+      }
+   }
+
+   if (pweb->pwsock && pweb->pwsock->channel && mg_websocket_channel_subscribe(pweb) == 1) { /* CMT79 the channel already has a publisher */
+      return mg_websocket_channel_session(pweb);
+   }
+
 #if 0
    if (pweb->sse && pweb->evented) { /* v2.7.33 sse */
       int n;
@@ -742,7 +953,9 @@ mg_web_process_failover:
 
    pweb->mg_connect_failed = 0;
    DBX_TRACE(6)
+   time_start = mg_time_usecs(); /* CMT74 */
    rc = mg_obtain_connection(pweb);
+   pweb->metrics_connect += (mg_time_usecs() - time_start);
 
    DBX_TRACE(7)
    if (rc == CACHE_FAILURE) { /* v2.1.13 */
@@ -796,6 +1009,7 @@ mg_web_process_failover:
          if (mg_server_alternatives(pweb, pweb->psrv, info, 0) > 0) { /* CMT51 any viable alternatives? */
             sprintf(pweb->error, "Cannot connect to DB Server %s; attempting to failover", pweb->psrv ? pweb->psrv->name : "null");
             mg_log_event(pweb->plog, pweb, pweb->error, "mg_web: connectivity error", 0);
+            mg_metrics_failover(pweb); /* CMT74 */
             failover_no ++;
             goto mg_web_process_failover;
          }
@@ -817,6 +1031,10 @@ mg_web_process_failover:
    }
 
    DBX_TRACE(21)
+   if (!pweb->metrics_psrv && pweb->metrics && pweb->psrv->pmetrics) { /* CMT74 */
+      pweb->metrics_psrv = pweb->psrv;
+      mg_metrics_count(pweb->psrv->pmetrics, 0, 1);
+   }
    *(pweb->serverno) = (unsigned char) ((pweb->server_no / 10) + 48);
    *(pweb->serverno + 1) = (unsigned char) ((pweb->server_no % 10) + 48);
    strncpy(pweb->server, pweb->psrv->name, pweb->psrv->name_len);
@@ -847,7 +1065,9 @@ mg_web_process_failover:
 */
 
    DBX_TRACE(24)
+   time_start = mg_time_usecs(); /* CMT74 */
    rc = mg_web_execute(pweb);
+   pweb->metrics_execute += (mg_time_usecs() - time_start);
 
    /* v2.7.33 */
 /*
@@ -949,6 +1169,15 @@ mg_web_process_failover:
 
       DBX_TRACE(41)
       pweb->response_headers_len = (int) strlen(pweb->response_headers);
+      pweb->rcache_headers_len = pweb->response_headers_len; /* CMT71 before the headers added by mg_web */
+      if (pweb->timing && mg_system.timing_header) { /* CMT75 */
+         mg_timing_header(pweb, buffer);
+         len = (int) strlen(buffer);
+         if ((pweb->response_headers_len + len + 6) < pweb->response_headers_alloc) {
+            strcpy(pweb->response_headers + pweb->response_headers_len, buffer);
+            pweb->response_headers_len += len;
+         }
+      }
       if (pweb->ppath->sa_cookie) {
          if (pweb->tls) {
             sprintf(buffer, "\r\nSet-Cookie: %s=%d; path=/; httpOnly; secure;", (char *) pweb->ppath->sa_cookie, pweb->server_no);
@@ -1045,14 +1274,13 @@ mg_web_process_failover:
             mg_log_event(pweb->plog, pweb, info, "mg_web: connectivity", 0);
          }
       }
-      else {
-         mg_release_connection(pweb, 1); /* v2.4.24 */
-      }
+      mg_release_connection(pweb, 1); /* v2.4.24 CMT57 the failed connection is always returned to the pool */
       /* v2.1.16 : DB Servers marked for exclusive use cannot failover to another server in the list */
       if (pweb->failover_possible && pweb->ppath->srv_max > 1 && pweb->ppath->srv_max > failover_no && pweb->ppath->servers[pweb->server_no].exclusive == 0) {
          if (mg_server_alternatives(pweb, pweb->psrv, info, 0) > 0) { /* CMT51 any viable alternatives? */
             sprintf(pweb->error, "Cannot send request to DB Server %s; attempting to failover", pweb->psrv ? pweb->psrv->name : "null");
             mg_log_event(pweb->plog, pweb, pweb->error, "mg_web: connectivity error", 0);
+            mg_metrics_failover(pweb); /* CMT74 */
             failover_no ++;
             goto mg_web_process_failover;
          }
@@ -1061,6 +1289,7 @@ mg_web_process_failover:
 
    DBX_TRACE(50)
    if (rc != CACHE_SUCCESS) {
+      pweb->rcache_status = 0; /* CMT71 */
 
       /* v2.1.10 */
 /*
@@ -1114,24 +1343,40 @@ mg_web_process_failover:
 
    DBX_TRACE(60)
    if (pweb->pwsock) {
+      if (pweb->pwsock->pchannel) { /* CMT79 */
+         mg_websocket_channel_publish(pweb);
+         return mg_websocket_channel_session(pweb);
+      }
       rc = mg_websocket_connection(pweb);
       rc = mg_websocket_disconnect(pweb);
       return rc;
    }
 
    DBX_TRACE(70)
+   if (pweb->rcache_status == 1 && !pweb->sse && !pweb->response_streamed && pweb->response_remaining == 0 && !pweb->output_val.pnext && get == pweb->response_clen) { /* CMT71 */
+      mg_rcache_store(pweb, get);
+   }
 
    mg_submit_headers(pweb);
    DBX_TRACE(71)
 
    if (pweb->sse) { /* v2.7.33 */
 
+#if defined(MG_SSE_RELAY)
+      /* CMT78 pass the stream to the SSE relay if the web server module can complete the request from another thread */
+      if (mg_system.psserelay && pweb->sse_complete && pweb->pcon->psrv->net_connection && !pweb->pcon->ptlscon) {
+         if (mg_sse_relay_add(pweb) == CACHE_SUCCESS) {
+            return CACHE_SUCCESS;
+         }
+      }
+#endif
+
       p = (unsigned char *) (pweb->output_val.svalue.buf_addr + (pweb->output_val.svalue.len_used + pweb->response_headers_len + 6));
       len = (pweb->output_val.svalue.len_alloc - (pweb->output_val.svalue.len_used + pweb->response_headers_len + 6));
       get = 0;
 
       while (1) {
-         rc = netx_tcp_read(pweb, (unsigned char *) p, len, 60, 0); /* v2.8.41: was 86400 */
+         rc = netx_tcp_read(pweb, (unsigned char *) p, len, mg_system.sse_heartbeat > 0 ? mg_system.sse_heartbeat : 60, 0); /* v2.8.41: was 86400 */
 /*
          {
             char bufferx[256];
@@ -1140,6 +1385,9 @@ mg_web_process_failover:
          }
 */
          if (rc == NETX_READ_TIMEOUT) { /* v2.8.41 */
+            if (mg_system.sse_heartbeat > 0 && mg_sse_heartbeat(pweb) < 1) { /* CMT78 */
+               break;
+            }
             if (mg_client_gone(pweb)) {
                /* mg_log_event(pweb->plog, pweb, "*** client gone (post DBServer timeout test) ***", "SSE Message", 0); */
                break;
@@ -1151,50 +1399,17 @@ mg_web_process_failover:
             break;
          }
 
-         if (pweb->wstype == MG_WS_NGINX) {
-            sprintf(buffer, "%x", rc);
-            len1 = (int) strlen(buffer);
-            p -= (len1 + 2);
-            rc += (len1 + 2);
-            strncpy((char *) p, buffer, len1);
-            *(p + len1) = '\r';
-            *(p + (len1 + 1)) = '\n';
-            *(p + rc) = '\r';
-            *(p + (rc + 1)) = '\n';
-            rc += 2;
-            /* mg_log_buffer(pweb->plog, pweb, (char *) p, rc, "SSE Data (Chunked)", 0); */
-            get = mg_client_write_now(pweb, (unsigned char *) p, (int) rc);
-            p += (len1 + 2);
-         }
-         else {
-            get = mg_client_write_now(pweb, (unsigned char *) p, (int) rc);
-         }
+         get = mg_sse_write(pweb, (unsigned char *) p, (int) rc);
          if (get < 1) {
             /* mg_log_event(pweb->plog, pweb, "*** client gone (cannot write to client) ***", "SSE Message", 0); */
             break;
          }
       }
 
-      if (pweb->wstype == MG_WS_NGINX) {
-         mg_client_write_now(pweb, (unsigned char *) "0\r\n\r\n", (int) 5);
-      }
-
       DBX_TRACE(90)
-      mg_cleanup(pweb);
+      mg_sse_close(pweb);
       DBX_TRACE(91)
-      if (pweb->pcon) {
-         pweb->pcon->no_requests ++;
-      }
-
-      get = netx_tcp_write(pweb, (unsigned char *) "\xff\xff\xff\xff\xff", 5);
-/*
-      {
-         char bufferx[256];
-         sprintf(bufferx, "netx_tcp_write: fired a 0xff*5 result=%d;", get);
-         mg_log_event(pweb->plog, pweb, bufferx, "SSE", 0);
-      }
-*/
-      mg_sleep(10000); /* give server a chance to cleanup. */
+      mg_sse_drain(pweb, MG_SSE_CLOSE_TIMEOUT); /* CMT78 was mg_sleep(10000): give server a chance to cleanup */
       close_connection = 1;
       mg_release_connection(pweb, close_connection);
 
@@ -1203,6 +1418,7 @@ mg_web_process_failover:
       return CACHE_SUCCESS;
    }
 
+
    rc = CACHE_SUCCESS;
    if (get) {
       if (pweb->response_streamed) {
@@ -1349,7 +1565,7 @@ mg_web_exit:
    mg_cleanup(pweb);
    DBX_TRACE(91)
    if (pweb->pcon) { /* v2.4.24 */
-      pweb->pcon->no_requests ++;
+      mg_connection_add_request(pweb->pcon); /* CMT82 */
    }
    mg_release_connection(pweb, close_connection);
 
@@ -1364,7 +1580,7 @@ __except (EXCEPTION_EXECUTE_HANDLER) {
 
    __try {
       code = GetExceptionCode();
-      sprintf_s(bufferx, 255, "Exception caught in f:mg_web_process: %x:%d", code, DBX_TRACE_VAR);
+      sprintf_s(bufferx, 255, "Exception caught in f:mg_web_process_ex: %x:%d", code, DBX_TRACE_VAR);
       mg_log_event(pweb->plog, pweb, bufferx, "Error Condition", 0);
    }
    __except (EXCEPTION_EXECUTE_HANDLER) {
@@ -1378,522 +1594,587 @@ __except (EXCEPTION_EXECUTE_HANDLER) {
 
 
 /* 2.0.8 */
-int mg_parse_headers(MGWEB *pweb)
+/* CMT78 send SSE data to the client: 'data' must be preceded by 16 Bytes and followed by 2 Bytes of free space for the chunk framing */
+int mg_sse_write(MGWEB *pweb, unsigned char *data, int len)
 {
-   DBX_TRACE_INIT(0)
-   int len;
-   char *pn, *ps, *pv, *pz;
-   char head[64];
+   int len1;
+   char buffer[16];
 
-#ifdef _WIN32
-__try {
-#endif
+   if (pweb->wstype == MG_WS_NGINX) {
+      sprintf(buffer, "%x", len);
+      len1 = (int) strlen(buffer);
+      data -= (len1 + 2);
+      len += (len1 + 2);
+      strncpy((char *) data, buffer, len1);
+      *(data + len1) = '\r';
+      *(data + (len1 + 1)) = '\n';
+      *(data + len) = '\r';
+      *(data + (len + 1)) = '\n';
+      len += 2;
+      /* mg_log_buffer(pweb->plog, pweb, (char *) data, len, "SSE Data (Chunked)", 0); */
+   }
 
-   pweb->response_clen_server = -1;
-   pweb->response_content_type = NULL; /* v2.7.33 */
-   pweb->response_cache_control = NULL;
-   pweb->response_connection = NULL;
+   return mg_client_write_now(pweb, (unsigned char *) data, (int) len);
+}
 
-   pn = pweb->response_headers;
-   while (pn && *pn) {
-      pz = strstr(pn, "\r\n");
-      if (pz) {
-         *pz = '\0';
-      }
-      ps = strstr(pn, ":");
-      if (ps) {
-         *ps = '\0';
-         pv = ps;
-         len = (int) (pv - pn);
-         if (len > 0 && len < 60) {
-            while (*(++ pv) == ' ')
-               ;
-/*
-            {
-               char bufferx[256];
-               sprintf(bufferx, "Response Header: len=%d; name=%s", len, pn);
-               mg_log_event(pweb->plog, pweb, pv, bufferx, 0);
-            }
-*/
-            strcpy(head, pn);
-            mg_lcase(head);
-            if (strstr(head, "content-length")) {
-               pweb->response_clen_server = (int) strtol(pv, NULL, 10);
-            }
-            else if (strstr(head, "content-type")) { /* v2.7.33 */
-               pweb->response_content_type = pn;
-            }
-            else if (strstr(head, "cache-control")) {
-               pweb->response_cache_control = pn;
-            }
-            else if (strstr(head, "connection")) { /* v2.8.38 */
-               pweb->response_connection = pn;
-            }
-         }
-         *ps = ':';
-      }
-      if (pz) {
-         *pz = '\r';
-         pn = (pz + 2);
-      }
-      else {
-         pn = NULL;
-      }
+
+/* CMT78 an SSE comment: ignored by the client but keeps intermediaries from timing out the stream and shows whether the client is still there */
+int mg_sse_heartbeat(MGWEB *pweb)
+{
+   unsigned char buffer[32];
+
+   strcpy((char *) buffer + 16, ":\n\n");
+
+   return mg_sse_write(pweb, buffer + 16, 3);
+}
+
+
+/* CMT78 end the stream: tell the DB Server (5 x 0xff) and close our side of the connection for writing */
+int mg_sse_close(MGWEB *pweb)
+{
+   int rc;
+
+   if (pweb->wstype == MG_WS_NGINX) {
+      mg_client_write_now(pweb, (unsigned char *) "0\r\n\r\n", (int) 5);
+   }
+
+   mg_cleanup(pweb);
+   if (!pweb->pcon) {
+      return CACHE_FAILURE;
    }
+   mg_connection_add_request(pweb->pcon); /* CMT82 */
+
+   rc = netx_tcp_write(pweb, (unsigned char *) "\xff\xff\xff\xff\xff", 5);
 /*
    {
       char bufferx[256];
-      sprintf(bufferx, "Response Header: clen=%d;", pweb->response_clen_server);
-      mg_log_event(pweb->plog, pweb, bufferx, "Content Length from Server", 0);
+      sprintf(bufferx, "netx_tcp_write: fired a 0xff*5 result=%d;", rc);
+      mg_log_event(pweb->plog, pweb, bufferx, "SSE", 0);
    }
 */
+   if (pweb->pcon->psrv->net_connection && !pweb->pcon->ptlscon && !pweb->pcon->eof) {
+#if defined(_WIN32)
+      shutdown(pweb->pcon->cli_socket, SD_SEND);
+#else
+      shutdown(pweb->pcon->cli_socket, SHUT_WR);
+#endif
+   }
 
-   return CACHE_SUCCESS;
-
-#ifdef _WIN32
+   return rc;
 }
-__except (EXCEPTION_EXECUTE_HANDLER) {
 
-   DWORD code;
-   char bufferx[256];
 
-   __try {
-      code = GetExceptionCode();
-      sprintf_s(bufferx, 255, "Exception caught in f:mg_parse_headers: %x:%d", code, DBX_TRACE_VAR);
-      mg_log_event(pweb->plog, pweb, bufferx, "Error Condition", 0);
+/* CMT78 wait (for up to 'timeout' seconds) for the DB Server to finish with a closed stream and close its side of the connection */
+int mg_sse_drain(MGWEB *pweb, int timeout)
+{
+   int rc;
+   time_t deadline, now;
+   unsigned char buffer[256];
+
+   if (!pweb->pcon || !pweb->pcon->psrv->net_connection || pweb->pcon->eof) {
+      return CACHE_SUCCESS;
    }
-   __except (EXCEPTION_EXECUTE_HANDLER) {
-      ;
+
+   deadline = time(NULL) + timeout;
+   for (;;) {
+      now = time(NULL);
+      if (now >= deadline) {
+         break;
+      }
+      rc = netx_tcp_read(pweb, buffer, (int) sizeof(buffer), (int) (deadline - now), 0);
+      if (rc < 1) {
+         break;
+      }
    }
 
-   return CACHE_FAILURE;
-}
-#endif
+   return CACHE_SUCCESS;
 }
 
 
-int mg_web_execute(MGWEB *pweb)
+#if defined(MG_SSE_RELAY)
+
+/* CMT78 start the SSE relay threads: called once, at worker initialization */
+int mg_sse_relay_start(int threads)
 {
-   DBX_TRACE_INIT(0)
-   int rc, len, get;
-   unsigned long offset, netbuf_used;
-   unsigned char *netbuf;
-   char label[16], routine[16], params[9], buffer[8];
-   DBXFUN fun;
-   DBXCON *pcon;
+   int n;
+   struct epoll_event event;
+   MGSSERELAY *prelay;
 
-#ifdef _WIN32
-__try {
-#endif
+   if (threads < 1) {
+      return CACHE_SUCCESS;
+   }
+   if (threads > MG_SSE_RELAY_MAX) {
+      threads = MG_SSE_RELAY_MAX;
+   }
 
-   pcon = pweb->pcon;
-   rc = CACHE_SUCCESS;
-   offset = 5;
+   prelay = (MGSSERELAY *) mg_malloc(NULL, sizeof(MGSSERELAY), MG_MID_SSERELAY);
+   if (!prelay) {
+      return CACHE_FAILURE;
+   }
+   memset((void *) prelay, 0, sizeof(MGSSERELAY));
+   prelay->free_slot = -1;
+   prelay->epfd = epoll_create1(EPOLL_CLOEXEC);
+   prelay->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+   if (prelay->epfd < 0 || prelay->wakefd < 0) {
+      goto mg_sse_relay_start_error;
+   }
+   event.events = EPOLLIN;
+   event.data.u64 = MG_WS_RELAY_WAKE;
+   if (epoll_ctl(prelay->epfd, EPOLL_CTL_ADD, prelay->wakefd, &event) != 0) {
+      goto mg_sse_relay_start_error;
+   }
+   pthread_mutex_init(&(prelay->lock), NULL);
 
-   mg_add_block_size((unsigned char *) pweb->input_buf.buf_addr, pweb->input_buf.len_used, 0,  DBX_DSORT_EOD, DBX_DTYPE_STR8);
-   pweb->input_buf.len_used += 5;
+   prelay->status = 1;
+   mg_system.psserelay = prelay;
+   for (n = 0; n < threads; n ++) {
+      if (mg_thread_create(&(prelay->thread[n]), (DBX_THR_FUNCTION) mg_sse_relay, (void *) prelay) != CACHE_SUCCESS) {
+         break;
+      }
+      prelay->threads ++;
+   }
+   if (prelay->threads == 0) {
+      mg_system.psserelay = NULL;
+      pthread_mutex_destroy(&(prelay->lock));
+      goto mg_sse_relay_start_error;
+   }
+   return CACHE_SUCCESS;
 
-   netbuf = (unsigned char *) (pweb->input_buf.buf_addr - DBX_IBUFFER_OFFSET);
-   netbuf_used = (pweb->input_buf.len_used + DBX_IBUFFER_OFFSET);
-   mg_add_block_size((unsigned char *) netbuf, 0, netbuf_used,  0, DBX_CMND_FUNCTION);
-   memset(netbuf + 5, 0, DBX_IBUFFER_OFFSET - 5); /* v2.3.22 */
+mg_sse_relay_start_error:
 
-   strcpy(params, "dbx");
-   strcpy(label, "ifc");
+   if (prelay->epfd >= 0) {
+      close(prelay->epfd);
+   }
+   if (prelay->wakefd >= 0) {
+      close(prelay->wakefd);
+   }
+   mg_free(NULL, (void *) prelay, MG_MID_SSERELAY);
+   return CACHE_FAILURE;
+}
 
-   strcpy(routine, "%zmgsis");
-   fun.label = label;
-   fun.label_len = (int) strlen(label);
-   fun.routine = routine;
-   fun.routine_len = (int) strlen(routine);
-   pweb->output_val.num.str = (char *) 0;
 
-   DBX_TRACE(1)
-   MG_LOG_REQUEST_FRAME(pweb, netbuf, netbuf_used);
-   MG_LOG_REQUEST_BUFFER(pweb, netbuf, netbuf_used);
+/* CMT78 stop the SSE relay threads: streams still open are abandoned along with the worker process */
+int mg_sse_relay_stop(void)
+{
+   int n;
+   uint64_t one;
+   MGSSERELAY *prelay;
 
-/*
-   if (mg_system.log.log_transmissions) {
-      mg_log_buffer(pweb->plog, pweb, pweb->input_buf.buf_addr, pweb->input_buf.len_used, "mg_web: request buffer", 0);
+   prelay = mg_system.psserelay;
+   if (!prelay) {
+      return CACHE_SUCCESS;
    }
-*/
-   /* v2.1.10 */
 
-   if (pcon->psrv->net_connection) { /* v2.8.42 */
-      DBX_TRACE(10)
-      memcpy((void *) pweb->mode, (void *) "tcp", (size_t) 3);
-      rc = netx_tcp_command(pweb, DBX_CMND_FUNCTION, 0);
+   pthread_mutex_lock(&(prelay->lock));
+   prelay->status = 2;
+   pthread_mutex_unlock(&(prelay->lock));
+   one = 1;
+   n = (int) write(prelay->wakefd, (void *) &one, sizeof(one));
 
-/* v2.7.33 */
-/*
-      {
-         char bufferx[64];
-         sprintf(bufferx, "netx_tcp_command: rc=%d;", rc);
-         mg_log_event(pweb->plog, pweb, bufferx, "Trace", 0);
-      }
-*/
+   for (n = 0; n < prelay->threads; n ++) {
+      mg_thread_join(&(prelay->thread[n]));
+   }
+   mg_system.psserelay = NULL;
 
+   close(prelay->epfd);
+   close(prelay->wakefd);
+   pthread_mutex_destroy(&(prelay->lock));
+   if (prelay->slots) {
+      mg_free(NULL, (void *) prelay->slots, MG_MID_SSERELAY);
    }
-   else if (pcon->psrv->dbtype == DBX_DBTYPE_YOTTADB) {
+   mg_free(NULL, (void *) prelay, MG_MID_SSERELAY);
 
-      ydb_string_t out, in1, in2, in3;
-#if !defined(_WIN32)
-      uid_t uid;
-      gid_t gid;
-      struct passwd *pwd;
-      struct group *grp;
-#endif
+   return CACHE_SUCCESS;
+}
 
-      DBX_TRACE(20)
-      memcpy((void *) pweb->mode, (void *) "api", (size_t) 3);
-      pweb->failover_possible = 0;
-      strcat(fun.label, "_zmgsis");
-      fun.label_len = (int) strlen(label);
 
-      strcpy(buffer, "");
+/* CMT78 hand an SSE stream (headers sent) to the relay: the DB Server socket is watched for data and the client socket for hang-up */
+int mg_sse_relay_add(MGWEB *pweb)
+{
+   int n, slot_no, slot_max;
+   uint64_t id;
+   struct epoll_event event;
+   MGSSESLOT *pslots;
+   MGSSERELAY *prelay;
 
-      out.address = (char *) pweb->output_val.svalue.buf_addr;
-      out.length = (unsigned long) pweb->output_val.svalue.len_alloc;
-      in1.address = (char *) buffer;
-      in1.length = (unsigned long) strlen(buffer);
-      in2.address = (char *) netbuf;
-      in2.length = (unsigned long) netbuf_used;
-      in3.address = (char *) params;
-      in3.length = (unsigned long) strlen(params);
+   prelay = mg_system.psserelay;
 
-      DBX_LOCK(0);
+   pthread_mutex_lock(&(prelay->lock));
 
-      if (pweb->request_long) { /* v2.2.18 */
-         rc = mg_execute_request_long(pweb, mg_write_chunk_ydb);
+   if (prelay->status != 1) {
+      pthread_mutex_unlock(&(prelay->lock));
+      return CACHE_FAILURE;
+   }
+
+   if (prelay->free_slot < 0) {
+      slot_max = prelay->slot_max ? (prelay->slot_max * 2) : 64;
+      pslots = (MGSSESLOT *) mg_malloc(NULL, sizeof(MGSSESLOT) * slot_max, MG_MID_SSERELAY);
+      if (!pslots) {
+         pthread_mutex_unlock(&(prelay->lock));
+         return CACHE_FAILURE;
+      }
+      memset((void *) pslots, 0, sizeof(MGSSESLOT) * slot_max);
+      if (prelay->slots) {
+         memcpy((void *) pslots, (void *) prelay->slots, sizeof(MGSSESLOT) * prelay->slot_max);
+         mg_free(NULL, (void *) prelay->slots, MG_MID_SSERELAY);
+      }
+      for (n = slot_max - 1; n >= prelay->slot_max; n --) {
+         pslots[n].next_free = prelay->free_slot;
+         prelay->free_slot = n;
+      }
+      prelay->slots = pslots;
+      prelay->slot_max = slot_max;
+   }
+
+   slot_no = prelay->free_slot;
+   prelay->free_slot = prelay->slots[slot_no].next_free;
+   prelay->slots[slot_no].pweb = pweb;
+   prelay->slots[slot_no].gen ++;
+   prelay->slots[slot_no].busy = 0;
+   prelay->slots[slot_no].state = MG_SSE_STREAMING;
+   prelay->slots[slot_no].client_gone = 0;
+   prelay->slots[slot_no].db_ready = 0;
+   prelay->slots[slot_no].last_write = time(NULL);
+   prelay->slots[slot_no].deadline = 0;
+
+   /* the request belongs to the relay from the moment the socket is added */
+   pweb->sse_relayed = 1;
+
+   id = (((uint64_t) prelay->slots[slot_no].gen) << 32) | (((uint64_t) slot_no) << 1);
+   event.events = EPOLLIN | EPOLLONESHOT;
+   event.data.u64 = id;
+   if (epoll_ctl(prelay->epfd, EPOLL_CTL_ADD, (int) pweb->pcon->cli_socket, &event) != 0) {
+      pweb->sse_relayed = 0;
+      prelay->slots[slot_no].pweb = NULL;
+      prelay->slots[slot_no].next_free = prelay->free_slot;
+      prelay->free_slot = slot_no;
+      pthread_mutex_unlock(&(prelay->lock));
+      return CACHE_FAILURE;
+   }
+   if (pweb->sse_client_fd >= 0) {
+      event.events = EPOLLRDHUP | EPOLLONESHOT;
+      event.data.u64 = id | 1;
+      if (epoll_ctl(prelay->epfd, EPOLL_CTL_ADD, pweb->sse_client_fd, &event) != 0) {
+         pweb->sse_client_fd = -1; /* a departed client will be noticed when the next write fails */
       }
+   }
+   mg_system.sse_relay_streams ++;
 
-      rc = pcon->p_ydb_so->p_ydb_ci(fun.label, &out, &in1, &in2, &in3);
+   pthread_mutex_unlock(&(prelay->lock));
 
-/*
-{
-   char bufferx[1024];
-   sprintf(bufferx, "mg_web_execute (YottaDB:ydb_string_t): rc=%d; len_used=%d; len_alloc=%d; out.length=%d;", rc,  pweb->output_val.svalue.len_used, pweb->output_val.svalue.len_alloc, (int) out.length);
-   mg_log_event(pweb->plog, pweb, bufferx, "mg_web_execute: YottaDB API", 0);
+   return CACHE_SUCCESS;
 }
-*/
 
-/*
+
+/* CMT78 serve one event for a stream held (busy) by this thread - event 0: DB Server data; 1: client hang-up; 2: timer */
+/* returns 0, 1 if the DB Server socket is to be rearmed or 2 if the stream has finished and the request has been completed */
+int mg_sse_relay_serve(MGSSERELAY *prelay, int slot_no, int event)
 {
-   char bufferx[1024];
-   sprintf(bufferx, "mg_web_execute (YottaDB:ydb_buffer_t): rc=%d; len_used=%d; len_alloc=%d; out.len_used=%d;", rc,  (int) pweb->output_val.svalue.len_used, (int) pweb->output_val.svalue.len_alloc, (int) out.len_used);
-   mg_log_event(pweb->plog, pweb, bufferx, "mg_web_execute: YottaDB API", 0);
-}
-*/
+   int rc, state, result, wrote, end;
+   time_t now, last_write, deadline;
+   unsigned char data[MG_SSE_BLOCK_SIZE + 32];
+   MGWEB *pweb;
+   MGSSESLOT *pslot;
 
-      if (rc == YDB_OK) {
-/*
-         pweb->output_val.svalue.len_used = (unsigned int) mg_get_size((unsigned char *) pweb->output_val.svalue.buf_addr);
-         pweb->response_size = (pweb->output_val.svalue.len_used - 5);
-*/
+   pthread_mutex_lock(&(prelay->lock));
+   pslot = &(prelay->slots[slot_no]);
+   pweb = pslot->pweb;
+   state = pslot->state;
+   last_write = pslot->last_write;
+   deadline = pslot->deadline;
+   pthread_mutex_unlock(&(prelay->lock));
 
-         pweb->output_val.api_size = (unsigned int) out.length;
-/*
-         pweb->output_val.api_size = (unsigned int) out.len_used;
-*/
+   now = time(NULL);
+   result = 0;
+   wrote = 0;
+   end = 0;
 
-         pweb->output_val.svalue.len_used = pweb->output_val.api_size;
-         pweb->response_size = (pweb->output_val.api_size - 5);
-         pweb->response_remaining = 0;
+   if (event == 0) {
+      rc = netx_tcp_read(pweb, data + 16, MG_SSE_BLOCK_SIZE, 1, 0);
+      if (rc == NETX_READ_TIMEOUT) {
+         result = 1;
       }
-      else if (pcon->p_ydb_so->p_ydb_zstatus) { /* v2.7.35 */
-         char buffer[1024], uuser[32], ugroup[32];
-
-         *uuser = '\0';
-         *ugroup = '\0';
-#if defined(_WIN32)
-         strcpy(buffer, "mg_web_execute: YottaDB API error text");
-#else
-         uid = getuid();
-         gid = getgid();
-         if ((pwd = getpwuid(uid)) != NULL) {
-            strncpy(uuser, pwd->pw_name, 30);
-            uuser[30] = '\0';
+      else if (rc < 1) {
+         if (state == MG_SSE_STREAMING) {
+            mg_sse_close(pweb);
          }
-         if ((grp = getgrgid(gid)) != NULL) {
-            strncpy(ugroup, grp->gr_name, 30);
-            ugroup[30] = '\0';
+         result = 2;
+      }
+      else if (state == MG_SSE_STREAMING) {
+         if (mg_sse_write(pweb, data + 16, rc) < 1) {
+            end = 1;
          }
-         sprintf(buffer, "mg_web_execute: YottaDB API error text: process user=%s; group=%s;", uuser, ugroup);
-#endif
+         else {
+            wrote = 1;
+         }
+         result = 1;
+      }
+      else {
+         result = 1; /* closing: anything more from the DB Server is discarded */
+      }
+   }
+   else if (event == 1) {
+      if (state == MG_SSE_STREAMING) {
+         end = 1;
+      }
+   }
+   else {
+      if (state == MG_SSE_STREAMING && mg_system.sse_heartbeat > 0 && (now - last_write) >= mg_system.sse_heartbeat) {
+         if (mg_sse_heartbeat(pweb) < 1) {
+            end = 1;
+         }
+         else {
+            wrote = 1;
+         }
+      }
+      else if (state == MG_SSE_CLOSING && now >= deadline) {
+         result = 2;
+      }
+   }
 
-         pcon->p_ydb_so->p_ydb_zstatus((ydb_char_t *) pweb->error, (ydb_long_t) DBX_ERROR_SIZE - 1); /* v2.7.35 */
-         mg_log_event(pweb->plog, pweb, pweb->error, buffer, 0);
+   if (result == 2) {
+      mg_sse_relay_finish(prelay, slot_no);
+      return result;
+   }
+
+   if (end) {
+      mg_sse_close(pweb);
+      state = MG_SSE_CLOSING;
+      deadline = now + MG_SSE_CLOSE_TIMEOUT;
+      if (pweb->sse_client_fd >= 0) {
+         epoll_ctl(prelay->epfd, EPOLL_CTL_DEL, pweb->sse_client_fd, NULL);
       }
+   }
 
-      DBX_UNLOCK();
+   pthread_mutex_lock(&(prelay->lock));
+   pslot = &(prelay->slots[slot_no]);
+   pslot->state = state;
+   pslot->deadline = deadline;
+   if (wrote) {
+      pslot->last_write = now;
    }
-   else {
-      unsigned long ne;
-      DBXCVAL cvalue;
+   pthread_mutex_unlock(&(prelay->lock));
 
-      DBX_TRACE(30)
-      memcpy((void *) pweb->mode, (void *) "api", (size_t) 3);
-      pweb->failover_possible = 0;
-      strcpy(buffer, "");
-      cvalue.pstr = NULL;
+   return result;
+}
 
-      DBX_LOCK(0);
 
-      if (pweb->request_long) { /* v2.2.18 */
-         rc = mg_execute_request_long(pweb, mg_write_chunk_isc);
+/* CMT78 serve an event for a stream marked busy by this thread, then any events that arrived for it in the meantime */
+int mg_sse_relay_dispatch(MGSSERELAY *prelay, int slot_no, int event)
+{
+   int rc;
+   struct epoll_event ev;
+   MGSSESLOT *pslot;
+
+   for (;;) {
+      rc = mg_sse_relay_serve(prelay, slot_no, event);
+      if (rc == 2) {
+         break;
       }
 
-      rc = pcon->p_isc_so->p_CachePushFunc(&(fun.rflag), (int) fun.label_len, (const Callin_char_t *) fun.label, (int) fun.routine_len, (const Callin_char_t *) fun.routine);
-      if (rc == CACHE_SUCCESS) {
-         rc = pcon->p_isc_so->p_CachePushStr((int) strlen(buffer), (Callin_char_t *) buffer);
-         if (rc == CACHE_SUCCESS) {
-            if (netbuf_used < CACHE_MAXSTRLEN) { /* v2.2.18 */
-               rc = pcon->p_isc_so->p_CachePushStr((int) netbuf_used, (Callin_char_t *) netbuf);
-            }
-            else {
-               cvalue.pstr = (void *) pcon->p_isc_so->p_CacheExStrNew((CACHE_EXSTRP) &(cvalue.zstr), netbuf_used + 1);
-               if (cvalue.pstr) {
-                  for (ne = 0; ne < netbuf_used; ne ++) {
-                     cvalue.zstr.str.ch[ne] = (char) netbuf[ne];
-                  }
-                  cvalue.zstr.str.ch[ne] = (char) 0;
-                  cvalue.zstr.len = netbuf_used;
-                  rc = pcon->p_isc_so->p_CachePushExStr((CACHE_EXSTRP) &(cvalue.zstr));
-               }
-               else {
-                  rc = CACHE_FAILURE;
-               }
-            }
-/*
-            {
-               char bufferx[1024];
-               sprintf(bufferx, "p_CachePush[Ex]Str: rc=%d; netbuf_used=%lu; cvalue.pstr=%p;", rc, netbuf_used, cvalue.pstr);
-               mg_log_event(pweb->plog, pweb, bufferx, "web_execute", 0);
-            }
-*/
-            if (rc == CACHE_SUCCESS) {
-               rc = pcon->p_isc_so->p_CachePushStr((int) strlen(params), (Callin_char_t *) params);
-               if (rc == CACHE_SUCCESS) {
-                  rc = pcon->p_isc_so->p_CacheExtFun(fun.rflag, 3);
-               }
-            }
-            if (cvalue.pstr) {
-               pcon->p_isc_so->p_CacheExStrKill(&(cvalue.zstr));
-            }
-         }
+      pthread_mutex_lock(&(prelay->lock));
+      pslot = &(prelay->slots[slot_no]);
+      if (rc == 1) {
+         ev.events = EPOLLIN | EPOLLONESHOT;
+         ev.data.u64 = (((uint64_t) pslot->gen) << 32) | (((uint64_t) slot_no) << 1);
+         epoll_ctl(prelay->epfd, EPOLL_CTL_MOD, (int) pslot->pweb->pcon->cli_socket, &ev);
       }
-/*
-      {
-         char bufferx[1024];
-         sprintf(bufferx, "p_CacheExtFun: rc=%d; cvalue.pstr=%p;", rc, cvalue.pstr);
-         mg_log_event(pweb->plog, pweb, bufferx, "web_execute", 0);
+      if (pslot->client_gone) {
+         pslot->client_gone = 0;
+         event = 1;
       }
-*/
-      if (rc == CACHE_SUCCESS) {
-         isc_pop_value(pcon, &(pweb->output_val), DBX_DTYPE_STR);
-/*
-         {
-            char bufferx[1024];
-            sprintf(bufferx, "isc_pop_value: len_used=%d; api_size=%d; len_alloc=%d", pweb->output_val.svalue.len_used, pweb->output_val.api_size, pweb->output_val.svalue.len_alloc);
-            mg_log_event(pweb->plog, pweb, bufferx, "web_execute", 0);
-            mg_log_buffer(pweb->plog, pweb, (char *) pweb->output_val.svalue.buf_addr, pweb->output_val.svalue.len_used, "web_execute", 0);
-         }
-*/
-         pweb->response_size = (pweb->output_val.api_size - 5);
-         if (pweb->response_size > (unsigned int) (pweb->output_val.svalue.len_alloc - DBX_HEADER_SIZE)) {
-            get = (pweb->output_val.svalue.len_alloc - DBX_HEADER_SIZE);
-            memcpy((void *) pweb->output_val.svalue.buf_addr, (void *) pweb->output_val.num.str, get);
-            pweb->output_val.svalue.len_used = get;
-            pweb->response_remaining = (pweb->response_size - (get - 5));
-         }
-         else {
-            memcpy((void *) pweb->output_val.svalue.buf_addr, (void *) pweb->output_val.num.str, pweb->output_val.api_size);
-            pweb->output_val.svalue.len_used = pweb->output_val.api_size;
-            pweb->response_remaining = 0;
-         }
+      else if (pslot->db_ready) {
+         pslot->db_ready = 0;
+         event = 0;
       }
       else {
-         mg_error_message(pweb, rc);
+         pslot->busy = 0;
+         pthread_mutex_unlock(&(prelay->lock));
+         break;
       }
-      DBX_UNLOCK();
+      pthread_mutex_unlock(&(prelay->lock));
    }
-/*
+
+   return CACHE_SUCCESS;
+}
+
+
+/* CMT78 the stream has finished: close the DB Server connection and pass the request back to the web server module */
+int mg_sse_relay_finish(MGSSERELAY *prelay, int slot_no)
 {
-   char buffer[1024];
-   sprintf_s(buffer, 1000, "mg_web_execute: rc=%d; len_used=%d;", rc,  pweb->output_val.svalue.len_used);
-   mg_log_buffer(pweb->plog, pweb, pweb->output_val.svalue.buf_addr, pweb->output_val.svalue.len_used, buffer, 0);
+   MGWEB *pweb;
+   MGSSESLOT *pslot;
+
+   pthread_mutex_lock(&(prelay->lock));
+   pslot = &(prelay->slots[slot_no]);
+   pweb = pslot->pweb;
+   epoll_ctl(prelay->epfd, EPOLL_CTL_DEL, (int) pweb->pcon->cli_socket, NULL);
+   if (pweb->sse_client_fd >= 0) {
+      epoll_ctl(prelay->epfd, EPOLL_CTL_DEL, pweb->sse_client_fd, NULL);
+   }
+   pslot->pweb = NULL;
+   pslot->busy = 0;
+   pslot->state = 0;
+   pslot->client_gone = 0;
+   pslot->db_ready = 0;
+   pslot->next_free = prelay->free_slot;
+   prelay->free_slot = slot_no;
+   mg_system.sse_relay_streams --;
+   pthread_mutex_unlock(&(prelay->lock));
+
+   mg_release_connection(pweb, 1);
+   pweb->sse_complete(pweb);
+
+   return CACHE_SUCCESS;
 }
-*/
 
-   DBX_TRACE(50)
 
-   if (rc != CACHE_SUCCESS) {
-      if (rc == NETX_READ_TIMEOUT) { /* v2.7.33 */
-         if (!pweb->error[0]) {
-            strcpy(pweb->error, "TCP Request Timeout");
+/* CMT78 SSE relay thread: each socket is armed for one event at a time and a stream is served by one thread at a time */
+DBX_THR_TYPE mg_sse_relay(void *arg)
+{
+   int n, i, slot_no, side, scan_no;
+   int scan[MG_SSE_RELAY_SCAN];
+   unsigned int gen;
+   time_t now;
+   struct epoll_event events[MG_WS_RELAY_EVENTS];
+   MGSSESLOT *pslot;
+   MGSSERELAY *prelay;
+
+   prelay = (MGSSERELAY *) arg;
+
+   while (prelay->status == 1) {
+      n = epoll_wait(prelay->epfd, events, MG_WS_RELAY_EVENTS, 1000);
+
+      for (i = 0; i < n && prelay->status == 1; i ++) {
+         if (events[i].data.u64 == MG_WS_RELAY_WAKE) {
+            continue;
+         }
+         slot_no = (int) ((events[i].data.u64 & 0xffffffff) >> 1);
+         side = (int) (events[i].data.u64 & 1);
+         gen = (unsigned int) (events[i].data.u64 >> 32);
+
+         pthread_mutex_lock(&(prelay->lock));
+         if (slot_no >= prelay->slot_max || prelay->slots[slot_no].gen != gen || !prelay->slots[slot_no].pweb) {
+            pthread_mutex_unlock(&(prelay->lock));
+            continue;
+         }
+         pslot = &(prelay->slots[slot_no]);
+         if (pslot->busy) {
+            if (side)
+               pslot->client_gone = 1;
+            else
+               pslot->db_ready = 1;
+            pthread_mutex_unlock(&(prelay->lock));
+            continue;
          }
+         pslot->busy = 1;
+         pthread_mutex_unlock(&(prelay->lock));
+
+         mg_sse_relay_dispatch(prelay, slot_no, side);
       }
-      else {
-         rc = CACHE_NOCON;
-         if (!pweb->error[0]) {
-            strcpy(pweb->error, "Database connectivity error");
+
+      /* heartbeats and close timeouts: the first thread to notice that a second has passed scans the streams */
+      now = time(NULL);
+      scan_no = 0;
+      pthread_mutex_lock(&(prelay->lock));
+      if (prelay->status == 1 && now >= prelay->next_scan) {
+         prelay->next_scan = now + 1;
+         for (slot_no = 0; slot_no < prelay->slot_max && scan_no < MG_SSE_RELAY_SCAN; slot_no ++) {
+            pslot = &(prelay->slots[slot_no]);
+            if (!pslot->pweb || pslot->busy) {
+               continue;
+            }
+            if ((pslot->state == MG_SSE_STREAMING && mg_system.sse_heartbeat > 0 && (now - pslot->last_write) >= mg_system.sse_heartbeat) || (pslot->state == MG_SSE_CLOSING && now >= pslot->deadline)) {
+               pslot->busy = 1;
+               scan[scan_no ++] = slot_no;
+            }
          }
       }
-      goto mg_web_execute_exit;
-   }
+      pthread_mutex_unlock(&(prelay->lock));
 
-   DBX_TRACE(51)
+      for (i = 0; i < scan_no; i ++) {
+         mg_sse_relay_dispatch(prelay, scan[i], 2);
+      }
+   }
 
-   len = mg_get_block_size((unsigned char *) pweb->output_val.svalue.buf_addr, 0, &(pweb->output_val.sort), &(pweb->output_val.type));
+   return DBX_THR_RETURN;
+}
 
-   if (!pcon->psrv->net_connection) { /* v2.8.42 */
-      MG_LOG_RESPONSE_FRAME(pweb, pweb->output_val.svalue.buf_addr, len);
-      MG_LOG_RESPONSE_BUFFER(pweb, pweb->output_val.svalue.buf_addr, pweb->output_val.svalue.buf_addr, pweb->output_val.svalue.len_used);
-   }
-/*
-   if (mg_system.log.log_transmissions) {
-      mg_log_buffer(pweb->plog, pweb, pweb->output_val.svalue.buf_addr, pweb->output_val.svalue.len_used, "mg_web: response buffer", 0);
-   }
-*/
+#endif
 
-   DBX_TRACE(52)
 
-   if (pweb->output_val.sort == DBX_DSORT_EOD || pweb->output_val.sort == DBX_DSORT_ERROR) {
-      DBX_TRACE(53)
-      rc = CACHE_FAILURE;
-      strncpy(pweb->error, pweb->output_val.svalue.buf_addr + offset, len);
-      pweb->error[len] = '\0';
-      goto mg_web_execute_exit;
-   }
-
-   DBX_TRACE(60)
-
-mg_web_execute_exit:
-
-   return rc;
-
-#ifdef _WIN32
-}
-__except (EXCEPTION_EXECUTE_HANDLER) {
-
-   DWORD code;
-   char bufferx[256];
-
-   __try {
-      code = GetExceptionCode();
-      sprintf_s(bufferx, 255, "Exception caught in f:mg_web_execute: %x:%d", code, DBX_TRACE_VAR);
-      mg_log_event(pweb->plog, pweb, bufferx, "Error Condition", 0);
-   }
-   __except (EXCEPTION_EXECUTE_HANDLER) {
-      ;
-   }
-
-   return CACHE_FAILURE;
-}
-#endif
-}
-
-
-int mg_execute_request_long(MGWEB *pweb, int (*p_write_chunk) (MGWEB *, unsigned char *, unsigned int, int))
+int mg_parse_headers(MGWEB *pweb)
 {
    DBX_TRACE_INIT(0)
-   int rc, blen, bsize, ptr, tail_ptr, tail_len, chunk_no;
-   unsigned int netbuf_used;
-   unsigned char *netbuf;
+   int len;
+   char *pn, *ps, *pv, *pz, *pe;
+   char head[64];
 
 #ifdef _WIN32
 __try {
 #endif
 
-   blen = (int) strlen(pweb->boundary);
-   pweb->failover_possible = 0; /* can't failover after this point */
-   netbuf = (unsigned char *) (pweb->request_content - 5);
-   chunk_no = 0;
-   DBX_TRACE(1)
-   while (1) {
-      netbuf_used = pweb->request_csize + 5;
-      tail_ptr = 0;
-      tail_len = 0;
-      if (blen && blen > pweb->request_csize) {
-         for (ptr = (pweb->request_csize - blen) + 1; ptr < pweb->request_csize; ptr ++) {
-            if (!strncmp(pweb->request_content + ptr, pweb->boundary, pweb->request_csize - ptr)) {
-               if (pweb->request_content[ptr - 1] == '-' && pweb->request_content[ptr - 2] == '-') {
-                  tail_ptr = ptr;
-                  tail_len = pweb->request_csize - tail_ptr;
-                  netbuf_used -= tail_len;
-                  mg_add_block_size((unsigned char *) netbuf, (unsigned long) 0, (unsigned long) (pweb->request_csize - tail_len), DBX_DSORT_WEBCONTENT, DBX_DTYPE_STR);
-               }
-            }
-         }
+   pweb->response_clen_server = -1;
+   pweb->response_content_type = NULL; /* v2.7.33 */
+   pweb->response_cache_control = NULL;
+   pweb->response_connection = NULL;
+
+   pn = pweb->response_headers;
+   pe = pn ? (pn + strlen(pn)) : NULL;
+   while (pn && *pn) {
+      pz = mg_scan_find(pn, (int) (pe - pn), "\r\n", 2); /* CMT69 */
+      if (pz) {
+         *pz = '\0';
       }
-      chunk_no ++;
+      ps = strstr(pn, ":");
+      if (ps) {
+         *ps = '\0';
+         pv = ps;
+         len = (int) (pv - pn);
+         if (len > 0 && len < 60) {
+            while (*(++ pv) == ' ')
+               ;
 /*
-      {
-         char bufferx[1024];
-         sprintf(bufferx, "HTTP Long Request 2: chunk_no=%d; pweb->request_content=%p; pweb->input_buf.len_used=%d; pweb->request_clen=%d; pweb->request_clen_remaining=%d; clen_to_send (+5)=%d; tail_ptr=%d; tail_len=%d;", chunk_no, pweb->request_content, pweb->input_buf.len_used, pweb->request_clen, pweb->request_clen_remaining, netbuf_used, tail_ptr, tail_len);
-         mg_log_buffer(pweb->plog, pweb, netbuf, 30, bufferx, 0);
-         mg_log_event(pweb->plog, pweb, bufferx, "HTTP Long Request 2", 0);
-      }
+            {
+               char bufferx[256];
+               sprintf(bufferx, "Response Header: len=%d; name=%s", len, pn);
+               mg_log_event(pweb->plog, pweb, pv, bufferx, 0);
+            }
 */
-      DBX_TRACE(2)
-      rc = p_write_chunk(pweb, (unsigned char *) netbuf, netbuf_used, chunk_no);
-      if (rc < 0) {
-         break;
-      }
-
-      if (pweb->request_chunked) { /* v2.8.37 */
-         if (pweb->request_read_status == 1) {
-            /* mg_log_event(pweb->plog, pweb, "******* End of Chunked Request Data *******", "HTTP Long Request", 0); */
-            rc = CACHE_SUCCESS;
-            break;
-         }
-
-         DBX_TRACE(3)
-         bsize = pweb->request_bsize;
-         if (tail_ptr) {
-            bsize -= tail_len;
-            mg_memcpy((void *) pweb->request_content, (void *) (pweb->request_content + tail_ptr), (size_t) tail_len);
-         }
-
-         pweb->request_csize = bsize;
-
-         DBX_TRACE(4)
-         pweb->request_csize = mg_client_read(pweb, (unsigned char *) (pweb->request_content + tail_len), pweb->request_csize);
-/*
-         {
-            char bufferx[1024];
-            sprintf(bufferx, "HTTP Chunked Request: len=%d; buffer_size=%d; request_read_status=%d;", pweb->request_csize, bsize, pweb->request_read_status);
-            mg_log_event(pweb->plog, pweb, bufferx, (char*)"mg_client_read 1", 0);
+            strcpy(head, pn);
+            mg_lcase(head);
+            if (strstr(head, "content-length")) {
+               pweb->response_clen_server = (int) strtol(pv, NULL, 10);
+            }
+            else if (strstr(head, "content-type")) { /* v2.7.33 */
+               pweb->response_content_type = pn;
+            }
+            else if (strstr(head, "cache-control")) {
+               pweb->response_cache_control = pn;
+            }
+            else if (strstr(head, "connection")) { /* v2.8.38 */
+               pweb->response_connection = pn;
+            }
          }
-*/
-         mg_add_block_size((unsigned char *) netbuf, 0, (pweb->request_csize + tail_len), DBX_DSORT_WEBCONTENT, DBX_DTYPE_STR);
+         *ps = ':';
+      }
+      if (pz) {
+         *pz = '\r';
+         pn = (pz + 2);
       }
       else {
-         if (pweb->request_clen_remaining == 0) {
-            rc = CACHE_SUCCESS;
-            break;
-         }
-
-         DBX_TRACE(3)
-         bsize = pweb->request_bsize;
-         if (tail_ptr) {
-            bsize -= tail_len;
-            mg_memcpy((void *) pweb->request_content, (void *) (pweb->request_content + tail_ptr), (size_t) tail_len);
-         }
-
-         pweb->request_csize = pweb->request_clen_remaining;
-         if (pweb->request_csize > bsize) {
-            pweb->request_csize = bsize;
-         }
-
-         DBX_TRACE(4)
-         mg_client_read(pweb, (unsigned char *) (pweb->request_content + tail_len), pweb->request_csize);
-         mg_add_block_size((unsigned char *) netbuf, 0, (pweb->request_csize + tail_len), DBX_DSORT_WEBCONTENT, DBX_DTYPE_STR);
-         pweb->request_clen_remaining -= pweb->request_csize;
+         pn = NULL;
       }
    }
+/*
+   {
+      char bufferx[256];
+      sprintf(bufferx, "Response Header: clen=%d;", pweb->response_clen_server);
+      mg_log_event(pweb->plog, pweb, bufferx, "Content Length from Server", 0);
+   }
+*/
 
-   return rc;
+   return CACHE_SUCCESS;
 
 #ifdef _WIN32
 }
@@ -1904,7 +2185,7 @@ __except (EXCEPTION_EXECUTE_HANDLER) {
 
    __try {
       code = GetExceptionCode();
-      sprintf_s(bufferx, 255, "Exception caught in f:mg_web_execute_request_long: %x:%d", code, DBX_TRACE_VAR);
+      sprintf_s(bufferx, 255, "Exception caught in f:mg_parse_headers: %x:%d", code, DBX_TRACE_VAR);
       mg_log_event(pweb->plog, pweb, bufferx, "Error Condition", 0);
    }
    __except (EXCEPTION_EXECUTE_HANDLER) {
@@ -1917,262 +2198,2947 @@ __except (EXCEPTION_EXECUTE_HANDLER) {
 }
 
 
-int mg_write_chunk_tcp(MGWEB *pweb, unsigned char *netbuf, unsigned int netbuf_used, int chunk_no)
-{
-   int rc;
-
-   rc = netx_tcp_write(pweb, (unsigned char *) netbuf, (int) netbuf_used);
-   return rc;
-}
-
-
-int mg_write_chunk_isc(MGWEB *pweb, unsigned char *netbuf, unsigned int netbuf_used, int chunk_no)
+int mg_web_execute(MGWEB *pweb)
 {
-#if 1
-
-   int rc, option;
-   char label[32], routine[32];
+   DBX_TRACE_INIT(0)
+   int rc, len, get;
+   unsigned long offset, netbuf_used;
+   unsigned char *netbuf;
+   char label[16], routine[16], params[9], buffer[8];
    DBXFUN fun;
-   unsigned long ne;
-   DBXCVAL cvalue;
    DBXCON *pcon;
 
-   pcon = pweb->pcon;
-/*
-   {
-      char bufferx[1024];
-      sprintf(bufferx, "mg_write_chunk_isc: chunk_no=%d; key=%s", chunk_no, pweb->key);
-      mg_log_buffer(pweb->plog, pweb, netbuf, 32, "mg_write_chunk_isc", 0);
-   }
-*/
+#ifdef _WIN32
+__try {
+#endif
 
-   /* dbxwebsn(key,cn,data,option) */
+   pcon = pweb->pcon;
    rc = CACHE_SUCCESS;
-   option = 0;
-   strcpy(label, "dbxwebsn");
+   offset = 5;
+
+   mg_add_block_size((unsigned char *) pweb->input_buf.buf_addr, pweb->input_buf.len_used, 0,  DBX_DSORT_EOD, DBX_DTYPE_STR8);
+   pweb->input_buf.len_used += 5;
+
+   netbuf = (unsigned char *) (pweb->input_buf.buf_addr - DBX_IBUFFER_OFFSET);
+   netbuf_used = (pweb->input_buf.len_used + DBX_IBUFFER_OFFSET);
+   mg_add_block_size((unsigned char *) netbuf, 0, netbuf_used,  0, DBX_CMND_FUNCTION);
+   memset(netbuf + 5, 0, DBX_IBUFFER_OFFSET - 5); /* v2.3.22 */
+
+   strcpy(params, "dbx");
+   strcpy(label, "ifc");
 
    strcpy(routine, "%zmgsis");
    fun.label = label;
    fun.label_len = (int) strlen(label);
    fun.routine = routine;
    fun.routine_len = (int) strlen(routine);
+   pweb->output_val.num.str = (char *) 0;
+
+   DBX_TRACE(1)
+   MG_LOG_REQUEST_FRAME(pweb, netbuf, netbuf_used);
+   MG_LOG_REQUEST_BUFFER(pweb, netbuf, netbuf_used);
 
-   rc = pcon->p_isc_so->p_CachePushFunc(&(fun.rflag), (int) fun.label_len, (const Callin_char_t *) fun.label, (int) fun.routine_len, (const Callin_char_t *) fun.routine);
-   if (rc == CACHE_SUCCESS) {
-      rc = pcon->p_isc_so->p_CachePushStr((int) strlen(pweb->key), (Callin_char_t *) pweb->key);
-      if (rc == CACHE_SUCCESS) {
-         rc = pcon->p_isc_so->p_CachePushInt((int) chunk_no);
-         if (rc == CACHE_SUCCESS) {
-            cvalue.pstr = (void *) pcon->p_isc_so->p_CacheExStrNew((CACHE_EXSTRP) &(cvalue.zstr), (netbuf_used - 5) + 1);
-            if (cvalue.pstr) {
-               for (ne = 5; ne < netbuf_used; ne ++) {
-                  cvalue.zstr.str.ch[ne - 5] = (char) netbuf[ne];
-               }
-               cvalue.zstr.str.ch[ne - 5] = (char) 0;
-               cvalue.zstr.len = (netbuf_used - 5);
-               rc = pcon->p_isc_so->p_CachePushExStr((CACHE_EXSTRP) &(cvalue.zstr));
-               if (rc == CACHE_SUCCESS) {
-                  rc = pcon->p_isc_so->p_CachePushInt((int) option);
-                  if (rc == CACHE_SUCCESS) {
-                     rc = pcon->p_isc_so->p_CacheExtFun(fun.rflag, 4);
 /*
-                     {
-                        char bufferx[1024];
-                        sprintf(bufferx, "mg_write_chunk_isc: p_CacheExtFun=%d; chunk_no=%d; key=%s", rc, chunk_no, pweb->key);
-                        mg_log_event(pweb->plog, pweb, bufferx, "mg_write_chunk_isc", 0);
-                     }
+   if (mg_system.log.log_transmissions) {
+      mg_log_buffer(pweb->plog, pweb, pweb->input_buf.buf_addr, pweb->input_buf.len_used, "mg_web: request buffer", 0);
+   }
 */
-                     if (rc == CACHE_SUCCESS) {
-                        rc = pcon->p_isc_so->p_CachePopInt(&option);
-                     }
+   /* v2.1.10 */
+
+   if (pcon->psrv->net_connection) { /* v2.8.42 */
+      DBX_TRACE(10)
+      memcpy((void *) pweb->mode, (void *) "tcp", (size_t) 3);
+      rc = netx_tcp_command(pweb, DBX_CMND_FUNCTION, 0);
+
+/* v2.7.33 */
+/*
+      {
+         char bufferx[64];
+         sprintf(bufferx, "netx_tcp_command: rc=%d;", rc);
+         mg_log_event(pweb->plog, pweb, bufferx, "Trace", 0);
+      }
+*/
+
+   }
+   else if (pcon->psrv->dbtype == DBX_DBTYPE_YOTTADB) {
+
+      ydb_string_t out, in1, in2, in3;
+#if !defined(_WIN32)
+      uid_t uid;
+      gid_t gid;
+      struct passwd *pwd;
+      struct group *grp;
+#endif
+
+      DBX_TRACE(20)
+      memcpy((void *) pweb->mode, (void *) "api", (size_t) 3);
+      pweb->failover_possible = 0;
+      strcat(fun.label, "_zmgsis");
+      fun.label_len = (int) strlen(label);
+
+      strcpy(buffer, "");
+
+      out.address = (char *) pweb->output_val.svalue.buf_addr;
+      out.length = (unsigned long) pweb->output_val.svalue.len_alloc;
+      in1.address = (char *) buffer;
+      in1.length = (unsigned long) strlen(buffer);
+      in2.address = (char *) netbuf;
+      in2.length = (unsigned long) netbuf_used;
+      in3.address = (char *) params;
+      in3.length = (unsigned long) strlen(params);
+
+      DBX_LOCK(0);
+
+      if (pweb->request_long) { /* v2.2.18 */
+         rc = mg_execute_request_long(pweb, mg_write_chunk_ydb);
+      }
+
+      rc = pcon->p_ydb_so->p_ydb_ci(fun.label, &out, &in1, &in2, &in3);
+
+/*
+{
+   char bufferx[1024];
+   sprintf(bufferx, "mg_web_execute (YottaDB:ydb_string_t): rc=%d; len_used=%d; len_alloc=%d; out.length=%d;", rc,  pweb->output_val.svalue.len_used, pweb->output_val.svalue.len_alloc, (int) out.length);
+   mg_log_event(pweb->plog, pweb, bufferx, "mg_web_execute: YottaDB API", 0);
+}
+*/
+
+/*
+{
+   char bufferx[1024];
+   sprintf(bufferx, "mg_web_execute (YottaDB:ydb_buffer_t): rc=%d; len_used=%d; len_alloc=%d; out.len_used=%d;", rc,  (int) pweb->output_val.svalue.len_used, (int) pweb->output_val.svalue.len_alloc, (int) out.len_used);
+   mg_log_event(pweb->plog, pweb, bufferx, "mg_web_execute: YottaDB API", 0);
+}
+*/
+
+      if (rc == YDB_OK) {
+/*
+         pweb->output_val.svalue.len_used = (unsigned int) mg_get_size((unsigned char *) pweb->output_val.svalue.buf_addr);
+         pweb->response_size = (pweb->output_val.svalue.len_used - 5);
+*/
+
+         pweb->output_val.api_size = (unsigned int) out.length;
+/*
+         pweb->output_val.api_size = (unsigned int) out.len_used;
+*/
+
+         pweb->output_val.svalue.len_used = pweb->output_val.api_size;
+         pweb->response_size = (pweb->output_val.api_size - 5);
+         pweb->response_remaining = 0;
+      }
+      else if (pcon->p_ydb_so->p_ydb_zstatus) { /* v2.7.35 */
+         char buffer[1024], uuser[32], ugroup[32];
+
+         *uuser = '\0';
+         *ugroup = '\0';
+#if defined(_WIN32)
+         strcpy(buffer, "mg_web_execute: YottaDB API error text");
+#else
+         uid = getuid();
+         gid = getgid();
+         if ((pwd = getpwuid(uid)) != NULL) {
+            strncpy(uuser, pwd->pw_name, 30);
+            uuser[30] = '\0';
+         }
+         if ((grp = getgrgid(gid)) != NULL) {
+            strncpy(ugroup, grp->gr_name, 30);
+            ugroup[30] = '\0';
+         }
+         sprintf(buffer, "mg_web_execute: YottaDB API error text: process user=%s; group=%s;", uuser, ugroup);
+#endif
+
+         pcon->p_ydb_so->p_ydb_zstatus((ydb_char_t *) pweb->error, (ydb_long_t) DBX_ERROR_SIZE - 1); /* v2.7.35 */
+         mg_log_event(pweb->plog, pweb, pweb->error, buffer, 0);
+      }
+
+      DBX_UNLOCK();
+   }
+   else {
+      unsigned long ne;
+      DBXCVAL cvalue;
+
+      DBX_TRACE(30)
+      memcpy((void *) pweb->mode, (void *) "api", (size_t) 3);
+      pweb->failover_possible = 0;
+      strcpy(buffer, "");
+      cvalue.pstr = NULL;
+
+      DBX_LOCK(0);
+
+      if (pweb->request_long) { /* v2.2.18 */
+         rc = mg_execute_request_long(pweb, mg_write_chunk_isc);
+      }
+
+      rc = pcon->p_isc_so->p_CachePushFunc(&(fun.rflag), (int) fun.label_len, (const Callin_char_t *) fun.label, (int) fun.routine_len, (const Callin_char_t *) fun.routine);
+      if (rc == CACHE_SUCCESS) {
+         rc = pcon->p_isc_so->p_CachePushStr((int) strlen(buffer), (Callin_char_t *) buffer);
+         if (rc == CACHE_SUCCESS) {
+            if (netbuf_used < CACHE_MAXSTRLEN) { /* v2.2.18 */
+               rc = pcon->p_isc_so->p_CachePushStr((int) netbuf_used, (Callin_char_t *) netbuf);
+            }
+            else {
+               cvalue.pstr = (void *) pcon->p_isc_so->p_CacheExStrNew((CACHE_EXSTRP) &(cvalue.zstr), netbuf_used + 1);
+               if (cvalue.pstr) {
+                  for (ne = 0; ne < netbuf_used; ne ++) {
+                     cvalue.zstr.str.ch[ne] = (char) netbuf[ne];
                   }
+                  cvalue.zstr.str.ch[ne] = (char) 0;
+                  cvalue.zstr.len = netbuf_used;
+                  rc = pcon->p_isc_so->p_CachePushExStr((CACHE_EXSTRP) &(cvalue.zstr));
+               }
+               else {
+                  rc = CACHE_FAILURE;
+               }
+            }
+/*
+            {
+               char bufferx[1024];
+               sprintf(bufferx, "p_CachePush[Ex]Str: rc=%d; netbuf_used=%lu; cvalue.pstr=%p;", rc, netbuf_used, cvalue.pstr);
+               mg_log_event(pweb->plog, pweb, bufferx, "web_execute", 0);
+            }
+*/
+            if (rc == CACHE_SUCCESS) {
+               rc = pcon->p_isc_so->p_CachePushStr((int) strlen(params), (Callin_char_t *) params);
+               if (rc == CACHE_SUCCESS) {
+                  rc = pcon->p_isc_so->p_CacheExtFun(fun.rflag, 3);
                }
             }
+            if (cvalue.pstr) {
+               pcon->p_isc_so->p_CacheExStrKill(&(cvalue.zstr));
+            }
+         }
+      }
+/*
+      {
+         char bufferx[1024];
+         sprintf(bufferx, "p_CacheExtFun: rc=%d; cvalue.pstr=%p;", rc, cvalue.pstr);
+         mg_log_event(pweb->plog, pweb, bufferx, "web_execute", 0);
+      }
+*/
+      if (rc == CACHE_SUCCESS) {
+         isc_pop_value(pcon, &(pweb->output_val), DBX_DTYPE_STR);
+/*
+         {
+            char bufferx[1024];
+            sprintf(bufferx, "isc_pop_value: len_used=%d; api_size=%d; len_alloc=%d", pweb->output_val.svalue.len_used, pweb->output_val.api_size, pweb->output_val.svalue.len_alloc);
+            mg_log_event(pweb->plog, pweb, bufferx, "web_execute", 0);
+            mg_log_buffer(pweb->plog, pweb, (char *) pweb->output_val.svalue.buf_addr, pweb->output_val.svalue.len_used, "web_execute", 0);
+         }
+*/
+         pweb->response_size = (pweb->output_val.api_size - 5);
+         if (pweb->response_size > (unsigned int) (pweb->output_val.svalue.len_alloc - DBX_HEADER_SIZE)) {
+            get = (pweb->output_val.svalue.len_alloc - DBX_HEADER_SIZE);
+            memcpy((void *) pweb->output_val.svalue.buf_addr, (void *) pweb->output_val.num.str, get);
+            pweb->output_val.svalue.len_used = get;
+            pweb->response_remaining = (pweb->response_size - (get - 5));
+         }
+         else {
+            memcpy((void *) pweb->output_val.svalue.buf_addr, (void *) pweb->output_val.num.str, pweb->output_val.api_size);
+            pweb->output_val.svalue.len_used = pweb->output_val.api_size;
+            pweb->response_remaining = 0;
+         }
+      }
+      else {
+         mg_error_message(pweb, rc);
+      }
+      DBX_UNLOCK();
+   }
+/*
+{
+   char buffer[1024];
+   sprintf_s(buffer, 1000, "mg_web_execute: rc=%d; len_used=%d;", rc,  pweb->output_val.svalue.len_used);
+   mg_log_buffer(pweb->plog, pweb, pweb->output_val.svalue.buf_addr, pweb->output_val.svalue.len_used, buffer, 0);
+}
+*/
+
+   DBX_TRACE(50)
+
+   if (rc != CACHE_SUCCESS) {
+      if (rc == NETX_READ_TIMEOUT) { /* v2.7.33 */
+         if (!pweb->error[0]) {
+            strcpy(pweb->error, "TCP Request Timeout");
+         }
+      }
+      else {
+         rc = CACHE_NOCON;
+         if (!pweb->error[0]) {
+            strcpy(pweb->error, "Database connectivity error");
          }
       }
+      goto mg_web_execute_exit;
+   }
+
+   DBX_TRACE(51)
+
+   len = mg_get_block_size((unsigned char *) pweb->output_val.svalue.buf_addr, 0, &(pweb->output_val.sort), &(pweb->output_val.type));
+
+   if (!pcon->psrv->net_connection) { /* v2.8.42 */
+      MG_LOG_RESPONSE_FRAME(pweb, pweb->output_val.svalue.buf_addr, len);
+      MG_LOG_RESPONSE_BUFFER(pweb, pweb->output_val.svalue.buf_addr, pweb->output_val.svalue.buf_addr, pweb->output_val.svalue.len_used);
+   }
+/*
+   if (mg_system.log.log_transmissions) {
+      mg_log_buffer(pweb->plog, pweb, pweb->output_val.svalue.buf_addr, pweb->output_val.svalue.len_used, "mg_web: response buffer", 0);
+   }
+*/
+
+   DBX_TRACE(52)
+
+   if (pweb->output_val.sort == DBX_DSORT_EOD || pweb->output_val.sort == DBX_DSORT_ERROR) {
+      DBX_TRACE(53)
+      rc = CACHE_FAILURE;
+      strncpy(pweb->error, pweb->output_val.svalue.buf_addr + offset, len);
+      pweb->error[len] = '\0';
+      goto mg_web_execute_exit;
+   }
+
+   DBX_TRACE(60)
+
+mg_web_execute_exit:
+
+   return rc;
+
+#ifdef _WIN32
+}
+__except (EXCEPTION_EXECUTE_HANDLER) {
+
+   DWORD code;
+   char bufferx[256];
+
+   __try {
+      code = GetExceptionCode();
+      sprintf_s(bufferx, 255, "Exception caught in f:mg_web_execute: %x:%d", code, DBX_TRACE_VAR);
+      mg_log_event(pweb->plog, pweb, bufferx, "Error Condition", 0);
+   }
+   __except (EXCEPTION_EXECUTE_HANDLER) {
+      ;
+   }
+
+   return CACHE_FAILURE;
+}
+#endif
+}
+
+
+int mg_execute_request_long(MGWEB *pweb, int (*p_write_chunk) (MGWEB *, unsigned char *, unsigned int, int))
+{
+   DBX_TRACE_INIT(0)
+   int rc, blen, bsize, ptr, tail_ptr, tail_len, chunk_no;
+   char *pb;
+   unsigned int netbuf_used;
+   unsigned char *netbuf;
+
+#ifdef _WIN32
+__try {
+#endif
+
+   blen = (int) strlen(pweb->boundary);
+   pweb->failover_possible = 0; /* can't failover after this point */
+   netbuf = (unsigned char *) (pweb->request_content - 5);
+   chunk_no = 0;
+   DBX_TRACE(1)
+   while (1) {
+      netbuf_used = pweb->request_csize + 5;
+      tail_ptr = 0;
+      tail_len = 0;
+      if (blen && blen > pweb->request_csize) {
+         for (ptr = (pweb->request_csize - blen) + 1; ptr < pweb->request_csize; ptr ++) {
+            /* CMT69 jump to the next candidate for the start of the boundary */
+            pb = mg_scan_find(pweb->request_content + ptr, pweb->request_csize - ptr, pweb->boundary, 1);
+            if (!pb) {
+               break;
+            }
+            ptr = (int) (pb - pweb->request_content);
+            if (!strncmp(pweb->request_content + ptr, pweb->boundary, pweb->request_csize - ptr)) {
+               if (pweb->request_content[ptr - 1] == '-' && pweb->request_content[ptr - 2] == '-') {
+                  tail_ptr = ptr;
+                  tail_len = pweb->request_csize - tail_ptr;
+                  netbuf_used -= tail_len;
+                  mg_add_block_size((unsigned char *) netbuf, (unsigned long) 0, (unsigned long) (pweb->request_csize - tail_len), DBX_DSORT_WEBCONTENT, DBX_DTYPE_STR);
+               }
+            }
+         }
+      }
+      chunk_no ++;
+/*
+      {
+         char bufferx[1024];
+         sprintf(bufferx, "HTTP Long Request 2: chunk_no=%d; pweb->request_content=%p; pweb->input_buf.len_used=%d; pweb->request_clen=%d; pweb->request_clen_remaining=%d; clen_to_send (+5)=%d; tail_ptr=%d; tail_len=%d;", chunk_no, pweb->request_content, pweb->input_buf.len_used, pweb->request_clen, pweb->request_clen_remaining, netbuf_used, tail_ptr, tail_len);
+         mg_log_buffer(pweb->plog, pweb, netbuf, 30, bufferx, 0);
+         mg_log_event(pweb->plog, pweb, bufferx, "HTTP Long Request 2", 0);
+      }
+*/
+      DBX_TRACE(2)
+      if (pweb->request_chunked) { /* CMT70 */
+         pweb->request_last_chunk = (pweb->request_read_status == 1) ? 1 : 0;
+      }
+      else {
+         pweb->request_last_chunk = (pweb->request_clen_remaining == 0) ? 1 : 0;
+      }
+      rc = p_write_chunk(pweb, (unsigned char *) netbuf, netbuf_used, chunk_no);
+      if (rc < 0) {
+         break;
+      }
+
+      if (pweb->request_chunked) { /* v2.8.37 */
+         if (pweb->request_read_status == 1) {
+            /* mg_log_event(pweb->plog, pweb, "******* End of Chunked Request Data *******", "HTTP Long Request", 0); */
+            rc = CACHE_SUCCESS;
+            break;
+         }
+
+         DBX_TRACE(3)
+         bsize = pweb->request_bsize;
+         if (tail_ptr) {
+            bsize -= tail_len;
+            mg_memcpy((void *) pweb->request_content, (void *) (pweb->request_content + tail_ptr), (size_t) tail_len);
+         }
+
+         pweb->request_csize = bsize;
+
+         DBX_TRACE(4)
+         pweb->request_csize = mg_client_read(pweb, (unsigned char *) (pweb->request_content + tail_len), pweb->request_csize);
+/*
+         {
+            char bufferx[1024];
+            sprintf(bufferx, "HTTP Chunked Request: len=%d; buffer_size=%d; request_read_status=%d;", pweb->request_csize, bsize, pweb->request_read_status);
+            mg_log_event(pweb->plog, pweb, bufferx, (char*)"mg_client_read 1", 0);
+         }
+*/
+         mg_add_block_size((unsigned char *) netbuf, 0, (pweb->request_csize + tail_len), DBX_DSORT_WEBCONTENT, DBX_DTYPE_STR);
+      }
+      else {
+         if (pweb->request_clen_remaining == 0) {
+            rc = CACHE_SUCCESS;
+            break;
+         }
+
+         DBX_TRACE(3)
+         bsize = pweb->request_bsize;
+         if (tail_ptr) {
+            bsize -= tail_len;
+            mg_memcpy((void *) pweb->request_content, (void *) (pweb->request_content + tail_ptr), (size_t) tail_len);
+         }
+
+         pweb->request_csize = pweb->request_clen_remaining;
+         if (pweb->request_csize > bsize) {
+            pweb->request_csize = bsize;
+         }
+
+         DBX_TRACE(4)
+         mg_client_read(pweb, (unsigned char *) (pweb->request_content + tail_len), pweb->request_csize);
+         mg_add_block_size((unsigned char *) netbuf, 0, (pweb->request_csize + tail_len), DBX_DSORT_WEBCONTENT, DBX_DTYPE_STR);
+         pweb->request_clen_remaining -= pweb->request_csize;
+      }
+   }
+
+   return rc;
+
+#ifdef _WIN32
+}
+__except (EXCEPTION_EXECUTE_HANDLER) {
+
+   DWORD code;
+   char bufferx[256];
+
+   __try {
+      code = GetExceptionCode();
+      sprintf_s(bufferx, 255, "Exception caught in f:mg_web_execute_request_long: %x:%d", code, DBX_TRACE_VAR);
+      mg_log_event(pweb->plog, pweb, bufferx, "Error Condition", 0);
+   }
+   __except (EXCEPTION_EXECUTE_HANDLER) {
+      ;
+   }
+
+   return CACHE_FAILURE;
+}
+#endif
+}
+
+
+int mg_write_chunk_tcp(MGWEB *pweb, unsigned char *netbuf, unsigned int netbuf_used, int chunk_no)
+{
+   int rc, iov_no;
+   unsigned char eod[8];
+   MGIOVEC iov[3];
+
+   /* CMT70 gather the request frame (first chunk), the content and the EOD marker (last chunk) into one write */
+   iov_no = 0;
+   if (pweb->request_frame) {
+      iov[iov_no].buf = pweb->request_frame;
+      iov[iov_no ++].len = pweb->request_frame_len;
+   }
+   iov[iov_no].buf = netbuf;
+   iov[iov_no ++].len = (int) netbuf_used;
+   if (pweb->request_last_chunk) {
+      mg_add_block_size((unsigned char *) eod, 0, 0, DBX_DSORT_EOD, DBX_DTYPE_STR8);
+      iov[iov_no].buf = eod;
+      iov[iov_no ++].len = 5;
+   }
+
+   if (pweb->request_frame) {
+      pweb->request_frame = NULL;
+      rc = netx_tcp_send_command(pweb, iov, iov_no, 0);
+   }
+   else {
+      rc = netx_tcp_writev(pweb, iov, iov_no);
+   }
+   if (rc >= 0 && pweb->request_last_chunk) {
+      pweb->request_eod_sent = 1;
+   }
+
+   return rc;
+}
+
+
+int mg_write_chunk_isc(MGWEB *pweb, unsigned char *netbuf, unsigned int netbuf_used, int chunk_no)
+{
+#if 1
+
+   int rc, option;
+   char label[32], routine[32];
+   DBXFUN fun;
+   unsigned long ne;
+   DBXCVAL cvalue;
+   DBXCON *pcon;
+
+   pcon = pweb->pcon;
+/*
+   {
+      char bufferx[1024];
+      sprintf(bufferx, "mg_write_chunk_isc: chunk_no=%d; key=%s", chunk_no, pweb->key);
+      mg_log_buffer(pweb->plog, pweb, netbuf, 32, "mg_write_chunk_isc", 0);
+   }
+*/
+
+   /* dbxwebsn(key,cn,data,option) */
+   rc = CACHE_SUCCESS;
+   option = 0;
+   strcpy(label, "dbxwebsn");
+
+   strcpy(routine, "%zmgsis");
+   fun.label = label;
+   fun.label_len = (int) strlen(label);
+   fun.routine = routine;
+   fun.routine_len = (int) strlen(routine);
+
+   rc = pcon->p_isc_so->p_CachePushFunc(&(fun.rflag), (int) fun.label_len, (const Callin_char_t *) fun.label, (int) fun.routine_len, (const Callin_char_t *) fun.routine);
+   if (rc == CACHE_SUCCESS) {
+      rc = pcon->p_isc_so->p_CachePushStr((int) strlen(pweb->key), (Callin_char_t *) pweb->key);
+      if (rc == CACHE_SUCCESS) {
+         rc = pcon->p_isc_so->p_CachePushInt((int) chunk_no);
+         if (rc == CACHE_SUCCESS) {
+            cvalue.pstr = (void *) pcon->p_isc_so->p_CacheExStrNew((CACHE_EXSTRP) &(cvalue.zstr), (netbuf_used - 5) + 1);
+            if (cvalue.pstr) {
+               for (ne = 5; ne < netbuf_used; ne ++) {
+                  cvalue.zstr.str.ch[ne - 5] = (char) netbuf[ne];
+               }
+               cvalue.zstr.str.ch[ne - 5] = (char) 0;
+               cvalue.zstr.len = (netbuf_used - 5);
+               rc = pcon->p_isc_so->p_CachePushExStr((CACHE_EXSTRP) &(cvalue.zstr));
+               if (rc == CACHE_SUCCESS) {
+                  rc = pcon->p_isc_so->p_CachePushInt((int) option);
+                  if (rc == CACHE_SUCCESS) {
+                     rc = pcon->p_isc_so->p_CacheExtFun(fun.rflag, 4);
+/*
+                     {
+                        char bufferx[1024];
+                        sprintf(bufferx, "mg_write_chunk_isc: p_CacheExtFun=%d; chunk_no=%d; key=%s", rc, chunk_no, pweb->key);
+                        mg_log_event(pweb->plog, pweb, bufferx, "mg_write_chunk_isc", 0);
+                     }
+*/
+                     if (rc == CACHE_SUCCESS) {
+                        rc = pcon->p_isc_so->p_CachePopInt(&option);
+                     }
+                  }
+               }
+            }
+         }
+      }
+   }
+   if (cvalue.pstr) {
+      pcon->p_isc_so->p_CacheExStrKill(&(cvalue.zstr));
+   }
+
+   return rc;
+
+#else
+
+   int rc;
+   char global[32];
+   unsigned long ne;
+   DBXCVAL cvalue;
+   DBXCON *pcon;
+
+   pcon = pweb->pcon;
+   strcpy(global, "mgweb");
+
+   if (chunk_no == 1) {
+      rc = pcon->p_isc_so->p_CachePushGlobal((int) strlen(global), (const Callin_char_t *) global);
+      if (rc == CACHE_SUCCESS) {
+         rc = pcon->p_isc_so->p_CachePushStr((int) strlen(pweb->key), (Callin_char_t *) pweb->key);
+         if (rc == CACHE_SUCCESS) {
+            rc = pcon->p_isc_so->p_CacheGlobalKill(1, 0);
+/*
+            {
+               char bufferx[1024];
+               sprintf(bufferx, "mg_write_chunk_isc: p_CacheGlobalKill=%d; chunk_no=%d; key=%s", rc, chunk_no, pweb->key);
+               mg_log_event(pweb->plog, pweb, bufferx, "mg_write_chunk_isc", 0);
+            }
+*/
+         }
+      }
+   }
+
+   rc = pcon->p_isc_so->p_CachePushGlobal((int) strlen(global), (const Callin_char_t *) global);
+   if (rc == CACHE_SUCCESS) {
+      rc = pcon->p_isc_so->p_CachePushStr((int) strlen(pweb->key), (Callin_char_t *) pweb->key);
+      if (rc == CACHE_SUCCESS) {
+         rc = pcon->p_isc_so->p_CachePushInt((int) chunk_no);
+         if (rc == CACHE_SUCCESS) {
+            cvalue.pstr = (void *) pcon->p_isc_so->p_CacheExStrNew((CACHE_EXSTRP) &(cvalue.zstr), netbuf_used + 1);
+            if (cvalue.pstr) {
+               for (ne = 0; ne < netbuf_used; ne ++) {
+                  cvalue.zstr.str.ch[ne] = (char) netbuf[ne];
+               }
+               cvalue.zstr.str.ch[ne] = (char) 0;
+               cvalue.zstr.len = netbuf_used;
+               rc = pcon->p_isc_so->p_CachePushExStr((CACHE_EXSTRP) &(cvalue.zstr));
+               if (rc == CACHE_SUCCESS) {
+                  rc = pcon->p_isc_so->p_CacheGlobalSet(2);
+/*
+                  {
+                     char bufferx[1024];
+                     sprintf(bufferx, "mg_write_chunk_isc: p_CacheGlobalSet=%d; chunk_no=%d; key=%s", rc, chunk_no, pweb->key);
+                     mg_log_event(pweb->plog, pweb, bufferx, "mg_write_chunk_isc", 0);
+                  }
+*/
+               }
+            }
+         }
+      }
+   }
+   if (cvalue.pstr) {
+      pcon->p_isc_so->p_CacheExStrKill(&(cvalue.zstr));
+   }
+
+   return rc;
+
+#endif
+}
+
+
+int mg_write_chunk_ydb(MGWEB *pweb, unsigned char *netbuf, unsigned int netbuf_used, int chunk_no)
+{
+#if 1
+
+   int rc, option;
+   char label[32], param[32], obuffer[32];
+   DBXFUN fun;
+   DBXCON *pcon;
+   ydb_string_t out, in1, in2, in3;
+
+   pcon = pweb->pcon;
+/*
+   {
+      char bufferx[1024];
+      sprintf(bufferx, "mg_write_chunk_ydb: chunk_no=%d; key=%s", chunk_no, pweb->key);
+      mg_log_buffer(pweb->plog, pweb, (char *) netbuf, 32, bufferx, 0);
+   }
+*/
+   /* dbxwebsn(key,cn,data,option) */
+   rc = CACHE_SUCCESS;
+   option = 0;
+   sprintf(param, "websn:%d:%d", chunk_no, option);
+   strcpy(label, "ifc_zmgsis");
+   fun.label = label;
+   fun.label_len = (int) strlen(label);
+
+   out.address = (char *) obuffer;
+   out.length = (unsigned long) sizeof(obuffer);
+   in1.address = (char *) pweb->key;
+   in1.length = (unsigned long) strlen(pweb->key);
+   in2.address = (char *) (netbuf + 5);
+   in2.length = (unsigned long) (netbuf_used - 5);
+   in3.address = (char *) param;
+   in3.length = (unsigned long) strlen(param);
+
+   rc = pcon->p_ydb_so->p_ydb_ci(fun.label, &out, &in1, &in2, &in3);
+/*
+   {
+      char bufferx[1024];
+      sprintf(bufferx, "mg_write_chunk_ydb: rc=%d; chunk_no=%d; key=%s", rc, chunk_no, pweb->key);
+      mg_log_event(pweb->plog, pweb, bufferx, "mg_write_chunk_isc", 0);
+   }
+*/
+   return rc;
+
+#else
+
+   int rc;
+   char global[32], buffer[32];
+   DBXCON *pcon;
+   ydb_buffer_t subs[4], glo, data;
+
+   pcon = pweb->pcon;
+   strcpy(global, "^mgweb");
+
+   glo.buf_addr = (char *) global;
+   glo.len_used = (unsigned long) strlen(global);
+   glo.len_alloc = glo.len_used;
+
+   if (chunk_no == 1) {
+      subs[0].buf_addr = (char *) pweb->key;
+      subs[0].len_used = (unsigned long) strlen(pweb->key);
+      subs[0].len_alloc = subs[0].len_used;
+
+      rc = pcon->p_ydb_so->p_ydb_delete_s(&glo, 1, &subs[0], YDB_DEL_TREE);
+   }
+
+   sprintf(buffer, "%d", chunk_no);
+   subs[0].buf_addr = (char *) pweb->key;
+   subs[0].len_used = (unsigned long) strlen(pweb->key);
+   subs[0].len_alloc = subs[0].len_used;
+   subs[1].buf_addr = (char *) buffer;
+   subs[1].len_used = (unsigned long) strlen(buffer);
+   subs[1].len_alloc = subs[1].len_used;
+
+   data.buf_addr = (char *) netbuf;
+   data.len_used = (unsigned long) netbuf_used;
+   data.len_alloc = data.len_used;
+
+   rc = pcon->p_ydb_so->p_ydb_set_s(&glo, 2, &subs[0], &data);
+
+   return rc;
+
+#endif
+}
+
+/* CMT53 */
+char * mg_web_response_headers_buffer(MGWEB *pweb, int size, int context)
+{
+   int headers_alloc;
+   char *response_headers;
+   DBX_TRACE_INIT(0)
+
+#ifdef _WIN32
+__try {
+#endif
+
+   response_headers = NULL;
+   headers_alloc = (int) (pweb->output_val.svalue.len_alloc - (pweb->output_val.svalue.len_used + 4));
+   if (size < headers_alloc) {
+      response_headers = (char *) pweb->output_val.svalue.buf_addr + (pweb->output_val.svalue.len_used + 4);
+   }
+   else {
+      pweb->response_headers_long = (char *) mg_malloc(pweb->pweb_server, size + DBX_HEADER_MARGIN, MG_MID_RESPHEADER);
+      if (pweb->response_headers_long) {
+         response_headers = pweb->response_headers_long;
+      }
+   }
+
+   return response_headers;
+
+#ifdef _WIN32
+}
+__except (EXCEPTION_EXECUTE_HANDLER) {
+
+   DWORD code;
+   char bufferx[256];
+
+   __try {
+      code = GetExceptionCode();
+      sprintf_s(bufferx, 255, "Exception caught in f:mg_web_response_headers_buffer: %x:%d (context=%d)", code, DBX_TRACE_VAR, context);
+      mg_log_event(pweb->plog, pweb, bufferx, "Error Condition", 0);
+   }
+   __except (EXCEPTION_EXECUTE_HANDLER) {
+      ;
+   }
+
+   return NULL;
+}
+#endif
+}
+
+
+int mg_web_http_error(MGWEB *pweb, int http_status_code, int custompage)
+{
+   DBX_TRACE_INIT(0)
+   char *custompage_url;
+   char buffer[64];
+
+#ifdef _WIN32
+__try {
+#endif
+
+   if (!pweb || !pweb->output_val.svalue.buf_addr) { /* CMT52 */
+      return -1;
+   }
+
+   if (!pweb->response_headers) { /* CMT52 */
+      return -1;
+   }
+
+   if (http_status_code >= 500) { /* CMT74 */
+      pweb->metrics_error = http_status_code;
+   }
+
+   custompage_url = NULL;
+   if (custompage > MG_CUSTOMPAGE_DBSERVER_NONE) {
+      DBX_TRACE(1)
+      if (custompage == MG_CUSTOMPAGE_DBSERVER_UNAVAILABLE && mg_system.custompage_dbserver_unavailable)
+         custompage_url =  mg_system.custompage_dbserver_unavailable;
+      else if (custompage == MG_CUSTOMPAGE_DBSERVER_BUSY && mg_system.custompage_dbserver_busy)
+         custompage_url =  mg_system.custompage_dbserver_busy;
+      else if (custompage == MG_CUSTOMPAGE_DBSERVER_DISABLED && mg_system.custompage_dbserver_disabled)
+         custompage_url =  mg_system.custompage_dbserver_disabled;
+      else if (custompage == MG_CUSTOMPAGE_DBSERVER_TIMEOUT && mg_system.custompage_dbserver_timeout) /* v2.7.33 */
+         custompage_url =  mg_system.custompage_dbserver_timeout;
+
+      if (custompage_url) {
+         DBX_TRACE(2)
+         if (pweb->request_method && !strcmp(pweb->request_method, "POST"))
+            sprintf(pweb->response_headers, "HTTP/1.1 301 Moved Permanently\r\nLocation: %s\r\nConnection: close\r\n\r\n", custompage_url);
+         else
+            sprintf(pweb->response_headers, "HTTP/1.1 307 Temporary Redirect\r\nLocation: %s\r\nConnection: close\r\n\r\n", custompage_url);
+         pweb->response_headers_len = (int) strlen(pweb->response_headers);
+         return 0;
+      }
+   }
+
+   DBX_TRACE(10)
+   /* v2.7.33 504 Gateway Timeout (wating for the DB Server) ; 408 Request Timeout (wating for the client) */
+   if (http_status_code == 504) {
+      sprintf(pweb->response_headers, "HTTP/1.1 %d Gateway Timeout\r\nConnection: close", http_status_code);
+   }
+   else if (http_status_code == 408) {
+      sprintf(pweb->response_headers, "HTTP/1.1 %d Request Timeout\r\nConnection: close", http_status_code);
+   }
+   else {
+      sprintf(pweb->response_headers, "HTTP/1.1 %d Internal Server Error\r\nConnection: close", http_status_code);
+   }
+   if (pweb->response_clen >= 0) {
+      sprintf(buffer, "\r\nContent-Length: %d\r\n\r\n", pweb->response_clen);
+   }
+   else {
+      strcpy(buffer, "\r\n\r\n");
+   }
+   DBX_TRACE(20)
+   strcat(pweb->response_headers, buffer);
+   pweb->response_headers_len = (int) strlen(pweb->response_headers);
+
+   return 0;
+
+#ifdef _WIN32
+}
+__except (EXCEPTION_EXECUTE_HANDLER) {
+
+   DWORD code;
+   char bufferx[256];
+
+   __try {
+      code = GetExceptionCode();
+      sprintf_s(bufferx, 255, "Exception caught in f:mg_web_http_error: %x:%d (memory allocated=%d; used=%d)", code, DBX_TRACE_VAR, pweb->output_val.svalue.len_alloc, pweb->output_val.svalue.len_used);
+      mg_log_event(pweb->plog, pweb, bufferx, "Error Condition", 0);
+   }
+   __except (EXCEPTION_EXECUTE_HANDLER) {
+      ;
+   }
+
+   return 0;
+}
+#endif
+}
+
+
+int mg_web_simple_response(MGWEB *pweb, char *text, char *error, int context)
+{
+   int len;
+   char *p;
+   char buffer[64], response[256];
+
+   p = NULL;
+   len = 0;
+   if (context == 0) {
+      if (text) {
+         p = text;
+         len = (int) strlen(text);
+      }
+      else if (error) {
+         p = error;
+         len = (int) strlen(error);
+      }
+      strcpy(pweb->response_headers, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nConnection: close\r\n");
+
+      if (len) {
+         sprintf(buffer, "Content-Length: %d\r\n\r\n", len);
+      }
+      else {
+         strcpy(buffer, "\r\n");
+      }
+      strcat(pweb->response_headers, buffer);
+      pweb->response_headers_len = (int) strlen(pweb->response_headers);
+   }
+   else {
+      sprintf(response, "{\r\n   \"ok\": %d,\r\n   \"result\": \"%s\",\r\n   \"error\": \"%s\"\r\n}\r\n", error ? 0 : 1, text ? text : "", error ? error : "");
+      len = (int) strlen(response);
+      p = response;
+
+      strcpy(pweb->response_headers, "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nConnection: close\r\n");
+
+      if (len) {
+         sprintf(buffer, "Content-Length: %d\r\n\r\n", len);
+         strcat(pweb->response_headers, buffer);
+      }
+      else {
+         strcpy(buffer, "\r\n");
+      }
+      strcat(pweb->response_headers, buffer);
+      pweb->response_headers_len = (int) strlen(pweb->response_headers);
+   }
+
+   mg_submit_headers(pweb);
+   if (p) {
+      mg_client_write(pweb, (unsigned char *) p, (int) len, 109);
+   }
+   return CACHE_SUCCESS;
+}
+
+
+int mg_get_all_cgi_variables(MGWEB *pweb)
+{
+   DBX_TRACE_INIT(0)
+   int result, rc, n, len, lenv;
+   char *p, *pv;
+   char buffer[128];
+
+#ifdef _WIN32
+__try {
+#endif
+
+   lenv = 32;
+   rc = mg_get_cgi_variable(pweb, "HTTPS", buffer, &lenv);
+   if (rc == MG_CGI_SUCCESS) {
+      mg_lcase(buffer);
+      if (!strcmp(buffer, "on")) {
+         pweb->tls = 1;
+      }
+   }
+
+   /* CMT68 index the request headers in a single pass */
+   mg_index_request_headers(pweb);
+
+   /* v2.7.33 look for SSE header: Accept: text/event-stream */
+   pweb->sse = 0;
+   lenv = 127;
+   if (pweb->hdr_status == 1) {
+      rc = mg_find_request_header(pweb, "HTTP_ACCEPT", &pv, &lenv);
+      if (rc == MG_CGI_SUCCESS) {
+         if (lenv > 127) {
+            lenv = 127;
+         }
+         strncpy(buffer, pv, lenv);
+         buffer[lenv] = '\0';
+      }
+   }
+   else {
+      rc = mg_get_cgi_variable(pweb, "HTTP_ACCEPT", buffer, &lenv);
+   }
+   if (rc == MG_CGI_SUCCESS) {
+      mg_lcase(buffer);
+      if (strstr(buffer, "/event-stream")) {
+         pweb->sse = 1;
+      }
+   }
+
+   result = 0;
+   for (n = 0; n < mg_system.cgi_max; n ++) {
+      p = (pweb->input_buf.buf_addr + pweb->input_buf.len_used + 5);
+
+      /* CMT82 stop if the name, '=' and at least one Byte of value no longer fit */
+      len = (int) strlen(mg_system.cgi[n]) + 1;
+      lenv = (int) pweb->input_buf.len_alloc - (int) (pweb->input_buf.len_used + len + 5 + MG_CGI_TAIL_RESERVE);
+      if (lenv < 2) {
+         sprintf(buffer, "Request headers exceed the space available (%u Bytes): %d CGI variable(s) not sent", pweb->input_buf.len_alloc, mg_system.cgi_max - n);
+         mg_log_event(pweb->plog, pweb, buffer, "mg_web: request headers too large", 0);
+         result = -1;
+         break;
+      }
+
+      strcpy(p, mg_system.cgi[n]);
+      strcat(p, "=");
+      p += len;
+
+      if (pweb->hdr_status == 1 && (!strncmp(mg_system.cgi[n], "HTTP_", 5) || !strcmp(mg_system.cgi[n], "HTTP*"))) { /* CMT68 */
+         rc = mg_get_request_variable(pweb, mg_system.cgi[n], p, &lenv);
+      }
+      else {
+         rc = mg_get_cgi_variable(pweb, mg_system.cgi[n], p, &lenv);
+      }
+
+      if (rc == MG_CGI_SUCCESS) {
+         len += lenv;
+         mg_add_block_size((unsigned char *) pweb->input_buf.buf_addr + pweb->input_buf.len_used, (unsigned long) 0, (unsigned long) len, DBX_DSORT_WEBCGI, DBX_DTYPE_STR);
+         pweb->input_buf.len_used += (len + 5);
+
+         if (n == DBX_CGI_REQUEST_METHOD) {
+            pweb->request_method = p;
+            pweb->request_method_len = lenv;
+         }
+         else if (n == DBX_CGI_SCRIPT_NAME) {
+            pweb->script_name = p;
+            pweb->script_name_len = lenv;
+            if (lenv > 250)
+               lenv = 250;
+            strncpy(pweb->script_name_lc, p, lenv);
+            pweb->script_name_lc[lenv] = '\0';
+            mg_lcase(pweb->script_name_lc);
+         }
+         if (n == DBX_CGI_QUERY_STRING) {
+            pweb->query_string = p;
+            pweb->query_string_len = lenv;
+         }
+      }
+   }
+
+	return result;
+
+#ifdef _WIN32
+}
+__except (EXCEPTION_EXECUTE_HANDLER) {
+
+   DWORD code;
+   char bufferx[256];
+
+   __try {
+      code = GetExceptionCode();
+      sprintf_s(bufferx, 255, "Exception caught in f:mg_get_all_cgi_variables: %x:%d", code, DBX_TRACE_VAR);
+      mg_log_event(pweb->plog, pweb, bufferx, "Error Condition", 0);
+   }
+   __except (EXCEPTION_EXECUTE_HANDLER) {
+      ;
+   }
+
+   return 0;
+}
+#endif
+
+}
+
+
+int mg_get_path_configuration(MGWEB *pweb)
+{
+   DBX_TRACE_INIT(0)
+   int rc, len_max;
+   MGPATH *ppath, *ppath_max;
+
+#ifdef _WIN32
+__try {
+#endif
+
+   rc = 0;
+   len_max = 0;
+   ppath_max = NULL;
+
+   /* CMT67 longest matching location from the index */
+   if (mg_path_index) {
+      len_max = mg_rtree_lookup(mg_path_index, pweb->script_name_lc, (int) strlen(pweb->script_name_lc), 0, (void **) &ppath_max);
+      if (!ppath_max) {
+         len_max = 0;
+      }
+   }
+
+   ppath = mg_path_index ? NULL : mg_path;
+   while (ppath) {
+      if (!strncmp(pweb->script_name_lc, ppath->name, ppath->name_len)) {
+         if (ppath->name_len > len_max) {
+            len_max = ppath->name_len;
+            ppath_max = ppath;
+         }
+      }
+/*
+      if (mg_system.log.log_frames) {
+         char bufferx[256];
+         sprintf(bufferx, "request=%s; ppath=%p; path=%s; ppath->name_len=%d; server1=%s; len_max=%d;", pweb->script_name_lc, ppath, ppath->name, ppath->name_len, ppath->servers[0].psrv->name, len_max);
+         mg_log_event(pweb->plog, pweb, bufferx, "mg_web: information", 0);
+      }
+*/
+      ppath = ppath->pnext;
+   }
+   
+   if (len_max) {
+      rc = CACHE_SUCCESS;
+      pweb->ppath = ppath_max;
+   }
+   else {
+      rc = CACHE_FAILURE;
+   }
+      
+	return rc;
+
+#ifdef _WIN32
+}
+__except (EXCEPTION_EXECUTE_HANDLER) {
+
+   DWORD code;
+   char bufferx[256];
+
+   __try {
+      code = GetExceptionCode();
+      sprintf_s(bufferx, 255, "Exception caught in f:mg_get_path_configuration: %x:%d", code, DBX_TRACE_VAR);
+      mg_log_event(pweb->plog, pweb, bufferx, "Error Condition", 0);
+   }
+   __except (EXCEPTION_EXECUTE_HANDLER) {
+      ;
+   }
+
+   return 0;
+}
+#endif
+}
+
+
+/* CMT68 request header index */
+/* The web server module's mg_get_request_headers() passes each request header to mg_index_request_header() */
+/* Names are compared in CGI form: upper case with '-' replaced by '_' and without the HTTP_ prefix */
+
+static unsigned int mg_hdr_hash(char *name, int name_len, int cgi_form)
+{
+   int n;
+   unsigned int hash, c;
+
+   if (cgi_form && name_len > 5 && !strncmp(name, "HTTP_", 5)) {
+      name += 5;
+      name_len -= 5;
+   }
+   hash = 2166136261U; /* FNV-1a */
+   for (n = 0; n < name_len; n ++) {
+      c = (unsigned int) (unsigned char) name[n];
+      if (c >= 'a' && c <= 'z')
+         c -= 32;
+      else if (c == '-')
+         c = '_';
+      hash = (hash ^ c) * 16777619U;
+   }
+   return hash;
+}
+
+
+static int mg_hdr_name_match(MGHDR *phdr, char *name, int name_len)
+{
+   int n, len;
+   char *p;
+   unsigned int c1, c2;
+
+   p = phdr->name;
+   len = phdr->name_len;
+   if (phdr->cgi_form && len > 5 && !strncmp(p, "HTTP_", 5)) {
+      p += 5;
+      len -= 5;
+   }
+   if (len != name_len) {
+      return 0;
+   }
+   for (n = 0; n < len; n ++) {
+      c1 = (unsigned int) (unsigned char) p[n];
+      c2 = (unsigned int) (unsigned char) name[n];
+      if (c1 >= 'a' && c1 <= 'z')
+         c1 -= 32;
+      else if (c1 == '-')
+         c1 = '_';
+      if (c1 != c2) {
+         return 0;
+      }
+   }
+   return 1;
+}
+
+
+int mg_index_request_header(MGWEB *pweb, char *name, int name_len, char *value, int value_len, int cgi_form)
+{
+   int slot, n, last;
+   MGHDR *phdr;
+
+   if (!name || name_len < 1) {
+      return CACHE_SUCCESS;
+   }
+   if (pweb->hdr_no >= MG_HDR_INDEX_MAX) {
+      pweb->hdr_status = -1;
+      return CACHE_FAILURE;
+   }
+
+   phdr = &(pweb->hdr[pweb->hdr_no]);
+   phdr->name = name;
+   phdr->name_len = name_len;
+   phdr->cgi_form = cgi_form;
+   phdr->value = value ? value : "";
+   phdr->value_len = value ? value_len : 0;
+   phdr->hash = mg_hdr_hash(name, name_len, cgi_form);
+   phdr->pnext = 0;
+   pweb->hdr_no ++;
+
+   /* headers with the same name are kept in the order received so the first is found */
+   slot = (int) (phdr->hash & (MG_HDR_INDEX_SLOTS - 1));
+   if (!pweb->hdr_slot[slot]) {
+      pweb->hdr_slot[slot] = (unsigned char) pweb->hdr_no;
+   }
+   else {
+      for (n = pweb->hdr_slot[slot]; n; n = pweb->hdr[n - 1].pnext) {
+         last = n;
+      }
+      pweb->hdr[last - 1].pnext = pweb->hdr_no;
+   }
+
+   return CACHE_SUCCESS;
+}
+
+
+int mg_index_request_headers(MGWEB *pweb)
+{
+   if (pweb->hdr_status != 0) {
+      return CACHE_SUCCESS;
+   }
+
+   pweb->hdr_no = 0;
+   memset((void *) pweb->hdr_slot, 0, sizeof(pweb->hdr_slot));
+   pweb->hdr_status = 1;
+   if (mg_get_request_headers(pweb) != CACHE_SUCCESS) {
+      pweb->hdr_status = -1;
+   }
+
+   return (pweb->hdr_status == 1) ? CACHE_SUCCESS : CACHE_FAILURE;
+}
+
+
+/* Find a request header by its CGI name (e.g. HTTP_COOKIE): the value returned is not null terminated */
+int mg_find_request_header(MGWEB *pweb, char *name, char **pvalue, int *pvalue_len)
+{
+   int n, name_len;
+   unsigned int hash;
+   MGHDR *phdr;
+
+   *pvalue = NULL;
+   *pvalue_len = 0;
+   if (pweb->hdr_status != 1) {
+      return MG_CGI_UNDEFINED;
+   }
+
+   name_len = (int) strlen(name);
+   if (name_len > 5 && !strncmp(name, "HTTP_", 5)) {
+      name += 5;
+      name_len -= 5;
+   }
+   hash = mg_hdr_hash(name, name_len, 0);
+
+   for (n = pweb->hdr_slot[hash & (MG_HDR_INDEX_SLOTS - 1)]; n; n = phdr->pnext) {
+      phdr = &(pweb->hdr[n - 1]);
+      if (phdr->hash == hash && mg_hdr_name_match(phdr, name, name_len)) {
+         *pvalue = phdr->value;
+         *pvalue_len = phdr->value_len;
+         return MG_CGI_SUCCESS;
+      }
+   }
+
+   return MG_CGI_UNDEFINED;
+}
+
+
+/* Serve an HTTP_* variable, or the HTTP* list, from the header index */
+int mg_get_request_variable(MGWEB *pweb, char *name, char *pbuffer, int *pbuffer_size)
+{
+   int n, len, offset, rc;
+   char *pval;
+   char vname[128];
+   MGHDR *phdr;
+
+   if (!strcmp(name, "HTTP*")) {
+      for (n = 0; n < pweb->hdr_no; n ++) {
+         phdr = &(pweb->hdr[n]);
+         if (phdr->cgi_form) {
+            len = phdr->name_len;
+            if (len > 120) {
+               continue;
+            }
+            strncpy(vname, phdr->name, len);
+            vname[len] = '\0';
+         }
+         else {
+            len = phdr->name_len + 5;
+            if (len > 120) {
+               continue;
+            }
+            strcpy(vname, "HTTP_");
+            strncpy(vname + 5, phdr->name, phdr->name_len);
+            vname[len] = '\0';
+         }
+         mg_ucase(vname);
+         for (len = 5; vname[len]; len ++) {
+            if (vname[len] == '-')
+               vname[len] = '_';
+         }
+         offset = 0;
+         if (!strcmp(vname + 5, "CONTENT_LENGTH") || !strcmp(vname + 5, "CONTENT_TYPE")) {
+            offset = 5;
+         }
+         mg_add_cgi_variable(pweb, vname + offset, (int) strlen(vname + offset), phdr->value, phdr->value_len);
+      }
+      return MG_CGI_LIST;
+   }
+
+   rc = mg_find_request_header(pweb, name, &pval, &len);
+   if (rc != MG_CGI_SUCCESS) {
+      *pbuffer_size = 0;
+      return rc;
+   }
+   if (len >= (*pbuffer_size)) {
+      return MG_CGI_TOOLONG;
+   }
+   memcpy((void *) pbuffer, (void *) pval, (size_t) len);
+   pbuffer[len] = '\0';
+   *pbuffer_size = len;
+
+   return MG_CGI_SUCCESS;
+}
+
+
+/* CMT67 radix tree index of configured names */
+/* Each node holds a label (a fragment of one or more names) and its children are sorted by the first character of their labels */
+/* A lookup follows one child per node, so costs at most the length of the key regardless of the number of names */
+
+MGRTNODE * mg_rtree_create(void)
+{
+   MGRTNODE *pnode;
+
+   pnode = (MGRTNODE *) mg_malloc(NULL, sizeof(MGRTNODE), MG_MID_RTREE);
+   if (pnode) {
+      memset((void *) pnode, 0, sizeof(MGRTNODE));
+   }
+   return pnode;
+}
+
+
+static int mg_rtree_find_child(MGRTNODE *pnode, char c, int *pinsert)
+{
+   int lo, hi, mid;
+
+   lo = 0;
+   hi = pnode->no_child - 1;
+   while (lo <= hi) {
+      mid = (lo + hi) / 2;
+      if (pnode->child[mid]->label[0] == c) {
+         return mid;
+      }
+      if ((unsigned char) pnode->child[mid]->label[0] < (unsigned char) c)
+         lo = mid + 1;
+      else
+         hi = mid - 1;
+   }
+   if (pinsert) {
+      *pinsert = lo;
+   }
+   return -1;
+}
+
+
+static int mg_rtree_add_child(MGRTNODE *pnode, MGRTNODE *pchild, int position)
+{
+   int n;
+   MGRTNODE **child;
+
+   if (pnode->no_child == pnode->child_alloc) {
+      n = pnode->child_alloc ? (pnode->child_alloc * 2) : 4;
+      child = (MGRTNODE **) mg_malloc(NULL, sizeof(MGRTNODE *) * n, MG_MID_RTREE);
+      if (!child) {
+         return CACHE_FAILURE;
+      }
+      if (pnode->child) {
+         memcpy((void *) child, (void *) pnode->child, sizeof(MGRTNODE *) * pnode->no_child);
+         mg_free(NULL, (void *) pnode->child, MG_MID_RTREE);
+      }
+      pnode->child = child;
+      pnode->child_alloc = n;
+   }
+   for (n = pnode->no_child; n > position; n --) {
+      pnode->child[n] = pnode->child[n - 1];
+   }
+   pnode->child[position] = pchild;
+   pnode->no_child ++;
+
+   return CACHE_SUCCESS;
+}
+
+
+/* The key must remain allocated for the life of the index: if a name is configured more than once the first is kept */
+int mg_rtree_insert(MGRTNODE *proot, char *key, int key_len, void *pvalue, int order)
+{
+   int n, position, common;
+   MGRTNODE *pnode, *pchild, *psplit;
+
+   pnode = proot;
+   while (key_len > 0) {
+      n = mg_rtree_find_child(pnode, key[0], &position);
+      if (n < 0) {
+         pchild = mg_rtree_create();
+         if (!pchild) {
+            return CACHE_FAILURE;
+         }
+         pchild->label = key;
+         pchild->label_len = key_len;
+         if (mg_rtree_add_child(pnode, pchild, position) != CACHE_SUCCESS) {
+            mg_free(NULL, (void *) pchild, MG_MID_RTREE);
+            return CACHE_FAILURE;
+         }
+         pnode = pchild;
+         break;
+      }
+      pchild = pnode->child[n];
+      for (common = 1; common < pchild->label_len && common < key_len && pchild->label[common] == key[common]; common ++)
+         ;
+      if (common < pchild->label_len) {
+         /* split the child at the end of the common prefix */
+         psplit = mg_rtree_create();
+         if (!psplit) {
+            return CACHE_FAILURE;
+         }
+         psplit->label = pchild->label;
+         psplit->label_len = common;
+         pchild->label += common;
+         pchild->label_len -= common;
+         if (mg_rtree_add_child(psplit, pchild, 0) != CACHE_SUCCESS) {
+            mg_free(NULL, (void *) psplit, MG_MID_RTREE);
+            return CACHE_FAILURE;
+         }
+         pnode->child[n] = psplit;
+         pchild = psplit;
+      }
+      pnode = pchild;
+      key += common;
+      key_len -= common;
+   }
+
+   if (!pnode->pvalue) {
+      pnode->pvalue = pvalue;
+      pnode->order = order;
+   }
+
+   return CACHE_SUCCESS;
+}
+
+
+/* Find the names that are prefixes of the key and return the longest (first=0) or the first configured (first=1) */
+/* Returns the length of the name found, or zero */
+int mg_rtree_lookup(MGRTNODE *proot, char *key, int key_len, int first, void **ppvalue)
+{
+   int n, matched, len_found, order_found;
+   MGRTNODE *pnode, *pchild;
+
+   *ppvalue = NULL;
+   len_found = 0;
+   order_found = 0;
+   matched = 0;
+   pnode = proot;
+
+   while (pnode) {
+      if (pnode->pvalue && (!first || !(*ppvalue) || pnode->order < order_found)) {
+         *ppvalue = pnode->pvalue;
+         len_found = matched;
+         order_found = pnode->order;
+      }
+      if (matched >= key_len) {
+         break;
+      }
+      n = mg_rtree_find_child(pnode, key[matched], NULL);
+      if (n < 0) {
+         break;
+      }
+      pchild = pnode->child[n];
+      if (pchild->label_len > (key_len - matched) || strncmp(pchild->label, key + matched, (size_t) pchild->label_len)) {
+         break;
+      }
+      matched += pchild->label_len;
+      pnode = pchild;
+   }
+
+   return len_found;
+}
+
+
+int mg_rtree_free(MGRTNODE *proot)
+{
+   int n;
+
+   if (!proot) {
+      return 0;
+   }
+   for (n = 0; n < proot->no_child; n ++) {
+      mg_rtree_free(proot->child[n]);
+   }
+   if (proot->child) {
+      mg_free(NULL, (void *) proot->child, MG_MID_RTREE);
+   }
+   mg_free(NULL, (void *) proot, MG_MID_RTREE);
+
+   return 0;
+}
+
+
+/* CMT67 index the configured locations and, for each location, its WebSocket names */
+/* If an index cannot be built the corresponding list is searched instead */
+int mg_build_path_index(void)
+{
+   int n, ok;
+   MGPATH *ppath;
+   MGWSMAP *pwsmap;
+
+   mg_path_index = mg_rtree_create();
+   ok = mg_path_index ? 1 : 0;
+   for (ppath = mg_path, n = 0; ppath && ok; ppath = ppath->pnext, n ++) {
+      if (ppath->name_len > 0 && mg_rtree_insert(mg_path_index, ppath->name, ppath->name_len, (void *) ppath, n) != CACHE_SUCCESS) {
+         ok = 0;
+      }
+   }
+   if (!ok) {
+      mg_rtree_free(mg_path_index);
+      mg_path_index = NULL;
+      mg_log_event(&(mg_system.log), NULL, "Cannot allocate memory for the location index: locations will be searched sequentially", "mg_web: error", 0);
+   }
+
+   for (ppath = mg_path; ppath; ppath = ppath->pnext) {
+      if (!ppath->pwsmap) {
+         continue;
+      }
+      ppath->pwsindex = mg_rtree_create();
+      ok = ppath->pwsindex ? 1 : 0;
+      for (pwsmap = ppath->pwsmap, n = 0; pwsmap && ok; pwsmap = pwsmap->pnext, n ++) {
+         if (pwsmap->name_len > 0 && mg_rtree_insert(ppath->pwsindex, pwsmap->name, pwsmap->name_len, (void *) pwsmap, n) != CACHE_SUCCESS) {
+            ok = 0;
+         }
+      }
+      if (!ok) {
+         mg_rtree_free(ppath->pwsindex);
+         ppath->pwsindex = NULL;
+      }
+   }
+
+   return CACHE_SUCCESS;
+}
+
+
+/* CMT69 byte scanners */
+/* mg_scan_find() returns the first occurrence of needle in buffer[0..len-1] (or NULL): it does not stop at a null byte */
+/* The SIMD versions test the first and last bytes of the needle across a whole block and only compare the rest at candidate positions */
+
+int mg_scan_init(int max_level)
+{
+   int level;
+
+   level = MG_SCAN_SCALAR;
+
+#if defined(MG_SCAN_SIMD)
+   level = MG_SCAN_SSE2; /* always present on x86-64 */
+#if defined(_MSC_VER)
+   {
+      int info[4];
+
+      __cpuid(info, 0);
+      if (info[0] >= 7) {
+         __cpuid(info, 1);
+         /* OSXSAVE and AVX, and the OS saves the YMM registers */
+         if ((info[2] & (1 << 27)) && (info[2] & (1 << 28)) && ((_xgetbv(0) & 6) == 6)) {
+            __cpuidex(info, 7, 0);
+            if (info[1] & (1 << 5)) {
+               level = MG_SCAN_AVX2;
+            }
+         }
+      }
+   }
+#else
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx2")) {
+      level = MG_SCAN_AVX2;
+   }
+#endif
+#endif
+
+   if (max_level >= 0 && level > max_level) {
+      level = max_level;
+   }
+   mg_scan_level = level;
+
+   return level;
+}
+
+
+static char * mg_scan_find_scalar(char *buffer, int len, char *needle, int needle_len)
+{
+   char *p, *pz;
+
+   pz = buffer + (len - needle_len);
+   for (p = buffer; p <= pz; p ++) {
+      p = (char *) memchr((void *) p, (int) needle[0], (size_t) ((pz - p) + 1));
+      if (!p) {
+         break;
+      }
+      if (needle_len == 1 || !memcmp((void *) (p + 1), (void *) (needle + 1), (size_t) (needle_len - 1))) {
+         return p;
+      }
+   }
+
+   return NULL;
+}
+
+
+#if defined(MG_SCAN_SIMD)
+
+static int mg_scan_ctz(unsigned int mask)
+{
+#if defined(_MSC_VER)
+   unsigned long n;
+
+   _BitScanForward(&n, (unsigned long) mask);
+   return (int) n;
+#else
+   return __builtin_ctz(mask);
+#endif
+}
+
+
+/* Candidate positions for a block of 16 (or 32) bytes at p: the first byte of the needle matches at p+n and the last at p+n+needle_len-1 */
+#define MG_SCAN_MASK_SSE2(p) \
+   _mm_and_si128(_mm_cmpeq_epi8(first, _mm_loadu_si128((__m128i *) (p))), _mm_cmpeq_epi8(final, _mm_loadu_si128((__m128i *) ((p) + needle_len - 1))))
+#define MG_SCAN_MASK_AVX2(p) \
+   _mm256_and_si256(_mm256_cmpeq_epi8(first, _mm256_loadu_si256((__m256i *) (p))), _mm256_cmpeq_epi8(final, _mm256_loadu_si256((__m256i *) ((p) + needle_len - 1))))
+
+static char * mg_scan_candidates(char *p, unsigned int mask, char *needle, int needle_len)
+{
+   int bit;
+
+   while (mask) {
+      bit = mg_scan_ctz(mask);
+      if (needle_len < 3 || !memcmp((void *) (p + bit + 1), (void *) (needle + 1), (size_t) (needle_len - 2))) {
+         return (p + bit);
+      }
+      mask &= (mask - 1);
+   }
+   return NULL;
+}
+
+
+static char * mg_scan_find_sse2(char *buffer, int len, char *needle, int needle_len)
+{
+   int n, k, last;
+   char *p;
+   __m128i first, final, m[4];
+
+   first = _mm_set1_epi8(needle[0]);
+   final = _mm_set1_epi8(needle[needle_len - 1]);
+   last = len - needle_len; /* last position at which the needle can start */
+
+   /* 64 bytes at a time: most blocks have no candidates and are passed over with a single test */
+   for (n = 0; (n + 64) <= (last + 1); n += 64) {
+      for (k = 0; k < 4; k ++) {
+         m[k] = MG_SCAN_MASK_SSE2(buffer + n + (k * 16));
+      }
+      if (!_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(m[0], m[1]), _mm_or_si128(m[2], m[3])))) {
+         continue;
+      }
+      for (k = 0; k < 4; k ++) {
+         p = mg_scan_candidates(buffer + n + (k * 16), (unsigned int) _mm_movemask_epi8(m[k]), needle, needle_len);
+         if (p) {
+            return p;
+         }
+      }
+   }
+   for (; (n + 16) <= (last + 1); n += 16) {
+      p = mg_scan_candidates(buffer + n, (unsigned int) _mm_movemask_epi8(MG_SCAN_MASK_SSE2(buffer + n)), needle, needle_len);
+      if (p) {
+         return p;
+      }
+   }
+
+   return mg_scan_find_scalar(buffer + n, len - n, needle, needle_len);
+}
+
+
+#if defined(__GNUC__)
+__attribute__((target("avx2")))
+#endif
+static char * mg_scan_find_avx2(char *buffer, int len, char *needle, int needle_len)
+{
+   int n, last;
+   char *p;
+   __m256i first, final, m0, m1;
+
+   first = _mm256_set1_epi8(needle[0]);
+   final = _mm256_set1_epi8(needle[needle_len - 1]);
+   last = len - needle_len;
+
+   for (n = 0; (n + 64) <= (last + 1); n += 64) {
+      m0 = MG_SCAN_MASK_AVX2(buffer + n);
+      m1 = MG_SCAN_MASK_AVX2(buffer + n + 32);
+      if (_mm256_testz_si256(_mm256_or_si256(m0, m1), _mm256_or_si256(m0, m1))) {
+         continue;
+      }
+      p = mg_scan_candidates(buffer + n, (unsigned int) _mm256_movemask_epi8(m0), needle, needle_len);
+      if (!p) {
+         p = mg_scan_candidates(buffer + n + 32, (unsigned int) _mm256_movemask_epi8(m1), needle, needle_len);
+      }
+      if (p) {
+         return p;
+      }
+   }
+
+   return mg_scan_find_sse2(buffer + n, len - n, needle, needle_len);
+}
+
+#endif /* #if defined(MG_SCAN_SIMD) */
+
+
+char * mg_scan_find(char *buffer, int len, char *needle, int needle_len)
+{
+   if (!buffer || !needle || needle_len < 1 || len < needle_len) {
+      return NULL;
+   }
+   if (mg_scan_level < 0) {
+      mg_scan_init(-1);
+   }
+
+#if defined(MG_SCAN_SIMD)
+   if (mg_scan_level == MG_SCAN_AVX2) {
+      return mg_scan_find_avx2(buffer, len, needle, needle_len);
+   }
+   if (mg_scan_level == MG_SCAN_SSE2) {
+      return mg_scan_find_sse2(buffer, len, needle, needle_len);
+   }
+#endif
+
+   return mg_scan_find_scalar(buffer, len, needle, needle_len);
+}
+
+
+/* CMT71 response cache */
+/* Responses to GET requests are cached for a location when the DB Server gives them an explicit lifetime (Cache-Control: max-age or s-maxage) */
+/* The key is the path, the query string and the values of the request headers listed by response_cache_vary */
+/* Entries are held in LRU order and the least recently used are removed when the cache is full */
+
+MGRCACHE * mg_rcache_create(MGPATH *ppath)
+{
+   int n, len;
+   char *p;
+   MGRCACHE *pcache;
+
+   pcache = (MGRCACHE *) mg_malloc(NULL, sizeof(MGRCACHE), MG_MID_RCACHE);
+   if (!pcache) {
+      mg_log_event(&(mg_system.log), NULL, "Cannot allocate memory for the response cache: responses will not be cached", "mg_web: error", 0);
+      return NULL;
+   }
+   memset((void *) pcache, 0, sizeof(MGRCACHE));
+   pcache->size_max = ppath->rcache_size;
+   pcache->entry_max = ppath->rcache_size / 4;
+
+   for (n = 0; n < ppath->rcache_vary_no; n ++) {
+      p = pcache->vary[pcache->vary_no ++];
+      strcpy(p, "HTTP_");
+      strncpy(p + 5, ppath->rcache_vary[n], 56);
+      p[61] = '\0';
+      mg_ucase(p);
+      for (len = 5; p[len]; len ++) {
+         if (p[len] == '-')
+            p[len] = '_';
+      }
+   }
+
+   return pcache;
+}
+
+
+int mg_rcache_free(MGRCACHE *pcache)
+{
+   MGRCENTRY *pentry, *pentry_next;
+
+   if (!pcache) {
+      return CACHE_SUCCESS;
+   }
+   for (pentry = pcache->phead; pentry; pentry = pentry_next) {
+      pentry_next = pentry->pnext;
+      mg_free(NULL, (void *) pentry, MG_MID_RCACHE);
+   }
+   mg_free(NULL, (void *) pcache, MG_MID_RCACHE);
+
+   return CACHE_SUCCESS;
+}
+
+
+static unsigned int mg_rcache_hash(char *key, int key_len)
+{
+   int n;
+   unsigned int hash;
+
+   hash = 2166136261U; /* FNV-1a */
+   for (n = 0; n < key_len; n ++) {
+      hash = (hash ^ (unsigned int) (unsigned char) key[n]) * 16777619U;
+   }
+   return hash;
+}
+
+
+/* Take an entry out of the hash table and LRU list: it is freed when no longer in use (call with mg_global_mutex held) */
+static void mg_rcache_remove(MGRCACHE *pcache, MGRCENTRY *pentry)
+{
+   MGRCENTRY **ppentry;
+
+   for (ppentry = &(pcache->slot[pentry->hash & (MG_RCACHE_SLOTS - 1)]); *ppentry; ppentry = &((*ppentry)->phnext)) {
+      if (*ppentry == pentry) {
+         *ppentry = pentry->phnext;
+         break;
+      }
+   }
+   if (pentry->pprev)
+      pentry->pprev->pnext = pentry->pnext;
+   else
+      pcache->phead = pentry->pnext;
+   if (pentry->pnext)
+      pentry->pnext->pprev = pentry->pprev;
+   else
+      pcache->ptail = pentry->pprev;
+
+   pcache->size -= pentry->size;
+   pcache->no_entries --;
+   pentry->removed = 1;
+   if (pentry->refs == 0) {
+      mg_free(NULL, (void *) pentry, MG_MID_RCACHE);
+   }
+}
+
+
+/* Copy the value of a request header given its CGI name: returns its length or -1 if absent */
+static int mg_rcache_request_header(MGWEB *pweb, char *name, char *buffer, int buffer_size)
+{
+   int rc, len;
+
+   len = buffer_size - 1;
+   if (pweb->hdr_status == 1)
+      rc = mg_get_request_variable(pweb, name, buffer, &len);
+   else
+      rc = mg_get_cgi_variable(pweb, name, buffer, &len);
+   if (rc != MG_CGI_SUCCESS) {
+      return -1;
+   }
+   buffer[len] = '\0';
+   return len;
+}
+
+
+/* Find a response header (case insensitive): copies its value in lower case and returns its length or -1 if absent */
+static int mg_rcache_response_header(char *headers, int headers_len, char *name, char *buffer, int buffer_size)
+{
+   int n, len, name_len;
+   char *p, *pz;
+
+   name_len = (int) strlen(name);
+   pz = headers + headers_len;
+   for (p = headers; p && p < pz; ) {
+      p = mg_scan_find(p, (int) (pz - p), "\r\n", 2);
+      if (!p) {
+         break;
+      }
+      p += 2;
+      if ((pz - p) > name_len && p[name_len] == ':' && !strncasecmp(p, name, name_len)) {
+         p += (name_len + 1);
+         while (p < pz && *p == ' ')
+            p ++;
+         for (n = 0, len = 0; (p + n) < pz && p[n] != '\r' && p[n] != '\0'; n ++) {
+            if (len < (buffer_size - 1)) {
+               buffer[len ++] = (char) tolower((int) (unsigned char) p[n]);
+            }
+         }
+         buffer[len] = '\0';
+         return len;
+      }
+   }
+   return -1;
+}
+
+
+static long mg_rcache_directive(char *cache_control, char *name)
+{
+   char *p;
+
+   p = strstr(cache_control, name);
+   if (!p || (p > cache_control && p[-1] != ' ' && p[-1] != ',')) {
+      return -1;
+   }
+   p += strlen(name);
+   if (*p != '=') {
+      return 0;
+   }
+   p ++;
+   if (*p == '\"') {
+      p ++;
+   }
+   return strtol(p, NULL, 10);
+}
+
+
+int mg_rcache_lookup(MGWEB *pweb)
+{
+   int n, len, age, stale;
+   char value[256];
+   time_t time_now;
+   MGRCACHE *pcache;
+   MGRCENTRY *pentry;
+
+   pcache = pweb->ppath->prcache;
+   pweb->rcache_status = 0;
+
+   if (pweb->request_method_len != 3 || strncmp(pweb->request_method, "GET", 3) || pweb->request_clen || pweb->request_chunked) {
+      return CACHE_FAILURE;
+   }
+   /* responses to authenticated requests are not shared */
+   if (mg_rcache_request_header(pweb, "HTTP_AUTHORIZATION", value, 256) >= 0) {
+      return CACHE_FAILURE;
+   }
+   if (mg_rcache_request_header(pweb, "HTTP_CACHE_CONTROL", value, 256) >= 0) {
+      mg_lcase(value);
+      if (strstr(value, "no-store")) {
+         return CACHE_FAILURE;
+      }
+   }
+   else {
+      value[0] = '\0';
+   }
+
+   /* key: path?query_string followed by the vary headers */
+   len = pweb->script_name_len + pweb->query_string_len + 1;
+   if (len >= MG_RCACHE_KEY_MAX) {
+      return CACHE_FAILURE;
+   }
+   memcpy((void *) pweb->rcache_key, (void *) pweb->script_name, (size_t) pweb->script_name_len);
+   pweb->rcache_key[pweb->script_name_len] = '?';
+   if (pweb->query_string_len > 0) {
+      memcpy((void *) (pweb->rcache_key + pweb->script_name_len + 1), (void *) pweb->query_string, (size_t) pweb->query_string_len);
+   }
+   for (n = 0; n < pcache->vary_no; n ++) {
+      pweb->rcache_key[len ++] = '\n';
+      age = mg_rcache_request_header(pweb, pcache->vary[n], pweb->rcache_key + len, MG_RCACHE_KEY_MAX - len);
+      if (age > 0) {
+         len += age;
+      }
+      if (len >= (MG_RCACHE_KEY_MAX - 1)) {
+         return CACHE_FAILURE;
+      }
+   }
+   pweb->rcache_key_len = len;
+   pweb->rcache_hash = mg_rcache_hash(pweb->rcache_key, len);
+   pweb->rcache_status = 1;
+
+   /* the client has asked for an end-to-end reload: fetch and store a new copy */
+   if (strstr(value, "no-cache")) {
+      mg_enter_critical_section((void *) &mg_global_mutex);
+      pcache->no_misses ++;
+      mg_leave_critical_section((void *) &mg_global_mutex);
+      return CACHE_FAILURE;
+   }
+
+   time_now = time(NULL);
+   stale = 0;
+   mg_enter_critical_section((void *) &mg_global_mutex);
+   for (pentry = pcache->slot[pweb->rcache_hash & (MG_RCACHE_SLOTS - 1)]; pentry; pentry = pentry->phnext) {
+      if (pentry->hash == pweb->rcache_hash && pentry->key_len == len && !memcmp((void *) pentry->key, (void *) pweb->rcache_key, (size_t) len)) {
+         break;
+      }
+   }
+   if (pentry && time_now >= pentry->expires) {
+      if (time_now >= pentry->stale_until) {
+         mg_rcache_remove(pcache, pentry);
+         pentry = NULL;
+      }
+      else if (!pentry->time_revalidate || (time_now - pentry->time_revalidate) > mg_system.timeout) {
+         /* stale-while-revalidate: this request refreshes the entry while others are given the stale copy */
+         pentry->time_revalidate = time_now;
+         pentry = NULL;
+      }
+      else {
+         stale = 1;
+      }
+   }
+   if (!pentry) {
+      pcache->no_misses ++;
+      mg_leave_critical_section((void *) &mg_global_mutex);
+      return CACHE_FAILURE;
+   }
+   if (stale) { /* CMT82 stale hits are counted separately from fresh ones */
+      pcache->no_hits_stale ++;
+   }
+   else {
+      pcache->no_hits ++;
+   }
+   pentry->refs ++;
+   if (pentry != pcache->phead) { /* move to the head of the LRU list */
+      pentry->pprev->pnext = pentry->pnext;
+      if (pentry->pnext)
+         pentry->pnext->pprev = pentry->pprev;
+      else
+         pcache->ptail = pentry->pprev;
+      pentry->pprev = NULL;
+      pentry->pnext = pcache->phead;
+      pcache->phead->pprev = pentry;
+      pcache->phead = pentry;
+   }
+   mg_leave_critical_section((void *) &mg_global_mutex);
+
+   /* the entry cannot be freed while we hold a reference */
+   pweb->rcache_status = 0;
+   pweb->response_headers = mg_web_response_headers_buffer(pweb, pentry->headers_len + 64, 9);
+   if (pweb->response_headers) {
+      age = (int) difftime(time_now, pentry->time_stored);
+      memcpy((void *) pweb->response_headers, (void *) pentry->headers, (size_t) pentry->headers_len);
+      len = pentry->headers_len;
+      if (!pentry->clen_server) {
+         sprintf(pweb->response_headers + len, "\r\nContent-Length: %d", pentry->content_len);
+         len += (int) strlen(pweb->response_headers + len);
+      }
+      sprintf(pweb->response_headers + len, "\r\nAge: %d\r\n\r\n", age);
+      pweb->response_headers_len = len + (int) strlen(pweb->response_headers + len);
+      pweb->response_content = pentry->content;
+      pweb->response_clen = pentry->content_len;
+      MG_LOG_RESPONSE_HEADER(pweb);
+      mg_submit_headers(pweb);
+      if (pentry->content_len > 0) {
+         MG_LOG_RESPONSE_BUFFER_TO_WEBSERVER(pweb, pentry->content, pentry->content_len);
+         mg_client_write(pweb, (unsigned char *) pentry->content, pentry->content_len, 109);
+      }
+   }
+
+   mg_enter_critical_section((void *) &mg_global_mutex);
+   pentry->refs --;
+   if (pentry->removed && pentry->refs == 0) {
+      mg_free(NULL, (void *) pentry, MG_MID_RCACHE);
+   }
+   mg_leave_critical_section((void *) &mg_global_mutex);
+
+   return pweb->response_headers ? CACHE_SUCCESS : CACHE_FAILURE;
+}
+
+
+int mg_rcache_store(MGWEB *pweb, int content_len)
+{
+   int n, len, status, headers_len;
+   long max_age, s_maxage, swr;
+   unsigned long size;
+   char *p, *pz, *headers;
+   char value[256], name[64];
+   time_t time_now;
+   MGRCACHE *pcache;
+   MGRCENTRY *pentry, *pold;
+
+   pcache = pweb->ppath->prcache;
+   pweb->rcache_status = 0;
+   headers = pweb->response_headers;
+   headers_len = pweb->rcache_headers_len;
+
+   if (!pcache || !headers || strncmp(headers, "HTTP/", 5)) {
+      return CACHE_FAILURE;
+   }
+   p = strstr(headers, " ");
+   status = p ? (int) strtol(p + 1, NULL, 10) : 0;
+   switch (status) { /* cacheable by default (RFC 9110) */
+      case 200: case 203: case 204: case 300: case 301: case 308: case 404: case 405: case 410: case 414: case 501:
+         break;
+      default:
+         return CACHE_FAILURE;
+   }
+
+   /* freshness from the Cache-Control header supplied by the DB Server */
+   if (!pweb->response_cache_control) {
+      return CACHE_FAILURE;
+   }
+   len = mg_rcache_response_header(headers, headers_len, "cache-control", value, 256);
+   if (len < 1 || strstr(value, "no-store") || strstr(value, "no-cache") || strstr(value, "private")) {
+      return CACHE_FAILURE;
+   }
+   s_maxage = mg_rcache_directive(value, "s-maxage");
+   max_age = mg_rcache_directive(value, "max-age");
+   if (s_maxage >= 0) {
+      max_age = s_maxage;
+   }
+   swr = mg_rcache_directive(value, "stale-while-revalidate");
+   if (max_age < 0 || (max_age + (swr > 0 ? swr : 0)) < 1) {
+      return CACHE_FAILURE;
+   }
+
+   /* responses that set cookies are never shared and Vary must be covered by the key */
+   if (mg_rcache_response_header(headers, headers_len, "set-cookie", value, 256) >= 0) {
+      return CACHE_FAILURE;
+   }
+   if (mg_rcache_response_header(headers, headers_len, "vary", value, 256) >= 0) {
+      for (p = value; *p; p = pz) { /* CMT82 walk the list: strtok() is not thread safe */
+         if (*p == ',' || *p == ' ' || *p == '\t') {
+            pz = p + 1;
+            continue;
+         }
+         for (pz = p; *pz && *pz != ',' && *pz != ' ' && *pz != '\t'; pz ++)
+            ;
+         len = (int) (pz - p);
+         if (len > 56) {
+            len = 56;
+         }
+         strcpy(name, "HTTP_");
+         strncpy(name + 5, p, len);
+         name[len + 5] = '\0';
+         mg_ucase(name);
+         for (len = 5; name[len]; len ++) {
+            if (name[len] == '-')
+               name[len] = '_';
+         }
+         for (n = 0; n < pcache->vary_no; n ++) {
+            if (!strcmp(name, pcache->vary[n])) {
+               break;
+            }
+         }
+         if (n == pcache->vary_no) {
+            return CACHE_FAILURE;
+         }
+      }
+   }
+
+   size = (unsigned long) (sizeof(MGRCENTRY) + pweb->rcache_key_len + headers_len + content_len + 3);
+   if (size > pcache->entry_max) {
+      return CACHE_FAILURE;
+   }
+   pentry = (MGRCENTRY *) mg_malloc(NULL, (int) size, MG_MID_RCACHE);
+   if (!pentry) {
+      return CACHE_FAILURE;
+   }
+   time_now = time(NULL);
+   memset((void *) pentry, 0, sizeof(MGRCENTRY));
+   pentry->hash = pweb->rcache_hash;
+   pentry->size = size;
+   pentry->key = (char *) pentry + sizeof(MGRCENTRY);
+   pentry->key_len = pweb->rcache_key_len;
+   memcpy((void *) pentry->key, (void *) pweb->rcache_key, (size_t) pentry->key_len);
+   pentry->headers = pentry->key + pentry->key_len + 1;
+   pentry->headers_len = headers_len;
+   memcpy((void *) pentry->headers, (void *) headers, (size_t) headers_len);
+   pentry->clen_server = (pweb->response_clen_server >= 0) ? 1 : 0;
+   pentry->content = pentry->headers + headers_len + 1;
+   pentry->content_len = content_len;
+   if (content_len > 0) {
+      memcpy((void *) pentry->content, (void *) pweb->response_content, (size_t) content_len);
+   }
+   pentry->time_stored = time_now;
+   pentry->expires = time_now + max_age;
+   pentry->stale_until = pentry->expires + (swr > 0 ? swr : 0);
+
+   mg_enter_critical_section((void *) &mg_global_mutex);
+   for (pold = pcache->slot[pentry->hash & (MG_RCACHE_SLOTS - 1)]; pold; pold = pold->phnext) {
+      if (pold->hash == pentry->hash && pold->key_len == pentry->key_len && !memcmp((void *) pold->key, (void *) pentry->key, (size_t) pentry->key_len)) {
+         mg_rcache_remove(pcache, pold);
+         break;
+      }
+   }
+   while (pcache->ptail && (pcache->size + size) > pcache->size_max) {
+      mg_rcache_remove(pcache, pcache->ptail);
+      pcache->no_evictions ++;
+   }
+   pentry->phnext = pcache->slot[pentry->hash & (MG_RCACHE_SLOTS - 1)];
+   pcache->slot[pentry->hash & (MG_RCACHE_SLOTS - 1)] = pentry;
+   pentry->pnext = pcache->phead;
+   if (pcache->phead)
+      pcache->phead->pprev = pentry;
+   else
+      pcache->ptail = pentry;
+   pcache->phead = pentry;
+   pcache->size += size;
+   pcache->no_entries ++;
+   pcache->no_stores ++;
+   mg_leave_critical_section((void *) &mg_global_mutex);
+
+   return CACHE_SUCCESS;
+}
+
+
+int mg_add_cgi_variable(MGWEB *pweb, char *name, int name_len, char *value, int value_len)
+{
+   DBX_TRACE_INIT(0)
+   int alloc, len;
+   char *p;
+
+#ifdef _WIN32
+__try {
+#endif
+
+   alloc = (pweb->input_buf.len_alloc - pweb->input_buf.len_used);
+   if ((name_len + value_len + 6) >= alloc) {
+      return CACHE_FAILURE;
+   }
+
+   p = (char *) (pweb->input_buf.buf_addr + pweb->input_buf.len_used);
+   p += 5;
+   strncpy(p, name, name_len);
+   p += name_len;
+   *p = '=';
+   p ++;
+   strncpy(p, value, value_len);
+   p += value_len;
+
+   len = (name_len + value_len + 1);
+   mg_add_block_size((unsigned char *) pweb->input_buf.buf_addr + pweb->input_buf.len_used, (unsigned long) 0, (unsigned long) len, DBX_DSORT_WEBCGI, DBX_DTYPE_STR);
+   pweb->input_buf.len_used += (len + 5);
+
+   return CACHE_SUCCESS;
+
+#ifdef _WIN32
+}
+__except (EXCEPTION_EXECUTE_HANDLER) {
+
+   DWORD code;
+   char bufferx[256];
+
+   __try {
+      code = GetExceptionCode();
+      sprintf_s(bufferx, 255, "Exception caught in f:mg_add_cgi_variable: %x:%d", code, DBX_TRACE_VAR);
+      mg_log_event(pweb->plog, pweb, bufferx, "Error Condition", 0);
+   }
+   __except (EXCEPTION_EXECUTE_HANDLER) {
+      ;
+   }
+
+   return CACHE_FAILURE;
+}
+#endif
+}
+
+
+int mg_obtain_connection(MGWEB *pweb)
+{
+   DBX_TRACE_INIT(0)
+   int rc, use_existing, idle_time, queue_timeout, server_busy;
+   DBXCON *pcon;
+   char bufferx[256], info[256];
+   MGSRV *psrv;
+   MGPATH *ppath;
+   char *p, *p1, *p2;
+   time_t time_now;
+
+#ifdef _WIN32
+__try {
+#endif
+
+   psrv = pweb->psrv;
+   ppath = pweb->ppath;
+   use_existing = 0;
+   server_busy = 0;
+   bufferx[0] = '\0';
+   info[0] = '\0';
+
+   DBX_TRACE(1)
+
+   mg_enter_critical_section((void *) &mg_global_mutex);
+
+   if (mg_system.psb && ppath) { /* CMT73 pick up changes made by other processes */
+      int n;
+      for (n = 0; ppath->servers[n].psrv; n ++) {
+         mg_sb_get_offline(ppath->servers[n].psrv);
+      }
+   }
+
+   if (pweb->server_no >= 0 && pweb->server_no < 32) { /* server affinity as server number pre-defined */
+      /* v2.1.16 : DB Server can be used if online and must be used if it's marked for exclusive use */
+      if (pweb->server_no < ppath->srv_max && ppath->servers[pweb->server_no].psrv && (ppath->servers[pweb->server_no].psrv->offline == 0 || ppath->servers[pweb->server_no].exclusive)) { /* check server in range and online */
+         psrv = ppath->servers[pweb->server_no].psrv;
+      }
+      else {
+         /* v2.4.24 */
+         if (ppath->servers[pweb->server_no].psrv)
+            sprintf(bufferx, "Preferred DB Server %s not available; offline=%d;", ppath->servers[pweb->server_no].psrv->name, ppath->servers[pweb->server_no].psrv->offline);
+         else
+            sprintf(bufferx, "Preferred DB Server number %d not available", pweb->server_no);
+         pweb->server_no = -1; /* preferred server not available, start again */
+      }
+   }
+   else if (pweb->server_no != -1) {
+      sprintf(bufferx, "Out of range DB Server number %d", pweb->server_no);
+      pweb->server_no = -1; /* bad server number */
+   }
+
+   if (pweb->server_no == -1) {
+      pweb->server_no = mg_obtain_server(pweb, info, 0);
+      if (pweb->server_no == -1) { /* no online servers in list */
+         pweb->server_no = 0;
+         pweb->psrv = ppath->servers[pweb->server_no].psrv;
+         mg_server_online(pweb, NULL, info, 0); /* v2.2.19 */
+         mg_leave_critical_section((void *) &mg_global_mutex);
+         /* v2.4.24 */
+         if (bufferx[0]) {
+            mg_log_event(pweb->plog, pweb, bufferx, "mg_web: connectivity error", 0);
+         }
+         if (info[0]) {
+            mg_log_event(pweb->plog, pweb, info, "mg_web: connectivity", 0);
+         }
+         strcpy(pweb->error, "All available DB Servers are currently offline");
+         return CACHE_FAILURE;
+      }
+      psrv = ppath->servers[pweb->server_no].psrv;
+   }
+
+   if (!pweb->requestno_in) {
+      pweb->requestno_in = mg_system.requestno ++;
+      psrv->no_requests ++;
+   }
+   mg_leave_critical_section((void *) &mg_global_mutex);
+
+   /* CMT57 take a connection from this server's own pool: the global lock is not held */
+   /* CMT58 if all connections are busy the request waits in the server's queue until one is released */
+   queue_timeout = NETX_QUEUE_TIMEOUT;
+   if (psrv->timeout) {
+      queue_timeout = psrv->timeout;
+   }
+   mg_timing_mark(pweb); /* CMT75 */
+   pcon = mg_pool_obtain(psrv, queue_timeout, (pweb->pwsock || pweb->sse || pweb->request_long) ? 1 : 0, &use_existing, &server_busy); /* CMT82 long requests hold the connection while the payload is streamed */
+   mg_timing_add(pweb, MG_TIMING_QUEUE);
+   if (mg_system.psb) { /* CMT73 */
+      mg_sb_publish(psrv, 0);
+   }
+/*
+   {
+      char buffer[256];
+      sprintf(buffer, "pcon=%p; queue_timeout=%d; server_busy=%d;", pcon, queue_timeout, server_busy);
+      mg_log_event(pweb->plog, pweb, buffer, "mg_obtain_connection", 0);
+   }
+*/
+   /* v2.4.24 */
+   if (bufferx[0]) {
+      mg_log_event(pweb->plog, pweb, bufferx, "mg_web: connectivity error", 0);
+   }
+   if (info[0]) {
+      mg_log_event(pweb->plog, pweb, info, "mg_web: connectivity", 0);
+   }
+
+   pweb->psrv = psrv;
+   if (!pcon && server_busy) { /* v2.5.30 */
+      strcpy(pweb->error, "Cannot connect to DB Server - All connections busy");
+      return CACHE_MAXCON;
+   }
+   if (!pcon) {
+      strcpy(pweb->error, "Unable to allocate memory for a new connection");
+      return CACHE_FAILURE;
+   }
+
+   pweb->pcon = pcon;
+   pweb->error[0] = '\0';
+   pweb->error_code = 0;
+   pweb->error_no = 0;
+
+   if (use_existing == 2) { /* CMT72 sharing a multiplexed connection that is already serving other requests */
+      pweb->mux = 1;
+      return CACHE_SUCCESS;
+   }
+
+   /* v2.4.26 */
+   idle_time = 0;
+   time_now = time(NULL);
+   /* CMT59 the pool maintenance thread will normally have refreshed or closed such connections before this point */
+   if (psrv->net_connection == 1 && psrv->idle_timeout && pcon->time_request) { /* v2.4.28 check connetion idle timeout for network connections */
+      idle_time = (int) difftime(time_now, pcon->time_request);
+      if (idle_time > (psrv->idle_timeout - 5)) {
+         if (pweb->plog->log_connections) { /* CMT55 */
+            char buffer[256];
+            sprintf(buffer, "Connection idle time exceeded: DB Server %s (%s:%d) address=%p; socket=%d;", (char *) pcon->psrv->name, (char *) pcon->psrv->ip_address, pcon->psrv->port, pcon, (int) pcon->cli_socket);
+            mg_log_event(pweb->plog, pweb, buffer, "mg_web: connections", 0);
+         }
+         use_existing = 0;
+         netx_tcp_disconnect(pweb, 0);
+/*
+         {
+            char buffer[256];
+            sprintf(buffer, "pcon=%p; (connection within 5 seconds of idle timeout - create new connection idle_timeout=%d;idle_time=%d;)", pcon, psrv->idle_timeout, idle_time);
+            mg_log_event(pweb->plog, pweb, buffer, "mg_obtain_connection", 0);
+         }
+*/
+      }
+   }
+   pcon->time_request = time_now; /* v2.4.26 */
+
+/*
+   {
+      char buffer[256];
+      sprintf(buffer, "pcon=%p; (alloc=%d;inuse=%d;use_existing=%d;net_connection=%d;idle_time=%d)", pcon, pcon->alloc, pcon->inuse, use_existing, psrv->net_connection, idle_time);
+      mg_log_event(pweb->plog, pweb, buffer, "mg_obtain_connection", 0);
+   }
+*/
+
+   if (use_existing) {
+      if (pcon->psrv->offline == 2) { /* v2.2.20 */
+         char buffer[256];
+         sprintf(buffer, "Previously offline DB Server %s is due for a health check; marking as online", pweb->psrv ? pweb->psrv->name : "null");
+         mg_log_event(pweb->plog, pweb, buffer, "mg_web: information", 0);
+         mg_server_online(pweb, pcon->psrv, info, 0);
+         if (info[0]) {
+            mg_log_event(pweb->plog, pweb, info, "mg_web: connectivity", 0);
+         }
+      }
+      if (pweb->plog->log_connections == 2) { /* CMT55 */
+         char buffer[256];
+         sprintf(buffer, "Connection reused: DB Server %s (%s:%d) address=%p; socket=%d;", (char *) pcon->psrv->name, (char *) pcon->psrv->ip_address, pcon->psrv->port, pcon, (int) pcon->cli_socket);
+         mg_log_event(pweb->plog, pweb, buffer, "mg_web: connections", 0);
+      }
+      if (pcon->mux_max > 1 && !pweb->pwsock && !pweb->sse && !pweb->request_long) { /* CMT72 open the connection to other requests */
+         mg_pool_mux_link(psrv, pcon);
+         pweb->mux = 1;
+      }
+      return CACHE_SUCCESS;
+   }
+
+   pcon->connected = 0;
+   /* pcon->closed = 0; v2.8.42 */
+   pcon->timeout = psrv->timeout;
+   pcon->current_timeout = 0;
+
+/*
+   {
+      char buffer[256];
+      sprintf(buffer, "pcon=%p; shdir=%p; ip_address=%p; port=%d;", pcon, psrv->shdir, psrv->ip_address, psrv->port);
+      mg_log_event(pweb->plog, pweb, buffer, "mg_obtain_connection : New Connection", 0);
+   }
+*/
+
+   pcon->p_isc_so = NULL;
+   pcon->p_ydb_so = NULL;
+   pcon->psrv = psrv;
+   pcon->p_db_mutex = &pcon->db_mutex;
+   mg_mutex_create(pcon->p_db_mutex);
+   pcon->p_zv = &pcon->zv;
+
+   pcon->pid = 0;
+  
+   if (pcon->psrv->penv) {
+      p = (char *) pcon->psrv->penv->p_buffer;
+      p2 = strstr(p, "\n");
+      while (p2) {
+         *p2 = '\0';
+         p1 = strstr(p, "=");
+         if (p1) {
+            *p1 = '\0';
+            p1 ++;
+#if defined(_WIN32)
+            SetEnvironmentVariable((LPCTSTR) p, (LPCTSTR) p1);
+#else
+            /* printf("\nLinux : environment variable p=%s p1=%s;", p, p1); */
+            setenv(p, p1, 1);
+#endif
+         }
+         else {
+            break;
+         }
+         p = p2 + 1;
+         p2 = strstr(p, "\n");
+      }
+   }
+
+   if (!pcon->psrv->dbtype) {
+      strcpy(pweb->error, "Unable to determine the database type");
+      rc = CACHE_NOCON;
+      mg_pool_release(pcon, 1); /* CMT57 */
+      pweb->pcon = NULL;
+      return rc;
+   }
+
+   mg_timing_mark(pweb); /* CMT75 */
+   rc = mg_connect(pweb, 0);
+   mg_timing_add(pweb, MG_TIMING_CONNECT);
+
+   if (rc == CACHE_SUCCESS) {
+      if (pcon->psrv->offline == 2) { /* v2.2.20 */
+         char buffer[256];
+         sprintf(buffer, "Previously offline DB Server %s has passed its health check; marking as online", pweb->psrv ? pweb->psrv->name : "null");
+         mg_log_event(pweb->plog, pweb, buffer, "mg_web: information", 0);
+         mg_server_online(pweb, pcon->psrv, info, 0);
+         if (info[0]) {
+            mg_log_event(pweb->plog, pweb, info, "mg_web: connectivity", 0);
+         }
+      }
+      if (pweb->plog->log_connections) { /* CMT55 */
+         char buffer[256];
+         sprintf(buffer, "Connection created: DB Server %s (%s:%d) address=%p; socket=%d;", (char *) pcon->psrv->name, (char *) pcon->psrv->ip_address, pcon->psrv->port, pcon, (int) pcon->cli_socket);
+         mg_log_event(pweb->plog, pweb, buffer, "mg_web: connections", 0);
+      }
+      if (pcon->mux_max > 1 && !pweb->pwsock && !pweb->sse && !pweb->request_long) { /* CMT72 CMT82 */
+         mg_pool_mux_link(psrv, pcon);
+         pweb->mux = 1;
+      }
+   }
+   else {
+      mg_pool_release(pcon, 1); /* CMT57 */
+      pweb->pcon = NULL;
+   }
+
+   return rc;
+
+#ifdef _WIN32
+}
+__except (EXCEPTION_EXECUTE_HANDLER) {
+
+   DWORD code;
+   char bufferx[256];
+
+   __try {
+      code = GetExceptionCode();
+      sprintf_s(bufferx, 255, "Exception caught in f:mg_obtain_connection: %x:%d", code, DBX_TRACE_VAR);
+      mg_log_event(pweb->plog, pweb, bufferx, "Error Condition", 0);
+   }
+   __except (EXCEPTION_EXECUTE_HANDLER) {
+      ;
+   }
+
+   return 0;
+}
+#endif
+}
+
+
+int mg_obtain_server(MGWEB *pweb, char *info, int context)
+{
+   DBX_TRACE_INIT(0)
+   int server_no, server_no_start;
+   time_t time_now;
+
+#ifdef _WIN32
+__try {
+#endif
+
+   time_now = time(NULL);
+   server_no_start = pweb->ppath->server_no;
+   server_no = -1;
+   DBX_TRACE(1)
+   while (server_no == -1) {
+
+      /* v2.1.16 */
+/*
+      {
+         char buffer[256];
+         sprintf(buffer, "pweb->ppath->server_no=%d; psrv->offline=%d; psrv->health_check=%d; exclusive=%d; time_offline=%d", pweb->ppath->server_no, pweb->ppath->servers[pweb->ppath->server_no].psrv->offline, pweb->ppath->servers[pweb->ppath->server_no].psrv->health_check, pweb->ppath->servers[pweb->ppath->server_no].exclusive, pweb->ppath->servers[pweb->ppath->server_no].psrv->offline ? (int) difftime(time_now, pweb->ppath->servers[pweb->ppath->server_no].psrv->time_offline) : 0);
+         mg_log_event(pweb->plog, pweb, buffer, "mg_obtain_server", 0);
+      }
+*/
+      /* v2.2.20 */
+      if (pweb->ppath->servers[pweb->ppath->server_no].exclusive == 0) {
+         if (pweb->ppath->servers[pweb->ppath->server_no].psrv->offline == 1 && pweb->ppath->servers[pweb->ppath->server_no].psrv->health_check > 0 && difftime(time_now, pweb->ppath->servers[pweb->ppath->server_no].psrv->time_offline) > pweb->ppath->servers[pweb->ppath->server_no].psrv->health_check) {
+
+            DBX_TRACE(2)
+            if (info) {
+               sprintf(info, "Retry DB Server %s; number=%d; health_check=%d; time_offline=%d;", pweb->ppath->servers[pweb->ppath->server_no].psrv->name, pweb->ppath->server_no, pweb->ppath->servers[pweb->ppath->server_no].psrv->health_check, (int) difftime(time_now, pweb->ppath->servers[pweb->ppath->server_no].psrv->time_offline));
+            }
+            pweb->ppath->servers[pweb->ppath->server_no].psrv->time_offline = time(NULL); /* push time offline forward so only this request tries */
+            mg_sb_set_offline(pweb->ppath->servers[pweb->ppath->server_no].psrv); /* CMT73 and only this process */
+            pweb->ppath->servers[pweb->ppath->server_no].psrv->offline = 2; /* indicate that we're retrying this offline server */
+            server_no = pweb->ppath->server_no;
+         }
+         else if (pweb->ppath->servers[pweb->ppath->server_no].psrv->offline == 0) { /* server online so we can use it */
+            DBX_TRACE(3)
+            server_no = pweb->ppath->server_no;
+         }
+      }
+/*
+      if (pweb->ppath->servers[pweb->ppath->server_no].psrv->offline == 0 && pweb->ppath->servers[pweb->ppath->server_no].exclusive == 0) {
+         server_no = pweb->ppath->server_no;
+      }
+*/
+      DBX_TRACE(4)
+      if (pweb->ppath->load_balancing || pweb->ppath->servers[pweb->ppath->server_no].psrv->offline > 0) { /* increment core server number if one is offline or load balancing is on */
+         pweb->ppath->server_no ++;
+         if (!pweb->ppath->servers[pweb->ppath->server_no].psrv) {
+            pweb->ppath->server_no = 0;
+         }
+      }
+      if (pweb->ppath->server_no == server_no_start) { /* all servers examined */
+         break;
+      }
+   }
+
+   DBX_TRACE(10)
+   return server_no;
+
+#ifdef _WIN32
+}
+__except (EXCEPTION_EXECUTE_HANDLER) {
+
+   DWORD code;
+   char bufferx[256];
+
+   __try {
+      code = GetExceptionCode();
+      sprintf_s(bufferx, 255, "Exception caught in f:mg_obtain_server: %x:%d", code, DBX_TRACE_VAR);
+      mg_log_event(pweb->plog, pweb, bufferx, "Error Condition", 0);
+   }
+   __except (EXCEPTION_EXECUTE_HANDLER) {
+      ;
+   }
+
+   return -1;
+}
+#endif
+}
+
+
+int mg_server_offline(MGWEB *pweb, MGSRV *psrv, char *info, int context)
+{
+   DBX_TRACE_INIT(0)
+   int mux;
+   DBXCON *pcon, *pcon_next, *pcon_request;
+
+#ifdef _WIN32
+__try {
+#endif
+
+   if (context == 10) { /* from admin */
+      if (!psrv) {
+         return -1;
+      }
    }
-   if (cvalue.pstr) {
-      pcon->p_isc_so->p_CacheExStrKill(&(cvalue.zstr));
+   else {
+      if (!psrv || !pweb->ppath) {
+         return -1;
+      }
+      if (!pweb->ppath->servers[1].psrv) { /* only one server, therefore no failover */
+         return -1;
+      }
+      if (mg_server_alternatives(pweb, psrv, info, context) == 0) { /* CMT51 no viable alternatives */
+         return -1;
+      }
    }
 
-   return rc;
+   DBX_TRACE(1)
+   /* block new connections to this server */
+   mg_enter_critical_section((void *) &mg_global_mutex);
 
-#else
+   psrv->offline = 1;
+   psrv->time_offline = time(NULL); /* v2.2.20 */
+   mg_sb_set_offline(psrv); /* CMT73 */
 
-   int rc;
-   char global[32];
-   unsigned long ne;
-   DBXCVAL cvalue;
-   DBXCON *pcon;
+   mg_leave_critical_section((void *) &mg_global_mutex);
 
-   pcon = pweb->pcon;
-   strcpy(global, "mgweb");
+   /* v2.4.24 */
+   if (info) {
+      sprintf(info, "DB Server %s marked offline; context=%d;", psrv->name, context);
+   }
 
-   if (chunk_no == 1) {
-      rc = pcon->p_isc_so->p_CachePushGlobal((int) strlen(global), (const Callin_char_t *) global);
-      if (rc == CACHE_SUCCESS) {
-         rc = pcon->p_isc_so->p_CachePushStr((int) strlen(pweb->key), (Callin_char_t *) pweb->key);
-         if (rc == CACHE_SUCCESS) {
-            rc = pcon->p_isc_so->p_CacheGlobalKill(1, 0);
-/*
-            {
-               char bufferx[1024];
-               sprintf(bufferx, "mg_write_chunk_isc: p_CacheGlobalKill=%d; chunk_no=%d; key=%s", rc, chunk_no, pweb->key);
-               mg_log_event(pweb->plog, pweb, bufferx, "mg_write_chunk_isc", 0);
-            }
-*/
-         }
-      }
+   DBX_TRACE(2)
+   /* CMT57 close the idle network connections held in this server's pool */
+   pcon_request = pweb->pcon;
+   mux = pweb->mux; /* CMT72 idle connections are not shared */
+   pweb->mux = 0;
+   pcon = mg_pool_drain(psrv);
+   while (pcon) {
+      pcon_next = pcon->pnext_pool;
+      DBX_TRACE(3)
+      pweb->pcon = pcon;
+      mg_release_connection(pweb, 1);
+      pcon = pcon_next;
    }
+   pweb->pcon = pcon_request;
+   pweb->mux = mux;
+   DBX_TRACE(10)
 
-   rc = pcon->p_isc_so->p_CachePushGlobal((int) strlen(global), (const Callin_char_t *) global);
-   if (rc == CACHE_SUCCESS) {
-      rc = pcon->p_isc_so->p_CachePushStr((int) strlen(pweb->key), (Callin_char_t *) pweb->key);
-      if (rc == CACHE_SUCCESS) {
-         rc = pcon->p_isc_so->p_CachePushInt((int) chunk_no);
-         if (rc == CACHE_SUCCESS) {
-            cvalue.pstr = (void *) pcon->p_isc_so->p_CacheExStrNew((CACHE_EXSTRP) &(cvalue.zstr), netbuf_used + 1);
-            if (cvalue.pstr) {
-               for (ne = 0; ne < netbuf_used; ne ++) {
-                  cvalue.zstr.str.ch[ne] = (char) netbuf[ne];
-               }
-               cvalue.zstr.str.ch[ne] = (char) 0;
-               cvalue.zstr.len = netbuf_used;
-               rc = pcon->p_isc_so->p_CachePushExStr((CACHE_EXSTRP) &(cvalue.zstr));
-               if (rc == CACHE_SUCCESS) {
-                  rc = pcon->p_isc_so->p_CacheGlobalSet(2);
-/*
-                  {
-                     char bufferx[1024];
-                     sprintf(bufferx, "mg_write_chunk_isc: p_CacheGlobalSet=%d; chunk_no=%d; key=%s", rc, chunk_no, pweb->key);
-                     mg_log_event(pweb->plog, pweb, bufferx, "mg_write_chunk_isc", 0);
-                  }
-*/
-               }
-            }
-         }
-      }
+   return 0;
+
+#ifdef _WIN32
+}
+__except (EXCEPTION_EXECUTE_HANDLER) {
+
+   DWORD code;
+   char bufferx[256];
+
+   __try {
+      code = GetExceptionCode();
+      sprintf_s(bufferx, 255, "Exception caught in f:mg_server_offline: %x:%d", code, DBX_TRACE_VAR);
+      mg_log_event(pweb->plog, pweb, bufferx, "Error Condition", 0);
    }
-   if (cvalue.pstr) {
-      pcon->p_isc_so->p_CacheExStrKill(&(cvalue.zstr));
+   __except (EXCEPTION_EXECUTE_HANDLER) {
+      ;
    }
 
-   return rc;
-
+   return 0;
+}
 #endif
 }
 
 
-int mg_write_chunk_ydb(MGWEB *pweb, unsigned char *netbuf, unsigned int netbuf_used, int chunk_no)
+/* v2.2.19 */
+int mg_server_online(MGWEB *pweb, MGSRV *psrv, char *info, int context)
 {
-#if 1
+   DBX_TRACE_INIT(0)
+   int server_no;
 
-   int rc, option;
-   char label[32], param[32], obuffer[32];
-   DBXFUN fun;
-   DBXCON *pcon;
-   ydb_string_t out, in1, in2, in3;
+#ifdef _WIN32
+__try {
+#endif
 
-   pcon = pweb->pcon;
-/*
-   {
-      char bufferx[1024];
-      sprintf(bufferx, "mg_write_chunk_ydb: chunk_no=%d; key=%s", chunk_no, pweb->key);
-      mg_log_buffer(pweb->plog, pweb, (char *) netbuf, 32, bufferx, 0);
+   if (psrv) { /* just mark one server as online */
+      if (context) {
+         /* block new connections to this server */
+         mg_enter_critical_section((void *) &mg_global_mutex);
+      }
+      psrv->offline = 0;
+      mg_sb_set_offline(psrv); /* CMT73 */
+      if (context) {
+         mg_leave_critical_section((void *) &mg_global_mutex);
+      }
+
+      /* v2.4.24 */
+      if (info) {
+         sprintf(info, "DB Server %s marked online; context=%d;", psrv->name, context);
+      }
+
+      return 0;
    }
-*/
-   /* dbxwebsn(key,cn,data,option) */
-   rc = CACHE_SUCCESS;
-   option = 0;
-   sprintf(param, "websn:%d:%d", chunk_no, option);
-   strcpy(label, "ifc_zmgsis");
-   fun.label = label;
-   fun.label_len = (int) strlen(label);
 
-   out.address = (char *) obuffer;
-   out.length = (unsigned long) sizeof(obuffer);
-   in1.address = (char *) pweb->key;
-   in1.length = (unsigned long) strlen(pweb->key);
-   in2.address = (char *) (netbuf + 5);
-   in2.length = (unsigned long) (netbuf_used - 5);
-   in3.address = (char *) param;
-   in3.length = (unsigned long) strlen(param);
+   if (!pweb->ppath) {
+      return -1;
+   }
+   if (!pweb->ppath->servers[1].psrv) { /* only one server, therefore no server list for failover */
+      return -1;
+   }
+   if (mg_server_alternatives(pweb, psrv, info, context) == 0) { /* CMT51 no viable alternatives */
+      return -1;
+   }
 
-   rc = pcon->p_ydb_so->p_ydb_ci(fun.label, &out, &in1, &in2, &in3);
-/*
-   {
-      char bufferx[1024];
-      sprintf(bufferx, "mg_write_chunk_ydb: rc=%d; chunk_no=%d; key=%s", rc, chunk_no, pweb->key);
-      mg_log_event(pweb->plog, pweb, bufferx, "mg_write_chunk_isc", 0);
+   if (context) {
+      /* block new connections to this server */
+      mg_enter_critical_section((void *) &mg_global_mutex);
+   }
+   for (server_no = 0; pweb->ppath->servers[server_no].psrv; server_no ++) {
+      pweb->ppath->servers[server_no].psrv->offline = 0;
+      mg_sb_set_offline(pweb->ppath->servers[server_no].psrv); /* CMT73 */
+   }
+   pweb->ppath->server_no = 0;
+   if (context) {
+      mg_leave_critical_section((void *) &mg_global_mutex);
+   }
+
+   /* v2.4.24 */
+   if (info) {
+      sprintf(info, "All DB Servers marked online; context=%d;", context);
    }
+
+/*
+   mg_log_event(pweb->plog, pweb, "Mark all servers for this path as 'online' following an 'All DB Servers offline' event", "mg_server_online", 0);
 */
-   return rc;
 
-#else
+   return 0;
 
-   int rc;
-   char global[32], buffer[32];
-   DBXCON *pcon;
-   ydb_buffer_t subs[4], glo, data;
+#ifdef _WIN32
+}
+__except (EXCEPTION_EXECUTE_HANDLER) {
 
-   pcon = pweb->pcon;
-   strcpy(global, "^mgweb");
+   DWORD code;
+   char bufferx[256];
 
-   glo.buf_addr = (char *) global;
-   glo.len_used = (unsigned long) strlen(global);
-   glo.len_alloc = glo.len_used;
+   __try {
+      code = GetExceptionCode();
+      sprintf_s(bufferx, 255, "Exception caught in f:mg_server_online: %x:%d", code, DBX_TRACE_VAR);
+      mg_log_event(pweb->plog, pweb, bufferx, "Error Condition", 0);
+   }
+   __except (EXCEPTION_EXECUTE_HANDLER) {
+      ;
+   }
 
-   if (chunk_no == 1) {
-      subs[0].buf_addr = (char *) pweb->key;
-      subs[0].len_used = (unsigned long) strlen(pweb->key);
-      subs[0].len_alloc = subs[0].len_used;
+   return 0;
+}
+#endif
+}
+
+/* CMT51 */
+int mg_server_alternatives(MGWEB *pweb, MGSRV *psrv, char *info, int context)
+{
+   DBX_TRACE_INIT(0)
+   int n, nalt;
+
+#ifdef _WIN32
+__try {
+#endif
+
+   if (!pweb->ppath) {
+      return 0;
+   }
+   if (!pweb->ppath->servers[1].psrv) { /* only one server, therefore no server list for failover */
+      return 0;
+   }
+
+   nalt = 0;
+   for (n = 0; pweb->ppath->servers[n].psrv; n ++) {
+      if (n < 32) {
+         if (pweb->ppath->servers[n].exclusive == 0) {
+            nalt ++;
+         }
+      }
+      else {
+         break;
+      }
+   }
+
+   if (nalt > 0) {
+      nalt --; /* discounting the current server */
+   }
 
-      rc = pcon->p_ydb_so->p_ydb_delete_s(&glo, 1, &subs[0], YDB_DEL_TREE);
+/*
+   {
+      char buffer[256];
+      sprintf(buffer, "Number of possible alternative servers in configuration: %d", nalt);
+      mg_log_event(pweb->plog, pweb, buffer, "Alternative Servers", 0);
    }
+*/
 
-   sprintf(buffer, "%d", chunk_no);
-   subs[0].buf_addr = (char *) pweb->key;
-   subs[0].len_used = (unsigned long) strlen(pweb->key);
-   subs[0].len_alloc = subs[0].len_used;
-   subs[1].buf_addr = (char *) buffer;
-   subs[1].len_used = (unsigned long) strlen(buffer);
-   subs[1].len_alloc = subs[1].len_used;
+   return nalt;
 
-   data.buf_addr = (char *) netbuf;
-   data.len_used = (unsigned long) netbuf_used;
-   data.len_alloc = data.len_used;
+#ifdef _WIN32
+}
+__except (EXCEPTION_EXECUTE_HANDLER) {
 
-   rc = pcon->p_ydb_so->p_ydb_set_s(&glo, 2, &subs[0], &data);
+   DWORD code;
+   char bufferx[256];
 
-   return rc;
+   __try {
+      code = GetExceptionCode();
+      sprintf_s(bufferx, 255, "Exception caught in f:mg_server_alternatives: %x:%d", code, DBX_TRACE_VAR);
+      mg_log_event(pweb->plog, pweb, bufferx, "Error Condition", 0);
+   }
+   __except (EXCEPTION_EXECUTE_HANDLER) {
+      ;
+   }
 
+   return 0;
+}
 #endif
 }
 
-/* CMT53 */
-char * mg_web_response_headers_buffer(MGWEB *pweb, int size, int context)
+
+int mg_connect(MGWEB *pweb, int context)
 {
-   int headers_alloc;
-   char *response_headers;
    DBX_TRACE_INIT(0)
+   int rc, con_retry_no, con_retry_time;
+   char bufferx[256];
+   DBXCON *pcon;
+   time_t time_start, time_now;
 
 #ifdef _WIN32
 __try {
 #endif
 
-   response_headers = NULL;
-   headers_alloc = (int) (pweb->output_val.svalue.len_alloc - (pweb->output_val.svalue.len_used + 4));
-   if (size < headers_alloc) {
-      response_headers = (char *) pweb->output_val.svalue.buf_addr + (pweb->output_val.svalue.len_used + 4);
+   /* v2.4.25 */
+   time_start = time(NULL);
+   con_retry_no = 0;
+   con_retry_time = 0;
+   pweb->mg_connect_failed = 0;
+   pcon = pweb->pcon;
+
+   rc = CACHE_SUCCESS;
+   if (!pcon->psrv->shdir && pcon->psrv->ip_address && pcon->psrv->port) {
+
+      while (1) {
+         rc = netx_tcp_connect(pweb, 0);
+/*
+         {
+            char buffer[256];
+            sprintf(buffer, "network rc=%d;", rc);
+            mg_log_event(pweb->plog, pweb, buffer, "mg_connect: New Connection", 0);
+         }
+*/
+         if (rc == CACHE_SUCCESS) {
+            rc = netx_tcp_handshake(pweb, 0);
+/*
+            {
+               char buffer[256];
+               sprintf(buffer, "network handshake rc=%d;", rc);
+               mg_log_event(pweb->plog, pweb, buffer, "mg_connect: New Connection", 0);
+            }
+*/
+            if (rc == CACHE_SUCCESS) {
+               break;
+            }
+         }
+         /* see if we can retry connecting */
+         con_retry_no ++;
+         if (pcon->psrv->con_retry_no > 0 && con_retry_no > pcon->psrv->con_retry_no) {
+            con_retry_no = pcon->psrv->con_retry_no;
+            sprintf(bufferx, "Cannot connect to DB Server %s (%s:%d) after %d %s", pcon->psrv->name, pcon->psrv->ip_address, pcon->psrv->port, con_retry_no, con_retry_no == 1 ? "attempt" : "attempts");
+            mg_log_event(pweb->plog, pweb, bufferx, "mg_connect: new connection attempt", 0);
+            break;
+         }
+         else if (pcon->psrv->con_retry_time > 0) {
+            time_now = time(NULL);
+            con_retry_time = (int) difftime(time_now, time_start);
+            if (con_retry_time > pcon->psrv->con_retry_time) {
+               sprintf(bufferx, "Cannot connect to DB Server %s (%s:%d) after %d seconds", pcon->psrv->name, pcon->psrv->ip_address, pcon->psrv->port, con_retry_time);
+               mg_log_event(pweb->plog, pweb, bufferx, "mg_connect: new connection attempt", 0);
+               break;
+            }
+         }
+         else {
+            sprintf(bufferx, "Cannot connect to DB Server %s (%s:%d)  after %d %s", pcon->psrv->name, pcon->psrv->ip_address, pcon->psrv->port, con_retry_no, con_retry_no == 1 ? "attempt" : "attempts");
+            mg_log_event(pweb->plog, pweb, bufferx, "mg_connect: new connection attempt", 0);
+            break;
+         }
+         /* backoff slightly after each retry */
+         /* CMT82 but give up if the worker is closing */
+         if (mg_pool_maintenance_wait((unsigned long) (con_retry_no < 5 ? (con_retry_no * 1000) : 5000))) {
+            break;
+         }
+      }
+
+      if (rc != CACHE_SUCCESS) {
+         pweb->mg_connect_failed = 1;
+         pcon->alloc = 0;
+         pcon->connected = 0; /* v2.8.42 */
+         /* pcon->closed = 1; v2.8.42 */
+         rc = CACHE_NOCON;
+         mg_error_message(pweb, rc);
+         return rc;
+      }
+ 
+      pcon->alloc = 1;
+      pcon->connected = 1; /* network connection */
+      return rc;
+   }
+
+   if (!pcon->psrv->shdir) {
+      strcpy(pweb->error, "Unable to determine the path to the database installation");
+      rc = CACHE_NOCON;
+      return rc;
+   }
+
+   pcon->use_db_mutex = 1;
+
+   DBX_LOCK(0);
+   if (pcon->psrv->dbtype != DBX_DBTYPE_YOTTADB) {
+      rc = isc_open(pweb);
+
+      if (rc == CACHE_SUCCESS) {
+         pcon->alloc = 1;
+      }
+      else {
+         pcon->alloc = 0;
+      }
    }
    else {
-      pweb->response_headers_long = (char *) mg_malloc(pweb->pweb_server, size + DBX_HEADER_MARGIN, MG_MID_RESPHEADER);
-      if (pweb->response_headers_long) {
-         response_headers = pweb->response_headers_long;
+      rc = ydb_open(pweb);
+
+      if (rc == CACHE_SUCCESS) {
+         pcon->alloc = 1;
+      }
+      else {
+         pcon->alloc = 0;
       }
    }
+   DBX_UNLOCK();
 
-   return response_headers;
+   if (pcon->alloc) {
+      return CACHE_SUCCESS;
+   }
+   else {
+      pweb->mg_connect_failed = 1;
+      return CACHE_NOCON;
+   }
 
 #ifdef _WIN32
 }
@@ -2183,82 +5149,112 @@ __except (EXCEPTION_EXECUTE_HANDLER) {
 
    __try {
       code = GetExceptionCode();
-      sprintf_s(bufferx, 255, "Exception caught in f:mg_web_response_headers_buffer: %x:%d (context=%d)", code, DBX_TRACE_VAR, context);
+      sprintf_s(bufferx, 255, "Exception caught in f:mg_connect: %x:%d", code, DBX_TRACE_VAR);
       mg_log_event(pweb->plog, pweb, bufferx, "Error Condition", 0);
    }
    __except (EXCEPTION_EXECUTE_HANDLER) {
       ;
    }
 
-   return NULL;
+   return CACHE_NOCON;
 }
 #endif
 }
 
 
-int mg_web_http_error(MGWEB *pweb, int http_status_code, int custompage)
+int mg_release_connection(MGWEB *pweb, int close_connection)
 {
    DBX_TRACE_INIT(0)
-   char *custompage_url;
-   char buffer[64];
+   int rc;
+   DBXCON *pcon;
 
 #ifdef _WIN32
 __try {
 #endif
 
-   if (!pweb || !pweb->output_val.svalue.buf_addr) { /* CMT52 */
-      return -1;
-   }
+   pcon = pweb->pcon;
 
-   if (!pweb->response_headers) { /* CMT52 */
-      return -1;
+   if (!pcon) {
+      return CACHE_FAILURE;
    }
 
-   custompage_url = NULL;
-   if (custompage > MG_CUSTOMPAGE_DBSERVER_NONE) {
-      DBX_TRACE(1)
-      if (custompage == MG_CUSTOMPAGE_DBSERVER_UNAVAILABLE && mg_system.custompage_dbserver_unavailable)
-         custompage_url =  mg_system.custompage_dbserver_unavailable;
-      else if (custompage == MG_CUSTOMPAGE_DBSERVER_BUSY && mg_system.custompage_dbserver_busy)
-         custompage_url =  mg_system.custompage_dbserver_busy;
-      else if (custompage == MG_CUSTOMPAGE_DBSERVER_DISABLED && mg_system.custompage_dbserver_disabled)
-         custompage_url =  mg_system.custompage_dbserver_disabled;
-      else if (custompage == MG_CUSTOMPAGE_DBSERVER_TIMEOUT && mg_system.custompage_dbserver_timeout) /* v2.7.33 */
-         custompage_url =  mg_system.custompage_dbserver_timeout;
-
-      if (custompage_url) {
-         DBX_TRACE(2)
-         if (pweb->request_method && !strcmp(pweb->request_method, "POST"))
-            sprintf(pweb->response_headers, "HTTP/1.1 301 Moved Permanently\r\nLocation: %s\r\nConnection: close\r\n\r\n", custompage_url);
-         else
-            sprintf(pweb->response_headers, "HTTP/1.1 307 Temporary Redirect\r\nLocation: %s\r\nConnection: close\r\n\r\n", custompage_url);
-         pweb->response_headers_len = (int) strlen(pweb->response_headers);
-         return 0;
+   rc = CACHE_SUCCESS;
+   if (pweb->mux) { /* CMT72 the last request to finish with a multiplexed connection releases it */
+      mg_mux_end(pweb, close_connection);
+      pweb->mux = 0;
+      if (!mg_pool_mux_release(pcon)) {
+         return rc;
+      }
+      close_connection = pcon->mux_broken;
+   }
+   if (close_connection == 0) {
+      if (pweb->plog->log_connections == 2) { /* CMT55 */
+         char buffer[256];
+         sprintf(buffer, "Connection released: DB Server %s (%s:%d) address=%p; socket=%d;", (char *) pcon->psrv->name, (char *) pcon->psrv->ip_address, pcon->psrv->port, pcon, (int) pcon->cli_socket);
+         mg_log_event(pweb->plog, pweb, buffer, "mg_web: connections", 0);
       }
+      mg_pool_release(pcon, 0); /* CMT57 */
+      if (mg_system.psb) { /* CMT73 */
+         mg_sb_publish(pcon->psrv, 0);
+      }
+      return rc;
    }
 
-   DBX_TRACE(10)
-   /* v2.7.33 504 Gateway Timeout (wating for the DB Server) ; 408 Request Timeout (wating for the client) */
-   if (http_status_code == 504) {
-      sprintf(pweb->response_headers, "HTTP/1.1 %d Gateway Timeout\r\nConnection: close", http_status_code);
+   if (pcon->psrv->net_connection) { /* v2.8.42 */
+      DBX_TRACE(10)
+      rc = netx_tcp_disconnect(pweb, 0);
+      DBX_TRACE(11)
    }
-   else if (http_status_code == 408) {
-      sprintf(pweb->response_headers, "HTTP/1.1 %d Request Timeout\r\nConnection: close", http_status_code);
+   else if (pcon->psrv->dbtype == DBX_DBTYPE_YOTTADB) {
+      DBX_TRACE(20)
+      if (pcon->p_ydb_so->loaded) {
+         rc = pcon->p_ydb_so->p_ydb_exit();
+         /* printf("\r\np_ydb_exit=%d\r\n", rc); */
+      }
+
+      strcpy(pweb->error, "");
+
+      if (pcon->p_ydb_so) { /* v2.8.39 */
+/*
+         mg_dso_unload(pcon->p_ydb_so->p_library); 
+         pcon->p_ydb_so->p_library = NULL;
+         pcon->p_ydb_so->loaded = 0;
+*/
+         strcpy(pcon->p_ydb_so->libdir, "");
+         strcpy(pcon->p_ydb_so->libnam, "");
+      }
    }
    else {
-      sprintf(pweb->response_headers, "HTTP/1.1 %d Internal Server Error\r\nConnection: close", http_status_code);
-   }
-   if (pweb->response_clen >= 0) {
-      sprintf(buffer, "\r\nContent-Length: %d\r\n\r\n", pweb->response_clen);
+      DBX_TRACE(30)
+      if (pcon->p_isc_so->loaded) {
+         DBX_LOCK(0);
+         rc = pcon->p_isc_so->p_CacheEnd();
+         DBX_UNLOCK();
+      }
+
+      strcpy(pweb->error, "");
+
+      if (pcon->p_isc_so) { /* v2.8.39 */
+         mg_dso_unload(pcon->p_isc_so->p_library); 
+
+         pcon->p_isc_so->p_library = NULL;
+         pcon->p_isc_so->loaded = 0;
+
+         strcpy(pcon->p_isc_so->libdir, "");
+         strcpy(pcon->p_isc_so->libnam, "");
+      }
    }
-   else {
-      strcpy(buffer, "\r\n\r\n");
+
+   DBX_TRACE(90)
+
+   pcon->connected = 0;
+   /* pcon->closed = 1; v2.8.42 */
+   mg_pool_release(pcon, 1); /* CMT57 */
+   if (mg_system.psb && pcon->psrv) { /* CMT73 */
+      mg_sb_publish(pcon->psrv, 0);
    }
-   DBX_TRACE(20)
-   strcat(pweb->response_headers, buffer);
-   pweb->response_headers_len = (int) strlen(pweb->response_headers);
 
-   return 0;
+   return rc;
 
 #ifdef _WIN32
 }
@@ -2269,7 +5265,7 @@ __except (EXCEPTION_EXECUTE_HANDLER) {
 
    __try {
       code = GetExceptionCode();
-      sprintf_s(bufferx, 255, "Exception caught in f:mg_web_http_error: %x:%d (memory allocated=%d; used=%d)", code, DBX_TRACE_VAR, pweb->output_val.svalue.len_alloc, pweb->output_val.svalue.len_used);
+      sprintf_s(bufferx, 255, "Exception caught in f:mg_release_connection: %x:%d", code, DBX_TRACE_VAR);
       mg_log_event(pweb->plog, pweb, bufferx, "Error Condition", 0);
    }
    __except (EXCEPTION_EXECUTE_HANDLER) {
@@ -2282,1167 +5278,1656 @@ __except (EXCEPTION_EXECUTE_HANDLER) {
 }
 
 
-int mg_web_simple_response(MGWEB *pweb, char *text, char *error, int context)
+/* CMT57 Per-server connection pool: idle connections are held on a stack owned by their MGSRV so that obtaining and releasing a connection is O(1) and only serializes with requests for the same DB Server */
+
+int mg_pool_create(MGSRV *psrv)
 {
-   int len;
-   char *p;
-   char buffer[64], response[256];
+   memset((void *) &(psrv->pool), 0, sizeof(MGPOOL));
 
-   p = NULL;
-   len = 0;
-   if (context == 0) {
-      if (text) {
-         p = text;
-         len = (int) strlen(text);
-      }
-      else if (error) {
-         p = error;
-         len = (int) strlen(error);
-      }
-      strcpy(pweb->response_headers, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nConnection: close\r\n");
+#if defined(_WIN32)
+   InitializeCriticalSection(&(psrv->pool.lock));
+#else
+   pthread_mutex_init(&(psrv->pool.lock), NULL);
+#endif
 
-      if (len) {
-         sprintf(buffer, "Content-Length: %d\r\n\r\n", len);
-      }
-      else {
-         strcpy(buffer, "\r\n");
-      }
-      strcat(pweb->response_headers, buffer);
-      pweb->response_headers_len = (int) strlen(pweb->response_headers);
-   }
-   else {
-      sprintf(response, "{\r\n   \"ok\": %d,\r\n   \"result\": \"%s\",\r\n   \"error\": \"%s\"\r\n}\r\n", error ? 0 : 1, text ? text : "", error ? error : "");
-      len = (int) strlen(response);
-      p = response;
+   psrv->pool.created = 1;
 
-      strcpy(pweb->response_headers, "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nConnection: close\r\n");
+   return 0;
+}
 
-      if (len) {
-         sprintf(buffer, "Content-Length: %d\r\n\r\n", len);
-         strcat(pweb->response_headers, buffer);
-      }
-      else {
-         strcpy(buffer, "\r\n");
-      }
-      strcat(pweb->response_headers, buffer);
-      pweb->response_headers_len = (int) strlen(pweb->response_headers);
-   }
 
-   mg_submit_headers(pweb);
-   if (p) {
-      mg_client_write(pweb, (unsigned char *) p, (int) len, 109);
+int mg_pool_destroy(MGSRV *psrv)
+{
+   if (!psrv->pool.created) {
+      return 0;
    }
-   return CACHE_SUCCESS;
+
+   mg_enter_critical_section((void *) &(psrv->pool.lock));
+   psrv->pool.created = 0;
+   psrv->pool.pidle = NULL;
+   psrv->pool.pspare = NULL;
+   psrv->pool.pshared = NULL;
+   psrv->pool.no_alloc = 0;
+   psrv->pool.no_inuse = 0;
+   mg_leave_critical_section((void *) &(psrv->pool.lock));
+
+#if defined(_WIN32)
+   DeleteCriticalSection(&(psrv->pool.lock));
+#else
+   pthread_mutex_destroy(&(psrv->pool.lock));
+#endif
+
+   return 0;
 }
 
 
-int mg_get_all_cgi_variables(MGWEB *pweb)
+DBXCON * mg_pool_obtain(MGSRV *psrv, int queue_timeout, int exclusive, int *use_existing, int *server_busy)
 {
-   DBX_TRACE_INIT(0)
-   int result, rc, n, len, lenv;
-   char *p;
-   char buffer[128];
-
-#ifdef _WIN32
-__try {
+   int reserved;
+   unsigned long wait_start, wait_time;
+   DBXCON *pcon, *pcon_mux;
+   MGPWAIT wait, *pwait, *pwait_prev;
+#if !defined(_WIN32)
+   struct timeval tv;
+   struct timespec ts;
 #endif
 
-   lenv = 32;
-   rc = mg_get_cgi_variable(pweb, "HTTPS", buffer, &lenv);
-   if (rc == MG_CGI_SUCCESS) {
-      mg_lcase(buffer);
-      if (!strcmp(buffer, "on")) {
-         pweb->tls = 1;
+   *use_existing = 0;
+   *server_busy = 0;
+   pcon = NULL;
+   reserved = 0;
+
+   mg_enter_critical_section((void *) &(psrv->pool.lock));
+
+   /* CMT72 idle connections are used first, then the least busy multiplexed connection with room for another request */
+   pcon_mux = NULL;
+   if (psrv->net_connection == 1 && !exclusive && !psrv->pool.pidle) {
+      for (pcon = psrv->pool.pmux; pcon; pcon = pcon->pnext_mux) {
+         if (!pcon->mux_broken && pcon->mux_inflight < pcon->mux_max && (!pcon_mux || pcon->mux_inflight < pcon_mux->mux_inflight)) {
+            pcon_mux = pcon;
+         }
       }
+      pcon = NULL;
    }
 
-   /* v2.7.33 look for SSE header: Accept: text/event-stream */
-   pweb->sse = 0;
-   lenv = 127;
-   rc = mg_get_cgi_variable(pweb, "HTTP_ACCEPT", buffer, &lenv);
-   if (rc == MG_CGI_SUCCESS) {
-      mg_lcase(buffer);
-      if (strstr(buffer, "/event-stream")) {
-         pweb->sse = 1;
+   if (psrv->net_connection == 0) { /* API: one connection is shared by all requests */
+      if (psrv->pool.pshared) {
+         pcon = psrv->pool.pshared;
+         pcon->inuse = 1;
+         *use_existing = 1;
+         mg_leave_critical_section((void *) &(psrv->pool.lock));
+         return pcon;
       }
    }
+   else if (psrv->pool.pidle) { /* network: take the most recently used idle connection */
+      pcon = psrv->pool.pidle;
+      psrv->pool.pidle = pcon->pnext_pool;
+      pcon->pnext_pool = NULL;
+      pcon->pool_state = MG_POOL_NONE;
+      pcon->inuse = 1;
+      psrv->pool.no_inuse ++;
+      *use_existing = 1;
+      mg_leave_critical_section((void *) &(psrv->pool.lock));
+      return pcon;
+   }
+   else if (pcon_mux) { /* CMT72 */
+      pcon_mux->mux_inflight ++;
+      psrv->pool.no_mux_requests ++;
+      *use_existing = 2;
+      mg_leave_critical_section((void *) &(psrv->pool.lock));
+      return pcon_mux;
+   }
+   else if (psrv->max_connections && psrv->pool.no_inuse >= psrv->max_connections) { /* v2.5.30 */
+      if (queue_timeout < 1) {
+         *server_busy = 1;
+         mg_leave_critical_section((void *) &(psrv->pool.lock));
+         return NULL;
+      }
 
-   result = 0;
-   for (n = 0; n < mg_system.cgi_max; n ++) {
-      p = (pweb->input_buf.buf_addr + pweb->input_buf.len_used + 5);
-
-      strcpy(p, mg_system.cgi[n]);
-      strcat(p, "=");
-      len = (int) strlen(p);
-      p += len;
-
-      lenv = (pweb->input_buf.len_alloc - (pweb->input_buf.len_used + len + 5));
-      rc = mg_get_cgi_variable(pweb, mg_system.cgi[n], p, &lenv);
-
-      if (rc == MG_CGI_SUCCESS) {
-         len += lenv;
-         mg_add_block_size((unsigned char *) pweb->input_buf.buf_addr + pweb->input_buf.len_used, (unsigned long) 0, (unsigned long) len, DBX_DSORT_WEBCGI, DBX_DTYPE_STR);
-         pweb->input_buf.len_used += (len + 5);
+      /* CMT58 join the back of the queue and wait for mg_pool_release() to hand us a connection */
+      memset((void *) &wait, 0, sizeof(MGPWAIT));
+      wait.exclusive = exclusive;
+#if defined(_WIN32)
+      InitializeConditionVariable(&(wait.cond));
+#else
+      pthread_cond_init(&(wait.cond), NULL);
+#endif
+      if (psrv->pool.pwait_tail) {
+         psrv->pool.pwait_tail->pnext = &wait;
+      }
+      else {
+         psrv->pool.pwait_head = &wait;
+      }
+      psrv->pool.pwait_tail = &wait;
+      psrv->pool.no_waiting ++;
+      psrv->pool.no_queued ++;
 
-         if (n == DBX_CGI_REQUEST_METHOD) {
-            pweb->request_method = p;
-            pweb->request_method_len = lenv;
+      wait_start = mg_time_msecs();
+      while (!wait.signalled) {
+         wait_time = mg_time_msecs() - wait_start;
+         if (wait_time >= ((unsigned long) queue_timeout * 1000)) {
+            break;
          }
-         else if (n == DBX_CGI_SCRIPT_NAME) {
-            pweb->script_name = p;
-            pweb->script_name_len = lenv;
-            if (lenv > 250)
-               lenv = 250;
-            strncpy(pweb->script_name_lc, p, lenv);
-            pweb->script_name_lc[lenv] = '\0';
-            mg_lcase(pweb->script_name_lc);
+         wait_time = ((unsigned long) queue_timeout * 1000) - wait_time;
+#if defined(_WIN32)
+         SleepConditionVariableCS(&(wait.cond), &(psrv->pool.lock), (DWORD) wait_time);
+#else
+         gettimeofday(&tv, NULL);
+         ts.tv_sec = tv.tv_sec + (time_t) (wait_time / 1000);
+         ts.tv_nsec = (long) (tv.tv_usec * 1000) + (long) ((wait_time % 1000) * 1000000);
+         if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec ++;
+            ts.tv_nsec -= 1000000000;
          }
-         if (n == DBX_CGI_QUERY_STRING) {
-            pweb->query_string = p;
-            pweb->query_string_len = lenv;
+         pthread_cond_timedwait(&(wait.cond), &(psrv->pool.lock), &ts);
+#endif
+      }
+#if !defined(_WIN32)
+      pthread_cond_destroy(&(wait.cond));
+#endif
+
+      wait_time = mg_time_msecs() - wait_start;
+      psrv->pool.wait_time_total += wait_time;
+      if (wait_time > psrv->pool.wait_time_max) {
+         psrv->pool.wait_time_max = wait_time;
+      }
+
+      if (!wait.signalled) { /* timed out: take ourselves out of the queue and return HTTP Server Busy */
+         pwait_prev = NULL;
+         for (pwait = psrv->pool.pwait_head; pwait; pwait = pwait->pnext) {
+            if (pwait == &wait) {
+               if (pwait_prev) {
+                  pwait_prev->pnext = wait.pnext;
+               }
+               else {
+                  psrv->pool.pwait_head = wait.pnext;
+               }
+               if (psrv->pool.pwait_tail == &wait) {
+                  psrv->pool.pwait_tail = pwait_prev;
+               }
+               break;
+            }
+            pwait_prev = pwait;
          }
+         psrv->pool.no_waiting --;
+         psrv->pool.no_queue_timeouts ++;
+         *server_busy = 1;
+         mg_leave_critical_section((void *) &(psrv->pool.lock));
+         return NULL;
       }
+
+      if (wait.pcon) { /* an open connection was handed over */
+         *use_existing = wait.mux ? 2 : 1;
+         mg_leave_critical_section((void *) &(psrv->pool.lock));
+         return wait.pcon;
+      }
+      reserved = 1; /* a slot was released for us and has already been counted in no_inuse */
    }
 
-	return result;
+   if (psrv->pool.pspare) { /* reuse a slot previously released by this server */
+      pcon = psrv->pool.pspare;
+      psrv->pool.pspare = pcon->pnext_pool;
+      pcon->pnext_pool = NULL;
+   }
+   else {
+      pcon = (DBXCON *) mg_malloc(NULL, sizeof(DBXCON), MG_MID_CONNECTION);
+      if (pcon) {
+         memset((void *) pcon, 0, sizeof(DBXCON));
+         pcon->psrv = psrv;
+         pcon->int_pipe[0] = 0;
+         pcon->int_pipe[1] = 0;
+#if defined(_WIN32)
+         InitializeCriticalSection(&(pcon->mux_lock)); /* CMT72 */
+         InitializeCriticalSection(&(pcon->mux_write));
+#else
+         pthread_mutex_init(&(pcon->mux_lock), NULL); /* CMT72 */
+         pthread_mutex_init(&(pcon->mux_write), NULL);
+#endif
+         pcon->mux_created = 1;
+         /* the global list is only used for reporting and for closing down */
+         mg_enter_critical_section((void *) &mg_global_mutex);
+         pcon->pnext = mg_connection;
+         mg_connection = pcon;
+         mg_leave_critical_section((void *) &mg_global_mutex);
+      }
+   }
+   if (pcon) {
+      pcon->alloc = 1;
+      pcon->inuse = 1;
+      pcon->connected = 0; /* v2.8.42 */
+      pcon->time_request = 0; /* v2.4.26 */
+      pcon->no_requests = 0;
+      pcon->pool_state = MG_POOL_NONE;
+      psrv->pool.no_alloc ++;
+      if (psrv->net_connection == 0) {
+         psrv->pool.pshared = pcon;
+      }
+      else if (!reserved) {
+         psrv->pool.no_inuse ++;
+      }
+   }
+   else if (reserved) { /* pass the slot on to the next in the queue */
+      psrv->pool.no_inuse --;
+      mg_pool_wake(psrv, NULL);
+   }
 
-#ifdef _WIN32
+   mg_leave_critical_section((void *) &(psrv->pool.lock));
+
+   return pcon;
 }
-__except (EXCEPTION_EXECUTE_HANDLER) {
 
-   DWORD code;
-   char bufferx[256];
 
-   __try {
-      code = GetExceptionCode();
-      sprintf_s(bufferx, 255, "Exception caught in f:mg_get_all_cgi_variables: %x:%d", code, DBX_TRACE_VAR);
-      mg_log_event(pweb->plog, pweb, bufferx, "Error Condition", 0);
+/* CMT58 hand a released connection (or, if pcon is NULL, a free slot) to the request at the head of the queue: called with the pool lock held */
+int mg_pool_wake(MGSRV *psrv, DBXCON *pcon)
+{
+   MGPWAIT *pwait;
+
+   pwait = psrv->pool.pwait_head;
+   if (!pwait) {
+      return 0;
    }
-   __except (EXCEPTION_EXECUTE_HANDLER) {
-      ;
+   if (!pcon && psrv->max_connections && psrv->pool.no_inuse >= psrv->max_connections) {
+      return 0;
    }
 
-   return 0;
-}
+   psrv->pool.pwait_head = pwait->pnext;
+   if (!psrv->pool.pwait_head) {
+      psrv->pool.pwait_tail = NULL;
+   }
+   psrv->pool.no_waiting --;
+
+   if (pcon) {
+      pcon->inuse = 1;
+   }
+   psrv->pool.no_inuse ++;
+   pwait->pcon = pcon;
+   pwait->signalled = 1;
+   pwait->pnext = NULL;
+
+#if defined(_WIN32)
+   WakeConditionVariable(&(pwait->cond));
+#else
+   pthread_cond_signal(&(pwait->cond));
 #endif
 
+   return 1;
 }
 
 
-int mg_get_path_configuration(MGWEB *pweb)
+int mg_pool_release(DBXCON *pcon, int close_connection)
 {
-   DBX_TRACE_INIT(0)
-   int rc, len_max;
-   MGPATH *ppath, *ppath_max;
-
-#ifdef _WIN32
-__try {
-#endif
+   MGSRV *psrv;
 
-   rc = 0;
-   len_max = 0;
-   ppath_max = NULL;
+   psrv = pcon->psrv;
 
-   ppath = mg_path;
-   while (ppath) {
-      if (!strncmp(pweb->script_name_lc, ppath->name, ppath->name_len)) {
-         if (ppath->name_len > len_max) {
-            len_max = ppath->name_len;
-            ppath_max = ppath;
-         }
-      }
-/*
-      if (mg_system.log.log_frames) {
-         char bufferx[256];
-         sprintf(bufferx, "request=%s; ppath=%p; path=%s; ppath->name_len=%d; server1=%s; len_max=%d;", pweb->script_name_lc, ppath, ppath->name, ppath->name_len, ppath->servers[0].psrv->name, len_max);
-         mg_log_event(pweb->plog, pweb, bufferx, "mg_web: information", 0);
+   if (!psrv || !psrv->pool.created) { /* closing down */
+      pcon->inuse = 0;
+      if (close_connection) {
+         pcon->alloc = 0;
       }
-*/
-      ppath = ppath->pnext;
-   }
-   
-   if (len_max) {
-      rc = CACHE_SUCCESS;
-      pweb->ppath = ppath_max;
-   }
-   else {
-      rc = CACHE_FAILURE;
+      return 0;
    }
-      
-	return rc;
 
-#ifdef _WIN32
-}
-__except (EXCEPTION_EXECUTE_HANDLER) {
+   mg_enter_critical_section((void *) &(psrv->pool.lock));
 
-   DWORD code;
-   char bufferx[256];
+   if (pcon->pool_state != MG_POOL_NONE) { /* already returned to the pool */
+      mg_leave_critical_section((void *) &(psrv->pool.lock));
+      return 0;
+   }
 
-   __try {
-      code = GetExceptionCode();
-      sprintf_s(bufferx, 255, "Exception caught in f:mg_get_path_configuration: %x:%d", code, DBX_TRACE_VAR);
-      mg_log_event(pweb->plog, pweb, bufferx, "Error Condition", 0);
+   if (pcon->inuse && psrv->net_connection == 1) {
+      psrv->pool.no_inuse --;
+   }
+   pcon->inuse = 0;
+   if (close_connection) {
+      pcon->alloc = 0;
+   }
+
+   if (pcon->alloc) {
+      if (psrv->net_connection == 1 && !mg_pool_wake(psrv, pcon)) { /* CMT58 a queued request takes precedence */
+         pcon->pool_state = MG_POOL_IDLE;
+         pcon->pnext_pool = psrv->pool.pidle;
+         psrv->pool.pidle = pcon;
+      }
    }
-   __except (EXCEPTION_EXECUTE_HANDLER) {
-      ;
+   else {
+      if (psrv->pool.pshared == pcon) {
+         psrv->pool.pshared = NULL;
+      }
+      psrv->pool.no_alloc --;
+      pcon->pool_state = MG_POOL_SPARE;
+      pcon->pnext_pool = psrv->pool.pspare;
+      psrv->pool.pspare = pcon;
+      if (psrv->net_connection == 1) { /* CMT58 the next queued request may now create a connection */
+         mg_pool_wake(psrv, NULL);
+      }
    }
 
+   mg_leave_critical_section((void *) &(psrv->pool.lock));
+
    return 0;
 }
-#endif
-}
 
 
-int mg_add_cgi_variable(MGWEB *pweb, char *name, int name_len, char *value, int value_len)
+DBXCON * mg_pool_drain(MGSRV *psrv)
 {
-   DBX_TRACE_INIT(0)
-   int alloc, len;
-   char *p;
+   DBXCON *pcon, *pcon_idle;
 
-#ifdef _WIN32
-__try {
-#endif
+   mg_enter_critical_section((void *) &(psrv->pool.lock));
 
-   alloc = (pweb->input_buf.len_alloc - pweb->input_buf.len_used);
-   if ((name_len + value_len + 6) >= alloc) {
-      return CACHE_FAILURE;
+   pcon_idle = psrv->pool.pidle;
+   psrv->pool.pidle = NULL;
+   for (pcon = pcon_idle; pcon; pcon = pcon->pnext_pool) {
+      pcon->pool_state = MG_POOL_NONE;
+      pcon->inuse = 1;
+      psrv->pool.no_inuse ++;
    }
 
-   p = (char *) (pweb->input_buf.buf_addr + pweb->input_buf.len_used);
-   p += 5;
-   strncpy(p, name, name_len);
-   p += name_len;
-   *p = '=';
-   p ++;
-   strncpy(p, value, value_len);
-   p += value_len;
+   mg_leave_critical_section((void *) &(psrv->pool.lock));
 
-   len = (name_len + value_len + 1);
-   mg_add_block_size((unsigned char *) pweb->input_buf.buf_addr + pweb->input_buf.len_used, (unsigned long) 0, (unsigned long) len, DBX_DSORT_WEBCGI, DBX_DTYPE_STR);
-   pweb->input_buf.len_used += (len + 5);
+   return pcon_idle; /* linked through pnext_pool */
+}
 
-   return CACHE_SUCCESS;
 
-#ifdef _WIN32
-}
-__except (EXCEPTION_EXECUTE_HANDLER) {
+/* CMT59 take the longest serving connection from the idle stack provided it has been idle for at least idle_time seconds */
+DBXCON * mg_pool_obtain_idle(MGSRV *psrv, time_t time_now, int idle_time)
+{
+   DBXCON *pcon, *pcon_prev, *pcon_found, *pcon_found_prev;
 
-   DWORD code;
-   char bufferx[256];
+   pcon_found = NULL;
+   pcon_found_prev = NULL;
 
-   __try {
-      code = GetExceptionCode();
-      sprintf_s(bufferx, 255, "Exception caught in f:mg_add_cgi_variable: %x:%d", code, DBX_TRACE_VAR);
-      mg_log_event(pweb->plog, pweb, bufferx, "Error Condition", 0);
+   mg_enter_critical_section((void *) &(psrv->pool.lock));
+
+   pcon_prev = NULL;
+   for (pcon = psrv->pool.pidle; pcon; pcon = pcon->pnext_pool) {
+      if ((int) difftime(time_now, pcon->time_request) >= idle_time) {
+         pcon_found = pcon;
+         pcon_found_prev = pcon_prev;
+      }
+      pcon_prev = pcon;
    }
-   __except (EXCEPTION_EXECUTE_HANDLER) {
-      ;
+   if (pcon_found) {
+      if (pcon_found_prev) {
+         pcon_found_prev->pnext_pool = pcon_found->pnext_pool;
+      }
+      else {
+         psrv->pool.pidle = pcon_found->pnext_pool;
+      }
+      pcon_found->pnext_pool = NULL;
+      pcon_found->pool_state = MG_POOL_NONE;
+      pcon_found->inuse = 1;
+      psrv->pool.no_inuse ++;
    }
 
-   return CACHE_FAILURE;
+   mg_leave_critical_section((void *) &(psrv->pool.lock));
+
+   return pcon_found;
 }
+
+
+/* CMT74 metrics */
+/* Each server and location has its own set of counters, spread over MG_METRICS_STRIPES stripes */
+/* A thread always updates the same stripe and the metrics report adds the stripes together */
+
+static void mg_metrics_add(volatile long long *pvalue, long long n)
+{
+#if defined(_WIN32)
+   InterlockedExchangeAdd64((volatile LONGLONG *) pvalue, (LONGLONG) n);
+#else
+   __sync_fetch_and_add(pvalue, n);
 #endif
+   return;
 }
 
 
-int mg_obtain_connection(MGWEB *pweb)
+static MGMSTRIPE * mg_metrics_stripe(MGMETRICS *pmetrics)
 {
-   DBX_TRACE_INIT(0)
-   int rc, use_existing, idle_time, connections_inuse, queue_time, queue_timeout, server_busy;
-   DBXCON *pcon, *pcon_last, *pcon_free;
-   char bufferx[256], info[256];
-   MGSRV *psrv;
-   MGPATH *ppath;
-   char *p, *p1, *p2;
-   time_t time_now;
+   unsigned long id;
 
-#ifdef _WIN32
-__try {
-#endif
+   id = (unsigned long) mg_current_thread_id();
+   id = id ^ (id >> 7) ^ (id >> 13);
+   return &(pmetrics->stripe[id % MG_METRICS_STRIPES]);
+}
 
-   psrv = pweb->psrv;
-   ppath = pweb->ppath;
-   use_existing = 0;
-   pcon_free = NULL;
-   pcon_last = NULL;
-   bufferx[0] = '\0';
-   info[0] = '\0';
 
-   DBX_TRACE(1)
+MGMETRICS * mg_metrics_create(void)
+{
+   MGMETRICS *pmetrics;
 
-   mg_enter_critical_section((void *) &mg_global_mutex);
+   pmetrics = (MGMETRICS *) mg_malloc(NULL, sizeof(MGMETRICS), MG_MID_METRICS);
+   if (pmetrics) {
+      memset((void *) pmetrics, 0, sizeof(MGMETRICS));
+   }
+   return pmetrics;
+}
 
-   if (pweb->server_no >= 0 && pweb->server_no < 32) { /* server affinity as server number pre-defined */
-      /* v2.1.16 : DB Server can be used if online and must be used if it's marked for exclusive use */
-      if (pweb->server_no < ppath->srv_max && ppath->servers[pweb->server_no].psrv && (ppath->servers[pweb->server_no].psrv->offline == 0 || ppath->servers[pweb->server_no].exclusive)) { /* check server in range and online */
-         psrv = ppath->servers[pweb->server_no].psrv;
-      }
-      else {
-         /* v2.4.24 */
-         if (ppath->servers[pweb->server_no].psrv)
-            sprintf(bufferx, "Preferred DB Server %s not available; offline=%d;", ppath->servers[pweb->server_no].psrv->name, ppath->servers[pweb->server_no].psrv->offline);
-         else
-            sprintf(bufferx, "Preferred DB Server number %d not available", pweb->server_no);
-         pweb->server_no = -1; /* preferred server not available, start again */
-      }
+
+int mg_metrics_free(MGMETRICS *pmetrics)
+{
+   if (pmetrics) {
+      mg_free(NULL, (void *) pmetrics, MG_MID_METRICS);
    }
-   else if (pweb->server_no != -1) {
-      sprintf(bufferx, "Out of range DB Server number %d", pweb->server_no);
-      pweb->server_no = -1; /* bad server number */
+   return CACHE_SUCCESS;
+}
+
+
+int mg_metrics_request_start(MGWEB *pweb)
+{
+   pweb->metrics = 0;
+   if (!pweb->ppath || !pweb->ppath->pmetrics) { /* the admin location is not measured */
+      return CACHE_SUCCESS;
    }
 
-   if (pweb->server_no == -1) {
-      pweb->server_no = mg_obtain_server(pweb, info, 0);
-      if (pweb->server_no == -1) { /* no online servers in list */
-         pweb->server_no = 0;
-         pweb->psrv = ppath->servers[pweb->server_no].psrv;
-         mg_server_online(pweb, NULL, info, 0); /* v2.2.19 */
-         mg_leave_critical_section((void *) &mg_global_mutex);
-         /* v2.4.24 */
-         if (bufferx[0]) {
-            mg_log_event(pweb->plog, pweb, bufferx, "mg_web: connectivity error", 0);
-         }
-         if (info[0]) {
-            mg_log_event(pweb->plog, pweb, info, "mg_web: connectivity", 0);
-         }
-         strcpy(pweb->error, "All available DB Servers are currently offline");
-         return CACHE_FAILURE;
-      }
-      psrv = ppath->servers[pweb->server_no].psrv;
+   pweb->metrics = 1;
+   pweb->metrics_error = 0;
+   pweb->metrics_start = mg_time_usecs();
+   pweb->metrics_connect = 0;
+   pweb->metrics_execute = 0;
+   pweb->metrics_psrv = NULL;
+   mg_metrics_count(pweb->ppath->pmetrics, 0, 1);
+
+   return CACHE_SUCCESS;
+}
+
+
+int mg_metrics_request_end(MGWEB *pweb)
+{
+   long long total;
+   MGSRV *psrv;
+   MGMSTRIPE *pstripe;
+
+   if (!pweb->metrics) {
+      return CACHE_SUCCESS;
    }
+   pweb->metrics = 0;
+   total = mg_time_usecs() - pweb->metrics_start;
 
-   queue_timeout = NETX_QUEUE_TIMEOUT;
-   queue_time = 0;
-   server_busy = 0;
-   connections_inuse = 0;
-   pcon = mg_connection;
-   while (pcon) {
-      pcon_last = pcon;
-      if (pcon->alloc && pcon->psrv == psrv) {
-         if (psrv->net_connection == 1) { /* network */
-            if (pcon->inuse == 0) {
-               pcon->inuse = 1;
-               use_existing = 1;
-               break;
-            }
-            else { /* v2.5.30 */
-               connections_inuse ++;
-               if (psrv->max_connections && connections_inuse >= psrv->max_connections) {
-                  if (psrv->timeout) {
-                     queue_timeout = psrv->timeout;
-                  }
-                  if (queue_time < queue_timeout) { /* queue request */
-                     mg_leave_critical_section((void *) &mg_global_mutex);
-                     mg_sleep(1000);
-                     mg_enter_critical_section((void *) &mg_global_mutex);
-                     queue_time ++;
-                     connections_inuse = 0;
-                     pcon = mg_connection;
-                     continue;
-                  }
-                  else { /* give up and return HTTP Server Busy */
-                     pcon = NULL;
-                     server_busy = 1;
-                     break;
-                  }
-               }
-            }
-         }
-         if (psrv->net_connection == 0) { /* API */
-            pcon->inuse = 1;
-            use_existing = 1;
-            break;
-         }
-      }
-      if (!pcon->alloc && !pcon_free) {
-         pcon_free = pcon;
-      }
-      pcon = pcon->pnext;
+   pstripe = mg_metrics_stripe(pweb->ppath->pmetrics);
+   mg_metrics_add(&(pstripe->no_requests), 1);
+   mg_metrics_add(&(pstripe->no_inflight), -1);
+   if (pweb->metrics_error) {
+      mg_metrics_add(&(pstripe->no_errors), 1);
    }
-   if (!pcon) {
-      if (!server_busy) {
-         if (pcon_free) {
-            pcon = pcon_free;
-            pcon->alloc = 1;
-            pcon->inuse = 1;
-            /* pcon->closed = 0; v2.8.42 */
-            pcon->connected = 0; /* v2.8.42 */
-            pcon->no_requests = 0;
-         }
-         else {
-            pcon = (DBXCON *) mg_malloc(NULL, sizeof(DBXCON), MG_MID_CONNECTION);
-            if (pcon) {
-               memset((void *) pcon, 0, sizeof(DBXCON));
-               if (!mg_connection) {
-                  mg_connection = pcon;
-               }
-               else {
-                  pcon_last->pnext = pcon;
-               }
-               pcon->alloc = 1;
-               pcon->inuse = 1;
-               /* pcon->closed = 0; v2.8.42 */
-               pcon->connected = 0; /* v2.8.42 */
-               pcon->time_request = 0; /* v2.4.26 */
-               pcon->no_requests = 0;
-               pcon->int_pipe[0] = 0;
-               pcon->int_pipe[1] = 0;
-            }
-         }
-      }
+   if (pweb->pwsock || pweb->sse) { /* these last as long as the client stays connected */
+      total = -1;
    }
-   if (!pweb->requestno_in) {
-      pweb->requestno_in = mg_system.requestno ++;
-      psrv->no_requests ++;
+   else {
+      mg_metrics_observe(pweb->ppath->pmetrics, MG_METRICS_TOTAL, total);
    }
-   mg_leave_critical_section((void *) &mg_global_mutex);
-/*
-   {
-      char buffer[256];
-      sprintf(buffer, "pcon=%p; connections_inuse=%d; queue_timeout=%d; queue_time=%d; server_busy=%d;", pcon, connections_inuse, queue_timeout, queue_time, server_busy);
-      mg_log_event(pweb->plog, pweb, buffer, "mg_obtain_connection", 0);
+
+   /* the server that served the request or, failing that, the one that could not (requests served from the response cache have neither) */
+   psrv = pweb->metrics_psrv ? pweb->metrics_psrv : (pweb->metrics_error ? pweb->psrv : NULL);
+   if (!psrv || !psrv->pmetrics) {
+      return CACHE_SUCCESS;
    }
-*/
-   /* v2.4.24 */
-   if (bufferx[0]) {
-      mg_log_event(pweb->plog, pweb, bufferx, "mg_web: connectivity error", 0);
+   pstripe = mg_metrics_stripe(psrv->pmetrics);
+   mg_metrics_add(&(pstripe->no_requests), 1);
+   if (pweb->metrics_psrv) {
+      mg_metrics_add(&(pstripe->no_inflight), -1);
    }
-   if (info[0]) {
-      mg_log_event(pweb->plog, pweb, info, "mg_web: connectivity", 0);
+   if (pweb->metrics_error) {
+      mg_metrics_add(&(pstripe->no_errors), 1);
    }
+   mg_metrics_observe(psrv->pmetrics, MG_METRICS_CONNECT, pweb->metrics_connect);
+   if (pweb->metrics_psrv && total >= 0) {
+      mg_metrics_observe(psrv->pmetrics, MG_METRICS_EXECUTE, pweb->metrics_execute);
+      mg_metrics_observe(psrv->pmetrics, MG_METRICS_TOTAL, total);
+   }
+   pweb->metrics_psrv = NULL;
 
-   pweb->psrv = psrv;
-   if (!pcon && server_busy) { /* v2.5.30 */
-      strcpy(pweb->error, "Cannot connect to DB Server - All connections busy");
-      return CACHE_MAXCON;
+   return CACHE_SUCCESS;
+}
+
+
+int mg_metrics_count(MGMETRICS *pmetrics, int failovers, int inflight)
+{
+   MGMSTRIPE *pstripe;
+
+   if (!pmetrics) {
+      return CACHE_SUCCESS;
    }
-   if (!pcon) {
-      strcpy(pweb->error, "Unable to allocate memory for a new connection");
-      return CACHE_FAILURE;
+   pstripe = mg_metrics_stripe(pmetrics);
+   if (failovers) {
+      mg_metrics_add(&(pstripe->no_failovers), (long long) failovers);
+   }
+   if (inflight) {
+      mg_metrics_add(&(pstripe->no_inflight), (long long) inflight);
    }
+   return CACHE_SUCCESS;
+}
 
-   pweb->pcon = pcon;
-   pweb->error[0] = '\0';
-   pweb->error_code = 0;
-   pweb->error_no = 0;
 
-   /* v2.4.26 */
-   idle_time = 0;
-   time_now = time(NULL);
-   if (psrv->net_connection == 1 && psrv->idle_timeout && pcon->time_request) { /* v2.4.28 check connetion idle timeout for network connections */
-      idle_time = (int) difftime(time_now, pcon->time_request);
-      if (idle_time > (psrv->idle_timeout - 5)) {
-         if (pweb->plog->log_connections) { /* CMT55 */
-            char buffer[256];
-            sprintf(buffer, "Connection idle time exceeded: DB Server %s (%s:%d) address=%p; socket=%d;", (char *) pcon->psrv->name, (char *) pcon->psrv->ip_address, pcon->psrv->port, pcon, (int) pcon->cli_socket);
-            mg_log_event(pweb->plog, pweb, buffer, "mg_web: connections", 0);
-         }
-         use_existing = 0;
-         netx_tcp_disconnect(pweb, 0);
-/*
-         {
-            char buffer[256];
-            sprintf(buffer, "pcon=%p; (connection within 5 seconds of idle timeout - create new connection idle_timeout=%d;idle_time=%d;)", pcon, psrv->idle_timeout, idle_time);
-            mg_log_event(pweb->plog, pweb, buffer, "mg_obtain_connection", 0);
-         }
-*/
-      }
+/* the request is moving from the current server to another */
+int mg_metrics_failover(MGWEB *pweb)
+{
+   if (!pweb->metrics) {
+      return CACHE_SUCCESS;
    }
-   pcon->time_request = time_now; /* v2.4.26 */
+   if (pweb->psrv) {
+      mg_metrics_count(pweb->psrv->pmetrics, 1, 0);
+   }
+   if (pweb->metrics_psrv) {
+      mg_metrics_count(pweb->metrics_psrv->pmetrics, 0, -1);
+      pweb->metrics_psrv = NULL;
+   }
+   return CACHE_SUCCESS;
+}
 
-/*
-   {
-      char buffer[256];
-      sprintf(buffer, "pcon=%p; pcon_last=%p; pcon_free=%p; (alloc=%d;inuse=%d;use_existing=%d;net_connection=%d;idle_time=%d)", pcon, pcon_last, pcon_free, pcon->alloc, pcon->inuse, use_existing, psrv->net_connection, idle_time);
-      mg_log_event(pweb->plog, pweb, buffer, "mg_obtain_connection", 0);
+
+int mg_metrics_observe(MGMETRICS *pmetrics, int hist, long long usecs)
+{
+   int n;
+   MGMSTRIPE *pstripe;
+
+   if (!pmetrics || usecs < 0) {
+      return CACHE_SUCCESS;
    }
-*/
+   for (n = 0; n < (MG_METRICS_BUCKETS - 1); n ++) {
+      if (usecs <= mg_metrics_bounds[n]) {
+         break;
+      }
+   }
+   pstripe = mg_metrics_stripe(pmetrics);
+   mg_metrics_add(&(pstripe->hist_bucket[hist][n]), 1);
+   mg_metrics_add(&(pstripe->hist_count[hist]), 1);
+   mg_metrics_add(&(pstripe->hist_sum[hist]), usecs);
 
-   if (use_existing) {
-      if (pcon->psrv->offline == 2) { /* v2.2.20 */
-         char buffer[256];
-         sprintf(buffer, "Previously offline DB Server %s is due for a health check; marking as online", pweb->psrv ? pweb->psrv->name : "null");
-         mg_log_event(pweb->plog, pweb, buffer, "mg_web: information", 0);
-         mg_server_online(pweb, pcon->psrv, info, 0);
-         if (info[0]) {
-            mg_log_event(pweb->plog, pweb, info, "mg_web: connectivity", 0);
+   return CACHE_SUCCESS;
+}
+
+
+/* add the stripes together: histogram buckets are returned as cumulative counts */
+int mg_metrics_collect(MGMETRICS *pmetrics, MGMSTRIPE *ptotal)
+{
+   int n, h, b;
+   MGMSTRIPE *pstripe;
+
+   memset((void *) ptotal, 0, sizeof(MGMSTRIPE));
+   if (!pmetrics) {
+      return CACHE_FAILURE;
+   }
+   for (n = 0; n < MG_METRICS_STRIPES; n ++) {
+      pstripe = &(pmetrics->stripe[n]);
+      ptotal->no_requests += pstripe->no_requests;
+      ptotal->no_errors += pstripe->no_errors;
+      ptotal->no_failovers += pstripe->no_failovers;
+      ptotal->no_inflight += pstripe->no_inflight;
+      for (h = 0; h < MG_METRICS_HISTOGRAMS; h ++) {
+         ptotal->hist_count[h] += pstripe->hist_count[h];
+         ptotal->hist_sum[h] += pstripe->hist_sum[h];
+         for (b = 0; b < MG_METRICS_BUCKETS; b ++) {
+            ptotal->hist_bucket[h][b] += pstripe->hist_bucket[h][b];
          }
       }
-      if (pweb->plog->log_connections == 2) { /* CMT55 */
-         char buffer[256];
-         sprintf(buffer, "Connection reused: DB Server %s (%s:%d) address=%p; socket=%d;", (char *) pcon->psrv->name, (char *) pcon->psrv->ip_address, pcon->psrv->port, pcon, (int) pcon->cli_socket);
-         mg_log_event(pweb->plog, pweb, buffer, "mg_web: connections", 0);
-      }
-      return CACHE_SUCCESS;
    }
+   for (h = 0; h < MG_METRICS_HISTOGRAMS; h ++) {
+      for (b = 1; b < MG_METRICS_BUCKETS; b ++) {
+         ptotal->hist_bucket[h][b] += ptotal->hist_bucket[h][b - 1];
+      }
+   }
+   return CACHE_SUCCESS;
+}
 
-   pcon->connected = 0;
-   /* pcon->closed = 0; v2.8.42 */
-   pcon->timeout = psrv->timeout;
-   pcon->current_timeout = 0;
 
-/*
-   {
-      char buffer[256];
-      sprintf(buffer, "pcon=%p; shdir=%p; ip_address=%p; port=%d;", pcon, psrv->shdir, psrv->ip_address, psrv->port);
-      mg_log_event(pweb->plog, pweb, buffer, "mg_obtain_connection : New Connection", 0);
-   }
-*/
+/* CMT75 phase timing */
+/* One request in every 'request_timing' requests records the time spent in each phase */
+/* The results are written to the event log (log) and/or returned to the client in a Server-Timing header (header) */
 
-   pcon->p_isc_so = NULL;
-   pcon->p_ydb_so = NULL;
-   pcon->psrv = psrv;
-   pcon->p_db_mutex = &pcon->db_mutex;
-   mg_mutex_create(pcon->p_db_mutex);
-   pcon->p_zv = &pcon->zv;
+int mg_timing_request_start(MGWEB *pweb)
+{
+   int n;
 
-   pcon->pid = 0;
-  
-   if (pcon->psrv->penv) {
-      p = (char *) pcon->psrv->penv->p_buffer;
-      p2 = strstr(p, "\n");
-      while (p2) {
-         *p2 = '\0';
-         p1 = strstr(p, "=");
-         if (p1) {
-            *p1 = '\0';
-            p1 ++;
-#if defined(_WIN32)
-            SetEnvironmentVariable((LPCTSTR) p, (LPCTSTR) p1);
-#else
-            /* printf("\nLinux : environment variable p=%s p1=%s;", p, p1); */
-            setenv(p, p1, 1);
-#endif
-         }
-         else {
-            break;
-         }
-         p = p2 + 1;
-         p2 = strstr(p, "\n");
-      }
+   pweb->timing = 0;
+   if (mg_system.timing_sample < 1 || !pweb->ppath || pweb->ppath->admin) {
+      return CACHE_SUCCESS;
+   }
+   if ((mg_system.timing_no ++ % (unsigned long) mg_system.timing_sample) != 0) { /* an occasional lost update only changes which request is sampled */
+      return CACHE_SUCCESS;
    }
 
-   if (!pcon->psrv->dbtype) {
-      strcpy(pweb->error, "Unable to determine the database type");
-      rc = CACHE_NOCON;
-      pcon->alloc = 0;
-      pcon->inuse = 0;
-      pweb->pcon = NULL;
-      return rc;
+   pweb->timing = 1;
+   pweb->timing_start = mg_time_usecs();
+   pweb->timing_mark = pweb->timing_start;
+   pweb->timing_relay_start = 0;
+   for (n = 0; n < MG_TIMING_PHASES; n ++) {
+      pweb->timing_phase[n] = 0;
    }
+   return CACHE_SUCCESS;
+}
 
-   rc = mg_connect(pweb, 0);
 
-   if (rc == CACHE_SUCCESS) {
-      if (pcon->psrv->offline == 2) { /* v2.2.20 */
-         char buffer[256];
-         sprintf(buffer, "Previously offline DB Server %s has passed its health check; marking as online", pweb->psrv ? pweb->psrv->name : "null");
-         mg_log_event(pweb->plog, pweb, buffer, "mg_web: information", 0);
-         mg_server_online(pweb, pcon->psrv, info, 0);
-         if (info[0]) {
-            mg_log_event(pweb->plog, pweb, info, "mg_web: connectivity", 0);
-         }
-      }
-      if (pweb->plog->log_connections) { /* CMT55 */
-         char buffer[256];
-         sprintf(buffer, "Connection created: DB Server %s (%s:%d) address=%p; socket=%d;", (char *) pcon->psrv->name, (char *) pcon->psrv->ip_address, pcon->psrv->port, pcon, (int) pcon->cli_socket);
-         mg_log_event(pweb->plog, pweb, buffer, "mg_web: connections", 0);
-      }
+int mg_timing_request_end(MGWEB *pweb)
+{
+   int status;
+   long long time_now;
+   char buffer[512];
+
+   if (!pweb->timing) {
+      return CACHE_SUCCESS;
    }
-   else {
-      pcon->alloc = 0;
-      pcon->inuse = 0;
-      pweb->pcon = NULL;
+   pweb->timing = 0;
+   time_now = mg_time_usecs();
+   if (pweb->timing_relay_start) {
+      pweb->timing_phase[MG_TIMING_RELAY] = time_now - pweb->timing_relay_start;
+   }
+   if (!mg_system.timing_log) {
+      return CACHE_SUCCESS;
    }
 
-   return rc;
+   status = pweb->metrics_error;
+   if (!status && pweb->response_headers && !strncmp(pweb->response_headers, "HTTP/", 5) && strlen(pweb->response_headers) > 9) {
+      status = (int) strtol(pweb->response_headers + 9, NULL, 10);
+   }
+   sprintf(buffer, "requestno=%lu; method=%.*s; uri=%.*s; server=%s; status=%d; queue_us=%lld; connect_us=%lld; send_us=%lld; db_us=%lld; relay_us=%lld; total_us=%lld;",
+            pweb->requestno_in,
+            pweb->request_method ? (pweb->request_method_len < 16 ? pweb->request_method_len : 16) : 0, pweb->request_method ? pweb->request_method : "",
+            pweb->script_name ? (pweb->script_name_len < 200 ? pweb->script_name_len : 200) : 0, pweb->script_name ? pweb->script_name : "",
+            pweb->psrv ? pweb->psrv->name : "", status,
+            pweb->timing_phase[MG_TIMING_QUEUE], pweb->timing_phase[MG_TIMING_CONNECT], pweb->timing_phase[MG_TIMING_SEND], pweb->timing_phase[MG_TIMING_DB], pweb->timing_phase[MG_TIMING_RELAY],
+            time_now - pweb->timing_start);
+   mg_log_event(pweb->plog, pweb, buffer, "mg_web: request timing", 0);
 
-#ifdef _WIN32
+   return CACHE_SUCCESS;
 }
-__except (EXCEPTION_EXECUTE_HANDLER) {
 
-   DWORD code;
-   char bufferx[256];
 
-   __try {
-      code = GetExceptionCode();
-      sprintf_s(bufferx, 255, "Exception caught in f:mg_obtain_connection: %x:%d", code, DBX_TRACE_VAR);
-      mg_log_event(pweb->plog, pweb, bufferx, "Error Condition", 0);
-   }
-   __except (EXCEPTION_EXECUTE_HANDLER) {
-      ;
+/* the start of a phase */
+int mg_timing_mark(MGWEB *pweb)
+{
+   if (pweb->timing) {
+      pweb->timing_mark = mg_time_usecs();
    }
-
-   return 0;
+   return CACHE_SUCCESS;
 }
-#endif
+
+
+/* the end of a phase: the next phase starts here */
+int mg_timing_add(MGWEB *pweb, int phase)
+{
+   long long time_now;
+
+   if (pweb->timing) {
+      time_now = mg_time_usecs();
+      pweb->timing_phase[phase] += (time_now - pweb->timing_mark);
+      pweb->timing_mark = time_now;
+   }
+   return CACHE_SUCCESS;
 }
 
 
-int mg_obtain_server(MGWEB *pweb, char *info, int context)
+/* Server-Timing header (durations in milliseconds): the response has yet to be relayed so 'total' is the time to this point */
+int mg_timing_header(MGWEB *pweb, char *buffer)
 {
-   DBX_TRACE_INIT(0)
-   int server_no, server_no_start;
-   time_t time_now;
+   sprintf(buffer, "\r\nServer-Timing: queue;dur=%.3f, connect;dur=%.3f, send;dur=%.3f, db;dur=%.3f, total;dur=%.3f",
+            (double) pweb->timing_phase[MG_TIMING_QUEUE] / 1000.0, (double) pweb->timing_phase[MG_TIMING_CONNECT] / 1000.0,
+            (double) pweb->timing_phase[MG_TIMING_SEND] / 1000.0, (double) pweb->timing_phase[MG_TIMING_DB] / 1000.0,
+            (double) (mg_time_usecs() - pweb->timing_start) / 1000.0);
+   return CACHE_SUCCESS;
+}
 
-#ifdef _WIN32
-__try {
+
+/* CMT73 scoreboard */
+/* An optional shared memory segment holding DB Server state and statistics for all worker processes of the web server */
+/* Offline status is written through to the scoreboard and picked up by the other processes when they next choose a server */
+/* Connection counts are kept by each process and published to its own slot in the scoreboard as they change */
+/* CMT82 counters are added to the scoreboard as they change */
+
+static long mg_sb_add(volatile long *pvalue, long n)
+{
+#if defined(_WIN32)
+   return (long) InterlockedExchangeAdd((volatile LONG *) pvalue, (LONG) n);
+#else
+   return __sync_fetch_and_add(pvalue, n);
 #endif
+}
 
-   time_now = time(NULL);
-   server_no_start = pweb->ppath->server_no;
-   server_no = -1;
-   DBX_TRACE(1)
-   while (server_no == -1) {
 
-      /* v2.1.16 */
-/*
-      {
-         char buffer[256];
-         sprintf(buffer, "pweb->ppath->server_no=%d; psrv->offline=%d; psrv->health_check=%d; exclusive=%d; time_offline=%d", pweb->ppath->server_no, pweb->ppath->servers[pweb->ppath->server_no].psrv->offline, pweb->ppath->servers[pweb->ppath->server_no].psrv->health_check, pweb->ppath->servers[pweb->ppath->server_no].exclusive, pweb->ppath->servers[pweb->ppath->server_no].psrv->offline ? (int) difftime(time_now, pweb->ppath->servers[pweb->ppath->server_no].psrv->time_offline) : 0);
-         mg_log_event(pweb->plog, pweb, buffer, "mg_obtain_server", 0);
-      }
-*/
-      /* v2.2.20 */
-      if (pweb->ppath->servers[pweb->ppath->server_no].exclusive == 0) {
-         if (pweb->ppath->servers[pweb->ppath->server_no].psrv->offline == 1 && pweb->ppath->servers[pweb->ppath->server_no].psrv->health_check > 0 && difftime(time_now, pweb->ppath->servers[pweb->ppath->server_no].psrv->time_offline) > pweb->ppath->servers[pweb->ppath->server_no].psrv->health_check) {
+static void mg_sb_lock(MGSB *psb)
+{
+   int n;
 
-            DBX_TRACE(2)
-            if (info) {
-               sprintf(info, "Retry DB Server %s; number=%d; health_check=%d; time_offline=%d;", pweb->ppath->servers[pweb->ppath->server_no].psrv->name, pweb->ppath->server_no, pweb->ppath->servers[pweb->ppath->server_no].psrv->health_check, (int) difftime(time_now, pweb->ppath->servers[pweb->ppath->server_no].psrv->time_offline));
-            }
-            pweb->ppath->servers[pweb->ppath->server_no].psrv->time_offline = time(NULL); /* push time offline forward so only this request tries */
-            pweb->ppath->servers[pweb->ppath->server_no].psrv->offline = 2; /* indicate that we're retrying this offline server */
-            server_no = pweb->ppath->server_no;
-         }
-         else if (pweb->ppath->servers[pweb->ppath->server_no].psrv->offline == 0) { /* server online so we can use it */
-            DBX_TRACE(3)
-            server_no = pweb->ppath->server_no;
-         }
-      }
-/*
-      if (pweb->ppath->servers[pweb->ppath->server_no].psrv->offline == 0 && pweb->ppath->servers[pweb->ppath->server_no].exclusive == 0) {
-         server_no = pweb->ppath->server_no;
-      }
-*/
-      DBX_TRACE(4)
-      if (pweb->ppath->load_balancing || pweb->ppath->servers[pweb->ppath->server_no].psrv->offline > 0) { /* increment core server number if one is offline or load balancing is on */
-         pweb->ppath->server_no ++;
-         if (!pweb->ppath->servers[pweb->ppath->server_no].psrv) {
-            pweb->ppath->server_no = 0;
-         }
-      }
-      if (pweb->ppath->server_no == server_no_start) { /* all servers examined */
-         break;
+#if defined(_WIN32)
+   for (n = 0; InterlockedExchange((volatile LONG *) &(psb->lock), 1); n ++) {
+#else
+   for (n = 0; __sync_lock_test_and_set(&(psb->lock), 1); n ++) {
+#endif
+      if (n > 100) {
+         mg_sleep(1);
       }
    }
+   return;
+}
 
-   DBX_TRACE(10)
-   return server_no;
 
-#ifdef _WIN32
+static void mg_sb_unlock(MGSB *psb)
+{
+#if defined(_WIN32)
+   InterlockedExchange((volatile LONG *) &(psb->lock), 0);
+#else
+   __sync_lock_release(&(psb->lock));
+#endif
+   return;
 }
-__except (EXCEPTION_EXECUTE_HANDLER) {
 
+
+/* CMT82 */
+static int mg_sb_process_alive(unsigned long pid)
+{
+#if defined(_WIN32)
+   int alive;
    DWORD code;
-   char bufferx[256];
+   HANDLE hprocess;
 
-   __try {
-      code = GetExceptionCode();
-      sprintf_s(bufferx, 255, "Exception caught in f:mg_obtain_server: %x:%d", code, DBX_TRACE_VAR);
-      mg_log_event(pweb->plog, pweb, bufferx, "Error Condition", 0);
+   hprocess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, (DWORD) pid);
+   if (!hprocess) {
+      return (GetLastError() == ERROR_ACCESS_DENIED) ? 1 : 0;
    }
-   __except (EXCEPTION_EXECUTE_HANDLER) {
-      ;
+   alive = (GetExitCodeProcess(hprocess, &code) && code == STILL_ACTIVE) ? 1 : 0;
+   CloseHandle(hprocess);
+
+   return alive;
+#else
+   if (kill((pid_t) pid, 0) == 0 || errno == EPERM) {
+      return 1;
    }
+   return 0;
+#endif
+}
 
-   return -1;
+
+/* CMT82 count the processes attached to the scoreboard, freeing the slots of those that have gone: called with the scoreboard locked */
+static int mg_sb_reclaim(MGSB *psb)
+{
+   int n, no_processes;
+
+   no_processes = 0;
+   for (n = 0; n < MG_SB_PROCESSES; n ++) {
+      if (!psb->proc[n].pid) {
+         continue;
+      }
+      if (!mg_sb_process_alive(psb->proc[n].pid)) {
+         memset((void *) &(psb->proc[n]), 0, sizeof(MGSBPROC));
+         continue;
+      }
+      no_processes ++;
+   }
+
+   return no_processes;
 }
+
+
+static void mg_sb_unmap(MGSB *psb)
+{
+#if defined(_WIN32)
+   UnmapViewOfFile((void *) psb);
+   CloseHandle(mg_system.sb_handle); /* the segment goes with the last handle */
+   mg_system.sb_handle = NULL;
+#else
+   munmap((void *) psb, sizeof(MGSB));
 #endif
+   return;
 }
 
 
-int mg_server_offline(MGWEB *pweb, MGSRV *psrv, char *info, int context)
+int mg_sb_init(void)
 {
-   DBX_TRACE_INIT(0)
-   DBXCON *pcon;
-
-#ifdef _WIN32
-__try {
+   int n, created;
+   unsigned int hash;
+   char *p;
+   char buffer[256];
+   MGSB *psb;
+   MGSRV *psrv;
+#if !defined(_WIN32)
+   int fd;
 #endif
 
-   if (context == 10) { /* from admin */
-      if (!psrv) {
-         return -1;
+   /* the segment is named after the configuration file and (for UNIX) the parent of the worker processes */
+   hash = 2166136261U;
+   for (p = mg_system.config_file; *p; p ++) {
+      hash = (hash ^ (unsigned int) (unsigned char) *p) * 16777619U;
+   }
+   psb = NULL;
+   created = 0;
+
+#if defined(_WIN32)
+   sprintf(mg_system.sb_name, "Local\\mg_web_%08x", hash);
+   mg_system.sb_handle = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, (DWORD) sizeof(MGSB), mg_system.sb_name);
+   if (mg_system.sb_handle) {
+      created = (GetLastError() == ERROR_ALREADY_EXISTS) ? 0 : 1;
+      psb = (MGSB *) MapViewOfFile(mg_system.sb_handle, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(MGSB));
+      if (!psb) {
+         CloseHandle(mg_system.sb_handle);
+         mg_system.sb_handle = NULL;
       }
    }
-   else {
-      if (!psrv || !pweb->ppath) {
-         return -1;
+#else
+   sprintf(mg_system.sb_name, "/mg_web_%lu_%08x", (unsigned long) getppid(), hash);
+   fd = shm_open(mg_system.sb_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+   if (fd >= 0) {
+      created = 1;
+      if (ftruncate(fd, (off_t) sizeof(MGSB)) != 0) {
+         close(fd);
+         shm_unlink(mg_system.sb_name);
+         fd = -1;
+      }
+   }
+   else if (errno == EEXIST) {
+      fd = shm_open(mg_system.sb_name, O_RDWR, 0600);
+      for (n = 0; fd >= 0 && n < 100; n ++) { /* wait for the creator to size the segment */
+         struct stat st;
+         if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(MGSB)) {
+            break;
+         }
+         mg_sleep(10);
       }
-      if (!pweb->ppath->servers[1].psrv) { /* only one server, therefore no failover */
-         return -1;
+   }
+   if (fd >= 0) {
+      psb = (MGSB *) mmap(NULL, sizeof(MGSB), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      close(fd);
+      if (psb == (MGSB *) MAP_FAILED) {
+         psb = NULL;
+      }
+   }
+#endif
+
+   if (!psb) {
+      sprintf(buffer, "Cannot create or attach to the scoreboard (%s): statistics will be reported for this process only", mg_system.sb_name);
+      mg_log_event(&(mg_system.log), NULL, buffer, "mg_web: error", 0);
+      return CACHE_FAILURE;
+   }
+
+   /* a new segment is zero filled so the lock is free */
+   mg_sb_lock(psb);
+   if (psb->magic == 0) {
+      psb->magic = MG_SB_MAGIC;
+      psb->size = (unsigned long) sizeof(MGSB);
+      psb->time_created = time(NULL);
+   }
+   else if (psb->magic != MG_SB_MAGIC || psb->size != (unsigned long) sizeof(MGSB)) {
+      mg_sb_unlock(psb);
+      sprintf(buffer, "The scoreboard (%s) was created by a different version of mg_web: statistics will be reported for this process only", mg_system.sb_name);
+      mg_log_event(&(mg_system.log), NULL, buffer, "mg_web: error", 0);
+      mg_sb_unmap(psb);
+      return CACHE_FAILURE;
+   }
+
+   /* CMT82 take a free process slot */
+   mg_sb_reclaim(psb);
+   for (n = 0; n < MG_SB_PROCESSES; n ++) {
+      if (!psb->proc[n].pid) {
+         break;
+      }
+   }
+   if (n == MG_SB_PROCESSES) {
+      mg_sb_unlock(psb);
+      sprintf(buffer, "The scoreboard (%s) is full (%d processes): statistics will be reported for this process only", mg_system.sb_name, MG_SB_PROCESSES);
+      mg_log_event(&(mg_system.log), NULL, buffer, "mg_web: error", 0);
+      mg_sb_unmap(psb);
+      return CACHE_FAILURE;
+   }
+   memset((void *) &(psb->proc[n]), 0, sizeof(MGSBPROC));
+   psb->proc[n].pid = mg_current_process_id();
+   mg_system.sb_slot = n;
+
+   for (psrv = mg_server; psrv; psrv = psrv->pnext) {
+      psrv->psb = NULL;
+      for (n = 0; n < psb->no_servers; n ++) {
+         if (!strcmp(psb->srv[n].name, psrv->name)) {
+            psrv->psb = &(psb->srv[n]);
+            break;
+         }
       }
-      if (mg_server_alternatives(pweb, psrv, info, context) == 0) { /* CMT51 no viable alternatives */
-         return -1;
+      if (!psrv->psb && psb->no_servers < MG_SB_SERVERS) {
+         psrv->psb = &(psb->srv[psb->no_servers ++]);
+         strncpy(psrv->psb->name, psrv->name, 63);
+         psrv->psb->name[63] = '\0';
       }
+      else if (psrv->psb && psrv->psb->offline) { /* another process has already found this server to be offline */
+         psrv->offline = 1;
+         psrv->time_offline = psrv->psb->time_offline;
+      }
+      psrv->sb_requests = 0;
+      psrv->sb_queued = 0;
+      psrv->sb_queue_timeouts = 0;
    }
+   mg_sb_unlock(psb);
 
-   DBX_TRACE(1)
-   /* block new connections to this server */
-   mg_enter_critical_section((void *) &mg_global_mutex);
+   mg_system.psb = psb;
 
-   psrv->offline = 1;
-   psrv->time_offline = time(NULL); /* v2.2.20 */
+   sprintf(buffer, "Scoreboard %s (%s)", created ? "created" : "attached", mg_system.sb_name);
+   mg_log_event(&(mg_system.log), NULL, buffer, "mg_web: information", 0);
 
-   mg_leave_critical_section((void *) &mg_global_mutex);
+   return CACHE_SUCCESS;
+}
 
-   /* v2.4.24 */
-   if (info) {
-      sprintf(info, "DB Server %s marked offline; context=%d;", psrv->name, context);
+
+int mg_sb_exit(void)
+{
+   int no_processes;
+   MGSB *psb;
+   MGSRV *psrv;
+
+   psb = mg_system.psb;
+   if (!psb) {
+      return CACHE_SUCCESS;
    }
 
-   DBX_TRACE(2)
-   pcon = mg_connection;
-   while (pcon) {
-      if (pcon->alloc && pcon->psrv == psrv) {
-         if (psrv->net_connection == 1 && pcon->inuse == 0) { /* network */
-            DBX_TRACE(3)
-            mg_release_connection(pweb, 1);
-         }
-      }
-      pcon = pcon->pnext;
+   for (psrv = mg_server; psrv; psrv = psrv->pnext) {
+      mg_sb_publish(psrv, 1);
+      psrv->psb = NULL;
    }
-   DBX_TRACE(10)
+   mg_system.psb = NULL;
 
-   return 0;
+   mg_sb_lock(psb);
+   memset((void *) &(psb->proc[mg_system.sb_slot]), 0, sizeof(MGSBPROC));
+   no_processes = mg_sb_reclaim(psb); /* CMT82 processes that died without closing are not counted */
+   mg_sb_unlock(psb);
 
-#ifdef _WIN32
+   mg_sb_unmap(psb);
+#if !defined(_WIN32)
+   if (no_processes < 1) {
+      shm_unlink(mg_system.sb_name);
+   }
+#endif
+
+   return CACHE_SUCCESS;
 }
-__except (EXCEPTION_EXECUTE_HANDLER) {
 
-   DWORD code;
-   char bufferx[256];
 
-   __try {
-      code = GetExceptionCode();
-      sprintf_s(bufferx, 255, "Exception caught in f:mg_server_offline: %x:%d", code, DBX_TRACE_VAR);
-      mg_log_event(pweb->plog, pweb, bufferx, "Error Condition", 0);
+/* publish this process's connection counts and add the changes in its counters to the scoreboard (context 1: the process is closing) */
+int mg_sb_publish(MGSRV *psrv, int context)
+{
+   long n;
+   MGSBSRV *psb;
+   MGSBGAUGE *pgauge;
+
+   psb = psrv->psb;
+   if (!psb || !mg_system.psb) {
+      return CACHE_SUCCESS;
    }
-   __except (EXCEPTION_EXECUTE_HANDLER) {
-      ;
+   pgauge = &(mg_system.psb->proc[mg_system.sb_slot].srv[psb - mg_system.psb->srv]); /* CMT82 */
+
+   mg_enter_critical_section((void *) &(psrv->pool.lock));
+
+   pgauge->no_connections = context ? 0 : (long) psrv->pool.no_alloc;
+   pgauge->no_inuse = context ? 0 : (long) psrv->pool.no_inuse;
+   pgauge->no_waiting = context ? 0 : (long) psrv->pool.no_waiting;
+   n = (long) psrv->no_requests;
+   if (n != psrv->sb_requests) {
+      mg_sb_add(&(psb->no_requests), n - psrv->sb_requests);
+      psrv->sb_requests = n;
+   }
+   n = (long) psrv->pool.no_queued;
+   if (n != psrv->sb_queued) {
+      mg_sb_add(&(psb->no_queued), n - psrv->sb_queued);
+      psrv->sb_queued = n;
+   }
+   n = (long) psrv->pool.no_queue_timeouts;
+   if (n != psrv->sb_queue_timeouts) {
+      mg_sb_add(&(psb->no_queue_timeouts), n - psrv->sb_queue_timeouts);
+      psrv->sb_queue_timeouts = n;
    }
 
-   return 0;
-}
-#endif
+   mg_leave_critical_section((void *) &(psrv->pool.lock));
+
+   return CACHE_SUCCESS;
 }
 
 
-/* v2.2.19 */
-int mg_server_online(MGWEB *pweb, MGSRV *psrv, char *info, int context)
+/* CMT82 sum the connection counts published by each process for a server and return the number of processes attached to the scoreboard */
+int mg_sb_read(MGSRV *psrv, MGSBGAUGE *ptotal)
 {
-   DBX_TRACE_INIT(0)
-   int server_no;
+   int n, sn, no_processes;
+   MGSB *psb;
 
-#ifdef _WIN32
-__try {
-#endif
+   memset((void *) ptotal, 0, sizeof(MGSBGAUGE));
+   psb = mg_system.psb;
+   if (!psb || !psrv->psb) {
+      return 0;
+   }
+   sn = (int) (psrv->psb - psb->srv);
 
-   if (psrv) { /* just mark one server as online */
-      if (context) {
-         /* block new connections to this server */
-         mg_enter_critical_section((void *) &mg_global_mutex);
-      }
-      psrv->offline = 0;
-      if (context) {
-         mg_leave_critical_section((void *) &mg_global_mutex);
+   mg_sb_lock(psb);
+   no_processes = mg_sb_reclaim(psb);
+   for (n = 0; n < MG_SB_PROCESSES; n ++) {
+      if (psb->proc[n].pid) {
+         ptotal->no_connections += psb->proc[n].srv[sn].no_connections;
+         ptotal->no_inuse += psb->proc[n].srv[sn].no_inuse;
+         ptotal->no_waiting += psb->proc[n].srv[sn].no_waiting;
       }
+   }
+   mg_sb_unlock(psb);
 
-      /* v2.4.24 */
-      if (info) {
-         sprintf(info, "DB Server %s marked online; context=%d;", psrv->name, context);
-      }
+   return no_processes;
+}
 
-      return 0;
-   }
 
-   if (!pweb->ppath) {
-      return -1;
-   }
-   if (!pweb->ppath->servers[1].psrv) { /* only one server, therefore no server list for failover */
-      return -1;
-   }
-   if (mg_server_alternatives(pweb, psrv, info, context) == 0) { /* CMT51 no viable alternatives */
-      return -1;
+/* write this process's view of a server's status to the scoreboard: called with mg_global_mutex held */
+int mg_sb_set_offline(MGSRV *psrv)
+{
+   if (!psrv->psb) {
+      return CACHE_SUCCESS;
    }
 
-   if (context) {
-      /* block new connections to this server */
-      mg_enter_critical_section((void *) &mg_global_mutex);
-   }
-   for (server_no = 0; pweb->ppath->servers[server_no].psrv; server_no ++) {
-      pweb->ppath->servers[server_no].psrv->offline = 0;
-   }
-   pweb->ppath->server_no = 0;
-   if (context) {
-      mg_leave_critical_section((void *) &mg_global_mutex);
+   psrv->psb->time_offline = psrv->time_offline;
+   psrv->psb->offline = psrv->offline ? 1 : 0;
+
+   return CACHE_SUCCESS;
+}
+
+
+/* take up a change of status made by another process: called with mg_global_mutex held */
+int mg_sb_get_offline(MGSRV *psrv)
+{
+   if (!psrv->psb || psrv->offline == 2) { /* leave a health check in progress to finish */
+      return CACHE_SUCCESS;
    }
 
-   /* v2.4.24 */
-   if (info) {
-      sprintf(info, "All DB Servers marked online; context=%d;", context);
+   if (psrv->offline != psrv->psb->offline || (psrv->offline && psrv->time_offline != psrv->psb->time_offline)) {
+      psrv->offline = psrv->psb->offline;
+      psrv->time_offline = psrv->psb->time_offline;
    }
 
-/*
-   mg_log_event(pweb->plog, pweb, "Mark all servers for this path as 'online' following an 'All DB Servers offline' event", "mg_server_online", 0);
-*/
+   return CACHE_SUCCESS;
+}
 
-   return 0;
 
-#ifdef _WIN32
+/* CMT72 put a connection on the server's list of multiplexed connections: the calling request is its first */
+int mg_pool_mux_link(MGSRV *psrv, DBXCON *pcon)
+{
+   mg_enter_critical_section((void *) &(psrv->pool.lock));
+
+   pcon->mux_inflight = 1;
+   pcon->mux_broken = 0;
+   pcon->mux_reader = 0;
+   pcon->pmux_wait = NULL;
+   if (!pcon->mux_linked) {
+      pcon->mux_linked = 1;
+      pcon->pnext_mux = psrv->pool.pmux;
+      psrv->pool.pmux = pcon;
+   }
+   while (mg_pool_mux_wake(psrv, pcon)) /* requests queued for a connection can now share this one */
+      ;
+
+   mg_leave_critical_section((void *) &(psrv->pool.lock));
+
+   return 0;
 }
-__except (EXCEPTION_EXECUTE_HANDLER) {
 
-   DWORD code;
-   char bufferx[256];
 
-   __try {
-      code = GetExceptionCode();
-      sprintf_s(bufferx, 255, "Exception caught in f:mg_server_online: %x:%d", code, DBX_TRACE_VAR);
-      mg_log_event(pweb->plog, pweb, bufferx, "Error Condition", 0);
+/* CMT72 give a place on a multiplexed connection to the request at the head of the queue: called with the pool lock held */
+int mg_pool_mux_wake(MGSRV *psrv, DBXCON *pcon)
+{
+   MGPWAIT *pwait;
+
+   pwait = psrv->pool.pwait_head;
+   if (!pwait || pwait->exclusive || pcon->mux_broken || pcon->mux_inflight >= pcon->mux_max) {
+      return 0;
    }
-   __except (EXCEPTION_EXECUTE_HANDLER) {
-      ;
+
+   psrv->pool.pwait_head = pwait->pnext;
+   if (!psrv->pool.pwait_head) {
+      psrv->pool.pwait_tail = NULL;
    }
+   psrv->pool.no_waiting --;
 
-   return 0;
-}
+   pcon->mux_inflight ++;
+   psrv->pool.no_mux_requests ++;
+   pwait->pcon = pcon;
+   pwait->mux = 1;
+   pwait->signalled = 1;
+   pwait->pnext = NULL;
+
+#if defined(_WIN32)
+   WakeConditionVariable(&(pwait->cond));
+#else
+   pthread_cond_signal(&(pwait->cond));
 #endif
+
+   return 1;
 }
 
-/* CMT51 */
-int mg_server_alternatives(MGWEB *pweb, MGSRV *psrv, char *info, int context)
+
+/* CMT72 a request has finished with a multiplexed connection: returns 1 if it was the last, in which case the caller returns the connection to the pool */
+int mg_pool_mux_release(DBXCON *pcon)
 {
-   DBX_TRACE_INIT(0)
-   int n, nalt;
+   int last;
+   MGSRV *psrv;
+   DBXCON *pcon1, *pcon_prev;
 
-#ifdef _WIN32
-__try {
-#endif
+   psrv = pcon->psrv;
+   last = 0;
 
-   if (!pweb->ppath) {
-      return 0;
-   }
-   if (!pweb->ppath->servers[1].psrv) { /* only one server, therefore no server list for failover */
-      return 0;
-   }
+   mg_enter_critical_section((void *) &(psrv->pool.lock));
 
-   nalt = 0;
-   for (n = 0; pweb->ppath->servers[n].psrv; n ++) {
-      if (n < 32) {
-         if (pweb->ppath->servers[n].exclusive == 0) {
-            nalt ++;
+   pcon->mux_inflight --;
+   mg_pool_mux_wake(psrv, pcon);
+
+   if (pcon->mux_inflight < 1) {
+      pcon->mux_inflight = 0;
+      pcon_prev = NULL;
+      for (pcon1 = psrv->pool.pmux; pcon1; pcon1 = pcon1->pnext_mux) {
+         if (pcon1 == pcon) {
+            if (pcon_prev)
+               pcon_prev->pnext_mux = pcon->pnext_mux;
+            else
+               psrv->pool.pmux = pcon->pnext_mux;
+            break;
          }
+         pcon_prev = pcon1;
       }
-      else {
+      pcon->pnext_mux = NULL;
+      pcon->mux_linked = 0;
+      last = 1;
+   }
+
+   mg_leave_critical_section((void *) &(psrv->pool.lock));
+
+   return last;
+}
+
+
+static void mg_mux_unlink(DBXCON *pcon, MGMUXWAIT *pwait)
+{
+   MGMUXWAIT **ppwait;
+
+   for (ppwait = &(pcon->pmux_wait); *ppwait; ppwait = &((*ppwait)->pnext)) {
+      if (*ppwait == pwait) {
+         *ppwait = pwait->pnext;
          break;
       }
    }
+   pwait->pnext = NULL;
+}
 
-   if (nalt > 0) {
-      nalt --; /* discounting the current server */
-   }
 
-/*
-   {
-      char buffer[256];
-      sprintf(buffer, "Number of possible alternative servers in configuration: %d", nalt);
-      mg_log_event(pweb->plog, pweb, buffer, "Alternative Servers", 0);
+/* CMT72 wake every request waiting on the connection: called with mux_lock held */
+static void mg_mux_wake_all(DBXCON *pcon)
+{
+   MGMUXWAIT *pwait;
+
+   for (pwait = pcon->pmux_wait; pwait; pwait = pwait->pnext) {
+#if defined(_WIN32)
+      WakeConditionVariable(&(pwait->cond));
+#else
+      pthread_cond_signal(&(pwait->cond));
+#endif
    }
-*/
+}
 
-   return nalt;
 
-#ifdef _WIN32
-}
-__except (EXCEPTION_EXECUTE_HANDLER) {
+/* CMT72 register for a response before the request is sent so that a reply arriving early is not lost */
+int mg_mux_register(MGWEB *pweb, MGMUXWAIT *pwait)
+{
+   DBXCON *pcon;
+   MGMUXWAIT **ppwait;
 
-   DWORD code;
-   char bufferx[256];
+   pcon = pweb->pcon;
 
-   __try {
-      code = GetExceptionCode();
-      sprintf_s(bufferx, 255, "Exception caught in f:mg_server_alternatives: %x:%d", code, DBX_TRACE_VAR);
-      mg_log_event(pweb->plog, pweb, bufferx, "Error Condition", 0);
-   }
-   __except (EXCEPTION_EXECUTE_HANDLER) {
+   memset((void *) pwait, 0, sizeof(MGMUXWAIT));
+   pwait->requestno = (unsigned long) pweb->requestno_in;
+#if defined(_WIN32)
+   InitializeConditionVariable(&(pwait->cond));
+#else
+   pthread_cond_init(&(pwait->cond), NULL);
+#endif
+
+   mg_enter_critical_section((void *) &(pcon->mux_lock));
+   for (ppwait = &(pcon->pmux_wait); *ppwait; ppwait = &((*ppwait)->pnext))
       ;
-   }
+   *ppwait = pwait;
+   mg_leave_critical_section((void *) &(pcon->mux_lock));
 
    return 0;
 }
-#endif
-}
 
 
-int mg_connect(MGWEB *pweb, int context)
+int mg_mux_unregister(MGWEB *pweb, MGMUXWAIT *pwait)
 {
-   DBX_TRACE_INIT(0)
-   int rc, con_retry_no, con_retry_time;
-   char bufferx[256];
    DBXCON *pcon;
-   time_t time_start, time_now;
 
-#ifdef _WIN32
-__try {
+   pcon = pweb->pcon;
+
+   mg_enter_critical_section((void *) &(pcon->mux_lock));
+   mg_mux_unlink(pcon, pwait);
+   mg_leave_critical_section((void *) &(pcon->mux_lock));
+
+#if !defined(_WIN32)
+   pthread_cond_destroy(&(pwait->cond));
 #endif
 
-   /* v2.4.25 */
-   time_start = time(NULL);
-   con_retry_no = 0;
-   con_retry_time = 0;
-   pweb->mg_connect_failed = 0;
-   pcon = pweb->pcon;
+   return 0;
+}
 
-   rc = CACHE_SUCCESS;
-   if (!pcon->psrv->shdir && pcon->psrv->ip_address && pcon->psrv->port) {
 
-      while (1) {
-         rc = netx_tcp_connect(pweb, 0);
-/*
-         {
-            char buffer[256];
-            sprintf(buffer, "network rc=%d;", rc);
-            mg_log_event(pweb->plog, pweb, buffer, "mg_connect: New Connection", 0);
-         }
-*/
-         if (rc == CACHE_SUCCESS) {
-            rc = netx_tcp_handshake(pweb, 0);
-/*
-            {
-               char buffer[256];
-               sprintf(buffer, "network handshake rc=%d;", rc);
-               mg_log_event(pweb->plog, pweb, buffer, "mg_connect: New Connection", 0);
-            }
-*/
-            if (rc == CACHE_SUCCESS) {
-               break;
+/* CMT72 read the 10 Byte header of the response to this request: returns 10 with the read side owned by this request, or a NETX_READ_* code */
+int mg_mux_read_head(MGWEB *pweb, MGMUXWAIT *pwait, unsigned char *head, int timeout)
+{
+   int rc, get, dsort, dtype;
+   unsigned long requestno, size, wait_start, wait_time;
+   unsigned char discard[1024];
+   DBXCON *pcon;
+   MGMUXWAIT *pwait1;
+#if !defined(_WIN32)
+   struct timeval tv;
+   struct timespec ts;
+#endif
+
+   pcon = pweb->pcon;
+   if (timeout < 1) {
+      timeout = NETX_TIMEOUT;
+   }
+
+   rc = NETX_READ_ERROR;
+   wait_start = mg_time_msecs();
+
+   mg_enter_critical_section((void *) &(pcon->mux_lock));
+
+   for (;;) {
+      if (pwait->ready) { /* another request has read our header and passed the connection to us */
+         memcpy((void *) head, (void *) pwait->head, 10);
+         pweb->mux_reader = 1;
+         rc = 10;
+         break;
+      }
+      if (pcon->mux_broken) {
+         strcpy(pweb->error, "Multiplexed connection to the DB Server lost");
+         rc = NETX_READ_ERROR;
+         break;
+      }
+
+      if (!pcon->mux_reader) {
+         pcon->mux_reader = 1;
+         mg_leave_critical_section((void *) &(pcon->mux_lock));
+
+         rc = netx_tcp_read(pweb, head, 10, timeout, 1);
+
+         mg_enter_critical_section((void *) &(pcon->mux_lock));
+         if (rc != 10) { /* we can no longer tell where the next frame starts */
+            pcon->mux_reader = 0;
+            pcon->mux_broken = 1;
+            mg_mux_wake_all(pcon);
+            if (rc >= 0) {
+               rc = NETX_READ_ERROR;
             }
+            break;
          }
-         /* see if we can retry connecting */
-         con_retry_no ++;
-         if (pcon->psrv->con_retry_no > 0 && con_retry_no > pcon->psrv->con_retry_no) {
-            con_retry_no = pcon->psrv->con_retry_no;
-            sprintf(bufferx, "Cannot connect to DB Server %s (%s:%d) after %d %s", pcon->psrv->name, pcon->psrv->ip_address, pcon->psrv->port, con_retry_no, con_retry_no == 1 ? "attempt" : "attempts");
-            mg_log_event(pweb->plog, pweb, bufferx, "mg_connect: new connection attempt", 0);
+
+         requestno = mg_get_size(head + 5);
+         if (requestno == pwait->requestno) {
+            pweb->mux_reader = 1;
             break;
          }
-         else if (pcon->psrv->con_retry_time > 0) {
-            time_now = time(NULL);
-            con_retry_time = (int) difftime(time_now, time_start);
-            if (con_retry_time > pcon->psrv->con_retry_time) {
-               sprintf(bufferx, "Cannot connect to DB Server %s (%s:%d) after %d seconds", pcon->psrv->name, pcon->psrv->ip_address, pcon->psrv->port, con_retry_time);
-               mg_log_event(pweb->plog, pweb, bufferx, "mg_connect: new connection attempt", 0);
+
+         for (pwait1 = pcon->pmux_wait; pwait1; pwait1 = pwait1->pnext) {
+            if (pwait1->requestno == requestno && !pwait1->ready) {
                break;
             }
          }
-         else {
-            sprintf(bufferx, "Cannot connect to DB Server %s (%s:%d)  after %d %s", pcon->psrv->name, pcon->psrv->ip_address, pcon->psrv->port, con_retry_no, con_retry_no == 1 ? "attempt" : "attempts");
-            mg_log_event(pweb->plog, pweb, bufferx, "mg_connect: new connection attempt", 0);
+         if (pwait1) { /* the read side passes to the request that owns this frame */
+            memcpy((void *) pwait1->head, (void *) head, 10);
+            pwait1->ready = 1;
+#if defined(_WIN32)
+            WakeConditionVariable(&(pwait1->cond));
+#else
+            pthread_cond_signal(&(pwait1->cond));
+#endif
+            continue;
+         }
+
+         /* the response to a request that has given up waiting: skip it */
+         size = mg_get_block_size(head, 0, &dsort, &dtype);
+         if (size == 0 && (head[9] == '\x01' || head[9] == '\x02')) { /* streamed: the end can't be found */
+            pcon->mux_reader = 0;
+            pcon->mux_broken = 1;
+            mg_mux_wake_all(pcon);
+            strcpy(pweb->error, "Multiplexed connection to the DB Server lost: unclaimed response");
+            rc = NETX_READ_ERROR;
             break;
          }
-         /* backoff slightly after each retry */
-         if (con_retry_no < 5) {
-            mg_sleep((unsigned long) con_retry_no * 1000);
+         mg_leave_critical_section((void *) &(pcon->mux_lock));
+         for (size = (size > 5 ? size - 5 : 0), rc = 0; size > 0 && rc >= 0; size -= (unsigned long) get) {
+            get = (int) (size > sizeof(discard) ? sizeof(discard) : size);
+            rc = netx_tcp_read(pweb, discard, get, timeout, 1);
+            if (rc != get) {
+               rc = NETX_READ_ERROR;
+            }
          }
-         else {
-            mg_sleep((unsigned long) 5000);
+         mg_enter_critical_section((void *) &(pcon->mux_lock));
+         pcon->mux_reader = 0;
+         if (rc < 0) {
+            pcon->mux_broken = 1;
+            mg_mux_wake_all(pcon);
+            break;
          }
+         mg_mux_wake_all(pcon);
+         continue;
       }
 
-      if (rc != CACHE_SUCCESS) {
-         pweb->mg_connect_failed = 1;
-         pcon->alloc = 0;
-         pcon->connected = 0; /* v2.8.42 */
-         /* pcon->closed = 1; v2.8.42 */
-         rc = CACHE_NOCON;
-         mg_error_message(pweb, rc);
-         return rc;
+      wait_time = mg_time_msecs() - wait_start;
+      if (wait_time >= ((unsigned long) timeout * 1000)) {
+         sprintf(pweb->error, "TCP Read Error: DB Server %s (%s:%d) did not respond within the timeout period (%d seconds)", (char *) pcon->psrv->name, (char *) pcon->psrv->ip_address, pcon->psrv->port, timeout);
+         rc = NETX_READ_TIMEOUT;
+         break;
       }
- 
-      pcon->alloc = 1;
-      pcon->connected = 1; /* network connection */
-      return rc;
+      wait_time = ((unsigned long) timeout * 1000) - wait_time;
+#if defined(_WIN32)
+      SleepConditionVariableCS(&(pwait->cond), &(pcon->mux_lock), (DWORD) wait_time);
+#else
+      gettimeofday(&tv, NULL);
+      ts.tv_sec = tv.tv_sec + (time_t) (wait_time / 1000);
+      ts.tv_nsec = (long) (tv.tv_usec * 1000) + (long) ((wait_time % 1000) * 1000000);
+      if (ts.tv_nsec >= 1000000000) {
+         ts.tv_sec ++;
+         ts.tv_nsec -= 1000000000;
+      }
+      pthread_cond_timedwait(&(pwait->cond), &(pcon->mux_lock), &ts);
+#endif
    }
 
-   if (!pcon->psrv->shdir) {
-      strcpy(pweb->error, "Unable to determine the path to the database installation");
-      rc = CACHE_NOCON;
-      return rc;
-   }
+   mg_mux_unlink(pcon, pwait);
+   mg_leave_critical_section((void *) &(pcon->mux_lock));
 
-   pcon->use_db_mutex = 1;
+#if !defined(_WIN32)
+   pthread_cond_destroy(&(pwait->cond));
+#endif
 
-   DBX_LOCK(0);
-   if (pcon->psrv->dbtype != DBX_DBTYPE_YOTTADB) {
-      rc = isc_open(pweb);
+   return rc;
+}
 
-      if (rc == CACHE_SUCCESS) {
-         pcon->alloc = 1;
-      }
-      else {
-         pcon->alloc = 0;
-      }
-   }
-   else {
-      rc = ydb_open(pweb);
 
-      if (rc == CACHE_SUCCESS) {
-         pcon->alloc = 1;
-      }
-      else {
-         pcon->alloc = 0;
-      }
-   }
-   DBX_UNLOCK();
+/* CMT72 the response has been read in full: the next request waiting may read from the connection */
+int mg_mux_read_done(MGWEB *pweb)
+{
+   DBXCON *pcon;
 
-   if (pcon->alloc) {
-      return CACHE_SUCCESS;
-   }
-   else {
-      pweb->mg_connect_failed = 1;
-      return CACHE_NOCON;
+   pcon = pweb->pcon;
+   if (!pcon || !pweb->mux_reader) {
+      return 0;
    }
 
-#ifdef _WIN32
+   mg_enter_critical_section((void *) &(pcon->mux_lock));
+   pweb->mux_reader = 0;
+   pcon->mux_reader = 0;
+   mg_mux_wake_all(pcon);
+   mg_leave_critical_section((void *) &(pcon->mux_lock));
+
+   return 0;
 }
-__except (EXCEPTION_EXECUTE_HANDLER) {
 
-   DWORD code;
-   char bufferx[256];
 
-   __try {
-      code = GetExceptionCode();
-      sprintf_s(bufferx, 255, "Exception caught in f:mg_connect: %x:%d", code, DBX_TRACE_VAR);
-      mg_log_event(pweb->plog, pweb, bufferx, "Error Condition", 0);
+/* CMT72 a request has finished with a multiplexed connection: if it stopped part way through reading a response the connection is unusable */
+int mg_mux_end(MGWEB *pweb, int close_connection)
+{
+   DBXCON *pcon;
+
+   pcon = pweb->pcon;
+   if (!pcon) {
+      return 0;
    }
-   __except (EXCEPTION_EXECUTE_HANDLER) {
-      ;
+
+   if (pweb->mux_reader && (close_connection || pweb->response_remaining > 0)) {
+      mg_enter_critical_section((void *) &(pcon->mux_lock));
+      pcon->mux_broken = 1;
+      mg_leave_critical_section((void *) &(pcon->mux_lock));
    }
+   mg_mux_read_done(pweb);
 
-   return CACHE_NOCON;
+   return 0;
 }
+
+
+/* CMT82 count a request served by a connection: requests sharing a multiplexed connection can finish at the same time */
+int mg_connection_add_request(DBXCON *pcon)
+{
+#if defined(_WIN32)
+   InterlockedIncrement((volatile LONG *) &(pcon->no_requests));
+#else
+   __sync_fetch_and_add(&(pcon->no_requests), 1);
 #endif
+   return 0;
 }
 
 
-int mg_release_connection(MGWEB *pweb, int close_connection)
+/* CMT59 refresh (ping) or close connections that are nearing the DB Server's idle timeout and top up the pool to min_connections */
+int mg_pool_maintain_server(MGSRV *psrv, time_t time_now)
 {
-   DBX_TRACE_INIT(0)
-   int rc;
+   int rc, n, idle_time, use_existing, server_busy;
+   char buffer[256];
    DBXCON *pcon;
+   MGWEB web;
 
-#ifdef _WIN32
-__try {
-#endif
+   if (psrv->net_connection != 1 || psrv->offline || !psrv->pool.created) {
+      return 0;
+   }
 
-   pcon = pweb->pcon;
+   memset((void *) &web, 0, sizeof(MGWEB));
+   web.plog = mg_system.plog;
+   web.psrv = psrv;
 
-   if (!pcon) {
-      return CACHE_FAILURE;
+   if (psrv->idle_timeout > (MG_POOL_REFRESH_MARGIN * 2)) {
+      idle_time = psrv->idle_timeout - MG_POOL_REFRESH_MARGIN;
+   }
+   else if (psrv->idle_timeout > 0) {
+      idle_time = (psrv->idle_timeout / 2) + 1;
+   }
+   else {
+      idle_time = MG_POOL_PING_INTERVAL;
    }
 
-   rc = CACHE_SUCCESS;
-   if (close_connection == 0) {
-      if (pweb->plog->log_connections == 2) { /* CMT55 */
-         char buffer[256];
-         sprintf(buffer, "Connection released: DB Server %s (%s:%d) address=%p; socket=%d;", (char *) pcon->psrv->name, (char *) pcon->psrv->ip_address, pcon->psrv->port, pcon, (int) pcon->cli_socket);
-         mg_log_event(pweb->plog, pweb, buffer, "mg_web: connections", 0);
+   for (n = psrv->pool.no_alloc; n > 0 && mg_system.pool_maintenance == 1; n --) {
+      pcon = mg_pool_obtain_idle(psrv, time_now, idle_time);
+      if (!pcon) {
+         break;
+      }
+      web.pcon = pcon;
+      web.error[0] = '\0';
+      if (psrv->idle_timeout && psrv->pool.no_alloc > psrv->min_connections) { /* surplus to requirements: close it before the DB Server does */
+         if (web.plog->log_connections) {
+            sprintf(buffer, "Connection idle time exceeded: DB Server %s (%s:%d) address=%p; socket=%d;", (char *) psrv->name, (char *) psrv->ip_address, psrv->port, pcon, (int) pcon->cli_socket);
+            mg_log_event(web.plog, &web, buffer, "mg_web: connections", 0);
+         }
+         mg_release_connection(&web, 1);
+         continue;
+      }
+      rc = netx_tcp_ping(&web, 0);
+      if (rc == 0) {
+         pcon->time_request = time_now;
+         mg_pool_release(pcon, 0);
+      }
+      else {
+         if (web.plog->log_connections) {
+            sprintf(buffer, "Connection failed health check: DB Server %s (%s:%d) address=%p; socket=%d; rc=%d;", (char *) psrv->name, (char *) psrv->ip_address, psrv->port, pcon, (int) pcon->cli_socket, rc);
+            mg_log_event(web.plog, &web, buffer, "mg_web: connections", 0);
+         }
+         mg_release_connection(&web, 1);
       }
-      pcon->inuse = 0;
-      return rc;
    }
 
-   if (pcon->psrv->net_connection) { /* v2.8.42 */
-      DBX_TRACE(10)
-      rc = netx_tcp_disconnect(pweb, 0);
-      DBX_TRACE(11)
+   if (psrv->min_connections < 1) {
+      return 0;
+   }
+   if (psrv->pool.time_connect_failed && (int) difftime(time_now, psrv->pool.time_connect_failed) < MG_POOL_RETRY_INTERVAL) {
+      return 0;
    }
-   else if (pcon->psrv->dbtype == DBX_DBTYPE_YOTTADB) {
-      DBX_TRACE(20)
-      if (pcon->p_ydb_so->loaded) {
-         rc = pcon->p_ydb_so->p_ydb_exit();
-         /* printf("\r\np_ydb_exit=%d\r\n", rc); */
-      }
-
-      strcpy(pweb->error, "");
 
-      if (pcon->p_ydb_so) { /* v2.8.39 */
-/*
-         mg_dso_unload(pcon->p_ydb_so->p_library); 
-         pcon->p_ydb_so->p_library = NULL;
-         pcon->p_ydb_so->loaded = 0;
-*/
-         strcpy(pcon->p_ydb_so->libdir, "");
-         strcpy(pcon->p_ydb_so->libnam, "");
+   for (n = psrv->min_connections; n > 0 && psrv->pool.no_alloc < psrv->min_connections && mg_system.pool_maintenance == 1; n --) {
+      pcon = mg_pool_obtain(psrv, 0, 1, &use_existing, &server_busy);
+      if (!pcon) {
+         break;
       }
-   }
-   else {
-      DBX_TRACE(30)
-      if (pcon->p_isc_so->loaded) {
-         DBX_LOCK(0);
-         rc = pcon->p_isc_so->p_CacheEnd();
-         DBX_UNLOCK();
+      if (use_existing) {
+         mg_pool_release(pcon, 0);
+         break;
+      }
+      web.pcon = pcon;
+      web.error[0] = '\0';
+      pcon->timeout = psrv->timeout;
+      pcon->current_timeout = 0;
+      pcon->p_db_mutex = &pcon->db_mutex;
+      mg_mutex_create(pcon->p_db_mutex);
+      pcon->p_zv = &pcon->zv;
+      pcon->pid = 0;
+
+      rc = mg_connect(&web, 0);
+      if (rc != CACHE_SUCCESS) {
+         mg_pool_release(pcon, 1);
+         psrv->pool.time_connect_failed = time_now;
+         sprintf(buffer, "Cannot pre-open a connection to DB Server %s (%s:%d); retry in %d seconds", (char *) psrv->name, (char *) psrv->ip_address, psrv->port, MG_POOL_RETRY_INTERVAL);
+         mg_log_event(web.plog, &web, buffer, "mg_web: connectivity error", 0);
+         break;
+      }
+      psrv->pool.time_connect_failed = 0;
+      pcon->time_request = time(NULL);
+      if (web.plog->log_connections) {
+         sprintf(buffer, "Connection created (min_connections=%d): DB Server %s (%s:%d) address=%p; socket=%d;", psrv->min_connections, (char *) psrv->name, (char *) psrv->ip_address, psrv->port, pcon, (int) pcon->cli_socket);
+         mg_log_event(web.plog, &web, buffer, "mg_web: connections", 0);
       }
+      mg_pool_release(pcon, 0);
+   }
 
-      strcpy(pweb->error, "");
+   return 0;
+}
 
-      if (pcon->p_isc_so) { /* v2.8.39 */
-         mg_dso_unload(pcon->p_isc_so->p_library); 
 
-         pcon->p_isc_so->p_library = NULL;
-         pcon->p_isc_so->loaded = 0;
+DBX_THR_TYPE mg_pool_maintenance(void *arg)
+{
+#if defined(_WIN32)
+   int rc;
+#endif
+   MGSRV *psrv;
 
-         strcpy(pcon->p_isc_so->libdir, "");
-         strcpy(pcon->p_isc_so->libnam, "");
+#if defined(_WIN32)
+   rc = 0;
+#endif
+   (void) arg;
+
+   /* CMT82 not detached: mg_pool_maintenance_stop() joins this thread before the pools are destroyed */
+   while (mg_system.pool_maintenance == 1) {
+      for (psrv = mg_server; psrv && mg_system.pool_maintenance == 1; psrv = psrv->pnext) {
+         mg_pool_maintain_server(psrv, time(NULL));
+         mg_sb_publish(psrv, 0); /* CMT73 */
       }
+      mg_pool_maintenance_wait((unsigned long) MG_POOL_MAINTENANCE_INTERVAL * 1000);
    }
 
-   DBX_TRACE(90)
+#if defined(_WIN32)
+   mg_system.pool_maintenance = 3; /* mg_pool_maintenance_stop() waits for the thread handle */
+#else
+   pthread_mutex_lock(&mg_pool_stop_mutex);
+   mg_system.pool_maintenance = 3;
+   pthread_cond_broadcast(&mg_pool_stop_cond);
+   pthread_mutex_unlock(&mg_pool_stop_mutex);
+#endif
 
-   pcon->connected = 0;
-   /* pcon->closed = 1; v2.8.42 */
-   pcon->inuse = 0;
-   pcon->alloc = 0;
+   return DBX_THR_RETURN;
+}
 
-   return rc;
 
-#ifdef _WIN32
+/* CMT82 sleep for up to 'msecs' milliseconds: returns 1 (at once) if the connection pool maintenance thread has been asked to stop */
+int mg_pool_maintenance_wait(unsigned long msecs)
+{
+#if !defined(_WIN32)
+   struct timeval tv;
+   struct timespec ts;
+#endif
+
+   if (mg_system.pool_maintenance == 0) {
+      mg_sleep(msecs);
+      return 0;
+   }
+
+#if defined(_WIN32)
+   if (mg_pool_stop_event) {
+      WaitForSingleObject(mg_pool_stop_event, (DWORD) msecs);
+   }
+   else {
+      mg_sleep(msecs);
+   }
+#else
+   gettimeofday(&tv, NULL);
+   ts.tv_sec = tv.tv_sec + (time_t) (msecs / 1000);
+   ts.tv_nsec = (long) (tv.tv_usec * 1000) + (long) ((msecs % 1000) * 1000000);
+   if (ts.tv_nsec >= 1000000000) {
+      ts.tv_sec ++;
+      ts.tv_nsec -= 1000000000;
+   }
+   pthread_mutex_lock(&mg_pool_stop_mutex);
+   while (mg_system.pool_maintenance == 1) {
+      if (pthread_cond_timedwait(&mg_pool_stop_cond, &mg_pool_stop_mutex, &ts) == ETIMEDOUT) {
+         break;
+      }
+   }
+   pthread_mutex_unlock(&mg_pool_stop_mutex);
+#endif
+
+   return (mg_system.pool_maintenance > 1) ? 1 : 0;
 }
-__except (EXCEPTION_EXECUTE_HANDLER) {
 
-   DWORD code;
-   char bufferx[256];
 
-   __try {
-      code = GetExceptionCode();
-      sprintf_s(bufferx, 255, "Exception caught in f:mg_release_connection: %x:%d", code, DBX_TRACE_VAR);
-      mg_log_event(pweb->plog, pweb, bufferx, "Error Condition", 0);
+/* CMT82 stop the connection pool maintenance thread, waiting a maximum of 'wait' milliseconds for it to finish: returns 0 if it is not running */
+int mg_pool_maintenance_stop(int wait)
+{
+   int finished;
+#if !defined(_WIN32)
+   struct timeval tv;
+   struct timespec ts;
+#endif
+
+   if (mg_system.pool_maintenance == 0) {
+      return 0;
    }
-   __except (EXCEPTION_EXECUTE_HANDLER) {
-      ;
+
+#if defined(_WIN32)
+   if (mg_system.pool_maintenance == 1) {
+      mg_system.pool_maintenance = 2;
+   }
+   if (mg_pool_stop_event) {
+      SetEvent(mg_pool_stop_event);
+   }
+   finished = (WaitForSingleObject(mg_system.pool_thread.thread_handle, (DWORD) wait) == WAIT_OBJECT_0) ? 1 : 0;
+#else
+   gettimeofday(&tv, NULL);
+   ts.tv_sec = tv.tv_sec + (time_t) (wait / 1000);
+   ts.tv_nsec = (long) (tv.tv_usec * 1000) + (long) ((wait % 1000) * 1000000);
+   if (ts.tv_nsec >= 1000000000) {
+      ts.tv_sec ++;
+      ts.tv_nsec -= 1000000000;
    }
+   pthread_mutex_lock(&mg_pool_stop_mutex);
+   if (mg_system.pool_maintenance == 1) {
+      mg_system.pool_maintenance = 2;
+      pthread_cond_broadcast(&mg_pool_stop_cond);
+   }
+   while (mg_system.pool_maintenance == 2 && wait > 0) {
+      if (pthread_cond_timedwait(&mg_pool_stop_cond, &mg_pool_stop_mutex, &ts) == ETIMEDOUT) {
+         break;
+      }
+   }
+   finished = (mg_system.pool_maintenance == 3) ? 1 : 0;
+   pthread_mutex_unlock(&mg_pool_stop_mutex);
+#endif
 
-   return 0;
-}
+   if (!finished) {
+      return -1;
+   }
+
+   mg_thread_join(&(mg_system.pool_thread)); /* the thread has finished so this does not wait */
+#if defined(_WIN32)
+   CloseHandle(mg_system.pool_thread.thread_handle);
+   mg_system.pool_thread.thread_handle = NULL;
 #endif
+   mg_system.pool_maintenance = 0;
+
+   return 0;
 }
 
 
 MGWEB * mg_obtain_request_memory(void *pweb_server, unsigned long request_clen, int request_chunked, int wstype)
 {
    DBX_TRACE_INIT(0)
+   int mclass;
    unsigned int len_alloc;
    MGWEB *pweb;
 
@@ -3459,7 +6944,11 @@ __try {
    }
 */
 
-   len_alloc = 128000 + request_clen;
+   /* CMT82 size the block from the request payload plus the room kept for the request headers */
+   len_alloc = MG_MBLOCK_HEADER_RESERVE + request_clen;
+   if (len_alloc < MG_MBLOCK_BASE_SIZE) {
+      len_alloc = MG_MBLOCK_BASE_SIZE;
+   }
    if (len_alloc < mg_system.request_buffer_size) { /* v2.1.10 */
       len_alloc = mg_system.request_buffer_size;
    }
@@ -3468,12 +6957,26 @@ __try {
       len_alloc = DBX_LS_BUFFER_ISC;
    }
 
-   pweb = (MGWEB *) mg_malloc(pweb_server, sizeof(MGWEB) + (len_alloc + 32), MG_MID_PWEB); /* v2.5.31 */
+   /* CMT63 reuse a pooled block where possible: web servers that supply their own allocator (Nginx) release request memory themselves */
+   pweb = NULL;
+   mclass = -1;
+   if (!(mg_ext_malloc && pweb_server)) {
+      mclass = mg_mblock_class(len_alloc);
+      if (mclass >= 0) {
+         len_alloc = mg_mblock_size(mclass);
+         pweb = (MGWEB *) mg_mblock_obtain(mclass, MG_MID_PWEB);
+      }
+   }
+   if (!pweb) {
+      mclass = -1;
+      pweb = (MGWEB *) mg_malloc(pweb_server, sizeof(MGWEB) + (len_alloc + 32), MG_MID_PWEB); /* v2.5.31 */
+   }
    if (!pweb) {
       return NULL;
    }
 
    memset((void *) pweb, 0, sizeof(MGWEB) + DBX_IBUFFER_OFFSET); /* v2.3.22 */
+   pweb->mblock_class = mclass;
 
    pweb->input_buf.buf_addr = ((char *) pweb) + sizeof(MGWEB);
    pweb->input_buf.buf_addr += DBX_IBUFFER_OFFSET;
@@ -3490,9 +6993,14 @@ __try {
    pweb->response_headers_long = NULL; /* v2.8.43 */
    pweb->response_headers_alloc = 0; /* v2.8.43 */
    pweb->protocol_distressed = 0; /* CMT54 */
+   pweb->hdr_status = 0; /* CMT68 */
+   pweb->hdr_no = 0;
 
    pweb->wstype = wstype; /* v2.7.33 */
    pweb->evented = 0;
+   pweb->sse_relayed = 0; /* CMT78 */
+   pweb->sse_client_fd = -1;
+   pweb->sse_complete = NULL;
    pweb->wserver_chunks_response = 0;
 
    pweb->error[0] = '\0';
@@ -3509,6 +7017,10 @@ __try {
    pweb->request_long = 0; /* CMT52 */
    pweb->request_chunked = (int) request_chunked; /* v2.8.37 */
    pweb->request_read_status = 0;
+   pweb->metrics = 0; /* CMT74 */
+   pweb->metrics_error = 0;
+   pweb->metrics_psrv = NULL;
+   pweb->timing = 0; /* CMT75 */
 /*
    {
       char buffer[256];
@@ -3550,9 +7062,14 @@ DBXVAL * mg_extend_response_memory(MGWEB *pweb)
 __try {
 #endif
 
-   len_alloc = 128000;
+   len_alloc = MG_MBLOCK_BASE_SIZE;
 
-   pval = (DBXVAL *) mg_malloc(pweb->pweb_server, sizeof(DBXVAL) + (len_alloc + 32), MG_MID_PWEBEXT); /* v2.5.31 */
+   if (mg_ext_malloc && pweb->pweb_server) {
+      pval = (DBXVAL *) mg_malloc(pweb->pweb_server, sizeof(DBXVAL) + (len_alloc + 32), MG_MID_PWEBEXT); /* v2.5.31 */
+   }
+   else {
+      pval = (DBXVAL *) mg_mblock_obtain(MG_MBLOCK_EXT, MG_MID_PWEBEXT); /* CMT63 */
+   }
    if (!pval) {
       return NULL;
    }
@@ -3612,8 +7129,13 @@ __try {
    pval = pweb->output_val.pnext;
    while (pval) {
       pvalnext = pval->pnext;
-      mg_free(pweb->pweb_server, (void *) pval, MG_MID_PWEBEXT); /* v2.5.31 */
-      pval = pvalnext; 
+      if (mg_ext_malloc && pweb->pweb_server) {
+         mg_free(pweb->pweb_server, (void *) pval, MG_MID_PWEBEXT); /* v2.5.31 */
+      }
+      else {
+         mg_mblock_release((void *) pval, MG_MBLOCK_EXT, MG_MID_PWEBEXT); /* CMT63 */
+      }
+      pval = pvalnext;
    }
    if (pweb->request_cookie) { /* v2.1.10 */
       mg_free(pweb->pweb_server, (void *) pweb->request_cookie, MG_MID_COOKIE); /* v2.5.31 */
@@ -3623,7 +7145,12 @@ __try {
       /* mg_log_event(pweb->plog, pweb, "Release oversize header memory", "mg_web: oversize header", 0); */
    }
 
-   mg_free(pweb->pweb_server, pweb, MG_MID_PWEB);
+   if (pweb->mblock_class >= 0) {
+      mg_mblock_release((void *) pweb, pweb->mblock_class, MG_MID_PWEB); /* CMT63 */
+   }
+   else {
+      mg_free(pweb->pweb_server, pweb, MG_MID_PWEB);
+   }
 
    return 0;
 
@@ -3692,7 +7219,12 @@ __try {
          if (!pweb->request_content_type[0]) {
             len = 1020;
             DBX_TRACE(11)
-            rc = mg_get_cgi_variable(pweb, "CONTENT_TYPE", pweb->request_content_type, &len);
+            if (pweb->hdr_status == 1) { /* CMT68 */
+               rc = mg_get_request_variable(pweb, "HTTP_CONTENT_TYPE", pweb->request_content_type, &len);
+            }
+            else {
+               rc = mg_get_cgi_variable(pweb, "CONTENT_TYPE", pweb->request_content_type, &len);
+            }
             DBX_TRACE(12)
             if (rc == MG_CGI_SUCCESS) { /* v2.1.15 */
                p = strstr(pweb->request_content_type, "boundary=");
@@ -3903,8 +7435,8 @@ int mg_find_sa_variable_ex_mp(MGWEB *pweb, char *name, int name_len, unsigned ch
 {
    DBX_TRACE_INIT(0)
    int server_no, server_no0, n, nc, nn, blen, len, found;
-   char *ph, *phz, *pn, *pv, *pz;
-   char cname[64], sname[64];
+   char *ph, *phz, *pn, *pv, *pz, *pb;
+   char cname[64], sname[64], bname[260];
 
 #ifdef _WIN32
 __try {
@@ -3918,19 +7450,31 @@ __try {
    server_no = -1;
    DBX_TRACE(1)
    blen = (int) strlen(pweb->boundary);
+   /* CMT69 scan for each --boundary delimiter */
+   bname[0] = '-';
+   bname[1] = '-';
+   strcpy(bname + 2, pweb->boundary);
    for (nc = 0; nc < (content_len - 3); nc ++) {
       DBX_TRACE(2)
+      pb = mg_scan_find((char *) (content + nc), content_len - nc, bname, blen + 2);
+      if (!pb) {
+         break;
+      }
+      nc = (int) (pb - (char *) content);
       if (content[nc] == '-' && content[nc + 1] == '-') {
          DBX_TRACE(3)
          if (!strncmp((char *) (content + (nc + 2)), pweb->boundary, blen)) {
             DBX_TRACE(4)
             ph = (char *) (content + (nc + blen + 4)); /* section header starts here */
-            phz = strstr(ph, "\r\n\r\n"); /* section header ends here */
+            phz = NULL;
+            if ((nc + blen + 4) < content_len) {
+               phz = mg_scan_find(ph, content_len - (nc + blen + 4), "\r\n\r\n", 4); /* section header ends here */
+            }
             if (phz) {
                DBX_TRACE(5)
                *phz = '\0';
                pv = (phz + 4); /* section value starts here */
-               pz = strstr(pv, "\r\n"); /* section value ends here */
+               pz = mg_scan_find(pv, content_len - (int) (pv - (char *) content), "\r\n", 2); /* section value ends here */
                if (pz) {
                   *pz = '\0';
                   pn = strstr(ph, "name=");
@@ -4075,13 +7619,31 @@ __try {
 
    *sname = '\0';
    found = 0;
-   len = 4096;
-   pweb->request_cookie = (char *) mg_malloc(pweb->pweb_server, len + 32, MG_MID_COOKIE); /* v2.5.31 */
+
+   /* CMT68 copy the cookie header from the index */
+   if (pweb->hdr_status == 1) {
+      rc = mg_find_request_header(pweb, "HTTP_COOKIE", &pv, &len);
+      if (rc != MG_CGI_SUCCESS) {
+         return server_no;
+      }
+      pweb->request_cookie = (char *) mg_malloc(pweb->pweb_server, len + 32, MG_MID_COOKIE);
+      if (!pweb->request_cookie) {
+         return server_no;
+      }
+      memcpy((void *) pweb->request_cookie, (void *) pv, (size_t) len);
+      pweb->request_cookie[len] = '\0';
+      n = 3;
+   }
+   else {
+      len = 4096;
+      pweb->request_cookie = (char *) mg_malloc(pweb->pweb_server, len + 32, MG_MID_COOKIE); /* v2.5.31 */
+      n = 0;
+   }
    DBX_TRACE(1)
    if (!pweb->request_cookie) {
       return server_no;
    }
-   for (n = 0; n < 3; n ++) {
+   for (; n < 3; n ++) {
       DBX_TRACE(2)
       rc = mg_get_cgi_variable(pweb, "HTTP_COOKIE", pweb->request_cookie, &len);
 
@@ -4227,6 +7789,7 @@ int mg_worker_init()
    char *pa, *pz;
    char buffer[2048];
    FILE *fp;
+   MGSRV *psrv;
 
 #ifdef _WIN32
 __try {
@@ -4406,12 +7969,109 @@ __try {
    mg_system.plog = &(mg_system.log);
    mg_system.log.req_no = 0;
    mg_system.log.fun_no = 0;
+   mg_system.log_buffer_size = MG_LOG_BUFFER_SIZE; /* CMT62 */
+   mg_system.buffer_pool_size = MG_MBLOCK_POOL_SIZE; /* CMT63 */
+   mg_system.dns_cache_ttl = MG_DNS_CACHE_TTL; /* CMT66 */
+   mg_system.scoreboard = 0; /* CMT73 */
+   mg_system.timing_sample = 0; /* CMT75 */
+   mg_system.timing_log = 0;
+   mg_system.timing_header = 0;
+   mg_system.timing_no = 0;
+   mg_system.psb = NULL;
+   mg_system.ws_relay = 0; /* CMT77 */
+   mg_system.ws_relay_sockets = 0;
+   mg_system.pwsrelay = NULL;
+   mg_system.sse_relay = 0; /* CMT78 */
+   mg_system.sse_relay_streams = 0;
+   mg_system.sse_heartbeat = 0;
+   mg_system.psserelay = NULL;
+   mg_system.pwschannel = NULL; /* CMT79 */
+   mg_system.ws_channels = 0;
+   mg_system.ws_channel_subscribers = 0;
+   mg_system.ws_deflate = 0; /* CMT80 */
+   mg_system.ws_deflate_window_bits = MG_WS_DEFLATE_WINDOW_BITS;
+   mg_system.ws_deflate_memory_level = MG_WS_DEFLATE_MEMORY_LEVEL;
+   mg_system.ws_deflate_context_takeover = 1;
+
+   mg_scan_init(-1); /* CMT69 */
 
    mg_parse_config();
 
+   mg_mblock_init(mg_system.buffer_pool_size); /* CMT63 */
+
    if (!mg_system.config_error[0]) {
       mg_verify_config();
    }
+
+   if (mg_system.scoreboard && !mg_system.config_error[0]) { /* CMT73 */
+      mg_sb_init();
+   }
+
+   /* CMT62 start the asynchronous log writer */
+   if (mg_system.log_buffer_size > 0 && mg_system.log.log_file[0]) {
+      if (mg_log_start(&(mg_system.log), mg_system.log_buffer_size) != CACHE_SUCCESS) {
+         mg_log_event(&(mg_system.log), NULL, "Cannot start the asynchronous log writer: messages will be written directly to the log file", "mg_web: error", 0);
+      }
+   }
+
+   /* CMT59 start the connection pool maintenance thread if any DB Server needs it */
+   if (!mg_system.config_error[0]) {
+      for (psrv = mg_server; psrv; psrv = psrv->pnext) {
+         if (psrv->net_connection == 1 && (psrv->min_connections > 0 || psrv->idle_timeout > 0)) {
+            break;
+         }
+      }
+      if (psrv) {
+#if defined(_WIN32)
+         if (!mg_pool_stop_event) {
+            mg_pool_stop_event = CreateEvent(NULL, TRUE, FALSE, NULL); /* CMT82 kept for the life of the process */
+         }
+         else {
+            ResetEvent(mg_pool_stop_event);
+         }
+#endif
+         mg_system.pool_maintenance = 1;
+         if (mg_thread_create(&(mg_system.pool_thread), (DBX_THR_FUNCTION) mg_pool_maintenance, NULL) != CACHE_SUCCESS) {
+            mg_system.pool_maintenance = 0;
+            mg_log_event(&(mg_system.log), NULL, "Cannot start the connection pool maintenance thread", "mg_web: error", 0);
+         }
+      }
+   }
+
+   /* CMT77 start the shared threads that relay DB Server data to WebSocket clients */
+   if (!mg_system.config_error[0] && mg_system.ws_relay > 0) {
+#if defined(MG_WS_RELAY)
+      if (mg_websocket_relay_start(mg_system.ws_relay) != CACHE_SUCCESS) {
+         mg_log_event(&(mg_system.log), NULL, "Cannot start the WebSocket relay threads: a thread will be used for each WebSocket", "mg_web: error", 0);
+      }
+#else
+      mg_log_event(&(mg_system.log), NULL, "The WebSocket relay is not available on this platform: a thread will be used for each WebSocket", "mg_web: information", 0);
+#endif
+   }
+
+   /* CMT80 WebSocket compression needs zlib */
+   if (!mg_system.config_error[0] && mg_system.ws_deflate > 0) {
+#if DBX_WITH_ZLIB >= 1
+      if (mg_websocket_deflate_load() != CACHE_SUCCESS) {
+         mg_log_event(&(mg_system.log), NULL, "Cannot load the zlib library: WebSocket compression (permessage-deflate) is disabled", "mg_web: error", 0);
+         mg_system.ws_deflate = 0;
+      }
+#else
+      mg_log_event(&(mg_system.log), NULL, "WebSocket compression (permessage-deflate) is not included in this build: set DBX_WITH_ZLIB to 1 in mg_websys.h", "mg_web: information", 0);
+      mg_system.ws_deflate = 0;
+#endif
+   }
+
+   /* CMT78 start the shared threads that relay SSE streams handed off by the web server module */
+   if (!mg_system.config_error[0] && mg_system.sse_relay > 0) {
+#if defined(MG_SSE_RELAY)
+      if (mg_sse_relay_start(mg_system.sse_relay) != CACHE_SUCCESS) {
+         mg_log_event(&(mg_system.log), NULL, "Cannot start the SSE relay threads: each SSE stream will be served by its request thread", "mg_web: error", 0);
+      }
+#else
+      mg_log_event(&(mg_system.log), NULL, "The SSE relay is not available on this platform: each SSE stream will be served by its request thread", "mg_web: information", 0);
+#endif
+   }
 /*
    {
       int size;
@@ -4454,8 +8114,8 @@ __except (EXCEPTION_EXECUTE_HANDLER) {
 int mg_worker_exit()
 {
    DBX_TRACE_INIT(0)
-   int rc;
-   char title[128], buffer[128];
+   int rc, dns_refreshes, pool_running, ws_relay_held;
+   char title[128], buffer[160];
    MGWEB web;
    DBXCON *pcon, *pcon_next;
    MGTLS *ptls, *ptls_next;
@@ -4476,8 +8136,41 @@ __try {
    }
 */
 
+   /* CMT59 stop the connection pool maintenance thread */
+   /* CMT82 and wait for it to finish: it may be part way through a health check on a pooled connection which is about to be freed */
+   /* CMT82 not under the loader lock (IIS): the IIS module stops the thread before the DLL is unloaded */
+   pool_running = (mg_pool_maintenance_stop(mg_system.loader_lock ? 0 : MG_POOL_STOP_WAIT) != 0) ? 1 : 0;
+   if (pool_running) {
+      mg_log_event(&(mg_system.log), NULL, "The connection pool maintenance thread is still running: the connection pools and DB Server definitions will not be freed", "mg_web: web server worker closing", 0);
+   }
+
+   ws_relay_held = 0;
+#if defined(MG_WS_RELAY)
+   ws_relay_held = (mg_websocket_relay_stop() != CACHE_SUCCESS) ? 1 : 0; /* CMT77 */ /* CMT82 */
+#endif
+#if defined(MG_SSE_RELAY)
+   mg_sse_relay_stop(); /* CMT78 */
+#endif
+
+   dns_refreshes = mg_dns_stop(); /* CMT82 */
+   if (dns_refreshes > 0) {
+      sprintf(buffer, "%d DB Server host name lookups are still running: the DB Server definitions will not be freed", dns_refreshes);
+      mg_log_event(&(mg_system.log), NULL, buffer, "mg_web: web server worker closing", 0);
+   }
+
+   /* CMT57 connections are freed below so stop returning them to the server pools */
+   psrv = pool_running ? NULL : mg_server; /* CMT82 */
+   while (psrv) {
+      mg_pool_destroy(psrv);
+      psrv = psrv->pnext;
+   }
+
+   if (!pool_running) {
+      mg_sb_exit(); /* CMT73 withdraw this process's connections from the scoreboard */
+   }
+
    /* v2.8.39 close down conections and free associated global memory */
-   pcon = mg_connection;
+   pcon = pool_running ? NULL : mg_connection; /* CMT82 */
    while (pcon) {
       pcon_next = pcon->pnext;
       memset((void *) &web, 0, sizeof(MGWEB));
@@ -4488,7 +8181,11 @@ __try {
       mg_free(NULL, (void *) pcon, MG_MID_CONNECTION);
       pcon = pcon_next;
    }
-   mg_connection = NULL;
+   if (!pool_running) {
+      mg_connection = NULL;
+   }
+
+   mgtls_free_resources(); /* CMT60 */
 
    strcpy(title, "mg_web: web server worker closing");
    sprintf(buffer, "exit status code: %d", rc);
@@ -4510,7 +8207,13 @@ __try {
 
    mg_log_event(&(mg_system.log), NULL, buffer, title, 0);
 
-   mg_delete_critical_section((void *) &mg_global_mutex);
+   mg_log_stop(mg_system.loader_lock ? 0 : MG_LOG_STOP_WAIT); /* CMT62 */ /* CMT82 */
+
+   mg_mblock_destroy(); /* CMT63 */
+
+   if (dns_refreshes == 0 && !pool_running && !ws_relay_held) { /* CMT82 otherwise still in use by mg_dns_refresh(), the pool maintenance thread or mg_websocket_relay_remove() */
+      mg_delete_critical_section((void *) &mg_global_mutex);
+   }
 
    /* v2.8.39 free global memory used to hold configuration */
    ptls = mg_tls;
@@ -4531,18 +8234,30 @@ __try {
          pwsmap = pwsmap_next;
       }
       ppath->pwsmap = NULL;
+      mg_rtree_free(ppath->pwsindex); /* CMT67 */
+      ppath->pwsindex = NULL;
+      mg_rcache_free(ppath->prcache); /* CMT71 */
+      ppath->prcache = NULL;
+      mg_metrics_free(ppath->pmetrics); /* CMT74 */
+      ppath->pmetrics = NULL;
       mg_free(NULL, (void *) ppath, MG_MID_PATHCON);
       ppath = ppath_next;
    }
    mg_path = NULL;
+   mg_rtree_free(mg_path_index); /* CMT67 */
+   mg_path_index = NULL;
 
-   psrv = mg_server;
+   psrv = (dns_refreshes == 0 && !pool_running) ? mg_server : NULL; /* CMT82 */
    while (psrv) {
       psrv_next = psrv->pnext;
+      mg_metrics_free(psrv->pmetrics); /* CMT74 */
+      psrv->pmetrics = NULL;
       mg_free(NULL, (void *) psrv, MG_MID_SRVCON);
       psrv = psrv_next;
    }
-   mg_server = NULL;
+   if (dns_refreshes == 0 && !pool_running) {
+      mg_server = NULL;
+   }
 
    if (mg_system.config) {
       mg_free(NULL, (void *) mg_system.config, MG_MID_SYSCON);
@@ -4712,7 +8427,11 @@ __try {
                   psrv->con_retry_no = 0;
                   psrv->con_retry_time = 0;
                   psrv->max_connections = 0; /* v2.5.30 */
+                  psrv->min_connections = 0; /* CMT59 */
+                  psrv->multiplex = 0; /* CMT72 */
+                  psrv->dns.ttl = -1; /* CMT66 */
                   psrv->ptls = NULL; /* v2.3.21 */
+                  mg_pool_create(psrv); /* CMT57 */
                   if (psrv_prev) {
                      psrv_prev->pnext = psrv;
                   }
@@ -4754,6 +8473,9 @@ __try {
                   ppath->pwsmap = NULL;
                   pwsmap_prev = NULL;
                   ppath->admin = 0;
+                  ppath->rcache_size = 0; /* CMT71 */
+                  ppath->rcache_vary_no = 0;
+                  ppath->prcache = NULL;
                   ppath->load_balancing = 0;
                   ppath->sa_cookie = NULL;
                   ppath->sa_order = 0;
@@ -4880,6 +8602,18 @@ __try {
                   else if (!strcmp(word[0], "max_connections")) { /* v2.5.30 */
                      psrv->max_connections = (int) strtol(word[1], NULL, 10);
                   }
+                  else if (!strcmp(word[0], "min_connections")) { /* CMT59 */
+                     psrv->min_connections = (int) strtol(word[1], NULL, 10);
+                  }
+                  else if (!strcmp(word[0], "multiplex")) { /* CMT72 */
+                     psrv->multiplex = (int) strtol(word[1], NULL, 10);
+                     if (psrv->multiplex > MG_MUX_MAX) {
+                        psrv->multiplex = MG_MUX_MAX;
+                     }
+                  }
+                  else if (!strcmp(word[0], "dns_cache_ttl")) { /* CMT66 */
+                     psrv->dns.ttl = (int) strtol(word[1], NULL, 10);
+                  }
                   else if (!strcmp(word[0], "tls")) { /* v2.3.21 */
                      psrv->tls_name = word[1];
                   }
@@ -4909,6 +8643,13 @@ __try {
                            pwsmap->name_len = (int) strlen(pwsmap->name);
                            pwsmap->function = word[2];
                            pwsmap->function_len = (int) strlen(pwsmap->function);
+                           pwsmap->channel = 0;
+                           if (wn > 3) { /* CMT79 */
+                              mg_lcase(word[3]);
+                              if (!strcmp(word[3], "channel")) {
+                                 pwsmap->channel = 1;
+                              }
+                           }
                            pwsmap->pnext = NULL;
                            if (!ppath->pwsmap) {
                               ppath->pwsmap = pwsmap;
@@ -4994,6 +8735,22 @@ __try {
                         }
                      }
                   }
+                  else if (!strcmp(word[0], "response_cache")) { /* CMT71 */
+                     mg_lcase(word[1]);
+                     ppath->rcache_size = 0;
+                     if (strcmp(word[1], "off")) {
+                        ppath->rcache_size = (unsigned long) strtol(word[1], NULL, 10);
+                        if (strstr(word[1], "k"))
+                           ppath->rcache_size *= 1000;
+                        else if (strstr(word[1], "m"))
+                           ppath->rcache_size *= 1000000;
+                     }
+                  }
+                  else if (!strcmp(word[0], "response_cache_vary")) { /* CMT71 */
+                     for (n = 1; n < wn && ppath->rcache_vary_no < MG_RCACHE_VARY_MAX; n ++) {
+                        ppath->rcache_vary[ppath->rcache_vary_no ++] = word[n];
+                     }
+                  }
                   else if (!strcmp(word[0], "administrator")) { /* v2.4.24 */
                      ppath->admin = 1;
                      mg_lcase(word[1]);
@@ -5126,6 +8883,109 @@ __try {
                         }
                      }
                   }
+                  else if (!strcmp(word[0], "log_buffer_size")) { /* CMT62 */
+                     if (wn > 1 && word[1]) {
+                        mg_lcase(word[1]);
+                        mg_system.log_buffer_size = (unsigned long) strtol(word[1], NULL, 10);
+                        if (strstr(word[1], "k"))
+                           mg_system.log_buffer_size *= 1000;
+                        else if (strstr(word[1], "m"))
+                           mg_system.log_buffer_size *= 1000000;
+                     }
+                  }
+                  else if (!strcmp(word[0], "dns_cache_ttl")) { /* CMT66 */
+                     if (wn > 1 && word[1]) {
+                        mg_system.dns_cache_ttl = (int) strtol(word[1], NULL, 10);
+                     }
+                  }
+                  else if (!strcmp(word[0], "request_timing")) { /* CMT75 request_timing <sample> [log] [header] */
+                     if (wn > 1 && word[1]) {
+                        mg_system.timing_sample = (int) strtol(word[1], NULL, 10);
+                        for (n = 2; n < wn && word[n]; n ++) {
+                           mg_lcase(word[n]);
+                           if (!strcmp(word[n], "log"))
+                              mg_system.timing_log = 1;
+                           else if (!strcmp(word[n], "header"))
+                              mg_system.timing_header = 1;
+                           else
+                              sprintf(mg_system.config_error, "Invalid value (%s) for parameter 'request_timing' on line %d", word[n], ln);
+                        }
+                        if (!mg_system.timing_log && !mg_system.timing_header) {
+                           mg_system.timing_log = 1;
+                           mg_system.timing_header = 1;
+                        }
+                     }
+                  }
+                  else if (!strcmp(word[0], "websocket_relay")) { /* CMT77 websocket_relay <threads> */
+                     if (wn > 1 && word[1]) {
+                        mg_system.ws_relay = (int) strtol(word[1], NULL, 10);
+                        if (mg_system.ws_relay < 0 || mg_system.ws_relay > MG_WS_RELAY_MAX)
+                           sprintf(mg_system.config_error, "Invalid value (%s) for parameter 'websocket_relay' on line %d (permitted range 0 to %d)", word[1], ln, MG_WS_RELAY_MAX);
+                     }
+                  }
+                  else if (!strcmp(word[0], "websocket_deflate")) { /* CMT80 websocket_deflate <compression level 0-9> */
+                     if (wn > 1 && word[1]) {
+                        mg_system.ws_deflate = (int) strtol(word[1], NULL, 10);
+                        if (mg_system.ws_deflate < 0 || mg_system.ws_deflate > 9)
+                           sprintf(mg_system.config_error, "Invalid value (%s) for parameter 'websocket_deflate' on line %d (permitted range 0 to 9)", word[1], ln);
+                     }
+                  }
+                  else if (!strcmp(word[0], "websocket_deflate_window_bits")) { /* CMT80 */
+                     if (wn > 1 && word[1]) {
+                        mg_system.ws_deflate_window_bits = (int) strtol(word[1], NULL, 10);
+                        if (mg_system.ws_deflate_window_bits < 9 || mg_system.ws_deflate_window_bits > 15)
+                           sprintf(mg_system.config_error, "Invalid value (%s) for parameter 'websocket_deflate_window_bits' on line %d (permitted range 9 to 15)", word[1], ln);
+                     }
+                  }
+                  else if (!strcmp(word[0], "websocket_deflate_memory_level")) { /* CMT80 */
+                     if (wn > 1 && word[1]) {
+                        mg_system.ws_deflate_memory_level = (int) strtol(word[1], NULL, 10);
+                        if (mg_system.ws_deflate_memory_level < 1 || mg_system.ws_deflate_memory_level > 9)
+                           sprintf(mg_system.config_error, "Invalid value (%s) for parameter 'websocket_deflate_memory_level' on line %d (permitted range 1 to 9)", word[1], ln);
+                     }
+                  }
+                  else if (!strcmp(word[0], "websocket_deflate_context_takeover")) { /* CMT80 */
+                     mg_lcase(word[1]);
+                     if (!strcmp(word[1], "on") || !strcmp(word[1], "yes") || !strcmp(word[1], "1"))
+                        mg_system.ws_deflate_context_takeover = 1;
+                     else if (!strcmp(word[1], "off") || !strcmp(word[1], "no") || !strcmp(word[1], "0"))
+                        mg_system.ws_deflate_context_takeover = 0;
+                     else
+                        sprintf(mg_system.config_error, "Invalid value (%s) for parameter 'websocket_deflate_context_takeover' on line %d", word[1], ln);
+                  }
+                  else if (!strcmp(word[0], "sse_relay")) { /* CMT78 sse_relay <threads> */
+                     if (wn > 1 && word[1]) {
+                        mg_system.sse_relay = (int) strtol(word[1], NULL, 10);
+                        if (mg_system.sse_relay < 0 || mg_system.sse_relay > MG_SSE_RELAY_MAX)
+                           sprintf(mg_system.config_error, "Invalid value (%s) for parameter 'sse_relay' on line %d (permitted range 0 to %d)", word[1], ln, MG_SSE_RELAY_MAX);
+                     }
+                  }
+                  else if (!strcmp(word[0], "sse_heartbeat")) { /* CMT78 sse_heartbeat <seconds> */
+                     if (wn > 1 && word[1]) {
+                        mg_system.sse_heartbeat = (int) strtol(word[1], NULL, 10);
+                        if (mg_system.sse_heartbeat < 0)
+                           sprintf(mg_system.config_error, "Invalid value (%s) for parameter 'sse_heartbeat' on line %d", word[1], ln);
+                     }
+                  }
+                  else if (!strcmp(word[0], "scoreboard")) { /* CMT73 */
+                     mg_lcase(word[1]);
+                     if (!strcmp(word[1], "on") || !strcmp(word[1], "yes") || !strcmp(word[1], "1"))
+                        mg_system.scoreboard = 1;
+                     else if (!strcmp(word[1], "off") || !strcmp(word[1], "no") || !strcmp(word[1], "0"))
+                        mg_system.scoreboard = 0;
+                     else
+                        sprintf(mg_system.config_error, "Invalid value (%s) for parameter 'scoreboard' on line %d", word[1], ln);
+                  }
+                  else if (!strcmp(word[0], "buffer_pool_size")) { /* CMT63 */
+                     if (wn > 1 && word[1]) {
+                        mg_lcase(word[1]);
+                        mg_system.buffer_pool_size = (unsigned long) strtol(word[1], NULL, 10);
+                        if (strstr(word[1], "k"))
+                           mg_system.buffer_pool_size *= 1000;
+                        else if (strstr(word[1], "m"))
+                           mg_system.buffer_pool_size *= 1000000;
+                     }
+                  }
                   else if (!strcmp(word[0], "request_buffer_size")) { /* 2.1.10 */
                      if (wn > 1 && word[1]) {
                         mg_lcase(word[1]);
@@ -5164,6 +9024,20 @@ __try {
       mg_system.timeout = NETX_TIMEOUT;
    }
 
+   mg_build_path_index(); /* CMT67 */
+
+   for (ppath = mg_path; ppath; ppath = ppath->pnext) { /* CMT71 */
+      if (ppath->rcache_size > 0 && !ppath->admin) {
+         ppath->prcache = mg_rcache_create(ppath);
+      }
+      if (!ppath->admin) { /* CMT74 */
+         ppath->pmetrics = mg_metrics_create();
+      }
+   }
+   for (psrv = mg_server; psrv; psrv = psrv->pnext) {
+      psrv->pmetrics = mg_metrics_create();
+   }
+
    return 0;
 
 #ifdef _WIN32
@@ -5348,7 +9222,7 @@ __try {
       }
 
       if (pbuf) { /* v2.4.25 */
-         sprintf(pbuf, "server name=%s; type=%s; path=%s; host=%s; port=%d; username=%s; password=%s; idle_timeout=%d; health_check=%d; connection_retries=%d/%d; max_connections=%d; tls=%s;", psrv->name, psrv->dbtype_name ? psrv->dbtype_name : "null", psrv->shdir ? psrv->shdir : "null", psrv->ip_address ? psrv->ip_address : "null", psrv->port, psrv->username ? psrv->username : "null", psrv->password ? psrv->password : "null", psrv->idle_timeout, psrv->health_check, psrv->con_retry_no, psrv->con_retry_time, psrv->max_connections, psrv->tls_name ? psrv->tls_name : "null");
+         sprintf(pbuf, "server name=%s; type=%s; path=%s; host=%s; port=%d; username=%s; password=%s; idle_timeout=%d; health_check=%d; connection_retries=%d/%d; max_connections=%d; min_connections=%d; multiplex=%d; dns_cache_ttl=%d; tls=%s;", psrv->name, psrv->dbtype_name ? psrv->dbtype_name : "null", psrv->shdir ? psrv->shdir : "null", psrv->ip_address ? psrv->ip_address : "null", psrv->port, psrv->username ? psrv->username : "null", psrv->password ? psrv->password : "null", psrv->idle_timeout, psrv->health_check, psrv->con_retry_no, psrv->con_retry_time, psrv->max_connections, psrv->min_connections, psrv->multiplex, psrv->dns.ttl, psrv->tls_name ? psrv->tls_name : "null");
          mg_log_event(&(mg_system.log), NULL, pbuf, "mg_web: configuration: DB Server", 0);
          if (psrv->penv) {
             sprintf(pbuf, "mg_web: configuration: DB Server: environment variables for DB Server name=%s;", psrv->name);
@@ -7398,47 +11272,194 @@ void * mg_realloc(void *pweb_server, void *p, int curr_size, int new_size, short
       }
    }
 
-   /* printf("\r\n curr_size=%d; new_size=%d;\r\n", curr_size, new_size); */
+   /* printf("\r\n curr_size=%d; new_size=%d;\r\n", curr_size, new_size); */
+
+   return p;
+}
+
+
+int mg_free(void *pweb_server, void *p, short id)
+{
+   /* printf("\nmg_free: id=%d; p=%p;", id, p); */
+
+/* v2.8.38 */
+/*
+{
+   char buffer[256];
+   sprintf(buffer, "pweb_server=%p; p=%p; id=%d;", pweb_server, p, id);
+   mg_log_event(&(mg_system.log), NULL, buffer, "mg_web: mg_free", 0);
+}
+*/
+
+   if (mg_ext_free && pweb_server) {
+      mg_ext_free(pweb_server, (void *) p);
+   }
+   else {
+#if defined(_WIN32)
+/* v2.8.49 */
+#if defined(MG_PRIVATE_HEAP)
+      if (mg_private_heap) {
+         HeapFree(mg_private_heap, 0, p);
+      }
+      else {
+         HeapFree(GetProcessHeap(), 0, p);
+      }
+#else
+      HeapFree(GetProcessHeap(), 0, p);
+#endif /* #if defined(MG_PRIVATE_HEAP) */
+#else
+      free((void *) p);
+#endif
+   }
+
+   return 0;
+}
+
+
+/* CMT63 pool of request and response extension memory blocks: blocks are retained on a free list for each size class, up to a maximum amount of memory */
+int mg_mblock_init(unsigned long retain_max)
+{
+   int n;
+   MGMBPOOL *pmbpool;
+
+   pmbpool = &(mg_system.mbpool);
+
+   mg_init_critical_section((void *) &(pmbpool->lock));
+   pmbpool->retain_max = retain_max;
+   pmbpool->retained = 0;
+   pmbpool->no_hits = 0;
+   pmbpool->no_misses = 0;
+   for (n = 0; n <= MG_MBLOCK_CLASSES; n ++) {
+      pmbpool->no_free[n] = 0;
+      pmbpool->pfree[n] = NULL;
+   }
+   pmbpool->enabled = retain_max ? 1 : 0;
+
+   return CACHE_SUCCESS;
+}
+
+
+int mg_mblock_class(unsigned int len_alloc)
+{
+   int n;
+
+   for (n = 0; n < MG_MBLOCK_CLASSES; n ++) {
+      if (len_alloc <= (unsigned int) (MG_MBLOCK_BASE_SIZE << n)) {
+         return n;
+      }
+   }
+   return -1;
+}
+
+
+/* usable buffer size for a class */
+unsigned int mg_mblock_size(int mclass)
+{
+   if (mclass == MG_MBLOCK_EXT) {
+      return MG_MBLOCK_BASE_SIZE;
+   }
+   return (unsigned int) (MG_MBLOCK_BASE_SIZE << mclass);
+}
+
+
+static unsigned int mg_mblock_alloc_size(int mclass)
+{
+   if (mclass == MG_MBLOCK_EXT) {
+      return (unsigned int) sizeof(DBXVAL) + mg_mblock_size(mclass) + 32;
+   }
+   return (unsigned int) sizeof(MGWEB) + mg_mblock_size(mclass) + 32;
+}
+
+
+void * mg_mblock_obtain(int mclass, short id)
+{
+   MGMBLOCK *pblock;
+   MGMBPOOL *pmbpool;
+
+   pmbpool = &(mg_system.mbpool);
+   pblock = NULL;
+
+   if (pmbpool->enabled) {
+      mg_enter_critical_section((void *) &(pmbpool->lock));
+      pblock = pmbpool->pfree[mclass];
+      if (pblock) {
+         pmbpool->pfree[mclass] = pblock->pnext;
+         pmbpool->no_free[mclass] --;
+         pmbpool->retained -= mg_mblock_alloc_size(mclass);
+         pmbpool->no_hits ++;
+      }
+      else {
+         pmbpool->no_misses ++;
+      }
+      mg_leave_critical_section((void *) &(pmbpool->lock));
+   }
+
+   if (!pblock) {
+      pblock = (MGMBLOCK *) mg_malloc(NULL, (int) mg_mblock_alloc_size(mclass), id);
+   }
+
+   return (void *) pblock;
+}
+
+
+int mg_mblock_release(void *p, int mclass, short id)
+{
+   unsigned int size;
+   MGMBLOCK *pblock;
+   MGMBPOOL *pmbpool;
+
+   pmbpool = &(mg_system.mbpool);
+   pblock = (MGMBLOCK *) p;
+
+   if (pmbpool->enabled) {
+      size = mg_mblock_alloc_size(mclass);
+      mg_enter_critical_section((void *) &(pmbpool->lock));
+      if ((pmbpool->retained + size) <= pmbpool->retain_max) {
+         pblock->pnext = pmbpool->pfree[mclass];
+         pmbpool->pfree[mclass] = pblock;
+         pmbpool->no_free[mclass] ++;
+         pmbpool->retained += size;
+         pblock = NULL;
+      }
+      mg_leave_critical_section((void *) &(pmbpool->lock));
+   }
+
+   if (pblock) {
+      mg_free(NULL, (void *) pblock, id);
+   }
 
-   return p;
+   return CACHE_SUCCESS;
 }
 
 
-int mg_free(void *pweb_server, void *p, short id)
+int mg_mblock_destroy(void)
 {
-   /* printf("\nmg_free: id=%d; p=%p;", id, p); */
+   int n;
+   MGMBLOCK *pblock, *pblock_next;
+   MGMBPOOL *pmbpool;
 
-/* v2.8.38 */
-/*
-{
-   char buffer[256];
-   sprintf(buffer, "pweb_server=%p; p=%p; id=%d;", pweb_server, p, id);
-   mg_log_event(&(mg_system.log), NULL, buffer, "mg_web: mg_free", 0);
-}
-*/
+   pmbpool = &(mg_system.mbpool);
 
-   if (mg_ext_free && pweb_server) {
-      mg_ext_free(pweb_server, (void *) p);
+   if (!pmbpool->enabled) {
+      return CACHE_SUCCESS;
    }
-   else {
-#if defined(_WIN32)
-/* v2.8.49 */
-#if defined(MG_PRIVATE_HEAP)
-      if (mg_private_heap) {
-         HeapFree(mg_private_heap, 0, p);
-      }
-      else {
-         HeapFree(GetProcessHeap(), 0, p);
+
+   mg_enter_critical_section((void *) &(pmbpool->lock));
+   pmbpool->enabled = 0;
+   for (n = 0; n <= MG_MBLOCK_CLASSES; n ++) {
+      pblock = pmbpool->pfree[n];
+      while (pblock) {
+         pblock_next = pblock->pnext;
+         mg_free(NULL, (void *) pblock, n == MG_MBLOCK_EXT ? MG_MID_PWEBEXT : MG_MID_PWEB);
+         pblock = pblock_next;
       }
-#else
-      HeapFree(GetProcessHeap(), 0, p);
-#endif /* #if defined(MG_PRIVATE_HEAP) */
-#else
-      free((void *) p);
-#endif
+      pmbpool->pfree[n] = NULL;
+      pmbpool->no_free[n] = 0;
    }
+   pmbpool->retained = 0;
+   mg_leave_critical_section((void *) &(pmbpool->lock));
 
-   return 0;
+   return CACHE_SUCCESS;
 }
 
 
@@ -7557,13 +11578,6 @@ int mg_log_event(DBXLOG *p_log, MGWEB *pweb, char *message, char *title, int lev
    char timestr[64], heading[1024], buffer[2048];
    char *p_buffer;
    time_t now = 0;
-#if defined(_WIN32)
-   HANDLE hLogfile = 0;
-   DWORD dwPos = 0, dwBytesWritten = 0;
-#else
-   FILE *fp = NULL;
-   struct flock lock;
-#endif
 
 #ifdef _WIN32
 __try {
@@ -7605,42 +11619,21 @@ __try {
    len = (int) strlen(p_buffer) * sizeof(char);
 
 #if defined(_WIN32)
-
    strcat(p_buffer, "\r\n");
    len = len + (2 * sizeof(char));
-   hLogfile = CreateFileA(p_log->log_file, GENERIC_WRITE, FILE_SHARE_WRITE,
-                         (LPSECURITY_ATTRIBUTES) NULL, OPEN_ALWAYS,
-                         FILE_ATTRIBUTE_NORMAL, (HANDLE) NULL);
-   dwPos = SetFilePointer(hLogfile, 0, (LPLONG) NULL, FILE_END);
-   LockFile(hLogfile, dwPos, 0, dwPos + len, 0);
-   WriteFile(hLogfile, (LPTSTR) p_buffer, len, &dwBytesWritten, NULL);
-   UnlockFile(hLogfile, dwPos, 0, dwPos + len, 0);
-   CloseHandle(hLogfile);
-
-#else /* UNIX or VMS */
-
+#else
    strcat(p_buffer, "\n");
-   fp = fopen(p_log->log_file, "a");
-   if (fp) {
-
-      lock.l_type = F_WRLCK;
-      lock.l_start = 0;
-      lock.l_whence = SEEK_SET;
-      lock.l_len = 0;
-      n = fcntl(fileno(fp), F_SETLKW, &lock);
-
-      fputs(p_buffer, fp);
-
-      lock.l_type = F_UNLCK;
-      lock.l_start = 0;
-      lock.l_whence = SEEK_SET;
-      lock.l_len = 0;
-      n = fcntl(fileno(fp), F_SETLK, &lock);
+   len = len + sizeof(char);
+#endif
 
-      fclose(fp); /* v2.7.33 */
+   /* CMT62 hand the message to the asynchronous writer if it is running for this log */
+   n = 0;
+   if (mg_system.logbuf.plog && p_log == mg_system.logbuf.plog) { /* CMT82 mg_log_enqueue() checks the writer's status under its lock */
+      n = mg_log_enqueue(&(mg_system.logbuf), p_buffer, len);
+   }
+   if (n == 0) {
+      mg_log_write_file(p_log->log_file, p_buffer, len);
    }
-
-#endif
 
    if (p_buffer != buffer)
       free((void *) p_buffer);
@@ -7706,20 +11699,356 @@ __try {
       p[buffer_len] = '\0';
    }
 
-   mg_log_event(p_log, pweb, (char *) p, title, level);
-
-   free((void *) p);
-
-   return 1;
+   mg_log_event(p_log, pweb, (char *) p, title, level);
+
+   free((void *) p);
+
+   return 1;
+
+#ifdef _WIN32
+}
+__except (EXCEPTION_EXECUTE_HANDLER) {
+      return 0;
+}
+
+#endif
+
+}
+
+
+/* CMT62 append a block of formatted log text to the log file */
+int mg_log_write_file(char *log_file, char *buffer, int len)
+{
+#if defined(_WIN32)
+   HANDLE hLogfile = 0;
+   DWORD dwPos = 0, dwBytesWritten = 0;
+#else
+   FILE *fp = NULL;
+   struct flock lock;
+#endif
+
+#if defined(_WIN32)
+
+   hLogfile = CreateFileA(log_file, GENERIC_WRITE, FILE_SHARE_WRITE,
+                         (LPSECURITY_ATTRIBUTES) NULL, OPEN_ALWAYS,
+                         FILE_ATTRIBUTE_NORMAL, (HANDLE) NULL);
+   dwPos = SetFilePointer(hLogfile, 0, (LPLONG) NULL, FILE_END);
+   LockFile(hLogfile, dwPos, 0, dwPos + len, 0);
+   WriteFile(hLogfile, (LPTSTR) buffer, len, &dwBytesWritten, NULL);
+   UnlockFile(hLogfile, dwPos, 0, dwPos + len, 0);
+   CloseHandle(hLogfile);
+
+#else /* UNIX or VMS */
+
+   fp = fopen(log_file, "a");
+   if (fp) {
+
+      lock.l_type = F_WRLCK;
+      lock.l_start = 0;
+      lock.l_whence = SEEK_SET;
+      lock.l_len = 0;
+      fcntl(fileno(fp), F_SETLKW, &lock);
+
+      fwrite((void *) buffer, sizeof(char), (size_t) len, fp);
+
+      lock.l_type = F_UNLCK;
+      lock.l_start = 0;
+      lock.l_whence = SEEK_SET;
+      lock.l_len = 0;
+      fcntl(fileno(fp), F_SETLK, &lock);
+
+      fclose(fp); /* v2.7.33 */
+   }
+
+#endif
+
+   return 1;
+}
+
+
+/* CMT62 start the asynchronous log writer for this process: size is the memory budget (in bytes) for buffered messages */
+int mg_log_start(DBXLOG *p_log, unsigned long size)
+{
+   MGLOGBUF *plogbuf;
+
+   plogbuf = &(mg_system.logbuf);
+
+   if (!size || plogbuf->status != 0) {
+      return CACHE_FAILURE;
+   }
+
+   mg_init_critical_section((void *) &(plogbuf->lock));
+#if defined(_WIN32)
+   InitializeConditionVariable(&(plogbuf->cond)); /* CMT82 */
+#else
+   pthread_cond_init(&(plogbuf->cond), NULL);
+#endif
+   plogbuf->buffer = (char *) mg_malloc(NULL, (int) size, MG_MID_LOGBUF);
+   if (!plogbuf->buffer) {
+      return CACHE_FAILURE;
+   }
+   plogbuf->size = size;
+   plogbuf->tail = 0;
+   plogbuf->used = 0;
+   plogbuf->no_written = 0;
+   plogbuf->no_dropped = 0;
+   plogbuf->no_dropped_reported = 0;
+   plogbuf->plog = p_log;
+
+   plogbuf->status = 1;
+   if (mg_thread_create(&(plogbuf->thread), (DBX_THR_FUNCTION) mg_log_flusher, (void *) plogbuf) != CACHE_SUCCESS) {
+      plogbuf->status = 0;
+      mg_free(NULL, (void *) plogbuf->buffer, MG_MID_LOGBUF);
+      plogbuf->buffer = NULL;
+      return CACHE_FAILURE;
+   }
+
+   return CACHE_SUCCESS;
+}
+
+
+/* CMT62 stop the asynchronous log writer */
+/* CMT82 waiting a maximum of 'wait' milliseconds for buffered messages to be written: if the writer has not finished by then it frees the buffer itself */
+int mg_log_stop(int wait)
+{
+   int finished;
+   unsigned long wait_start, wait_time;
+#if !defined(_WIN32)
+   struct timeval tv;
+   struct timespec ts;
+#endif
+   MGLOGBUF *plogbuf;
+
+   plogbuf = &(mg_system.logbuf);
+
+   if (!plogbuf->plog) { /* CMT82 never started */
+      return CACHE_SUCCESS;
+   }
+
+   mg_enter_critical_section((void *) &(plogbuf->lock));
+   if (plogbuf->status != 1) {
+      mg_leave_critical_section((void *) &(plogbuf->lock));
+      return CACHE_SUCCESS;
+   }
+   plogbuf->status = 2;
+#if defined(_WIN32)
+   WakeAllConditionVariable(&(plogbuf->cond));
+#else
+   pthread_cond_broadcast(&(plogbuf->cond));
+#endif
+
+   wait_start = mg_time_msecs();
+   while (plogbuf->status == 2) {
+      wait_time = mg_time_msecs() - wait_start;
+      if (wait < 1 || wait_time >= (unsigned long) wait) {
+         break;
+      }
+      wait_time = (unsigned long) wait - wait_time;
+#if defined(_WIN32)
+      SleepConditionVariableCS(&(plogbuf->cond), &(plogbuf->lock), (DWORD) wait_time);
+#else
+      gettimeofday(&tv, NULL);
+      ts.tv_sec = tv.tv_sec + (time_t) (wait_time / 1000);
+      ts.tv_nsec = (long) (tv.tv_usec * 1000) + (long) ((wait_time % 1000) * 1000000);
+      if (ts.tv_nsec >= 1000000000) {
+         ts.tv_sec ++;
+         ts.tv_nsec -= 1000000000;
+      }
+      pthread_cond_timedwait(&(plogbuf->cond), &(plogbuf->lock), &ts);
+#endif
+   }
+   finished = (plogbuf->status == 3) ? 1 : 0;
+   if (!finished) {
+      plogbuf->status = 4; /* the writer is still busy: it releases the buffer when it finishes */
+   }
+   mg_leave_critical_section((void *) &(plogbuf->lock));
+
+   if (!finished) {
+      return CACHE_FAILURE;
+   }
+
+#if defined(_WIN32)
+   if (!mg_system.loader_lock) { /* the thread cannot exit while DllMain holds the loader lock */
+      mg_thread_join(&(plogbuf->thread));
+   }
+   CloseHandle(plogbuf->thread.thread_handle);
+   plogbuf->thread.thread_handle = NULL;
+#else
+   mg_thread_join(&(plogbuf->thread));
+#endif
+
+   mg_enter_critical_section((void *) &(plogbuf->lock));
+   mg_free(NULL, (void *) plogbuf->buffer, MG_MID_LOGBUF);
+   plogbuf->buffer = NULL;
+   plogbuf->used = 0;
+   plogbuf->status = 0;
+   mg_leave_critical_section((void *) &(plogbuf->lock));
+
+   return CACHE_SUCCESS;
+}
+
+
+/* CMT62 copy a formatted message into the ring buffer: returns 1 if queued, -1 if dropped (buffer full) or 0 if the caller must write it directly */
+int mg_log_enqueue(MGLOGBUF *plogbuf, char *buffer, int len)
+{
+   int result;
+   unsigned long head, n;
+
+   if (len < 1 || (unsigned long) len > plogbuf->size) {
+      return 0;
+   }
+
+   mg_enter_critical_section((void *) &(plogbuf->lock));
+
+   if (plogbuf->status != 1 || !plogbuf->buffer) {
+      result = 0;
+   }
+   else if ((unsigned long) len > (plogbuf->size - plogbuf->used)) {
+      plogbuf->no_dropped ++;
+      result = -1;
+   }
+   else {
+      head = (plogbuf->tail + plogbuf->used) % plogbuf->size;
+      n = plogbuf->size - head;
+      if (n >= (unsigned long) len) {
+         memcpy((void *) (plogbuf->buffer + head), (void *) buffer, (size_t) len);
+      }
+      else {
+         memcpy((void *) (plogbuf->buffer + head), (void *) buffer, (size_t) n);
+         memcpy((void *) plogbuf->buffer, (void *) (buffer + n), (size_t) (len - n));
+      }
+      plogbuf->used += (unsigned long) len;
+      plogbuf->no_written ++;
+      result = 1;
+      if (plogbuf->used >= (plogbuf->size / 2) && (plogbuf->used - (unsigned long) len) < (plogbuf->size / 2)) { /* CMT82 wake the writer early */
+#if defined(_WIN32)
+         WakeAllConditionVariable(&(plogbuf->cond));
+#else
+         pthread_cond_broadcast(&(plogbuf->cond));
+#endif
+      }
+   }
+
+   mg_leave_critical_section((void *) &(plogbuf->lock));
+
+   return result;
+}
+
+
+/* CMT62 write everything held in the ring buffer to the log file: only called by the writer thread */
+int mg_log_flush(MGLOGBUF *plogbuf)
+{
+   unsigned long tail, len, dropped;
+   char buffer[256];
+
+   mg_enter_critical_section((void *) &(plogbuf->lock));
+   dropped = plogbuf->no_dropped - plogbuf->no_dropped_reported;
+   plogbuf->no_dropped_reported = plogbuf->no_dropped;
+   mg_leave_critical_section((void *) &(plogbuf->lock));
+
+   for (;;) {
+      mg_enter_critical_section((void *) &(plogbuf->lock));
+      tail = plogbuf->tail;
+      len = plogbuf->used;
+      if (len > (plogbuf->size - tail)) {
+         len = plogbuf->size - tail;
+      }
+      mg_leave_critical_section((void *) &(plogbuf->lock));
+
+      if (len == 0) {
+         break;
+      }
+
+      /* the region being written cannot be reused by writers until tail is advanced */
+      mg_log_write_file(plogbuf->plog->log_file, plogbuf->buffer + tail, (int) len);
+
+      mg_enter_critical_section((void *) &(plogbuf->lock));
+      plogbuf->tail = (tail + len) % plogbuf->size;
+      plogbuf->used -= len;
+      mg_leave_critical_section((void *) &(plogbuf->lock));
+   }
+
+   if (dropped) {
+      sprintf(buffer, "%lu log message(s) discarded because the log buffer (%lu Bytes) was full; total discarded: %lu", dropped, plogbuf->size, plogbuf->no_dropped_reported);
+      mg_log_event(plogbuf->plog, NULL, buffer, "mg_web: log buffer full", 0);
+   }
+
+   return CACHE_SUCCESS;
+}
+
+
+DBX_THR_TYPE mg_log_flusher(void *arg)
+{
+   int abandoned;
+#if defined(_WIN32)
+   int rc;
+#else
+   struct timeval tv;
+   struct timespec ts;
+#endif
+   MGLOGBUF *plogbuf;
+
+#if defined(_WIN32)
+   rc = 0;
+#endif
+
+   plogbuf = (MGLOGBUF *) arg;
+
+   /* CMT82 not detached: mg_log_stop() waits for this thread to finish */
+   mg_enter_critical_section((void *) &(plogbuf->lock));
+   while (plogbuf->status == 1) {
+      mg_leave_critical_section((void *) &(plogbuf->lock));
+      mg_log_flush(plogbuf);
+      mg_enter_critical_section((void *) &(plogbuf->lock));
+      /* wake early if the buffer is more than half full (signalled by mg_log_enqueue()) or a stop is requested */
+      if (plogbuf->status == 1 && plogbuf->used < (plogbuf->size / 2)) {
+#if defined(_WIN32)
+         SleepConditionVariableCS(&(plogbuf->cond), &(plogbuf->lock), (DWORD) MG_LOG_FLUSH_INTERVAL);
+#else
+         gettimeofday(&tv, NULL);
+         ts.tv_sec = tv.tv_sec;
+         ts.tv_nsec = (long) (tv.tv_usec * 1000) + (long) (MG_LOG_FLUSH_INTERVAL * 1000000);
+         while (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec ++;
+            ts.tv_nsec -= 1000000000;
+         }
+         pthread_cond_timedwait(&(plogbuf->cond), &(plogbuf->lock), &ts);
+#endif
+      }
+   }
+   mg_leave_critical_section((void *) &(plogbuf->lock));
+
+   mg_log_flush(plogbuf);
 
-#ifdef _WIN32
-}
-__except (EXCEPTION_EXECUTE_HANDLER) {
-      return 0;
-}
+   abandoned = 0;
+   mg_enter_critical_section((void *) &(plogbuf->lock));
+   if (plogbuf->status == 4) { /* CMT82 mg_log_stop() has stopped waiting for us */
+      mg_free(NULL, (void *) plogbuf->buffer, MG_MID_LOGBUF);
+      plogbuf->buffer = NULL;
+      plogbuf->used = 0;
+      plogbuf->status = 0;
+      abandoned = 1;
+   }
+   else {
+      plogbuf->status = 3;
+#if defined(_WIN32)
+      WakeAllConditionVariable(&(plogbuf->cond));
+#else
+      pthread_cond_broadcast(&(plogbuf->cond));
+#endif
+   }
+   mg_leave_critical_section((void *) &(plogbuf->lock));
 
+   if (abandoned) {
+#if defined(_WIN32)
+      CloseHandle(plogbuf->thread.thread_handle);
+      plogbuf->thread.thread_handle = NULL;
+#else
+      mg_thread_detach();
 #endif
+   }
 
+   return DBX_THR_RETURN;
 }
 
 
@@ -8162,6 +12491,42 @@ int mg_sleep(unsigned long msecs)
 }
 
 
+/* CMT58 millisecond clock for measuring intervals: callers should only use the difference between two readings */
+/* CMT82 use the monotonic clock so that a change to the system time does not stretch or cut short a timeout */
+unsigned long mg_time_msecs(void)
+{
+#if defined(_WIN32)
+   return (unsigned long) GetTickCount();
+#else
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (unsigned long) ((ts.tv_sec * 1000) + (ts.tv_nsec / 1000000));
+#endif
+}
+
+
+/* CMT74 microsecond clock for measuring intervals */
+long long mg_time_usecs(void)
+{
+#if defined(_WIN32)
+   static LARGE_INTEGER freq = {0};
+   LARGE_INTEGER count;
+
+   if (!freq.QuadPart) {
+      QueryPerformanceFrequency(&freq);
+   }
+   QueryPerformanceCounter(&count);
+   return (long long) (((count.QuadPart / freq.QuadPart) * 1000000) + (((count.QuadPart % freq.QuadPart) * 1000000) / freq.QuadPart));
+#else
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ((long long) ts.tv_sec * 1000000) + (long long) (ts.tv_nsec / 1000);
+#endif
+}
+
+
 unsigned int mg_file_size(char *file)
 {
    unsigned int size;
@@ -8436,15 +12801,424 @@ netx_load_winsock_no_so:
 }
 
 
+/* CMT66 return the addresses for a DB Server from its cache, resolving the host name only if nothing is cached */
+/* An expired entry is still used while a background thread refreshes it, so connections never wait on the resolver once a server has been resolved */
+/* CMT82 the host name is first resolved for the first connection to the server: not at worker initialization, which (for IIS) runs under the loader lock */
+int mg_dns_lookup(MGWEB *pweb, MGSRV *psrv, MGDNSADDR *paddr, int max)
+{
+   int no_addr, ttl, refresh;
+   time_t time_now;
+   DBXTHR thread;
+
+   (void) pweb;
+   ttl = (psrv->dns.ttl >= 0) ? psrv->dns.ttl : mg_system.dns_cache_ttl;
+   if (ttl == 0) {
+      return mg_dns_resolve(psrv, paddr, max);
+   }
+
+   time_now = time(NULL);
+   refresh = 0;
+
+   mg_enter_critical_section((void *) &mg_global_mutex);
+   no_addr = psrv->dns.no_addr;
+   if (no_addr > 0) {
+      if (no_addr > max) {
+         no_addr = max;
+      }
+      memcpy((void *) paddr, (void *) psrv->dns.addr, (size_t) no_addr * sizeof(MGDNSADDR));
+      psrv->dns.no_hits ++;
+      if (!psrv->dns.refreshing && !mg_system.dns_stop && difftime(time_now, psrv->dns.time_resolved) >= (double) ttl && difftime(time_now, psrv->dns.time_attempted) >= (double) MG_DNS_RETRY_INTERVAL) {
+         psrv->dns.refreshing = 1;
+         psrv->dns.time_attempted = time_now;
+         mg_system.dns_refreshes ++; /* CMT82 */
+         refresh = 1;
+      }
+   }
+   mg_leave_critical_section((void *) &mg_global_mutex);
+
+   if (no_addr > 0) {
+      if (refresh) {
+         if (mg_thread_create(&thread, (DBX_THR_FUNCTION) mg_dns_refresh, (void *) psrv) != CACHE_SUCCESS) {
+            mg_enter_critical_section((void *) &mg_global_mutex);
+            psrv->dns.refreshing = 0;
+            mg_system.dns_refreshes --;
+            mg_leave_critical_section((void *) &mg_global_mutex);
+         }
+      }
+      return no_addr;
+   }
+
+   no_addr = mg_dns_resolve(psrv, paddr, max);
+   if (no_addr > 0) {
+      mg_dns_store(psrv, paddr, no_addr);
+   }
+
+   return no_addr;
+}
+
+
+#if defined(NETX_IPV6)
+
+/* CMT66 resolve a DB Server's host name: addresses are interleaved by family, starting with the family of the first address returned (RFC 8305) */
+int mg_dns_resolve(MGSRV *psrv, MGDNSADDR *paddr, int max)
+{
+   short mode, use6;
+   int n, no_addr, no6, no4, i6, i4;
+   char port_str[32];
+   struct addrinfo hints, *res, *ai;
+   struct addrinfo *ai6[MG_DNS_MAX_ADDR], *ai4[MG_DNS_MAX_ADDR];
+
+   if (max > MG_DNS_MAX_ADDR) {
+      max = MG_DNS_MAX_ADDR;
+   }
+   sprintf(port_str, "%d", psrv->port);
+   no_addr = 0;
+
+   for (mode = 0; mode < 3 && no_addr == 0; mode ++) {
+
+      res = NULL;
+      memset(&hints, 0, sizeof hints);
+      hints.ai_family = AF_UNSPEC;     /* Use IPv4 or IPv6 */
+      hints.ai_socktype = SOCK_STREAM;
+      if (mode == 0)
+         hints.ai_flags = AI_NUMERICHOST | AI_CANONNAME;
+      else if (mode == 1)
+         hints.ai_flags = AI_CANONNAME;
+      else {
+         /* Apparently an error can occur with AF_UNSPEC (See RJW1564) */
+         /* This iteration will return IPV6 addresses if any */
+         hints.ai_flags = AI_CANONNAME;
+         hints.ai_family = AF_INET6;
+      }
+
+      n = NETX_GETADDRINFO(psrv->ip_address, port_str, &hints, &res);
+      if (n != 0) {
+         continue;
+      }
+
+      no6 = 0;
+      no4 = 0;
+      use6 = -1;
+      for (ai = res; ai != NULL; ai = ai->ai_next) {
+         if (ai->ai_addrlen > sizeof(struct sockaddr_storage)) {
+            continue;
+         }
+         if (ai->ai_family == AF_INET6 && no6 < max) {
+            ai6[no6 ++] = ai;
+            if (use6 == -1)
+               use6 = 1;
+         }
+         else if (ai->ai_family == AF_INET && no4 < max) {
+            ai4[no4 ++] = ai;
+            if (use6 == -1)
+               use6 = 0;
+         }
+      }
+
+      i6 = 0;
+      i4 = 0;
+      while (no_addr < max && (i6 < no6 || i4 < no4)) {
+         if ((use6 && i6 < no6) || i4 >= no4)
+            ai = ai6[i6 ++];
+         else
+            ai = ai4[i4 ++];
+         use6 = !use6;
+
+         paddr[no_addr].family = ai->ai_family;
+         paddr[no_addr].socktype = ai->ai_socktype;
+         paddr[no_addr].protocol = ai->ai_protocol;
+         paddr[no_addr].addrlen = (socklen_netx) ai->ai_addrlen;
+         memcpy((void *) &(paddr[no_addr].addr), (void *) ai->ai_addr, (size_t) ai->ai_addrlen);
+         no_addr ++;
+      }
+
+      NETX_FREEADDRINFO(res);
+   }
+
+   return no_addr;
+}
+
+#else
+
+/* CMT82 resolve a DB Server's host name (IPv4 only) */
+int mg_dns_resolve(MGSRV *psrv, MGDNSADDR *paddr, int max)
+{
+   int n, no_addr;
+   unsigned long inetaddr;
+   struct hostent *hp;
+   struct in_addr **pptr;
+
+   if (max > MG_DNS_MAX_ADDR) {
+      max = MG_DNS_MAX_ADDR;
+   }
+   no_addr = 0;
+
+   inetaddr = NETX_INET_ADDR(psrv->ip_address);
+   if (inetaddr != INADDR_NONE) {
+      memset((void *) &(paddr[0]), 0, sizeof(MGDNSADDR));
+      paddr[0].addr.sin_addr.s_addr = inetaddr;
+      no_addr = 1;
+   }
+   else {
+#if !defined(_WIN32)
+      mg_enter_critical_section((void *) &mg_dns_mutex);
+#endif
+      hp = NETX_GETHOSTBYNAME((const char *) psrv->ip_address);
+      if (hp) {
+         for (pptr = (struct in_addr **) hp->h_addr_list; *pptr != NULL && no_addr < max; pptr ++) {
+            memset((void *) &(paddr[no_addr]), 0, sizeof(MGDNSADDR));
+            NETX_MEMCPY(&(paddr[no_addr].addr.sin_addr), *pptr, sizeof(struct in_addr));
+            no_addr ++;
+         }
+      }
+#if !defined(_WIN32)
+      mg_leave_critical_section((void *) &mg_dns_mutex);
+#endif
+   }
+
+   for (n = 0; n < no_addr; n ++) {
+      paddr[n].family = AF_INET;
+      paddr[n].socktype = SOCK_STREAM;
+      paddr[n].protocol = 0;
+      paddr[n].addrlen = (socklen_netx) sizeof(struct sockaddr_in);
+      paddr[n].addr.sin_family = AF_INET;
+      paddr[n].addr.sin_port = NETX_HTONS((unsigned short) psrv->port);
+   }
+
+   return no_addr;
+}
+
+#endif /* #if defined(NETX_IPV6) */
+
+
+int mg_dns_store(MGSRV *psrv, MGDNSADDR *paddr, int no_addr)
+{
+   mg_enter_critical_section((void *) &mg_global_mutex);
+   memcpy((void *) psrv->dns.addr, (void *) paddr, (size_t) no_addr * sizeof(MGDNSADDR));
+   psrv->dns.no_addr = no_addr;
+   psrv->dns.time_resolved = time(NULL);
+   psrv->dns.no_lookups ++;
+   mg_leave_critical_section((void *) &mg_global_mutex);
+
+   return 0;
+}
+
+
+/* CMT66 refresh an expired address cache entry: the previous addresses are retained if the host name cannot be resolved */
+DBX_THR_TYPE mg_dns_refresh(void *arg)
+{
+   int no_addr;
+#if defined(_WIN32)
+   int rc;
+#endif
+   MGSRV *psrv;
+   MGDNSADDR addr[MG_DNS_MAX_ADDR];
+   char buffer[256];
+
+#if defined(_WIN32)
+   rc = 0;
+#else
+   mg_thread_detach();
+#endif
+
+   psrv = (MGSRV *) arg;
+
+   no_addr = mg_dns_resolve(psrv, addr, MG_DNS_MAX_ADDR);
+   if (no_addr > 0) {
+      mg_dns_store(psrv, addr, no_addr);
+   }
+
+   if (no_addr < 1 && mg_system.log.log_errors) {
+      sprintf(buffer, "Cannot resolve the host name for DB Server %s (%s:%d): the cached addresses will continue to be used", (char *) psrv->name, (char *) psrv->ip_address, psrv->port);
+      mg_log_event(&(mg_system.log), NULL, buffer, "mg_web: error", 0);
+   }
+
+   /* CMT82 psrv must not be used after this: mg_worker_exit() frees the DB Servers once no refresh is running */
+   mg_enter_critical_section((void *) &mg_global_mutex);
+   if (no_addr < 1) {
+      psrv->dns.no_failures ++;
+   }
+   psrv->dns.refreshing = 0;
+   mg_system.dns_refreshes --;
+   mg_leave_critical_section((void *) &mg_global_mutex);
+
+   return DBX_THR_RETURN;
+}
+
+
+/* CMT82 stop address cache refreshes before the DB Servers are freed: returns the number still running after MG_DNS_STOP_WAIT milliseconds */
+int mg_dns_stop(void)
+{
+   int n, running;
+
+   running = 0;
+   for (n = 0; n <= MG_DNS_STOP_WAIT; n += 10) {
+      mg_enter_critical_section((void *) &mg_global_mutex);
+      mg_system.dns_stop = 1;
+      running = mg_system.dns_refreshes;
+      mg_leave_critical_section((void *) &mg_global_mutex);
+      if (running == 0) {
+         break;
+      }
+      mg_sleep(10);
+   }
+
+   return running;
+}
+
+
+#if defined(NETX_IPV6) && !defined(_WIN32)
+/* CMT66 happy eyeballs (RFC 8305): if an attempt has not completed within MG_DNS_ATTEMPT_DELAY the next address is tried in parallel */
+/* The first connection to complete is used and the others are closed: timeout is in seconds */
+int netx_tcp_connect_race(MGWEB *pweb, MGDNSADDR *paddr, int no_addr, int timeout)
+{
+   int n, i, nfds, next, active, winner, error, start_now, wait;
+   int sock[MG_DNS_MAX_ADDR], flags[MG_DNS_MAX_ADDR], index[MG_DNS_MAX_ADDR];
+   unsigned long time_start, time_attempt, time_now, time_limit;
+   socklen_netx len;
+   struct pollfd pfd[MG_DNS_MAX_ADDR];
+   DBXCON *pcon;
+
+   pcon = pweb->pcon;
+   if (no_addr > MG_DNS_MAX_ADDR) {
+      no_addr = MG_DNS_MAX_ADDR;
+   }
+   for (n = 0; n < no_addr; n ++) {
+      sock[n] = -1;
+   }
+   next = 0;
+   active = 0;
+   winner = -1;
+   error = 0;
+   start_now = 1;
+   time_limit = (unsigned long) timeout * 1000;
+   time_start = mg_time_msecs();
+   time_attempt = time_start;
+
+   while (winner < 0) {
+      time_now = mg_time_msecs();
+      if ((time_now - time_start) >= time_limit) {
+         error = ETIMEDOUT;
+         break;
+      }
+
+      if (next < no_addr && (start_now || (time_now - time_attempt) >= MG_DNS_ATTEMPT_DELAY)) {
+         n = next ++;
+         start_now = 0;
+         time_attempt = time_now;
+
+         sock[n] = (int) NETX_SOCKET(paddr[n].family, paddr[n].socktype, paddr[n].protocol);
+         if (sock[n] < 0) {
+            error = errno;
+            sock[n] = -1;
+            start_now = 1;
+            continue;
+         }
+         if (netx_so.nagle_algorithm == 0) {
+            int flag = 1;
+            NETX_SETSOCKOPT(sock[n], IPPROTO_TCP, TCP_NODELAY, (const char *) &flag, sizeof(int));
+         }
+         flags[n] = fcntl(sock[n], F_GETFL, 0);
+         fcntl(sock[n], F_SETFL, flags[n] | O_NONBLOCK);
+
+         if (NETX_CONNECT(sock[n], (xLPSOCKADDR) &(paddr[n].addr), (socklen_netx) paddr[n].addrlen) == 0) {
+            winner = n;
+            break;
+         }
+         if (errno != EINPROGRESS) {
+            error = errno;
+            close(sock[n]);
+            sock[n] = -1;
+            start_now = 1;
+            continue;
+         }
+         active ++;
+      }
+
+      if (active == 0) {
+         if (next >= no_addr) {
+            break;
+         }
+         start_now = 1;
+         continue;
+      }
+
+      wait = (int) (time_limit - (time_now - time_start));
+      if (next < no_addr && wait > (int) (MG_DNS_ATTEMPT_DELAY - (time_now - time_attempt))) {
+         wait = (int) (MG_DNS_ATTEMPT_DELAY - (time_now - time_attempt));
+      }
+      if (wait < 1) {
+         wait = 1;
+      }
+
+      nfds = 0;
+      for (n = 0; n < next; n ++) {
+         if (sock[n] >= 0) {
+            pfd[nfds].fd = sock[n];
+            pfd[nfds].events = POLLOUT;
+            pfd[nfds].revents = 0;
+            index[nfds] = n;
+            nfds ++;
+         }
+      }
+
+      n = NETX_POLL(pfd, (nfds_t) nfds, wait);
+      if (n < 0) {
+         if (errno == EINTR) {
+            continue;
+         }
+         error = errno;
+         break;
+      }
+
+      for (i = 0; i < nfds && winner < 0; i ++) {
+         if (!pfd[i].revents) {
+            continue;
+         }
+         n = index[i];
+         len = sizeof(error);
+         if (NETX_GETSOCKOPT(sock[n], SOL_SOCKET, SO_ERROR, (void *) &error, &len) < 0) {
+            error = errno;
+         }
+         if (error == 0) {
+            winner = n;
+         }
+         else {
+            close(sock[n]);
+            sock[n] = -1;
+            active --;
+            start_now = 1;
+         }
+      }
+   }
+
+   for (n = 0; n < next; n ++) {
+      if (sock[n] >= 0 && n != winner) {
+         close(sock[n]);
+      }
+   }
+
+   if (winner < 0) {
+      errno = error ? error : ECONNREFUSED;
+      return (error == ETIMEDOUT) ? -2 : -1;
+   }
+
+   fcntl(sock[winner], F_SETFL, flags[winner]); /* Restore file status flags */
+   pcon->cli_socket = (SOCKET) sock[winner];
+
+   return 0;
+}
+#endif
+
+
 int netx_tcp_connect(MGWEB *pweb, int context)
 {
    short physical_ip, ipv6, connected, getaddrinfo_ok;
-   int rc, n, errorno;
+   int rc, n, errorno, no_addr, addr_no;
    unsigned long inetaddr;
    DWORD spin_count;
    struct sockaddr_in srv_addr, cli_addr;
-   struct hostent *hp;
-   struct in_addr **pptr;
+   MGDNSADDR addr[MG_DNS_MAX_ADDR];
    DBXCON *pcon;
 
    pcon = pweb->pcon;
@@ -8496,95 +13270,66 @@ int netx_tcp_connect(MGWEB *pweb, int context)
 #if defined(NETX_IPV6)
 
    if (ipv6) {
-      short mode;
-      struct addrinfo hints, *res;
-      struct addrinfo *ai;
-      char port_str[32];
-
-      res = NULL;
-      sprintf(port_str, "%d", pcon->psrv->port);
       connected = 0;
       pweb->error_no = 0;
 
-      for (mode = 0; mode < 3; mode ++) {
+      /* CMT66 addresses are taken from the DB Server's address cache, which is refreshed in the background */
+      no_addr = mg_dns_lookup(pweb, pcon->psrv, addr, MG_DNS_MAX_ADDR);
 
-         if (res) {
-            NETX_FREEADDRINFO(res);
-            res = NULL;
-         }
+      if (no_addr > 0) {
+         getaddrinfo_ok = 1;
+      }
 
-         memset(&hints, 0, sizeof hints);
-         hints.ai_family = AF_UNSPEC;     /* Use IPv4 or IPv6 */
-         hints.ai_socktype = SOCK_STREAM;
-         /* hints.ai_flags = AI_PASSIVE; */
-         if (mode == 0)
-            hints.ai_flags = AI_NUMERICHOST | AI_CANONNAME;
-         else if (mode == 1)
-            hints.ai_flags = AI_CANONNAME;
-         else if (mode == 2) {
-            /* Apparently an error can occur with AF_UNSPEC (See RJW1564) */
-            /* This iteration will return IPV6 addresses if any */
-            hints.ai_flags = AI_CANONNAME;
-            hints.ai_family = AF_INET6;
+#if !defined(_WIN32) && !defined(SOLARIS)
+      if (no_addr > 0 && pcon->timeout != 0) {
+         n = netx_tcp_connect_race(pweb, addr, no_addr, pcon->timeout);
+         if (n == 0) {
+            connected = 1;
          }
-         else
-            break;
-
-         n = NETX_GETADDRINFO(pcon->psrv->ip_address, port_str, &hints, &res);
-
-         if (n != 0) {
-            continue;
+         else {
+            pweb->error_no = (n == -2) ? -2 : (int) netx_get_last_error(0);
          }
+         no_addr = 0;
+      }
+#endif
 
-         getaddrinfo_ok = 1;
-         spin_count = 0;
-         for (ai = res; ai != NULL; ai = ai->ai_next) {
-
-            spin_count ++;
-
-	         if (ai->ai_family != AF_INET && ai->ai_family != AF_INET6) {
-               continue;
-            }
-
-	         /* Open a socket with the correct address family for this address. */
-	         pcon->cli_socket = NETX_SOCKET(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+      spin_count = 0;
+      for (n = 0; n < no_addr; n ++) {
 
-            /* NETX_BIND(pcon->cli_socket, ai->ai_addr, (int) (ai->ai_addrlen)); */
-            /* NETX_CONNECT(pcon->cli_socket, ai->ai_addr, (int) (ai->ai_addrlen)); */
+         spin_count ++;
 
-            if (netx_so.nagle_algorithm == 0) {
+         /* Open a socket with the correct address family for this address. */
+         pcon->cli_socket = NETX_SOCKET(addr[n].family, addr[n].socktype, addr[n].protocol);
 
-               int flag = 1;
-               int result;
+         if (netx_so.nagle_algorithm == 0) {
 
-               result = NETX_SETSOCKOPT(pcon->cli_socket, IPPROTO_TCP, TCP_NODELAY, (const char *) &flag, sizeof(int));
+            int flag = 1;
+            int result;
 
-               if (result < 0) {
-                  strcpy(pweb->error, "Connection Error: Unable to disable the Nagle Algorithm");
-               }
+            result = NETX_SETSOCKOPT(pcon->cli_socket, IPPROTO_TCP, TCP_NODELAY, (const char *) &flag, sizeof(int));
 
+            if (result < 0) {
+               strcpy(pweb->error, "Connection Error: Unable to disable the Nagle Algorithm");
             }
 
-            pweb->error_no = 0;
-            n = netx_tcp_connect_ex(pweb, (xLPSOCKADDR) ai->ai_addr, (socklen_netx) (ai->ai_addrlen), pcon->timeout);
-            if (n == -2) {
-               pweb->error_no = n;
-               n = -737;
-               continue;
-            }
-            if (SOCK_ERROR(n)) {
-               errorno = (int) netx_get_last_error(0);
-               pweb->error_no = errorno;
-               netx_tcp_disconnect(pweb, 0);
-               continue;
-            }
-            else {
-               connected = 1;
-               break;
-            }
          }
-         if (connected)
+
+         pweb->error_no = 0;
+         rc = netx_tcp_connect_ex(pweb, (xLPSOCKADDR) &(addr[n].addr), (socklen_netx) (addr[n].addrlen), pcon->timeout);
+         if (rc == -2) {
+            pweb->error_no = rc;
+            continue;
+         }
+         if (SOCK_ERROR(rc)) {
+            errorno = (int) netx_get_last_error(0);
+            pweb->error_no = errorno;
+            netx_tcp_disconnect(pweb, 0);
+            continue;
+         }
+         else {
+            connected = 1;
             break;
+         }
       }
 
       if (pweb->error_no) {
@@ -8593,11 +13338,6 @@ int netx_tcp_connect(MGWEB *pweb, int context)
          sprintf(pweb->error, "Connection Error: Cannot Connect to DB Server %s (%s:%d): Error Code: %d (%s)", (char *) pcon->psrv->name, (char *) pcon->psrv->ip_address, pcon->psrv->port, pweb->error_no, message);
          n = -5;
       }
-
-      if (res) {
-         NETX_FREEADDRINFO(res);
-         res = NULL;
-      }
    }
 #endif
 
@@ -8658,20 +13398,24 @@ int netx_tcp_connect(MGWEB *pweb, int context)
 
    if (inetaddr == INADDR_NONE || !physical_ip) {
 
-      hp = NETX_GETHOSTBYNAME((const char *) pcon->psrv->ip_address);
+      /* CMT82 addresses are taken from the DB Server's address cache instead of calling gethostbyname() for each connection */
+      no_addr = mg_dns_lookup(pweb, pcon->psrv, addr, MG_DNS_MAX_ADDR);
 
-      if (hp == NULL) {
+      if (no_addr < 1) {
          n = -2;
          strcpy(pweb->error, "Connection Error: Invalid Host");
          return n;
       }
 
-      pptr = (struct in_addr **) hp->h_addr_list;
       connected = 0;
 
       spin_count = 0;
 
-      for (; *pptr != NULL; pptr ++) {
+      for (addr_no = 0; addr_no < no_addr; addr_no ++) {
+
+         if (addr[addr_no].family != AF_INET) {
+            continue;
+         }
 
          spin_count ++;
 
@@ -8725,7 +13469,7 @@ int netx_tcp_connect(MGWEB *pweb, int context)
          srv_addr.sin_family = AF_INET;
          srv_addr.sin_port = NETX_HTONS((unsigned short) pcon->psrv->port);
 
-         NETX_MEMCPY(&srv_addr.sin_addr, *pptr, sizeof(struct in_addr));
+         NETX_MEMCPY(&srv_addr.sin_addr, &(((struct sockaddr_in *) &(addr[addr_no].addr))->sin_addr), sizeof(struct in_addr));
 
          n = netx_tcp_connect_ex(pweb, (xLPSOCKADDR) &srv_addr, sizeof(srv_addr), pcon->timeout);
 
@@ -8861,7 +13605,14 @@ int netx_tcp_handshake(MGWEB *pweb, int context)
 * 
    sprintf(buffer, "^S^dbx1~%s~%d\n", pcon->psrv->uci ? pcon->psrv->uci : "", pcon->psrv->idle_timeout);
 */
-   sprintf(buffer, "dbx1~%s~%d\n", pcon->psrv->uci ? pcon->psrv->uci : "", pcon->psrv->idle_timeout);
+   pcon->mux_max = 0; /* CMT72 */
+   /* CMT82 the connection is only multiplexed if the DB Server echoes ~mux=<n> in its reply: until then mux_max stays at 0 */
+   if (pcon->psrv->multiplex > 1 && !pcon->psrv->ptls) { /* offer to multiplex: DB Servers that don't support it ignore the extra field */
+      sprintf(buffer, "dbx1~%s~%d~mux=%d\n", pcon->psrv->uci ? pcon->psrv->uci : "", pcon->psrv->idle_timeout, pcon->psrv->multiplex);
+   }
+   else {
+      sprintf(buffer, "dbx1~%s~%d\n", pcon->psrv->uci ? pcon->psrv->uci : "", pcon->psrv->idle_timeout);
+   }
    len = (int) strlen(buffer);
 
    netx_tcp_write(pweb, (unsigned char *) buffer, len);
@@ -8890,10 +13641,30 @@ int netx_tcp_handshake(MGWEB *pweb, int context)
       mg_log_event(pweb->plog, pweb, bufferx, "netx_tcp_handshake", -1);
    }
 */
+   if (len >= (int) sizeof(buffer)) {
+      return CACHE_NOCON;
+   }
    len1 = netx_tcp_read(pweb, (unsigned char *) buffer, len, 10, 1); /* v2.1.13 */
    if (len1 != len) {
       return CACHE_NOCON;
    }
+   buffer[len1] = '\0';
+
+   if (pcon->psrv->multiplex > 1 && !pcon->psrv->ptls) { /* CMT72 the DB Server confirms the number of requests it will accept at once */
+      char *p;
+
+      p = strstr(buffer, "~mux=");
+      if (p) {
+         pcon->mux_max = (int) strtol(p + 5, NULL, 10);
+         if (pcon->mux_max > pcon->psrv->multiplex) {
+            pcon->mux_max = pcon->psrv->multiplex;
+         }
+         if (pcon->mux_max < 2) {
+            pcon->mux_max = 0;
+         }
+         *p = '\0';
+      }
+   }
 
 
    if (pcon->psrv->dbtype == DBX_DBTYPE_IRIS || pcon->psrv->dbtype == DBX_DBTYPE_CACHE) {
@@ -8999,6 +13770,45 @@ dbx1 ; test
 */
 
 
+/* CMT70 send the start of a request: if a pooled connection has gone, reconnect and send it again */
+int netx_tcp_send_command(MGWEB *pweb, MGIOVEC *piov, int iov_no, int reconnect)
+{
+   int rc;
+   DBXCON *pcon;
+
+   pcon = pweb->pcon;
+
+netx_tcp_send_command_reconnect:
+
+   rc = netx_tcp_writev(pweb, piov, iov_no);
+
+   if (rc < 0) {
+      if (reconnect) {
+         return rc;
+      }
+      else {
+         netx_tcp_disconnect(pweb, 0); /* CMT55 */
+         rc = mg_connect(pweb, 1);
+         if (rc < 0) {
+            return rc;
+         }
+         pcon = pweb->pcon;
+         reconnect = 1;
+
+         if (pweb->plog->log_connections) { /* CMT55 */
+            char buffer[256];
+            sprintf(buffer, "Connection created: DB Server %s (%s:%d) address=%p; socket=%d;", (char *) pcon->psrv->name, (char *) pcon->psrv->ip_address, pcon->psrv->port, pcon, (int) pcon->cli_socket);
+            mg_log_event(pweb->plog, pweb, buffer, "mg_web: connections", 0);
+         }
+
+         goto netx_tcp_send_command_reconnect;
+      }
+   }
+
+   return rc;
+}
+
+
 int netx_tcp_command(MGWEB *pweb, int command, int context)
 {
    DBX_TRACE_INIT(0)
@@ -9006,6 +13816,7 @@ int netx_tcp_command(MGWEB *pweb, int command, int context)
    unsigned int netbuf_used;
    unsigned char *netbuf;
    DBXCON *pcon;
+   MGMUXWAIT mux_wait;
 
 #ifdef _WIN32
 __try {
@@ -9029,46 +13840,57 @@ __try {
 */
 
    reconnect = 0;
+   mg_timing_mark(pweb); /* CMT75 */
+   if (pweb->mux) { /* CMT72 other requests are using this connection: it can't be replaced */
+      reconnect = 1;
+      mg_mux_register(pweb, &mux_wait);
+#if defined(_WIN32)
+      EnterCriticalSection(&(pcon->mux_write));
+#else
+      pthread_mutex_lock(&(pcon->mux_write));
+#endif
+   }
 
 netx_tcp_command_reconnect:
 
-   rc = netx_tcp_write(pweb, (unsigned char *) netbuf, netbuf_used);
+   if (pweb->request_long) { /* v2.2.18 */
 
-   if (rc < 0) {
-      if (reconnect) {
-         return rc;
-      }
-      else {
-         netx_tcp_disconnect(pweb, 0); /* CMT55 */
-         rc = mg_connect(pweb, 1);
-         if (rc < 0) {
-            return rc;
-         }
-         reconnect = 1;
+      /* CMT70 the request frame goes out with the first chunk of content, and the EOD marker with the last */
+      pweb->request_frame = netbuf;
+      pweb->request_frame_len = (int) netbuf_used;
+      pweb->request_last_chunk = 0;
+      pweb->request_eod_sent = 0;
 
-         if (pweb->plog->log_connections) { /* CMT55 */
-            char buffer[256];
-            sprintf(buffer, "Connection created: DB Server %s (%s:%d) address=%p; socket=%d;", (char *) pcon->psrv->name, (char *) pcon->psrv->ip_address, pcon->psrv->port, pcon, (int) pcon->cli_socket);
-            mg_log_event(pweb->plog, pweb, buffer, "mg_web: connections", 0);
-         }
+      rc = mg_execute_request_long(pweb, mg_write_chunk_tcp);
 
-         goto netx_tcp_command_reconnect;
+      pweb->request_frame = NULL;
+      if (rc >= 0 && !pweb->request_eod_sent) {
+         mg_add_block_size((unsigned char *) netbuf, 0, 0, DBX_DSORT_EOD, DBX_DTYPE_STR8);
+         rc = netx_tcp_write(pweb, (unsigned char *) netbuf, 5);
       }
    }
+   else {
+      MGIOVEC iov;
 
-   if (pweb->request_long) { /* v2.2.18 */
-
-      rc = mg_execute_request_long(pweb, mg_write_chunk_tcp);
+      iov.buf = netbuf;
+      iov.len = (int) netbuf_used;
+      rc = netx_tcp_send_command(pweb, &iov, 1, reconnect);
+   }
 
+   if (pweb->mux) { /* CMT72 */
+#if defined(_WIN32)
+      LeaveCriticalSection(&(pcon->mux_write));
+#else
+      pthread_mutex_unlock(&(pcon->mux_write));
+#endif
       if (rc < 0) {
-         return rc;
-      }
-      mg_add_block_size((unsigned char *) netbuf, 0, 0, DBX_DSORT_EOD, DBX_DTYPE_STR8);
-      rc = netx_tcp_write(pweb, (unsigned char *) netbuf, 5);
-      if (rc < 0) {
-         return rc;
+         mg_mux_unregister(pweb, &mux_wait);
       }
    }
+   if (rc < 0) {
+      return rc;
+   }
+   mg_timing_add(pweb, MG_TIMING_SEND); /* CMT75 */
 
 /* read to timeout */
 /*
@@ -9101,7 +13923,12 @@ netx_tcp_command_reconnect:
    pweb->failover_possible = 0; /* can't failover after this point */
    pweb->output_val.svalue.len_used = 0;
 
-   rc = netx_tcp_read(pweb, (unsigned char *) pweb->output_val.svalue.buf_addr, offset, pcon->timeout, 1);
+   if (pweb->mux) { /* CMT72 wait for the header of our response */
+      rc = mg_mux_read_head(pweb, &mux_wait, (unsigned char *) pweb->output_val.svalue.buf_addr, pcon->timeout);
+   }
+   else {
+      rc = netx_tcp_read(pweb, (unsigned char *) pweb->output_val.svalue.buf_addr, offset, pcon->timeout, 1);
+   }
 
 /*
    {
@@ -9129,6 +13956,10 @@ netx_tcp_command_reconnect:
    }
 
    pweb->output_val.svalue.buf_addr[offset] = '\0';
+   if (pweb->timing) { /* CMT75 first byte of the response */
+      mg_timing_add(pweb, MG_TIMING_DB);
+      pweb->timing_relay_start = pweb->timing_mark;
+   }
 
    pweb->response_size = mg_get_block_size((unsigned char *) pweb->output_val.svalue.buf_addr, 0, &(pweb->output_val.sort), &(pweb->output_val.type));
    pweb->requestno_out = mg_get_size((unsigned char *) (pweb->output_val.svalue.buf_addr + 5));
@@ -9183,6 +14014,9 @@ netx_tcp_command_reconnect:
    if (rc > 0) {
       rc = CACHE_SUCCESS;
    }
+   if (pweb->mux && pweb->response_remaining == 0) { /* CMT72 the whole response has been read: let the next request read from the connection */
+      mg_mux_read_done(pweb);
+   }
    return rc;
 
 #ifdef _WIN32
@@ -9241,7 +14075,12 @@ netx_tcp_read_stream_start:
          eos = 0;
          get = (pval->svalue.len_alloc - (pval->svalue.len_used + DBX_HEADER_SIZE));
          while (get) {
-            rc = netx_tcp_read(pweb, (unsigned char *) pval->svalue.buf_addr + pval->svalue.len_used, get, pweb->protocol_distressed ? 5 : pcon->timeout, 0);
+            if (pweb->mux) { /* CMT72 other responses follow ours on this connection: don't read beyond the end of the stream */
+               rc = netx_tcp_read_eos(pweb, (unsigned char *) pval->svalue.buf_addr + pval->svalue.len_used, get, (pval->svalue.len_used < 3 ? (int) pval->svalue.len_used : 3), pweb->protocol_distressed ? 5 : pcon->timeout);
+            }
+            else {
+               rc = netx_tcp_read(pweb, (unsigned char *) pval->svalue.buf_addr + pval->svalue.len_used, get, pweb->protocol_distressed ? 5 : pcon->timeout, 0);
+            }
 /*
             {
                char bufferx[256];
@@ -9278,7 +14117,7 @@ netx_tcp_read_stream_start:
             }
 */
             if (pval->svalue.len_used > 4) {
-               if (((unsigned char) pval->svalue.buf_addr[pval->svalue.len_used - 1]) == 0xff && ((unsigned char) pval->svalue.buf_addr[pval->svalue.len_used - 2]) == 0xff && ((unsigned char) pval->svalue.buf_addr[pval->svalue.len_used - 3]) == 0xff && ((unsigned char) pval->svalue.buf_addr[pval->svalue.len_used - 4]) == 0xff) {
+               if (!memcmp((void *) (pval->svalue.buf_addr + (pval->svalue.len_used - 4)), (void *) MG_STREAM_EOS, 4)) { /* CMT69 */
                   eos = 1;
                   break;
                }
@@ -9353,7 +14192,7 @@ netx_tcp_read_stream_start:
       if (rc == NETX_READ_TIMEOUT || rc == NETX_READ_EOF) {
          return rc;
       }
-      if (pweb->db_chunk_head[0] == 0xff && pweb->db_chunk_head[1] == 0xff && pweb->db_chunk_head[2] == 0xff && pweb->db_chunk_head[3] == 0xff) {
+      if (!memcmp((void *) pweb->db_chunk_head, (void *) MG_STREAM_EOS, 4)) {
          pweb->response_remaining = 0;
          if (pweb->plog->log_frames) {
             char bufferx[256]; if (pweb->response_remaining > 0) sprintf(bufferx, "%sResponse from DB Server: 0x%02x%02x%02x%02x (%lu Bytes; sort=%d; type=%d)", pweb->response_streamed ? "Chunked " : "", (unsigned char)pweb->db_chunk_head[3], (unsigned char)pweb->db_chunk_head[2], (unsigned char)pweb->db_chunk_head[1], (unsigned char)pweb->db_chunk_head[0], (unsigned long)pweb->response_remaining, pweb->output_val.sort, pweb->output_val.type); else sprintf(bufferx, "%sResponse from DB Server: 0x%02x%02x%02x%02x (EOF)", pweb->response_streamed ? "Chunked " : "", (unsigned char)pweb->db_chunk_head[3], (unsigned char)pweb->db_chunk_head[2], (unsigned char)pweb->db_chunk_head[1], (unsigned char)pweb->db_chunk_head[0]); mg_log_event(pweb->plog, pweb, bufferx, "mg_web: Read response", 0);
@@ -9431,7 +14270,7 @@ netx_tcp_read_stream_start:
             break;
          }
 
-         if (pweb->db_chunk_head[0] == 0xff && pweb->db_chunk_head[1] == 0xff && pweb->db_chunk_head[2] == 0xff && pweb->db_chunk_head[3] == 0xff) {
+         if (!memcmp((void *) pweb->db_chunk_head, (void *) MG_STREAM_EOS, 4)) {
             pweb->response_remaining = 0;
             MG_LOG_RESPONSE_FRAME(pweb, pweb->db_chunk_head, pweb->response_remaining);
             rc = CACHE_SUCCESS;
@@ -9522,8 +14361,6 @@ int netx_tcp_connect_ex(MGWEB *pweb, xLPSOCKADDR p_srv_addr, socklen_netx srv_ad
 #else
    int flags, n, error;
    socklen_netx len;
-   fd_set rset, wset;
-   struct timeval tval;
 #endif
    DBXCON *pcon;
 
@@ -9570,14 +14407,8 @@ int netx_tcp_connect_ex(MGWEB *pweb, xLPSOCKADDR p_srv_addr, socklen_netx srv_ad
 
       if (n != 0) {
 
-         FD_ZERO(&rset);
-         FD_SET(pcon->cli_socket, &rset);
-
-         wset = rset;
-         tval.tv_sec = timeout;
-         tval.tv_usec = timeout;
-
-         n = NETX_SELECT((int) (pcon->cli_socket + 1), &rset, &wset, NULL, &tval);
+         /* CMT61 wait for the connection to complete with poll() rather than select() */
+         n = netx_tcp_wait(pweb, NETX_WAIT_READ | NETX_WAIT_WRITE, timeout * 1000);
 
          if (n == 0) {
             close(pcon->cli_socket);
@@ -9585,7 +14416,10 @@ int netx_tcp_connect_ex(MGWEB *pweb, xLPSOCKADDR p_srv_addr, socklen_netx srv_ad
 
             return (-2);
          }
-         if (NETX_FD_ISSET(pcon->cli_socket, &rset) || NETX_FD_ISSET(pcon->cli_socket, &wset)) {
+         if (n < 0) {
+            error = errno;
+         }
+         else if (n & (NETX_WAIT_READ | NETX_WAIT_WRITE)) {
 
             len = sizeof(error);
             if (NETX_GETSOCKOPT(pcon->cli_socket, SOL_SOCKET, SO_ERROR, (void *) &error, &len) < 0) {
@@ -9624,6 +14458,107 @@ int netx_tcp_connect_ex(MGWEB *pweb, xLPSOCKADDR p_srv_addr, socklen_netx srv_ad
 }
 
 
+/* CMT61 wait for the DB Server socket to become ready, or for the connection's interrupt pipe to be signalled */
+/* timeout is in milliseconds: returns a mask of NETX_WAIT_* events, 0 on timeout or -1 on error */
+int netx_tcp_wait(MGWEB *pweb, int events, int timeout)
+{
+   int n, result;
+   DBXCON *pcon;
+#if defined(_WIN32)
+   fd_set rset, wset, eset;
+   struct timeval tval;
+#else
+   int nfds;
+   char buffer[8];
+   struct pollfd pfd[2];
+#endif
+
+   pcon = pweb->pcon;
+   result = 0;
+
+#if defined(_WIN32)
+
+   /* WinSock sets are arrays of socket handles so are not bound by descriptor values */
+   FD_ZERO(&rset);
+   FD_ZERO(&wset);
+   FD_ZERO(&eset);
+   if (events & NETX_WAIT_READ) {
+      FD_SET(pcon->cli_socket, &rset);
+   }
+   if (events & NETX_WAIT_WRITE) {
+      FD_SET(pcon->cli_socket, &wset);
+   }
+   FD_SET(pcon->cli_socket, &eset);
+   tval.tv_sec = timeout / 1000;
+   tval.tv_usec = (timeout % 1000) * 1000;
+
+   n = NETX_SELECT((int) (pcon->cli_socket + 1), &rset, &wset, &eset, &tval);
+   if (n < 0) {
+      return -1;
+   }
+   if (n > 0) {
+      if (NETX_FD_ISSET(pcon->cli_socket, &rset)) {
+         result |= NETX_WAIT_READ;
+      }
+      if (NETX_FD_ISSET(pcon->cli_socket, &wset)) {
+         result |= NETX_WAIT_WRITE;
+      }
+      if (NETX_FD_ISSET(pcon->cli_socket, &eset)) {
+         result |= (events & NETX_WAIT_WRITE) ? NETX_WAIT_WRITE : 0;
+      }
+   }
+
+#else
+
+   pfd[0].fd = (int) pcon->cli_socket;
+   pfd[0].events = 0;
+   pfd[0].revents = 0;
+   if (events & NETX_WAIT_READ) {
+      pfd[0].events |= POLLIN;
+   }
+   if (events & NETX_WAIT_WRITE) {
+      pfd[0].events |= POLLOUT;
+   }
+   nfds = 1;
+   if (pcon->int_pipe[0] > 0) {
+      pfd[1].fd = pcon->int_pipe[0];
+      pfd[1].events = POLLIN;
+      pfd[1].revents = 0;
+      nfds = 2;
+   }
+
+   n = NETX_POLL(pfd, (nfds_t) nfds, timeout);
+   if (n < 0) {
+      return -1;
+   }
+   if (n > 0) {
+      if (nfds == 2 && (pfd[1].revents & POLLIN)) {
+         n = (int) read(pcon->int_pipe[0], buffer, 4);
+         if (n == 4 && !strncmp(buffer, "exit", 4)) {
+            result |= NETX_WAIT_INTERRUPT;
+         }
+      }
+      if (pfd[0].revents & POLLNVAL) {
+         return -1;
+      }
+      /* As with select(), a hang-up or error is reported as readiness and picked up by the subsequent recv() or SO_ERROR check */
+      if (pfd[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+         result |= (events & NETX_WAIT_READ) ? NETX_WAIT_READ : 0;
+      }
+      if (pfd[0].revents & (POLLOUT | POLLHUP | POLLERR)) {
+         result |= (events & NETX_WAIT_WRITE) ? NETX_WAIT_WRITE : 0;
+      }
+      if (!result) {
+         result = -1;
+      }
+   }
+
+#endif
+
+   return result;
+}
+
+
 int netx_tcp_disconnect(MGWEB *pweb, int context)
 {
    DBXCON *pcon;
@@ -9716,11 +14651,129 @@ int netx_tcp_write(MGWEB *pweb, unsigned char *data, int size)
 }
 
 
+/* CMT70 send several buffers with one system call (writev/WSASend) or, over TLS, in as few records as possible */
+int netx_tcp_writev(MGWEB *pweb, MGIOVEC *piov, int iov_no)
+{
+   int n, rc, errorno, size, total, next, offset, len;
+#if defined(_WIN32)
+   DWORD sent;
+   WSABUF iov[MG_IOVEC_MAX];
+#else
+   struct iovec iov[MG_IOVEC_MAX];
+#endif
+   DBXCON *pcon;
+
+   pcon = pweb->pcon;
+
+   if (pcon->connected == 0) {
+      strcpy(pweb->error, "TCP Write Error: Socket is Closed");
+      return -1;
+   }
+
+   size = 0;
+   for (n = 0; n < iov_no; n ++) {
+      size += piov[n].len;
+   }
+
+#if defined(_WIN32)
+   if (pcon->ptlscon || iov_no > MG_IOVEC_MAX || netx_so.winsock != 2) {
+#else
+   if (pcon->ptlscon || iov_no > MG_IOVEC_MAX) {
+#endif
+      unsigned char record[MG_TLS_RECORD_SIZE];
+
+      /* small buffers are coalesced into full records: whole records are written straight from the caller's buffer */
+      len = 0;
+      for (n = 0; n < iov_no; n ++) {
+         offset = 0;
+         while (offset < piov[n].len) {
+            if (len == 0 && (piov[n].len - offset) >= MG_TLS_RECORD_SIZE) {
+               next = ((piov[n].len - offset) / MG_TLS_RECORD_SIZE) * MG_TLS_RECORD_SIZE;
+               if (netx_tcp_write(pweb, piov[n].buf + offset, next) < 0) {
+                  return -1;
+               }
+               offset += next;
+               continue;
+            }
+            next = piov[n].len - offset;
+            if (next > (MG_TLS_RECORD_SIZE - len)) {
+               next = (MG_TLS_RECORD_SIZE - len);
+            }
+            memcpy((void *) (record + len), (void *) (piov[n].buf + offset), (size_t) next);
+            len += next;
+            offset += next;
+            if (len == MG_TLS_RECORD_SIZE) {
+               if (netx_tcp_write(pweb, record, len) < 0) {
+                  return -1;
+               }
+               len = 0;
+            }
+         }
+      }
+      if (len > 0 && netx_tcp_write(pweb, record, len) < 0) {
+         return -1;
+      }
+      return size;
+   }
+
+   rc = 0;
+   total = 0;
+   next = 0;
+   offset = 0;
+   while (total < size) {
+      /* skip the buffers already sent, allowing for a partial write */
+      while (next < iov_no && offset >= piov[next].len) {
+         offset -= piov[next].len;
+         next ++;
+      }
+      for (n = 0; (next + n) < iov_no; n ++) {
+#if defined(_WIN32)
+         iov[n].buf = (char *) (piov[next + n].buf + (n ? 0 : offset));
+         iov[n].len = (ULONG) (piov[next + n].len - (n ? 0 : offset));
+#else
+         iov[n].iov_base = (void *) (piov[next + n].buf + (n ? 0 : offset));
+         iov[n].iov_len = (size_t) (piov[next + n].len - (n ? 0 : offset));
+#endif
+      }
+
+#if defined(_WIN32)
+      sent = 0;
+      n = NETX_WSASEND(pcon->cli_socket, iov, (DWORD) n, &sent, 0, NULL, NULL);
+      if (!SOCK_ERROR(n)) {
+         n = (int) sent;
+      }
+#else
+      n = (int) writev(pcon->cli_socket, iov, n);
+#endif
+
+      if (SOCK_ERROR(n)) {
+         errorno = (int) netx_get_last_error(0);
+         if (NOT_BLOCKING(errorno) && errorno != 0) {
+            char message[256];
+
+            netx_get_error_message(errorno, message, 250, 0);
+            sprintf(pweb->error, "TCP Write Error: Cannot Write Data: Error Code: %d (%s)", errorno, message);
+            rc = -1;
+            break;
+         }
+      }
+      else {
+         total += n;
+         offset += n;
+      }
+   }
+
+   if (rc < 0)
+      return rc;
+   else
+      return size;
+}
+
+
 int netx_tcp_read(MGWEB *pweb, unsigned char *data, int size, int timeout, int context)
 {
-   int result, n, max_fd;
+   int result, n;
    int len;
-   fd_set rset, eset;
    struct timeval tval;
    unsigned long spin_count;
    DBXCON *pcon;
@@ -9750,29 +14803,14 @@ int netx_tcp_read(MGWEB *pweb, unsigned char *data, int size, int timeout, int c
          n = mgtls_recv(pweb, (unsigned char *) (data + len), size - len);
       }
       else {
-         FD_ZERO(&rset);
-         FD_ZERO(&eset);
-         FD_SET(pcon->cli_socket, &rset);
-         FD_SET(pcon->cli_socket, &eset);
+         /* CMT61 poll() replaces select() so that descriptors above FD_SETSIZE can be used */
+         n = netx_tcp_wait(pweb, NETX_WAIT_READ, timeout * 1000);
 
-#if defined(_WIN32)
-         max_fd = (int) (pcon->cli_socket + 1);
-         n = NETX_SELECT((int) max_fd, &rset, NULL, &eset, &tval);
-#else
-         if (pcon->int_pipe[0] > 0) {
-            FD_SET(pcon->int_pipe[0], &rset);
-         }
-         max_fd = ((int) pcon->cli_socket) > pcon->int_pipe[0] ? ((int) pcon->cli_socket) : pcon->int_pipe[0];
-         n = NETX_SELECT(max_fd + 1, &rset, NULL, &eset, &tval);
-         if (n > 0 && pcon->int_pipe[0] > 0 && NETX_FD_ISSET(pcon->int_pipe[0], &rset)) {
-            n = read(pcon->int_pipe[0], data, 4);
-            if (!strncmp((char *) data, (char *) "exit", 4)) {
-               data[0] = '\0';
-               result = NETX_READ_ERROR;
-               break;
-            }
+         if (n > 0 && (n & NETX_WAIT_INTERRUPT)) {
+            data[0] = '\0';
+            result = NETX_READ_ERROR;
+            break;
          }
-#endif
 
          if (n == 0) {
             sprintf(pweb->error, "TCP Read Error: DB Server %s (%s:%d) did not respond within the timeout period (%d seconds)", (char *) pcon->psrv->name, (char *) pcon->psrv->ip_address, pcon->psrv->port, timeout);
@@ -9780,13 +14818,13 @@ int netx_tcp_read(MGWEB *pweb, unsigned char *data, int size, int timeout, int c
             break;
          }
 
-         if (n < 0 || !NETX_FD_ISSET(pcon->cli_socket, &rset)) {
+         if (n < 0 || !(n & NETX_WAIT_READ)) {
             int errorno;
             char message[256];
 
             errorno = (int) netx_get_last_error(0);
             netx_get_error_message(errorno, message, 250, 0);
-            sprintf(pweb->error, "TCP Read Error (on select): DB Server %s (%s:%d) closed the connection unexpectedly (rc=%d; context=%d; stream mode=%d; Bytes requested=%d; address=%p; socket=%d): Error Code: %d (%s)", (char *) pcon->psrv->name, (char *) pcon->psrv->ip_address, pcon->psrv->port, n,  context, pweb->response_streamed, size, pcon, (int) pcon->cli_socket, errorno, message);
+            sprintf(pweb->error, "TCP Read Error (on poll): DB Server %s (%s:%d) closed the connection unexpectedly (rc=%d; context=%d; stream mode=%d; Bytes requested=%d; address=%p; socket=%d): Error Code: %d (%s)", (char *) pcon->psrv->name, (char *) pcon->psrv->ip_address, pcon->psrv->port, n,  context, pweb->response_streamed, size, pcon, (int) pcon->cli_socket, errorno, message);
 
             result = NETX_READ_ERROR;
             break;
@@ -9847,6 +14885,50 @@ int netx_tcp_read(MGWEB *pweb, unsigned char *data, int size, int timeout, int c
 }
 
 
+/* CMT72 read an ASCII stream from a multiplexed connection: stop at the end of stream marker (which may start in the 'behind' Bytes preceding 'data') */
+int netx_tcp_read_eos(MGWEB *pweb, unsigned char *data, int size, int behind, int timeout)
+{
+   int n, get, ptr;
+   DBXCON *pcon;
+
+   pcon = pweb->pcon;
+
+   n = netx_tcp_read(pweb, data, 1, timeout, 1);
+   if (n != 1 || size < 2) {
+      return n;
+   }
+
+   n = netx_tcp_wait(pweb, NETX_WAIT_READ, 0);
+   if (n < 0 || (n & NETX_WAIT_INTERRUPT)) {
+      return NETX_READ_ERROR;
+   }
+   if (!(n & NETX_WAIT_READ)) {
+      return 1;
+   }
+   n = NETX_RECV(pcon->cli_socket, (char *) data + 1, size - 1, MSG_PEEK);
+   if (n < 1) {
+      return 1;
+   }
+
+   get = n;
+   for (ptr = (0 - behind); (ptr + 4) <= (n + 1); ptr ++) {
+      if (!memcmp((void *) (data + ptr), (void *) MG_STREAM_EOS, 4)) {
+         get = (ptr + 4) - 1;
+         break;
+      }
+   }
+   if (get < 1) {
+      return 1;
+   }
+
+   n = netx_tcp_read(pweb, data + 1, get, timeout, 1);
+   if (n < 0) {
+      return n;
+   }
+   return (n + 1);
+}
+
+
 int netx_get_last_error(int context)
 {
    int error_code;
@@ -105,6 +105,15 @@
 #if !defined(HPUX) && !defined(HPUX10) && !defined(HPUX11)
 #include <sys/select.h>
 #endif
+#include <poll.h> /* CMT61 */
+#include <sys/uio.h> /* CMT70 */
+#include <sys/mman.h> /* CMT73 */
+#if defined(__linux__) /* CMT77 */
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#define MG_WS_RELAY              1
+#define MG_SSE_RELAY             1 /* CMT78 */
+#endif
 #if defined(SOLARIS)
 #include <sys/filio.h>
 #endif
@@ -459,6 +468,11 @@ typedef int    xc_status_t;
 #define NETX_READ_TIMEOUT        -3
 #define NETX_RECV_BUFFER         32768
 
+/* CMT61 readiness events for netx_tcp_wait() */
+#define NETX_WAIT_READ           1
+#define NETX_WAIT_WRITE          2
+#define NETX_WAIT_INTERRUPT      4
+
 #if defined(LINUX)
 #define NETX_MEMCPY(a,b,c)       memmove(a,b,c)
 #else
@@ -491,6 +505,14 @@ typedef int    xc_status_t;
 #define MG_MID_ENVCON            105
 #define MG_MID_WSCON             106
 #define MG_MID_CONMSG            107
+#define MG_MID_LOGBUF            108 /* CMT62 */
+#define MG_MID_RTREE             109 /* CMT67 */
+#define MG_MID_RCACHE            110 /* CMT71 */
+#define MG_MID_METRICS           111 /* CMT74 */
+#define MG_MID_WSRELAY           112 /* CMT77 */
+#define MG_MID_SSERELAY          113 /* CMT78 */
+#define MG_MID_WSCHANNEL         114 /* CMT79 */
+#define MG_MID_WSDEFLATE         115 /* CMT80 */
 
 #define MG_MID_ISC               201
 #define MG_MID_ISCSTR            202
@@ -624,6 +646,7 @@ typedef size_t          socklen_netx;
 #define NETX_GETSOCKOPT              getsockopt
 #define NETX_GETSOCKNAME             getsockname
 #define NETX_SELECT                  select
+#define NETX_POLL                    poll
 #define NETX_RECV                    recv
 #define NETX_SEND                    send
 #define NETX_SHUTDOWN                shutdown
@@ -925,6 +948,69 @@ typedef struct tagDBXTHR {
 } DBXTHR, *PDBXTHR;
 
 
+/* CMT62 asynchronous log writer: messages are held in a ring buffer and written to the log file by a background thread */
+#define MG_LOG_BUFFER_SIZE             1000000
+#define MG_LOG_FLUSH_INTERVAL          200
+#define MG_LOG_STOP_WAIT               5000  /* CMT82 milliseconds mg_worker_exit() waits for buffered messages to be written */
+
+/* CMT82 static initializers for the locks held in mg_system: they are initialized again before use */
+#if defined(_WIN32)
+#define MG_LOCK_INITIALIZER            {0}
+#define MG_COND_INITIALIZER            {0}
+#else
+#define MG_LOCK_INITIALIZER            PTHREAD_MUTEX_INITIALIZER
+#define MG_COND_INITIALIZER            PTHREAD_COND_INITIALIZER
+#endif
+
+typedef struct tagMGLOGBUF {
+#if defined(_WIN32)
+   CRITICAL_SECTION  lock;
+   CONDITION_VARIABLE cond; /* CMT82 */
+#else
+   pthread_mutex_t   lock;
+   pthread_cond_t    cond; /* CMT82 */
+#endif
+   int               status; /* 1: running; 2: stop requested; 3: finished (CMT82); 4: stop abandoned, the writer frees the buffer (CMT82); 0: stopped - protected by lock */
+   char              *buffer;
+   unsigned long     size;
+   unsigned long     tail; /* offset of the oldest byte not yet written */
+   unsigned long     used;
+   unsigned long     no_written;
+   unsigned long     no_dropped;
+   unsigned long     no_dropped_reported;
+   DBXLOG            *plog;
+   DBXTHR            thread;
+} MGLOGBUF, *LPMGLOGBUF;
+
+
+/* CMT63 pooled request (MGWEB) and response extension memory blocks */
+#define MG_MBLOCK_CLASSES              5        /* request buffer classes: 128000 Bytes doubling to 2048000 Bytes */
+#define MG_MBLOCK_BASE_SIZE            128000
+#define MG_MBLOCK_HEADER_RESERVE       128000   /* CMT82 room kept for the request headers (CGI variables) alongside the request payload */
+#define MG_CGI_TAIL_RESERVE            32       /* CMT82 room kept after the CGI variables for the block markers that follow them */
+#define MG_MBLOCK_EXT                  MG_MBLOCK_CLASSES /* response extension blocks */
+#define MG_MBLOCK_POOL_SIZE            8000000  /* default maximum memory retained */
+
+typedef struct tagMGMBLOCK {
+   struct tagMGMBLOCK   *pnext;
+} MGMBLOCK, *LPMGMBLOCK;
+
+typedef struct tagMGMBPOOL {
+#if defined(_WIN32)
+   CRITICAL_SECTION  lock;
+#else
+   pthread_mutex_t   lock;
+#endif
+   int               enabled;
+   unsigned long     retain_max;
+   unsigned long     retained;
+   unsigned long     no_hits;
+   unsigned long     no_misses;
+   int               no_free[MG_MBLOCK_CLASSES + 1];
+   MGMBLOCK          *pfree[MG_MBLOCK_CLASSES + 1];
+} MGMBPOOL, *LPMGMBPOOL;
+
+
 typedef struct tagDBXCVAL {
    void           *pstr;
    CACHE_EXSTR    zstr;
@@ -1113,10 +1199,164 @@ typedef struct tagMGTLS {
    char              *protocols[8];
    int               verify_peer;
    int               key_type;
+   void              *pctx; /* CMT60 shared SSL_CTX */
    struct tagMGTLS   *pnext;
 } MGTLS, *LPMGTLS;
 
 
+/* CMT57 per-server connection pool */
+#define MG_POOL_NONE       0
+#define MG_POOL_IDLE       1
+#define MG_POOL_SPARE      2
+
+/* CMT59 connection pool maintenance thread (seconds) */
+#define MG_POOL_MAINTENANCE_INTERVAL   5
+#define MG_POOL_REFRESH_MARGIN         10
+#define MG_POOL_PING_INTERVAL          60
+#define MG_POOL_RETRY_INTERVAL         60
+#define MG_POOL_STOP_WAIT              10000 /* CMT82 milliseconds mg_worker_exit() waits for the maintenance thread to finish */
+
+/* CMT58 a request queued for a connection once max_connections is reached */
+typedef struct tagMGPWAIT {
+#if defined(_WIN32)
+   CONDITION_VARIABLE   cond;
+#else
+   pthread_cond_t       cond;
+#endif
+   int                  signalled;
+   int                  exclusive; /* CMT72 the request cannot share a multiplexed connection */
+   int                  mux;     /* CMT72 a place on a multiplexed connection was handed over */
+   struct tagDBXCON     *pcon;   /* connection handed over by the releasing request (NULL: create a new one) */
+   struct tagMGPWAIT    *pnext;
+} MGPWAIT, *LPMGPWAIT;
+
+typedef struct tagMGPOOL {
+#if defined(_WIN32)
+   CRITICAL_SECTION  lock;
+#else
+   pthread_mutex_t   lock;
+#endif
+   int               created;
+   int               no_alloc;   /* connection slots allocated to this server */
+   int               no_inuse;   /* network connections currently serving a request */
+   struct tagDBXCON  *pidle;     /* stack of connected idle connections */
+   struct tagDBXCON  *pspare;    /* stack of unallocated connection slots */
+   struct tagDBXCON  *pshared;   /* API mode: the connection shared by all requests */
+   struct tagDBXCON  *pmux;      /* CMT72 multiplexed connections serving at least one request */
+   unsigned long     no_mux_requests; /* CMT72 requests that joined a connection already in use */
+   int               no_waiting; /* CMT58 FIFO queue of requests waiting for a connection */
+   MGPWAIT           *pwait_head;
+   MGPWAIT           *pwait_tail;
+   unsigned long     no_queued;
+   unsigned long     no_queue_timeouts;
+   unsigned long     wait_time_total; /* milliseconds */
+   unsigned long     wait_time_max;
+   time_t            time_connect_failed; /* CMT59 last failure to pre-open a connection */
+} MGPOOL, *LPMGPOOL;
+
+/* CMT69 byte scanners: SSE2 on x86-64 with AVX2 selected at run time; define MG_SCAN_NO_SIMD to use the scalar versions */
+#define MG_SCAN_SCALAR           0
+#define MG_SCAN_SSE2             1
+#define MG_SCAN_AVX2             2
+
+#define MG_STREAM_EOS            "\xff\xff\xff\xff" /* end of an ASCII stream from the DB Server */
+
+#if !defined(MG_SCAN_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64)) && (defined(_MSC_VER) || defined(__GNUC__))
+#define MG_SCAN_SIMD             1
+#endif
+
+/* CMT66 DB Server address cache */
+#define MG_DNS_MAX_ADDR          8
+#define MG_DNS_CACHE_TTL         300   /* seconds */
+#define MG_DNS_RETRY_INTERVAL    10    /* seconds between attempts to refresh an expired entry */
+#define MG_DNS_STOP_WAIT         5000  /* CMT82 milliseconds mg_worker_exit() waits for refreshes to finish */
+#define MG_DNS_ATTEMPT_DELAY     250   /* milliseconds before the next address is tried (RFC 8305 happy eyeballs) */
+
+typedef struct tagMGDNSADDR {
+   int                     family;
+   int                     socktype;
+   int                     protocol;
+   socklen_netx            addrlen;
+#if defined(NETX_IPV6)
+   struct sockaddr_storage addr;
+#else
+   struct sockaddr_in      addr; /* CMT82 */
+#endif
+} MGDNSADDR, *LPMGDNSADDR;
+
+typedef struct tagMGDNS {
+   int               ttl;        /* -1: use the global dns_cache_ttl */
+   int               no_addr;
+   int               refreshing;
+   time_t            time_resolved;
+   time_t            time_attempted;
+   unsigned long     no_lookups;
+   unsigned long     no_hits;
+   unsigned long     no_failures;
+   MGDNSADDR         addr[MG_DNS_MAX_ADDR]; /* interleaved by address family */
+} MGDNS, *LPMGDNS;
+
+
+/* CMT73 scoreboard: DB Server state and statistics shared by all worker processes of the web server */
+#define MG_SB_SERVERS            64
+#define MG_SB_PROCESSES          256 /* CMT82 */
+#define MG_SB_MAGIC              0x6d677362 /* mgsb */
+
+typedef struct tagMGSBSRV {
+   char              name[64];
+   volatile int      offline;
+   volatile time_t   time_offline;
+   volatile long     no_requests;    /* counters: the sum of the changes added by each process */
+   volatile long     no_queued;
+   volatile long     no_queue_timeouts;
+} MGSBSRV, *LPMGSBSRV;
+
+/* CMT82 gauges are held in a slot for each process and summed when read, so that the slot of a process that dies without closing can be reclaimed */
+typedef struct tagMGSBGAUGE {
+   volatile long     no_connections;
+   volatile long     no_inuse;
+   volatile long     no_waiting;
+} MGSBGAUGE, *LPMGSBGAUGE;
+
+typedef struct tagMGSBPROC {
+   volatile unsigned long  pid; /* 0: the slot is free */
+   MGSBGAUGE         srv[MG_SB_SERVERS];
+} MGSBPROC, *LPMGSBPROC;
+
+typedef struct tagMGSB {
+   volatile long     lock;
+   unsigned long     magic;
+   unsigned long     size;
+   int               no_servers;
+   time_t            time_created;
+   MGSBSRV           srv[MG_SB_SERVERS];
+   MGSBPROC          proc[MG_SB_PROCESSES]; /* CMT82 */
+} MGSB, *LPMGSB;
+
+/* CMT74 metrics: counters are spread over a number of stripes (chosen by thread) and updated with atomic adds */
+/* so that threads rarely share a cache line and reading the metrics never blocks a request */
+#define MG_METRICS_STRIPES       8
+#define MG_METRICS_BUCKETS       14 /* the last is +Inf */
+#define MG_METRICS_CONNECT       0  /* time to obtain a DB Server connection */
+#define MG_METRICS_EXECUTE       1  /* time from sending the request to the DB Server to receiving (the start of) its response */
+#define MG_METRICS_TOTAL         2  /* time for the whole request */
+#define MG_METRICS_HISTOGRAMS    3
+
+typedef struct tagMGMSTRIPE {
+   volatile long long   no_requests;
+   volatile long long   no_errors;
+   volatile long long   no_failovers;
+   volatile long long   no_inflight;
+   volatile long long   hist_count[MG_METRICS_HISTOGRAMS];
+   volatile long long   hist_sum[MG_METRICS_HISTOGRAMS]; /* microseconds */
+   volatile long long   hist_bucket[MG_METRICS_HISTOGRAMS][MG_METRICS_BUCKETS];
+   char                 pad[64];
+} MGMSTRIPE, *LPMGMSTRIPE;
+
+typedef struct tagMGMETRICS {
+   MGMSTRIPE            stripe[MG_METRICS_STRIPES];
+} MGMETRICS, *LPMGMETRICS;
+
 typedef struct tagMGSRV {
    short             dbtype;
    short             offline;
@@ -1127,6 +1367,7 @@ typedef struct tagMGSRV {
    int               con_retry_time; /* v2.4.25 */
    int               con_retry_no;
    int               max_connections; /* v2.5.30 */
+   int               min_connections; /* CMT59 */
    char              *name;
    char              lcname[64]; /* v2.1.17 */
    int               name_len;
@@ -1146,6 +1387,15 @@ typedef struct tagMGSRV {
    int               net_connection; /* flag set if configuration indicates network connection */
    char              *tls_name; /* v2.3.21 */
    MGTLS             *ptls;
+   void              *ptls_session; /* CMT60 last TLS session negotiated (for resumption) */
+   MGPOOL            pool; /* CMT57 */
+   MGDNS             dns; /* CMT66 */
+   int               multiplex; /* CMT72 requests in flight on one connection (negotiated with the DB Server) */
+   MGSBSRV           *psb; /* CMT73 this server's entry in the scoreboard */
+   MGMETRICS         *pmetrics; /* CMT74 */
+   long              sb_requests; /* CMT73 values last added to the scoreboard by this process */
+   long              sb_queued;
+   long              sb_queue_timeouts;
    struct tagMGSRV   *pnext;
 } MGSRV, *LPMGSRV;
 
@@ -1163,9 +1413,65 @@ typedef struct tagMGWSMAP {
    char        *name;
    int         function_len;
    char        *function;
+   int         channel; /* CMT79 clients requesting the same URL share one DB Server connection */
    struct tagMGWSMAP  *pnext;
 } MGWSMAP, *LPMGWSMAP;
 
+/* CMT67 radix tree index of configured names (location paths and WebSocket names) */
+/* Built once the configuration has been read and not modified thereafter, so lookups need no lock */
+typedef struct tagMGRTNODE {
+   char                 *label;     /* points into the configured name */
+   int                  label_len;
+   void                 *pvalue;    /* MGPATH or MGWSMAP whose name ends at this node */
+   int                  order;      /* position of pvalue in the configuration */
+   int                  no_child;
+   int                  child_alloc;
+   struct tagMGRTNODE   **child;    /* sorted by the first character of their labels */
+} MGRTNODE, *LPMGRTNODE;
+
+/* CMT71 response cache for a location */
+#define MG_RCACHE_SLOTS          1024  /* hash slots (a power of 2) */
+#define MG_RCACHE_VARY_MAX       8     /* request headers that can be added to the key */
+#define MG_RCACHE_KEY_MAX        1024  /* requests with a longer key are not cached */
+
+typedef struct tagMGRCENTRY {
+   unsigned int      hash;
+   int               key_len;
+   char              *key;
+   char              *headers;     /* response headers without the terminating blank line */
+   int               headers_len;
+   int               clen_server;  /* headers include Content-Length */
+   char              *content;
+   int               content_len;
+   unsigned long     size;         /* bytes charged to the cache */
+   time_t            time_stored;
+   time_t            expires;
+   time_t            stale_until;  /* stale-while-revalidate */
+   time_t            time_revalidate;
+   int               refs;
+   int               removed;
+   struct tagMGRCENTRY  *phnext;   /* next in hash slot */
+   struct tagMGRCENTRY  *pprev;    /* LRU list: most recently used at the head */
+   struct tagMGRCENTRY  *pnext;
+} MGRCENTRY, *LPMGRCENTRY;
+
+typedef struct tagMGRCACHE {
+   unsigned long     size_max;
+   unsigned long     size;
+   unsigned long     entry_max;    /* largest response stored */
+   int               vary_no;
+   char              vary[MG_RCACHE_VARY_MAX][64]; /* CGI names (HTTP_*) of the request headers in the key */
+   MGRCENTRY         *slot[MG_RCACHE_SLOTS];
+   MGRCENTRY         *phead;
+   MGRCENTRY         *ptail;
+   unsigned long     no_entries;
+   unsigned long     no_hits;
+   unsigned long     no_hits_stale;
+   unsigned long     no_misses;
+   unsigned long     no_stores;
+   unsigned long     no_evictions;
+} MGRCACHE, *LPMGRCACHE;
+
 typedef struct tagMGPATH {
    int         cgi_max;
    int         srv_max;
@@ -1173,6 +1479,7 @@ typedef struct tagMGPATH {
    int         name_len;
    char        *function;
    MGWSMAP     *pwsmap; /* v2.6.32 */
+   MGRTNODE    *pwsindex; /* CMT67 */
    int         load_balancing;
    int         server_no;
    int         sa_order;
@@ -1185,15 +1492,37 @@ typedef struct tagMGPATH {
    MGPSRV      servers[32]; /* v2.1.16 */
    char        *cgi[128];
    int         admin; /* v2.4.24 */
+   unsigned long  rcache_size; /* CMT71 */
+   int         rcache_vary_no;
+   char        *rcache_vary[MG_RCACHE_VARY_MAX];
+   MGRCACHE    *prcache;
+   MGMETRICS   *pmetrics; /* CMT74 */
    struct tagMGPATH  *pnext;
 } MGPATH, *LPMGPATH;
 
 
+/* CMT72 multiplexed connections */
+/* Requests sent over a multiplexed connection are matched to their responses by request number */
+/* One request at a time owns the read side: it reads the next frame header and, if the frame belongs to another request, hands the header (and the socket) to that request */
+#define MG_MUX_MAX               256
+
+typedef struct tagMGMUXWAIT {
+#if defined(_WIN32)
+   CONDITION_VARIABLE   cond;
+#else
+   pthread_cond_t       cond;
+#endif
+   unsigned long        requestno;
+   int                  ready;      /* frame header delivered: this request now owns the read side */
+   unsigned char        head[10];
+   struct tagMGMUXWAIT  *pnext;
+} MGMUXWAIT, *LPMGMUXWAIT;
+
 typedef struct tagDBXCON {
    int               alloc;
    int               inuse;
    int               argc;
-   unsigned long     no_requests;
+   volatile unsigned long no_requests; /* CMT82 updated by mg_connection_add_request() */
    unsigned long     pid;
    short             use_db_mutex;
    DBXMUTEX          *p_db_mutex;
@@ -1216,6 +1545,23 @@ typedef struct tagDBXCON {
    unsigned char     stream_tail[8];
    MGSRV             *psrv;
    void              *ptlscon;
+   short             pool_state; /* CMT57 */
+   struct tagDBXCON  *pnext_pool;
+   int               mux_max; /* CMT72 requests allowed in flight (0: not multiplexed) */
+   int               mux_inflight;
+   int               mux_linked; /* on the server's list of multiplexed connections */
+   int               mux_broken; /* frame boundaries lost: no new requests and close when the last one finishes */
+   int               mux_reader; /* a request owns the read side */
+   int               mux_created;
+#if defined(_WIN32)
+   CRITICAL_SECTION  mux_lock;
+   CRITICAL_SECTION  mux_write;
+#else
+   pthread_mutex_t   mux_lock;
+   pthread_mutex_t   mux_write;
+#endif
+   MGMUXWAIT         *pmux_wait;
+   struct tagDBXCON  *pnext_mux;
    struct tagDBXCON  *pnext;
 } DBXCON, *PDBXCON;
 
@@ -1246,6 +1592,41 @@ typedef struct tagMGSYS {
    char           cgi_base[64];
    char           *cgi[128];
    DBXLOG         log;
+   int            pool_maintenance; /* CMT59 1: running; 2: stop requested; 3: finished (CMT82); 0: stopped */
+   DBXTHR         pool_thread;
+   int            loader_lock; /* CMT82 set while the IIS module's DllMain() runs: threads must not be waited for */
+   unsigned long  log_buffer_size; /* CMT62 */
+   MGLOGBUF       logbuf; /* CMT62 */
+   unsigned long  buffer_pool_size; /* CMT63 */
+   MGMBPOOL       mbpool; /* CMT63 */
+   int            dns_cache_ttl; /* CMT66 */
+   int            dns_refreshes; /* CMT82 mg_dns_refresh() threads running (protected by mg_global_mutex) */
+   int            dns_stop;      /* CMT82 no more are to be started: the DB Servers are about to be freed */
+   int            scoreboard; /* CMT73 */
+   int            timing_sample; /* CMT75 measure one request in this many (0: off) */
+   int            timing_log;
+   int            timing_header;
+   unsigned long  timing_no;
+   MGSB           *psb;
+   int            sb_slot; /* CMT82 this process's slot in the scoreboard */
+   char           sb_name[64];
+#if defined(_WIN32)
+   HANDLE         sb_handle;
+#endif
+   int            ws_relay; /* CMT77 threads serving the DB Server side of WebSockets (0: a thread for each WebSocket) */
+   int            ws_relay_sockets;
+   struct tagMGWSRELAY *pwsrelay;
+   int            sse_relay; /* CMT78 threads serving handed-off SSE streams (0: each stream is served by its request thread) */
+   int            sse_relay_streams;
+   int            sse_heartbeat; /* seconds of inactivity before a comment is sent to the SSE client (0: off) */
+   struct tagMGSSERELAY *psserelay;
+   struct tagMGWSCHANNEL *pwschannel; /* CMT79 open WebSocket channels (protected by mg_global_mutex) */
+   int            ws_channels;
+   int            ws_channel_subscribers;
+   int            ws_deflate; /* CMT80 permessage-deflate compression level (0: off) */
+   int            ws_deflate_window_bits;
+   int            ws_deflate_memory_level;
+   int            ws_deflate_context_takeover;
 } MGSYS, *LPMGSYS;
 
 
@@ -1270,6 +1651,8 @@ typedef struct tagMGWSFDATA {
    unsigned char     opcode;
    unsigned int      utf8_state;
    mg_int64_t        message_length;
+   unsigned char     compressed; /* CMT80 RSV1 was set on the first frame of the message */
+   size_t            application_data_size; /* CMT81 allocated: kept for the next message */
 } MGWSFDATA, *PMGWSFDATA;
 
 
@@ -1299,6 +1682,26 @@ typedef struct tagMGWSRSTATE {
 #define MG_WEBSOCKET_CLOSED_BYSERVER   50
 #define MG_WEBSOCKET_CLOSED_BYCLIENT   60
 
+/* CMT80 permessage-deflate (RFC 7692) */
+#define MG_WS_DEFLATE_WINDOW_BITS 12    /* default LZ77 window (2^bits bytes) used to compress messages to the client */
+#define MG_WS_DEFLATE_MEMORY_LEVEL 5    /* default zlib memory level for each compressor */
+#define MG_WS_DEFLATE_MIN_SIZE 64       /* smaller messages are sent uncompressed */
+#define MG_WS_DEFLATE_BUFFER_KEEP 16384 /* larger buffers are freed once the message has been processed */
+
+typedef struct tagMGWSDEFLATE {
+   short             enabled;
+   short             server_takeover;    /* 0: server_no_context_takeover (the compressor is reset for each message) */
+   short             client_takeover;    /* 0: client_no_context_takeover */
+   short             server_window_bits;
+   short             client_window_bits;
+   void              *pdeflate;          /* z_stream: created on first use and, without context takeover, freed after each message */
+   void              *pinflate;
+   unsigned char     *dbuffer;           /* compressed messages to the client */
+   size_t            dbuffer_size;
+   unsigned char     *ibuffer;           /* decompressed messages from the client */
+   size_t            ibuffer_size;
+} MGWSDEFLATE, *LPMGWSDEFLATE;
+
 typedef struct tagMGWEBSOCK {
    short             status;
    short             binary;
@@ -1306,19 +1709,174 @@ typedef struct tagMGWEBSOCK {
    int               protocol_version;
    char              sec_websocket_key[256];
    char              sec_websocket_protocol[32];
+   char              sec_websocket_extensions[128]; /* CMT80 extensions accepted in the handshake response */
+   MGWSDEFLATE       deflate;
    unsigned char     block[MG_WS_BLOCK_DATA_SIZE];
    mg_int64_t        block_size;
    unsigned char     status_code_buffer[2];
    size_t            remaining_length;
    DBXTHR            db_read_thread;
+   int               relay_slot; /* CMT77 slot (+1) in the WebSocket relay: 0 if db_read_thread serves this WebSocket */
+   int               channel;    /* CMT79 subscribe to the channel named below */
+   char              channel_name[256];
+   struct tagMGWSCHANNEL *pchannel;
+   struct tagMGWEB   *pnext_sub;
+   int               channel_refs; /* CMT82 writes in progress from the channel (protected by the channel's lock) */
 } MGWEBSOCK, *LPMGWEBSOCK;
 
 
+/* CMT79 one DB Server connection (the publisher) feeds all the WebSocket clients subscribed to a channel */
+#define MG_WSCHANNEL_WAITING     0     /* the first subscriber is starting the publisher */
+#define MG_WSCHANNEL_OPEN        1
+#define MG_WSCHANNEL_CLOSED      2
+#define MG_WSCHANNEL_READ_TIMEOUT 1    /* CMT82 seconds: the publisher's reader checks for the channel stopping at least this often */
+
+typedef struct tagMGWSCHANNEL {
+   char              name[256];
+   int               status;
+   short             binary;
+   short             listed;   /* in mg_system.pwschannel */
+   int               no_subscribers; /* CMT82 protected by mg_global_mutex */
+   unsigned long     no_messages;
+   struct tagMGWEB   *psub;    /* subscribers: linked through pwsock->pnext_sub */
+   struct tagMGWEB   *ppub;    /* holds the DB Server connection */
+   DBXMUTEX          lock;     /* subscriber list (never taken with mg_global_mutex held) */
+   DBXMUTEX          send_lock; /* writes to the DB Server (and changes to status) */
+   DBXTHR            read_thread;
+   int               stopping; /* CMT82 set by the last subscriber to leave: the reader stops */
+   MGWSDEFLATE       deflate;  /* CMT80 messages are compressed once (without context takeover) for subscribers using permessage-deflate */
+   struct tagMGWSCHANNEL *pnext;
+} MGWSCHANNEL, *LPMGWSCHANNEL;
+
+
+/* CMT77 one epoll set (and a small pool of threads) relays data from the DB Server to all WebSocket clients */
+#define MG_WS_RELAY_MAX          16    /* maximum number of relay threads */
+#define MG_WS_RELAY_EVENTS       64    /* events collected by each call to epoll_wait() */
+#define MG_WS_RELAY_WAKE         0xffffffffffffffffULL
+#define MG_WS_RELAY_QUEUE_MAX    262144 /* CMT82 Bytes queued for a client before its DB Server socket is no longer read */
+#define MG_WS_RELAY_STOP_WAIT    5000  /* CMT82 milliseconds mg_websocket_relay_stop() waits for callers still using the relay */
+
+#if defined(MG_WS_RELAY)
+/* CMT82 data read from the DB Server by a relay thread and waiting to be written to the client by a writer thread */
+typedef struct tagMGWSRBUF {
+   struct tagMGWSRBUF *pnext;
+   int               type;
+   int               len;
+   unsigned char     data[MG_WS_BLOCK_DATA_SIZE];
+} MGWSRBUF, *LPMGWSRBUF;
+
+typedef struct tagMGWSRSLOT {
+   struct tagMGWEB   *pweb;
+   unsigned int      gen;      /* distinguishes events for a WebSocket that has since closed from those for its successor in this slot */
+   short             busy;     /* a relay thread is reading from the DB Server */
+   short             closed;   /* the DB Server closed the connection: not rearmed */
+   short             removing; /* mg_websocket_relay_remove() is waiting for 'busy' and 'writing' to clear */
+   short             writing;  /* CMT82 on the write queue or being written to the client by a writer thread */
+   short             paused;   /* CMT82 too much is queued for the client: the DB Server socket is rearmed once it has been written */
+   unsigned long     out_bytes;
+   MGWSRBUF          *pout_head; /* CMT82 data waiting to be written to the client */
+   MGWSRBUF          *pout_tail;
+   int               next_write;
+   int               next_free;
+} MGWSRSLOT, *LPMGWSRSLOT;
+
+typedef struct tagMGWSRELAY {
+   int               status;   /* 1: running; 2: stop requested */
+   int               refs;     /* CMT82 callers of mg_websocket_relay_add() and mg_websocket_relay_remove() (protected by mg_global_mutex) */
+   int               epfd;
+   int               wakefd;
+   int               threads;
+   int               slot_max;
+   int               free_slot;
+   MGWSRSLOT         *slots;
+   int               writers;  /* CMT82 */
+   int               write_head; /* CMT82 slots with data for the client, linked through next_write (-1: none) */
+   int               write_tail;
+   pthread_mutex_t   lock;
+   pthread_cond_t    cond;
+   pthread_cond_t    cond_write; /* CMT82 */
+   DBXTHR            thread[MG_WS_RELAY_MAX];
+   DBXTHR            thread_write[MG_WS_RELAY_MAX]; /* CMT82 */
+} MGWSRELAY, *LPMGWSRELAY;
+#endif
+
+
+/* CMT78 SSE streams handed off by the web server module are relayed from one epoll set */
+#define MG_SSE_RELAY_MAX         16    /* maximum number of relay threads */
+#define MG_SSE_RELAY_SCAN        256   /* heartbeats and close timeouts served by each scan */
+#define MG_SSE_CLOSE_TIMEOUT     10    /* seconds to wait for the DB Server to close its side of a finished stream */
+#define MG_SSE_BLOCK_SIZE        8192
+#define MG_SSE_STREAMING         1
+#define MG_SSE_CLOSING           2     /* end of stream sent to the DB Server: waiting for it to close the connection */
+
+#if defined(MG_SSE_RELAY)
+typedef struct tagMGSSESLOT {
+   struct tagMGWEB   *pweb;
+   unsigned int      gen;
+   short             busy;        /* a relay thread is serving this stream */
+   short             state;
+   short             client_gone; /* events received while busy: served by the thread that holds the stream */
+   short             db_ready;
+   time_t            last_write;
+   time_t            deadline;
+   int               next_free;
+} MGSSESLOT, *LPMGSSESLOT;
+
+typedef struct tagMGSSERELAY {
+   int               status;   /* 1: running; 2: stop requested */
+   int               epfd;
+   int               wakefd;
+   int               threads;
+   int               slot_max;
+   int               free_slot;
+   time_t            next_scan;
+   MGSSESLOT         *slots;
+   pthread_mutex_t   lock;
+   DBXTHR            thread[MG_SSE_RELAY_MAX];
+} MGSSERELAY, *LPMGSSERELAY;
+#endif
+
+
+/* CMT68 per-request index of the HTTP request headers, filled in one pass by the web server module */
+#define MG_HDR_INDEX_MAX         64    /* headers indexed: if a request has more, lookups revert to mg_get_cgi_variable() */
+#define MG_HDR_INDEX_SLOTS       128   /* hash slots (a power of 2) */
+
+/* CMT70 a buffer to send with netx_tcp_writev() */
+#define MG_IOVEC_MAX             8
+#define MG_TLS_RECORD_SIZE       16384 /* maximum TLS record payload */
+
+typedef struct tagMGIOVEC {
+   unsigned char  *buf;
+   int            len;
+} MGIOVEC, *LPMGIOVEC;
+
+typedef struct tagMGHDR {
+   char           *name;      /* as received (e.g. Accept-Encoding) or, if cgi_form is set, in CGI form (e.g. HTTP_ACCEPT_ENCODING) */
+   int            name_len;
+   int            cgi_form;
+   char           *value;     /* memory owned by the web server for the life of the request */
+   int            value_len;
+   unsigned int   hash;
+   int            pnext;      /* next header (+1) in the same slot */
+} MGHDR, *LPMGHDR;
+
+/* CMT75 request phases timed for sampled requests */
+#define MG_TIMING_QUEUE          0  /* waiting for a connection from the pool */
+#define MG_TIMING_CONNECT        1  /* connecting to the DB Server */
+#define MG_TIMING_SEND           2  /* sending the request */
+#define MG_TIMING_DB             3  /* DB Server execution: until the first byte of the response */
+#define MG_TIMING_RELAY          4  /* reading the rest of the response and sending it to the client */
+#define MG_TIMING_PHASES         5
+
 typedef struct tagMGWEB {
    int            wstype; /* v2.7.33 web server type */
+   int            mblock_class; /* CMT63 pooled memory block class (-1 if not pooled) */
    int            evented;
    int            tls;
    int            sse; /* v2.7.33 Server Sent Events */
+   int            sse_relayed; /* CMT78 the stream has been passed to the SSE relay: the web server must not complete the request */
+   int            sse_client_fd; /* client socket watched by the SSE relay for hang-up (-1: not available) */
+   int            (* sse_complete) (struct tagMGWEB *pweb); /* supplied by web server modules that can complete a request from another thread */
    int            http_version_major;
    int            http_version_minor;
    int            wserver_chunks_response;
@@ -1342,6 +1900,32 @@ typedef struct tagMGWEB {
    char           request_content_type[1024];
    char           boundary[256]; /* v2.1.15 */
    char           *request_cookie;
+   int            hdr_status; /* CMT68 0: not indexed; 1: indexed; -1: not available */
+   int            hdr_no;
+   MGHDR          hdr[MG_HDR_INDEX_MAX];
+   unsigned char  hdr_slot[MG_HDR_INDEX_SLOTS]; /* first header (+1) for each slot */
+   unsigned char  *request_frame; /* CMT70 request frame to send with the first chunk of a long request */
+   int            request_frame_len;
+   int            request_last_chunk;
+   int            request_eod_sent;
+   int            mux; /* CMT72 sharing a multiplexed connection */
+   int            mux_reader; /* CMT72 owns the read side of the connection */
+   int            rcache_status; /* CMT71 0: not cacheable; 1: key made and not found in the cache */
+   int            rcache_key_len;
+   unsigned int   rcache_hash;
+   int            rcache_headers_len;
+   char           rcache_key[MG_RCACHE_KEY_MAX];
+   int            metrics; /* CMT74 request is being measured */
+   int            metrics_error; /* HTTP status if the gateway returned an error */
+   long long      metrics_start; /* microseconds */
+   long long      metrics_connect;
+   long long      metrics_execute;
+   struct tagMGSRV *metrics_psrv; /* server for which this request is in flight */
+   int            timing; /* CMT75 request has been sampled for phase timing */
+   long long      timing_start; /* microseconds */
+   long long      timing_mark;
+   long long      timing_relay_start;
+   long long      timing_phase[MG_TIMING_PHASES];
    int            protocol_distressed; /* CMT54 */
    int            response_clen_server;
    int            response_streamed;
@@ -1407,7 +1991,10 @@ extern pthread_mutex_t   mg_global_mutex;
 extern MGSYS         mg_system;
 extern DBXCON *      mg_connection;
 extern MGSRV *       mg_server;
+extern MGTLS *       mg_tls;
 extern MGPATH *      mg_path;
+extern MGRTNODE *    mg_path_index;
+extern const long long  mg_metrics_bounds[MG_METRICS_BUCKETS - 1];
 
 extern MG_MALLOC     mg_ext_malloc;
 extern MG_REALLOC    mg_ext_realloc;
@@ -1416,6 +2003,7 @@ extern MG_FREE       mg_ext_free;
 
 /* From web server interface code page */
 int                     mg_get_cgi_variable           (MGWEB *pweb, char *name, char *pbuffer, int *pbuffer_size);
+int                     mg_get_request_headers        (MGWEB *pweb); /* CMT68 */
 int                     mg_client_gone                (MGWEB *pweb);
 int                     mg_client_write               (MGWEB *pweb, unsigned char *pbuffer, int buffer_size, int context);
 int                     mg_client_write_now           (MGWEB *pweb, unsigned char *pbuffer, int buffer_size);
@@ -1436,6 +2024,7 @@ size_t                  mg_websocket_read_block       (MGWEB *pweb, char *buffer
 size_t                  mg_websocket_read             (MGWEB *pweb, char *buffer, size_t bufsiz);
 size_t                  mg_websocket_queue_block      (MGWEB *pweb, int type, unsigned char *buffer, size_t buffer_size, short locked);
 size_t                  mg_websocket_write_block      (MGWEB *pweb, int type, unsigned char *buffer, size_t buffer_size);
+size_t                  mg_websocket_write_frame      (MGWEB *pweb, unsigned char *header, size_t header_size, unsigned char *buffer, size_t buffer_size); /* CMT79 */
 int                     mg_websocket_write            (MGWEB *pweb, char *buffer, int len);
 int                     mg_websocket_exit             (MGWEB *pweb);
 
@@ -1443,6 +2032,7 @@ int                     mg_websocket_exit             (MGWEB *pweb);
 /* Core code page */
 int                     mg_web                        (MGWEB *pweb);
 int                     mg_web_process                (MGWEB *pweb);
+int                     mg_web_process_ex             (MGWEB *pweb);
 int                     mg_parse_headers              (MGWEB *pweb);
 int                     mg_web_execute                (MGWEB *pweb);
 int                     mg_execute_request_long       (MGWEB *pweb, int (*p_write_chunk) (MGWEB *, unsigned char *, unsigned int, int));
@@ -1454,6 +2044,21 @@ int                     mg_web_http_error             (MGWEB *pweb, int http_sta
 int                     mg_web_simple_response        (MGWEB *pweb, char *text, char *error, int context);
 int                     mg_get_all_cgi_variables      (MGWEB *pweb);
 int                     mg_get_path_configuration     (MGWEB *pweb);
+int                     mg_index_request_header       (MGWEB *pweb, char *name, int name_len, char *value, int value_len, int cgi_form); /* CMT68 */
+int                     mg_index_request_headers      (MGWEB *pweb);
+int                     mg_find_request_header        (MGWEB *pweb, char *name, char **pvalue, int *pvalue_len);
+int                     mg_get_request_variable       (MGWEB *pweb, char *name, char *pbuffer, int *pbuffer_size);
+MGRTNODE *              mg_rtree_create               (void); /* CMT67 */
+int                     mg_rtree_insert               (MGRTNODE *proot, char *key, int key_len, void *pvalue, int order);
+int                     mg_rtree_lookup               (MGRTNODE *proot, char *key, int key_len, int first, void **ppvalue);
+int                     mg_rtree_free                 (MGRTNODE *proot);
+int                     mg_build_path_index           (void);
+int                     mg_scan_init                  (int max_level); /* CMT69 */
+MGRCACHE *              mg_rcache_create              (MGPATH *ppath); /* CMT71 */
+int                     mg_rcache_free                (MGRCACHE *pcache);
+int                     mg_rcache_lookup              (MGWEB *pweb);
+int                     mg_rcache_store               (MGWEB *pweb, int content_len);
+char *                  mg_scan_find                  (char *buffer, int len, char *needle, int needle_len);
 int                     mg_add_cgi_variable           (MGWEB *pweb, char *name, int name_len, char *value, int value_len);
 int                     mg_obtain_connection          (MGWEB *pweb);
 int                     mg_obtain_server              (MGWEB *pweb, char *info, int context);
@@ -1462,6 +2067,58 @@ int                     mg_server_online              (MGWEB *pweb, MGSRV *psrv,
 int                     mg_server_alternatives        (MGWEB *pweb, MGSRV *psrv, char *info, int context); /* CMT51 */
 int                     mg_connect                    (MGWEB *pweb, int context);
 int                     mg_release_connection         (MGWEB *pweb, int close_connection);
+int                     mg_pool_create                (MGSRV *psrv); /* CMT57 */
+int                     mg_pool_destroy               (MGSRV *psrv);
+DBXCON *                mg_pool_obtain                (MGSRV *psrv, int queue_timeout, int exclusive, int *use_existing, int *server_busy);
+int                     mg_pool_wake                  (MGSRV *psrv, DBXCON *pcon);
+int                     mg_pool_release               (DBXCON *pcon, int close_connection);
+DBXCON *                mg_pool_drain                 (MGSRV *psrv);
+DBXCON *                mg_pool_obtain_idle           (MGSRV *psrv, time_t time_now, int idle_time); /* CMT59 */
+int                     mg_pool_maintain_server       (MGSRV *psrv, time_t time_now);
+MGMETRICS *             mg_metrics_create             (void); /* CMT74 */
+int                     mg_metrics_free               (MGMETRICS *pmetrics);
+int                     mg_metrics_request_start      (MGWEB *pweb);
+int                     mg_metrics_request_end        (MGWEB *pweb);
+int                     mg_metrics_count              (MGMETRICS *pmetrics, int failovers, int inflight);
+int                     mg_metrics_failover           (MGWEB *pweb);
+int                     mg_metrics_observe            (MGMETRICS *pmetrics, int hist, long long usecs);
+int                     mg_metrics_collect            (MGMETRICS *pmetrics, MGMSTRIPE *ptotal);
+int                     mg_timing_request_start       (MGWEB *pweb); /* CMT75 */
+int                     mg_timing_request_end         (MGWEB *pweb);
+int                     mg_timing_mark                (MGWEB *pweb);
+int                     mg_timing_add                 (MGWEB *pweb, int phase);
+int                     mg_timing_header              (MGWEB *pweb, char *buffer);
+int                     mg_sse_write                  (MGWEB *pweb, unsigned char *data, int len); /* CMT78 */
+int                     mg_sse_heartbeat              (MGWEB *pweb);
+int                     mg_sse_close                  (MGWEB *pweb);
+int                     mg_sse_drain                  (MGWEB *pweb, int timeout);
+#if defined(MG_SSE_RELAY)
+int                     mg_sse_relay_start            (int threads);
+int                     mg_sse_relay_stop             (void);
+int                     mg_sse_relay_add              (MGWEB *pweb);
+int                     mg_sse_relay_serve            (MGSSERELAY *prelay, int slot_no, int event);
+int                     mg_sse_relay_dispatch         (MGSSERELAY *prelay, int slot_no, int event);
+int                     mg_sse_relay_finish           (MGSSERELAY *prelay, int slot_no);
+DBX_THR_TYPE            mg_sse_relay                  (void *arg);
+#endif
+int                     mg_sb_init                    (void); /* CMT73 */
+int                     mg_sb_exit                    (void);
+int                     mg_sb_publish                 (MGSRV *psrv, int context);
+int                     mg_sb_set_offline             (MGSRV *psrv);
+int                     mg_sb_get_offline             (MGSRV *psrv);
+int                     mg_sb_read                    (MGSRV *psrv, MGSBGAUGE *ptotal); /* CMT82 */
+int                     mg_pool_mux_link              (MGSRV *psrv, DBXCON *pcon); /* CMT72 */
+int                     mg_pool_mux_wake              (MGSRV *psrv, DBXCON *pcon);
+int                     mg_pool_mux_release           (DBXCON *pcon);
+int                     mg_mux_register               (MGWEB *pweb, MGMUXWAIT *pwait);
+int                     mg_mux_unregister             (MGWEB *pweb, MGMUXWAIT *pwait);
+int                     mg_mux_read_head              (MGWEB *pweb, MGMUXWAIT *pwait, unsigned char *head, int timeout);
+int                     mg_mux_read_done              (MGWEB *pweb);
+int                     mg_mux_end                    (MGWEB *pweb, int close_connection);
+int                     mg_connection_add_request     (DBXCON *pcon);
+DBX_THR_TYPE            mg_pool_maintenance           (void *arg);
+int                     mg_pool_maintenance_wait      (unsigned long msecs);
+int                     mg_pool_maintenance_stop      (int wait);
 MGWEB *                 mg_obtain_request_memory      (void *pweb_server, unsigned long request_clen, int request_chunked, int wstype);
 DBXVAL *                mg_extend_response_memory     (MGWEB *pweb);
 int                     mg_release_request_memory     (MGWEB *pweb);
@@ -1514,12 +2171,25 @@ int                     mg_ccase                      (char *string);
 int                     mg_log_init                   (DBXLOG *plog);
 int                     mg_log_event                  (DBXLOG *plog, MGWEB *pweb, char *message, char *title, int level);
 int                     mg_log_buffer                 (DBXLOG *plog, MGWEB *pweb, char *buffer, int buffer_len, char *title, int level);
+int                     mg_log_write_file             (char *log_file, char *buffer, int len);
+int                     mg_mblock_init                (unsigned long retain_max);
+int                     mg_mblock_class               (unsigned int len_alloc);
+unsigned int            mg_mblock_size                (int mclass);
+void *                  mg_mblock_obtain              (int mclass, short id);
+int                     mg_mblock_release             (void *p, int mclass, short id);
+int                     mg_mblock_destroy             (void);
+int                     mg_log_start                  (DBXLOG *plog, unsigned long size);
+int                     mg_log_stop                   (int wait);
+int                     mg_log_enqueue                (MGLOGBUF *plogbuf, char *buffer, int len);
+int                     mg_log_flush                  (MGLOGBUF *plogbuf);
+DBX_THR_TYPE            mg_log_flusher                (void *arg);
 DBXPLIB                 mg_dso_load                   (char *library);
 DBXPROC                 mg_dso_sym                    (DBXPLIB p_library, char *symbol);
 int                     mg_dso_unload                 (DBXPLIB p_library);
 int                     mg_thread_create              (DBXTHR *pthr, DBX_THR_FUNCTION function, void * arg);
 int                     mg_thread_terminate           (DBXTHR *pthr);
 int                     mg_thread_join                (DBXTHR *pthr);
+int                     mg_thread_detach              (void);
 int                     mg_thread_exit                (void);
 DBXTHID                 mg_current_thread_id          (void);
 unsigned long           mg_current_process_id         (void);
@@ -1535,18 +2205,34 @@ int                     mg_delete_critical_section    (void *p_crit);
 int                     mg_enter_critical_section     (void *p_crit);
 int                     mg_leave_critical_section     (void *p_crit);
 int                     mg_sleep                      (unsigned long msecs);
+long long               mg_time_usecs                 (void); /* CMT74 */
+unsigned long           mg_time_msecs                 (void); /* CMT58 */
 unsigned int            mg_file_size                  (char *file);
 
 int                     netx_load_winsock             (MGWEB *pweb, int context);
 int                     netx_tcp_connect              (MGWEB *pweb, int context);
+int                     mg_dns_lookup                 (MGWEB *pweb, MGSRV *psrv, MGDNSADDR *paddr, int max); /* CMT66 */
+int                     mg_dns_resolve                (MGSRV *psrv, MGDNSADDR *paddr, int max);
+int                     mg_dns_store                  (MGSRV *psrv, MGDNSADDR *paddr, int no_addr);
+DBX_THR_TYPE            mg_dns_refresh                (void *arg);
+int                     mg_dns_stop                   (void); /* CMT82 */
+#if defined(NETX_IPV6)
+#if !defined(_WIN32)
+int                     netx_tcp_connect_race         (MGWEB *pweb, MGDNSADDR *paddr, int no_addr, int timeout);
+#endif
+#endif
 int                     netx_tcp_handshake            (MGWEB *pweb, int context);
 int                     netx_tcp_ping                 (MGWEB *pweb, int context);
 int                     netx_tcp_command              (MGWEB *pweb, int command, int context);
+int                     netx_tcp_send_command         (MGWEB *pweb, MGIOVEC *piov, int iov_no, int reconnect); /* CMT70 */
 int                     netx_tcp_read_stream          (MGWEB *pweb);
 int                     netx_tcp_connect_ex           (MGWEB *pweb, xLPSOCKADDR p_srv_addr, socklen_netx srv_addr_len, int timeout);
+int                     netx_tcp_wait                 (MGWEB *pweb, int events, int timeout);
 int                     netx_tcp_disconnect           (MGWEB *pweb, int context);
 int                     netx_tcp_write                (MGWEB *pweb, unsigned char *data, int size);
+int                     netx_tcp_writev               (MGWEB *pweb, MGIOVEC *piov, int iov_no); /* CMT70 */
 int                     netx_tcp_read                 (MGWEB *pweb, unsigned char *data, int size, int timeout, int context);
+int                     netx_tcp_read_eos             (MGWEB *pweb, unsigned char *data, int size, int behind, int timeout); /* CMT72 */
 int                     netx_get_last_error           (int context);
 int                     netx_get_error_message        (int error_code, char *message, int size, int context);
 int                     netx_get_std_error_message    (int error_code, char *message, int size, int context);
@@ -30,13 +30,21 @@
 #include "mg_web.h"
 #include "mg_websocket.h"
 
+#if DBX_WITH_ZLIB >= 1
+static DBXZLIBSO     mg_zlib_so; /* CMT80 */
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MG_WS_UNMASK_SSE2 /* CMT81 */
+#endif
 
 int mg_websocket_check(MGWEB *pweb)
 {
    int rc, n, len, lenu, lenc, upgrade_connection, protocol_version;
    char *p, *pa, *pz;
    char upgrade[128], buffer[256], connection[256], wsfunction[128];
-   char host[128], sec_websocket_key[256], token[256], hash[256], sec_websocket_accept[256], sec_websocket_protocol[32];
+   char host[128], sec_websocket_key[256], token[256], hash[256], sec_websocket_accept[256], sec_websocket_protocol[32], sec_websocket_extensions[256];
    MGWSMAP *pwsmap;
 
    protocol_version = 0;
@@ -132,6 +140,19 @@ int mg_websocket_check(MGWEB *pweb)
       sec_websocket_protocol[len] = '\0';
    }
 
+   *sec_websocket_extensions = '\0';
+   if (mg_system.ws_deflate > 0 && pweb->wstype != MG_WS_IIS) { /* CMT80 the handshake response is sent by the IIS WebSocket module */
+      len = 250;
+      rc = mg_get_cgi_variable(pweb, "HTTP_SEC_WEBSOCKET_EXTENSIONS", sec_websocket_extensions, &len);
+      sec_websocket_extensions[250] = '\0';
+      if (rc == CACHE_SUCCESS) {
+         sec_websocket_extensions[len] = '\0';
+      }
+      else {
+         *sec_websocket_extensions = '\0';
+      }
+   }
+
    len = 30;
    rc = mg_get_cgi_variable(pweb, "HTTP_SEC_WEBSOCKET_VERSION", buffer, &len);
    buffer[30] = '\0';
@@ -148,6 +169,9 @@ int mg_websocket_check(MGWEB *pweb)
       if (pweb->script_name[n] == '/') {
          lenu = n + 1;
          /* v2.6.32 */
+         if (pweb->ppath->pwsindex) { /* CMT67 only the name following the last '/' is used */
+            continue;
+         }
          pwsmap = pweb->ppath->pwsmap;
          while (pwsmap) {
             if (!strncmp(pweb->script_name + lenu, pwsmap->name, pwsmap->name_len)) {
@@ -165,6 +189,10 @@ int mg_websocket_check(MGWEB *pweb)
 */
    }
 
+   if (pweb->ppath->pwsindex && lenu) { /* CMT67 first configured name that prefixes the last path segment */
+      lenc = mg_rtree_lookup(pweb->ppath->pwsindex, pweb->script_name + lenu, pweb->script_name_len - lenu, 1, (void **) &pwsmap);
+   }
+
    if (lenc && pwsmap) {
       strcpy(wsfunction, pwsmap->function);
       len = pwsmap->function_len;
@@ -214,6 +242,22 @@ int mg_websocket_check(MGWEB *pweb)
       pweb->pwsock->protocol_version = protocol_version;
       strcpy(pweb->pwsock->sec_websocket_key, sec_websocket_key);
       strcpy(pweb->pwsock->sec_websocket_protocol, sec_websocket_protocol);
+      if (*sec_websocket_extensions) {
+         mg_websocket_deflate_negotiate(pweb, sec_websocket_extensions);
+      }
+
+      /* CMT79 clients requesting the same URL (including the query string) subscribe to the same channel */
+      if (pwsmap && pwsmap->channel && (pweb->script_name_len + pweb->query_string_len) < 250) {
+         pweb->pwsock->channel = 1;
+         strncpy(pweb->pwsock->channel_name, pweb->script_name, pweb->script_name_len);
+         len = pweb->script_name_len;
+         if (pweb->query_string_len > 0) {
+            pweb->pwsock->channel_name[len ++] = '?';
+            strncpy(pweb->pwsock->channel_name + len, pweb->query_string, pweb->query_string_len);
+            len += pweb->query_string_len;
+         }
+         pweb->pwsock->channel_name[len] = '\0';
+      }
 
       mg_websocket_create_lock(pweb);
 
@@ -265,14 +309,23 @@ int mg_websocket_connection(MGWEB *pweb)
       pweb->pwsock->binary = 1;
    }
 
-#if !defined(_WIN32)
-   rc = pipe(pweb->pcon->int_pipe);
-   if (rc == -1) {
-      return rc;
+   rc = CACHE_FAILURE;
+#if defined(MG_WS_RELAY)
+   if (mg_system.pwsrelay && !pweb->pcon->ptlscon) { /* CMT77 data from the DB Server is relayed by the shared relay threads */
+      rc = mg_websocket_relay_add(pweb);
    }
 #endif
 
-   rc = mg_thread_create(&(pweb->pwsock->db_read_thread), mg_websocket_dbserver_read, (void *) pweb);
+   if (rc != CACHE_SUCCESS) {
+#if !defined(_WIN32)
+      rc = pipe(pweb->pcon->int_pipe);
+      if (rc == -1) {
+         return rc;
+      }
+#endif
+
+      rc = mg_thread_create(&(pweb->pwsock->db_read_thread), mg_websocket_dbserver_read, (void *) pweb);
+   }
 
    /* The main data framing loop */
    rc = mg_websocket_data_framing(pweb);
@@ -283,7 +336,7 @@ int mg_websocket_connection(MGWEB *pweb)
 
 int mg_websocket_disconnect(MGWEB *pweb)
 {
-   int rc;
+   int rc, relay;
 /*
    unsigned char status_code_buffer[2];
    status_code_buffer[0] = (MG_WS_STATUS_CODE_INTERNAL_ERROR >> 8) & 0xFF;
@@ -291,21 +344,32 @@ int mg_websocket_disconnect(MGWEB *pweb)
    mg_websocket_write_block(pweb, MG_WS_MESSAGE_TYPE_CLOSE, (unsigned char *) status_code_buffer, sizeof(status_code_buffer));
 */
 
+   relay = pweb->pwsock->relay_slot;
+#if defined(MG_WS_RELAY)
+   if (relay) { /* CMT77 take the connection back from the relay before it's closed */
+      mg_websocket_relay_remove(pweb);
+   }
+#endif
+
    mg_cleanup(pweb);
    mg_release_connection(pweb, 1);
 
+   if (!relay) {
 #if !defined(_WIN32)
-   rc = write(pweb->pcon->int_pipe[1], "exit", 4);
+      rc = write(pweb->pcon->int_pipe[1], "exit", 4);
 #endif
 
-   mg_thread_join(&(pweb->pwsock->db_read_thread));
+      mg_thread_join(&(pweb->pwsock->db_read_thread));
+   }
    mg_websocket_destroy_lock(pweb);
 
 #if !defined(_WIN32)
-   close(pweb->pcon->int_pipe[0]);
-   close(pweb->pcon->int_pipe[1]);
-   pweb->pcon->int_pipe[0] = 0;
-   pweb->pcon->int_pipe[1] = 0;
+   if (!relay) {
+      close(pweb->pcon->int_pipe[0]);
+      close(pweb->pcon->int_pipe[1]);
+      pweb->pcon->int_pipe[0] = 0;
+      pweb->pcon->int_pipe[1] = 0;
+   }
 #endif
 
    rc = mg_websocket_exit(pweb);
@@ -319,8 +383,8 @@ int mg_websocket_data_framing(MGWEB *pweb)
 {
    int rc;
    MGWSRSTATE read_state;
-   MGWSFDATA control_frame = { 0, NULL, 1, 8, UTF8_VALID, 0 };
-   MGWSFDATA message_frame = { 0, NULL, 1, 0, UTF8_VALID, 0 };
+   MGWSFDATA control_frame = { 0, NULL, 1, 8, UTF8_VALID, 0, 0, 0 }; /* CMT82 */
+   MGWSFDATA message_frame = { 0, NULL, 1, 0, UTF8_VALID, 0, 0, 0 };
    MGWEBSOCK * pwsock = pweb->pwsock;
 
    if (mg_websocket_frame_init(pweb) == CACHE_SUCCESS) {
@@ -373,7 +437,7 @@ int mg_websocket_data_framing(MGWEB *pweb)
 
 void mg_websocket_incoming_frame(MGWEB *pweb, MGWSRSTATE *pread_state, char *block, mg_int64_t block_size)
 {
-   int close_reason;
+   int close_reason, rsv1;
    mg_int64_t payload_limit, block_offset;
    payload_limit = 32 * 1024 * 1024;
    block_offset = 0;
@@ -389,10 +453,11 @@ void mg_websocket_incoming_frame(MGWEB *pweb, MGWSRSTATE *pread_state, char *blo
       switch (pread_state->framing_state) {
          case MG_WS_DATA_FRAMING_START:
             /*
-               Since we don't currently support any extensions,
-               the reserve bits must be 0
+               The only extension supported is permessage-deflate (CMT80) which uses RSV1:
+               the other reserve bits must be 0
             */
-            if ((MG_WS_FRAME_GET_RSV1(block[block_offset]) != 0) || (MG_WS_FRAME_GET_RSV2(block[block_offset]) != 0) || (MG_WS_FRAME_GET_RSV3(block[block_offset]) != 0)) {
+            rsv1 = MG_WS_FRAME_GET_RSV1(block[block_offset]);
+            if ((rsv1 && !pweb->pwsock->deflate.enabled) || (MG_WS_FRAME_GET_RSV2(block[block_offset]) != 0) || (MG_WS_FRAME_GET_RSV3(block[block_offset]) != 0)) {
                pread_state->framing_state = MG_WS_DATA_FRAMING_CLOSE;
                pread_state->status_code = MG_WS_STATUS_CODE_PROTOCOL_ERROR;
                close_reason = 1;
@@ -404,7 +469,7 @@ void mg_websocket_incoming_frame(MGWEB *pweb, MGWSRSTATE *pread_state, char *blo
             pread_state->framing_state = MG_WS_DATA_FRAMING_PAYLOAD_LENGTH;
 
             if (pread_state->opcode >= 0x8) { /* Control frame */
-               if (pread_state->fin) {
+               if (pread_state->fin && !rsv1) {
                   pread_state->frame = &(pread_state->control_frame);
                   pread_state->frame->opcode = pread_state->opcode;
                   pread_state->frame->utf8_state = UTF8_VALID;
@@ -422,6 +487,7 @@ void mg_websocket_incoming_frame(MGWEB *pweb, MGWSRSTATE *pread_state, char *blo
                   if (pread_state->frame->fin) {
                      pread_state->frame->opcode = pread_state->opcode;
                      pread_state->frame->utf8_state = UTF8_VALID;
+                     pread_state->frame->compressed = (unsigned char) rsv1;
                   }
                   else {
                      pread_state->framing_state = MG_WS_DATA_FRAMING_CLOSE;
@@ -430,7 +496,7 @@ void mg_websocket_incoming_frame(MGWEB *pweb, MGWSRSTATE *pread_state, char *blo
                      break;
                   }
                }
-               else if (pread_state->frame->fin || ((pread_state->opcode = pread_state->frame->opcode) == 0)) {
+               else if (pread_state->frame->fin || rsv1 || ((pread_state->opcode = pread_state->frame->opcode) == 0)) {
                   pread_state->framing_state = MG_WS_DATA_FRAMING_CLOSE;
                   pread_state->status_code = MG_WS_STATUS_CODE_PROTOCOL_ERROR;
                   close_reason = 4;
@@ -517,9 +583,17 @@ void mg_websocket_incoming_frame(MGWEB *pweb, MGWSRSTATE *pread_state, char *blo
          case MG_WS_DATA_FRAMING_EXTENSION_DATA:
             /* Deal with extension data when we support them -- FIXME */
             if (pread_state->extension_bytes_remaining == 0) {
-               if (pread_state->payload_length > 0) {
-                  pread_state->frame->application_data = (unsigned char *) realloc(pread_state->frame->application_data, (size_t) (pread_state->frame->application_data_offset + pread_state->payload_length));
+               if (pread_state->payload_length > 0 && (pread_state->frame->application_data_offset + pread_state->payload_length) > pread_state->frame->application_data_size) {
+                  /* CMT81 the buffer is kept between messages and grows geometrically for fragmented messages */
+                  size_t size = (size_t) (pread_state->frame->application_data_size * 2);
+                  if (size < MG_WS_MESSAGE_BUFFER_MIN)
+                     size = MG_WS_MESSAGE_BUFFER_MIN;
+                  if (size < (size_t) (pread_state->frame->application_data_offset + pread_state->payload_length))
+                     size = (size_t) (pread_state->frame->application_data_offset + pread_state->payload_length);
+                  pread_state->frame->application_data = (unsigned char *) realloc(pread_state->frame->application_data, size);
+                  pread_state->frame->application_data_size = size;
                   if (pread_state->frame->application_data == NULL) {
+                     pread_state->frame->application_data_size = 0;
                      pread_state->framing_state = MG_WS_DATA_FRAMING_CLOSE;
                      pread_state->status_code = (pweb->pwsock->protocol_version >= 13) ? MG_WS_STATUS_CODE_INTERNAL_ERROR : MG_WS_STATUS_CODE_GOING_AWAY;
                      close_reason = 6;
@@ -539,34 +613,15 @@ void mg_websocket_incoming_frame(MGWEB *pweb, MGWSRSTATE *pread_state, char *blo
                block_length = block_size - block_offset;
                block_data_length = (pread_state->payload_length > block_length) ? block_length : pread_state->payload_length;
 
-               if (pread_state->masking) {
-                  mg_int64_t i;
-
-                  if (pread_state->opcode == MG_WS_OPCODE_TEXT) {
-                     unsigned int utf8_state = pread_state->frame->utf8_state;
-                     unsigned char c;
-
-                     for (i = 0; i < block_data_length; i++) {
-                        c = block[block_offset ++] ^ pread_state->mask[pread_state->mask_offset ++ & 3];
-                        utf8_state = validate_utf8[utf8_state + c];
-                        if (utf8_state == UTF8_INVALID) {
-                           pread_state->payload_length = block_data_length;
-                           break;
-                        }
-                        application_data[application_data_offset++] = c;
-                     }
-                     pread_state->frame->utf8_state = utf8_state;
+               if (block_data_length > 0) {
+                  if (pread_state->masking) { /* CMT81 unmask a word (or vector) at a time */
+                     mg_websocket_unmask(&application_data[application_data_offset], (unsigned char *) &block[block_offset], (size_t) block_data_length, pread_state->mask, pread_state->mask_offset);
+                     pread_state->mask_offset += block_data_length;
                   }
                   else {
-                     /* Need to optimize the unmasking -- FIXME */
-                     for (i = 0; i < block_data_length; i ++) {
-                        application_data[application_data_offset ++] = block[block_offset ++] ^ pread_state->mask[pread_state->mask_offset ++ & 3];
-                     }
+                     memcpy(&application_data[application_data_offset], &block[block_offset], (size_t) block_data_length);
                   }
-               }
-               else if (block_data_length > 0) {
-                  memcpy(&application_data[application_data_offset], &block[block_offset], (size_t) block_data_length);
-                  if (pread_state->opcode == MG_WS_OPCODE_TEXT) {
+                  if (pread_state->opcode == MG_WS_OPCODE_TEXT && !pread_state->frame->compressed) { /* CMT80 compressed text is validated once decompressed */
                      mg_int64_t i, application_data_end = application_data_offset + block_data_length;
                      unsigned int utf8_state = pread_state->frame->utf8_state;
 
@@ -616,6 +671,9 @@ void mg_websocket_incoming_frame(MGWEB *pweb, MGWSRSTATE *pread_state, char *blo
                         break;
                   }
                   if (pread_state->fin && (message_type != MG_WS_MESSAGE_TYPE_INVALID) && (application_data_offset > 0)) {
+                     unsigned char *message;
+                     size_t message_length;
+                     int status_code;
 /*
                      {
                         char bufferx[256];
@@ -623,15 +681,40 @@ void mg_websocket_incoming_frame(MGWEB *pweb, MGWSRSTATE *pread_state, char *blo
                         mg_log_buffer(pweb->plog, pweb, (char *)  application_data, (int) application_data_offset, bufferx, 0);
                      }
 */
-                     netx_tcp_write(pweb, (unsigned char *) application_data, (int) application_data_offset);
+                     message = (unsigned char *) application_data;
+                     message_length = (size_t) application_data_offset;
+                     status_code = 0;
+                     if (pread_state->frame->compressed) { /* CMT80 */
+                        status_code = mg_websocket_inflate(&(pweb->pwsock->deflate), (unsigned char *) application_data, (size_t) application_data_offset, payload_limit, &message, &message_length);
+                        if (!status_code && message_type == MG_WS_MESSAGE_TYPE_TEXT && !mg_websocket_valid_utf8(message, message_length)) {
+                           status_code = MG_WS_STATUS_CODE_INVALID_UTF8;
+                        }
+                        if (status_code) {
+                           pread_state->framing_state = MG_WS_DATA_FRAMING_CLOSE;
+                           pread_state->status_code = (unsigned short) status_code;
+                           close_reason = 9;
+                        }
+                     }
+                     if (!status_code && message_length > 0) {
+                        if (pweb->pwsock->pchannel) { /* CMT79 */
+                           mg_websocket_channel_send(pweb, message, (int) message_length);
+                        }
+                        else {
+                           netx_tcp_write(pweb, message, (int) message_length);
+                        }
+                     }
+                     if (pread_state->frame->compressed) {
+                        mg_websocket_deflate_release(&(pweb->pwsock->deflate), 1);
+                     }
                   }
                   if (pread_state->framing_state != MG_WS_DATA_FRAMING_CLOSE) {
                      pread_state->framing_state = MG_WS_DATA_FRAMING_START;
 
                      if (pread_state->fin) {
-                        if (pread_state->frame->application_data != NULL) {
+                        if (pread_state->frame->application_data != NULL && pread_state->frame->application_data_size > MG_WS_MESSAGE_BUFFER_KEEP) { /* CMT81 */
                            free(pread_state->frame->application_data);
                            pread_state->frame->application_data = NULL;
+                           pread_state->frame->application_data_size = 0;
                         }
                         application_data_offset = 0;
                      }
@@ -661,6 +744,46 @@ void mg_websocket_incoming_frame(MGWEB *pweb, MGWSRSTATE *pread_state, char *blo
 }
 
 
+/* CMT81 XOR the client's masking key over a payload: mask_offset is the position of src[0] in the frame's payload */
+void mg_websocket_unmask(unsigned char *dst, unsigned char *src, size_t len, unsigned char *mask, mg_int64_t mask_offset)
+{
+   size_t n;
+   mg_uint64_t mask64, word;
+   unsigned char rmask[8];
+
+   for (n = 0; n < 8; n ++) { /* the key rotated to start at the current position: valid for every 8 (or 16) Byte step */
+      rmask[n] = mask[(mask_offset + n) & 3];
+   }
+   n = 0;
+
+#if defined(MG_WS_UNMASK_SSE2)
+   if (len >= 16) {
+      __m128i vmask, vdata;
+
+      vmask = _mm_set_epi8((char) rmask[7], (char) rmask[6], (char) rmask[5], (char) rmask[4], (char) rmask[3], (char) rmask[2], (char) rmask[1], (char) rmask[0],
+                           (char) rmask[7], (char) rmask[6], (char) rmask[5], (char) rmask[4], (char) rmask[3], (char) rmask[2], (char) rmask[1], (char) rmask[0]);
+      for (; (n + 16) <= len; n += 16) {
+         vdata = _mm_loadu_si128((__m128i *) (src + n));
+         _mm_storeu_si128((__m128i *) (dst + n), _mm_xor_si128(vdata, vmask));
+      }
+   }
+#endif
+
+   memcpy((void *) &mask64, (void *) rmask, 8);
+   for (; (n + 8) <= len; n += 8) { /* memcpy: the buffers need not be aligned */
+      memcpy((void *) &word, (void *) (src + n), 8);
+      word ^= mask64;
+      memcpy((void *) (dst + n), (void *) &word, 8);
+   }
+
+   for (; n < len; n ++) {
+      dst[n] = src[n] ^ rmask[n & 7];
+   }
+
+   return;
+}
+
+
 DBX_THR_TYPE mg_websocket_dbserver_read(void *arg)
 {
    int len, timeout, type;
@@ -709,7 +832,7 @@ DBX_THR_TYPE mg_websocket_dbserver_read(void *arg)
          else
             type = MG_WS_MESSAGE_TYPE_TEXT;
 #if defined(_WIN32)
-         rc = mg_websocket_write_block(pweb, type, (unsigned char *) data, (size_t) len);
+         rc = mg_websocket_write_message(pweb, type, (unsigned char *) data, (size_t) len);
 #else
 /*
 {
@@ -718,7 +841,7 @@ DBX_THR_TYPE mg_websocket_dbserver_read(void *arg)
    mg_log_buffer(pweb->plog, pweb, data, len > 0 ? len : 0, bufferx, 0);
 }
 */
-         mg_websocket_write_block(pweb, type, (unsigned char *) data, (size_t) len);
+         mg_websocket_write_message(pweb, type, (unsigned char *) data, (size_t) len);
 #endif
       }
    }
@@ -727,12 +850,1487 @@ DBX_THR_TYPE mg_websocket_dbserver_read(void *arg)
 }
 
 
-size_t mg_websocket_create_header(MGWEB *pweb, int type, unsigned char *header, mg_uint64_t payload_length)
+#if defined(MG_WS_RELAY)
+
+/* CMT77 read data from the DB Server for a WebSocket client: 0 if the connection remains open */
+/* CMT82 the data (or, once the DB Server has closed, a close frame) is left in pbuf for a writer thread: pbuf->len is -1 if there is nothing to write */
+int mg_websocket_relay_read(MGWEB *pweb, MGWSRBUF *pbuf)
 {
-   size_t pos;
-   unsigned char opcode;
+   int len;
 
-   pos = 0;
+   pbuf->pnext = NULL;
+   pbuf->len = -1;
+   len = netx_tcp_read(pweb, (unsigned char *) pbuf->data, (int) sizeof(pbuf->data), 1, 0);
+
+   if (len == NETX_READ_TIMEOUT) {
+      return 0;
+   }
+   if (len == NETX_READ_EOF || len == NETX_READ_ERROR) {
+      if (len == NETX_READ_ERROR) {
+         pweb->pwsock->status = MG_WEBSOCKET_CLOSED_BYSERVER;
+      }
+      pbuf->type = MG_WS_MESSAGE_TYPE_CLOSE;
+      pbuf->len = 0;
+      return -1;
+   }
+   if (len > 0) {
+      if (pweb->pwsock->binary)
+         pbuf->type = MG_WS_MESSAGE_TYPE_BINARY;
+      else
+         pbuf->type = MG_WS_MESSAGE_TYPE_TEXT;
+      pbuf->len = len;
+   }
+
+   return 0;
+}
+
+
+/* CMT77 start the relay threads: called once, at worker initialization */
+int mg_websocket_relay_start(int threads)
+{
+   int n;
+   struct epoll_event event;
+   MGWSRELAY *prelay;
+
+   if (threads < 1) {
+      return CACHE_SUCCESS;
+   }
+   if (threads > MG_WS_RELAY_MAX) {
+      threads = MG_WS_RELAY_MAX;
+   }
+
+   prelay = (MGWSRELAY *) mg_malloc(NULL, sizeof(MGWSRELAY), MG_MID_WSRELAY);
+   if (!prelay) {
+      return CACHE_FAILURE;
+   }
+   memset((void *) prelay, 0, sizeof(MGWSRELAY));
+   prelay->free_slot = -1;
+   prelay->epfd = epoll_create1(EPOLL_CLOEXEC);
+   prelay->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+   if (prelay->epfd < 0 || prelay->wakefd < 0) {
+      goto mg_websocket_relay_start_error;
+   }
+   event.events = EPOLLIN;
+   event.data.u64 = MG_WS_RELAY_WAKE;
+   if (epoll_ctl(prelay->epfd, EPOLL_CTL_ADD, prelay->wakefd, &event) != 0) {
+      goto mg_websocket_relay_start_error;
+   }
+   pthread_mutex_init(&(prelay->lock), NULL);
+   pthread_cond_init(&(prelay->cond), NULL);
+   pthread_cond_init(&(prelay->cond_write), NULL);
+   prelay->write_head = -1;
+   prelay->write_tail = -1;
+
+   prelay->status = 1;
+   /* CMT82 the writer threads are started first: the relay threads never write to a client themselves */
+   for (n = 0; n < threads; n ++) {
+      if (mg_thread_create(&(prelay->thread_write[n]), (DBX_THR_FUNCTION) mg_websocket_relay_write, (void *) prelay) != CACHE_SUCCESS) {
+         break;
+      }
+      prelay->writers ++;
+   }
+   if (prelay->writers > 0) {
+      mg_system.pwsrelay = prelay;
+      for (n = 0; n < threads; n ++) {
+         if (mg_thread_create(&(prelay->thread[n]), (DBX_THR_FUNCTION) mg_websocket_relay, (void *) prelay) != CACHE_SUCCESS) {
+            break;
+         }
+         prelay->threads ++;
+      }
+   }
+   if (prelay->threads == 0) {
+      mg_system.pwsrelay = NULL;
+      pthread_mutex_lock(&(prelay->lock));
+      prelay->status = 2;
+      pthread_cond_broadcast(&(prelay->cond_write));
+      pthread_mutex_unlock(&(prelay->lock));
+      for (n = 0; n < prelay->writers; n ++) {
+         mg_thread_join(&(prelay->thread_write[n]));
+      }
+      pthread_mutex_destroy(&(prelay->lock));
+      pthread_cond_destroy(&(prelay->cond));
+      pthread_cond_destroy(&(prelay->cond_write));
+      goto mg_websocket_relay_start_error;
+   }
+   return CACHE_SUCCESS;
+
+mg_websocket_relay_start_error:
+
+   if (prelay->epfd >= 0) {
+      close(prelay->epfd);
+   }
+   if (prelay->wakefd >= 0) {
+      close(prelay->wakefd);
+   }
+   mg_free(NULL, (void *) prelay, MG_MID_WSRELAY);
+   return CACHE_FAILURE;
+}
+
+
+/* CMT77 stop the relay threads: WebSockets still open are no longer served */
+int mg_websocket_relay_stop(void)
+{
+   int n, refs;
+   uint64_t one;
+   char buffer[128];
+   MGWSRELAY *prelay;
+
+   prelay = mg_system.pwsrelay;
+   if (!prelay) {
+      return CACHE_SUCCESS;
+   }
+
+   pthread_mutex_lock(&(prelay->lock));
+   prelay->status = 2;
+   pthread_cond_broadcast(&(prelay->cond_write));
+   pthread_mutex_unlock(&(prelay->lock));
+   one = 1;
+   n = (int) write(prelay->wakefd, (void *) &one, sizeof(one));
+
+   for (n = 0; n < prelay->threads; n ++) {
+      mg_thread_join(&(prelay->thread[n]));
+   }
+   for (n = 0; n < prelay->writers; n ++) { /* CMT82 */
+      mg_thread_join(&(prelay->thread_write[n]));
+   }
+
+   /* CMT82 no thread is using a slot now: release mg_websocket_relay_remove() for slots still marked (for example, queued for a writer thread that has stopped) */
+   pthread_mutex_lock(&(prelay->lock));
+   for (n = 0; n < prelay->slot_max; n ++) {
+      prelay->slots[n].busy = 0;
+      prelay->slots[n].writing = 0;
+   }
+   pthread_cond_broadcast(&(prelay->cond));
+   pthread_mutex_unlock(&(prelay->lock));
+
+   mg_enter_critical_section((void *) &mg_global_mutex);
+   mg_system.pwsrelay = NULL; /* CMT82 no new references */
+   mg_leave_critical_section((void *) &mg_global_mutex);
+
+   /* CMT82 and wait for those callers to finish with the relay before it is freed */
+   refs = 0;
+   for (n = 0; n <= MG_WS_RELAY_STOP_WAIT; n += 10) {
+      mg_enter_critical_section((void *) &mg_global_mutex);
+      refs = prelay->refs;
+      mg_leave_critical_section((void *) &mg_global_mutex);
+      if (refs == 0) {
+         break;
+      }
+      mg_sleep(10);
+   }
+   if (refs > 0) {
+      sprintf(buffer, "%d WebSockets are still being withdrawn from the relay: the relay will not be freed", refs);
+      mg_log_event(&(mg_system.log), NULL, buffer, "mg_web: web server worker closing", 0);
+      return CACHE_FAILURE;
+   }
+
+   close(prelay->epfd);
+   close(prelay->wakefd);
+   pthread_mutex_destroy(&(prelay->lock));
+   pthread_cond_destroy(&(prelay->cond));
+   pthread_cond_destroy(&(prelay->cond_write));
+   if (prelay->slots) {
+      for (n = 0; n < prelay->slot_max; n ++) {
+         mg_websocket_relay_discard(&(prelay->slots[n]));
+      }
+      mg_free(NULL, (void *) prelay->slots, MG_MID_WSRELAY);
+   }
+   mg_free(NULL, (void *) prelay, MG_MID_WSRELAY);
+
+   return CACHE_SUCCESS;
+}
+
+
+/* CMT77 pass the DB Server side of a WebSocket to the relay */
+int mg_websocket_relay_add(MGWEB *pweb)
+{
+   int n, slot_no, slot_max;
+   struct epoll_event event;
+   MGWSRSLOT *pslots;
+   MGWSRELAY *prelay;
+
+   prelay = mg_websocket_relay_ref(); /* CMT82 */
+   if (!prelay) {
+      return CACHE_FAILURE;
+   }
+
+   pthread_mutex_lock(&(prelay->lock));
+
+   if (prelay->status != 1) {
+      pthread_mutex_unlock(&(prelay->lock));
+      mg_websocket_relay_unref(prelay);
+      return CACHE_FAILURE;
+   }
+
+   if (prelay->free_slot < 0) {
+      slot_max = prelay->slot_max ? (prelay->slot_max * 2) : 64;
+      pslots = (MGWSRSLOT *) mg_malloc(NULL, sizeof(MGWSRSLOT) * slot_max, MG_MID_WSRELAY);
+      if (!pslots) {
+         pthread_mutex_unlock(&(prelay->lock));
+         mg_websocket_relay_unref(prelay);
+         return CACHE_FAILURE;
+      }
+      memset((void *) pslots, 0, sizeof(MGWSRSLOT) * slot_max);
+      if (prelay->slots) {
+         memcpy((void *) pslots, (void *) prelay->slots, sizeof(MGWSRSLOT) * prelay->slot_max);
+         mg_free(NULL, (void *) prelay->slots, MG_MID_WSRELAY);
+      }
+      for (n = slot_max - 1; n >= prelay->slot_max; n --) {
+         pslots[n].next_free = prelay->free_slot;
+         prelay->free_slot = n;
+      }
+      prelay->slots = pslots;
+      prelay->slot_max = slot_max;
+   }
+
+   slot_no = prelay->free_slot;
+   prelay->free_slot = prelay->slots[slot_no].next_free;
+   prelay->slots[slot_no].pweb = pweb;
+   prelay->slots[slot_no].gen ++;
+   prelay->slots[slot_no].busy = 0;
+   prelay->slots[slot_no].closed = 0;
+   prelay->slots[slot_no].removing = 0;
+   prelay->slots[slot_no].writing = 0;
+   prelay->slots[slot_no].paused = 0;
+   prelay->slots[slot_no].out_bytes = 0;
+   prelay->slots[slot_no].pout_head = NULL;
+   prelay->slots[slot_no].pout_tail = NULL;
+
+   event.events = EPOLLIN | EPOLLONESHOT;
+   event.data.u64 = (((uint64_t) prelay->slots[slot_no].gen) << 32) | (uint64_t) slot_no;
+   if (epoll_ctl(prelay->epfd, EPOLL_CTL_ADD, (int) pweb->pcon->cli_socket, &event) != 0) {
+      prelay->slots[slot_no].pweb = NULL;
+      prelay->slots[slot_no].next_free = prelay->free_slot;
+      prelay->free_slot = slot_no;
+      pthread_mutex_unlock(&(prelay->lock));
+      mg_websocket_relay_unref(prelay);
+      return CACHE_FAILURE;
+   }
+   pweb->pwsock->relay_slot = slot_no + 1;
+   mg_system.ws_relay_sockets ++;
+
+   pthread_mutex_unlock(&(prelay->lock));
+   mg_websocket_relay_unref(prelay);
+
+   return CACHE_SUCCESS;
+}
+
+
+/* CMT77 withdraw a WebSocket from the relay: on return no relay thread is using it */
+int mg_websocket_relay_remove(MGWEB *pweb)
+{
+   int slot_no;
+   MGWSRELAY *prelay;
+
+   slot_no = pweb->pwsock->relay_slot - 1;
+   if (slot_no < 0) {
+      return CACHE_SUCCESS;
+   }
+   prelay = mg_websocket_relay_ref(); /* CMT82 */
+   if (!prelay) {
+      return CACHE_SUCCESS;
+   }
+   pweb->pwsock->relay_slot = 0;
+
+   pthread_mutex_lock(&(prelay->lock));
+
+   epoll_ctl(prelay->epfd, EPOLL_CTL_DEL, (int) pweb->pcon->cli_socket, NULL);
+   prelay->slots[slot_no].removing = 1;
+   /* CMT82 mg_websocket_relay_stop() clears 'busy' and 'writing' once its threads have stopped */
+   while (prelay->slots[slot_no].busy || prelay->slots[slot_no].writing) {
+      pthread_cond_wait(&(prelay->cond), &(prelay->lock));
+   }
+   if (prelay->status != 1) { /* CMT82 the relay is stopping: the slots are freed with it */
+      pthread_mutex_unlock(&(prelay->lock));
+      mg_websocket_relay_unref(prelay);
+      return CACHE_SUCCESS;
+   }
+   mg_websocket_relay_discard(&(prelay->slots[slot_no])); /* CMT82 data not yet written to the client */
+   prelay->slots[slot_no].pweb = NULL;
+   prelay->slots[slot_no].removing = 0;
+   prelay->slots[slot_no].closed = 0;
+   prelay->slots[slot_no].next_free = prelay->free_slot;
+   prelay->free_slot = slot_no;
+   mg_system.ws_relay_sockets --;
+
+   pthread_mutex_unlock(&(prelay->lock));
+   mg_websocket_relay_unref(prelay);
+
+   return CACHE_SUCCESS;
+}
+
+
+/* CMT82 take a reference to the relay: mg_websocket_relay_stop() does not free it while references are held */
+MGWSRELAY * mg_websocket_relay_ref(void)
+{
+   MGWSRELAY *prelay;
+
+   mg_enter_critical_section((void *) &mg_global_mutex);
+   prelay = mg_system.pwsrelay;
+   if (prelay) {
+      prelay->refs ++;
+   }
+   mg_leave_critical_section((void *) &mg_global_mutex);
+
+   return prelay;
+}
+
+
+void mg_websocket_relay_unref(MGWSRELAY *prelay)
+{
+   mg_enter_critical_section((void *) &mg_global_mutex);
+   prelay->refs --;
+   mg_leave_critical_section((void *) &mg_global_mutex);
+
+   return;
+}
+
+
+/* CMT82 pass data read from the DB Server to the writer threads and rearm the DB Server socket unless too much is waiting for the client: called with the relay locked */
+int mg_websocket_relay_queue(MGWSRELAY *prelay, int slot_no, MGWSRBUF *pbuf, int rc)
+{
+   struct epoll_event event;
+   MGWSRSLOT *pslot;
+
+   pslot = &(prelay->slots[slot_no]);
+
+   if (pbuf) {
+      pbuf->pnext = NULL;
+      if (pslot->pout_tail)
+         pslot->pout_tail->pnext = pbuf;
+      else
+         pslot->pout_head = pbuf;
+      pslot->pout_tail = pbuf;
+      pslot->out_bytes += (unsigned long) pbuf->len;
+      if (!pslot->writing) {
+         pslot->writing = 1;
+         pslot->next_write = -1;
+         if (prelay->write_tail >= 0)
+            prelay->slots[prelay->write_tail].next_write = slot_no;
+         else
+            prelay->write_head = slot_no;
+         prelay->write_tail = slot_no;
+         pthread_cond_signal(&(prelay->cond_write));
+      }
+   }
+
+   if (rc < 0) {
+      pslot->closed = 1;
+   }
+   else if (pslot->out_bytes >= MG_WS_RELAY_QUEUE_MAX) {
+      pslot->paused = 1;
+   }
+   else {
+      event.events = EPOLLIN | EPOLLONESHOT;
+      event.data.u64 = (((uint64_t) pslot->gen) << 32) | (uint64_t) slot_no;
+      epoll_ctl(prelay->epfd, EPOLL_CTL_MOD, (int) pslot->pweb->pcon->cli_socket, &event);
+   }
+
+   return 0;
+}
+
+
+/* CMT82 free the data queued for a client: called with the relay locked (or stopped) */
+void mg_websocket_relay_discard(MGWSRSLOT *pslot)
+{
+   MGWSRBUF *pbuf;
+
+   while (pslot->pout_head) {
+      pbuf = pslot->pout_head;
+      pslot->pout_head = pbuf->pnext;
+      mg_free(NULL, (void *) pbuf, MG_MID_WSRELAY);
+   }
+   pslot->pout_tail = NULL;
+   pslot->out_bytes = 0;
+
+   return;
+}
+
+
+/* CMT77 relay thread: each socket is armed for one event at a time so only one thread serves a WebSocket at once */
+/* CMT82 data for the client is queued for the writer threads so that a slow client never holds up the epoll set */
+DBX_THR_TYPE mg_websocket_relay(void *arg)
+{
+   int n, i, rc, slot_no;
+   unsigned int gen;
+   struct epoll_event events[MG_WS_RELAY_EVENTS];
+   MGWEB *pweb;
+   MGWSRBUF *pbuf;
+   MGWSRELAY *prelay;
+
+   prelay = (MGWSRELAY *) arg;
+   pbuf = NULL;
+
+   while (prelay->status == 1) {
+      n = epoll_wait(prelay->epfd, events, MG_WS_RELAY_EVENTS, 10000);
+
+      for (i = 0; i < n && prelay->status == 1; i ++) {
+         if (events[i].data.u64 == MG_WS_RELAY_WAKE) {
+            continue;
+         }
+         slot_no = (int) (events[i].data.u64 & 0xffffffff);
+         gen = (unsigned int) (events[i].data.u64 >> 32);
+
+         pthread_mutex_lock(&(prelay->lock));
+         if (slot_no >= prelay->slot_max || prelay->slots[slot_no].gen != gen || !prelay->slots[slot_no].pweb || prelay->slots[slot_no].removing || prelay->slots[slot_no].closed) {
+            pthread_mutex_unlock(&(prelay->lock));
+            continue;
+         }
+         pweb = prelay->slots[slot_no].pweb;
+         prelay->slots[slot_no].busy = 1;
+         pthread_mutex_unlock(&(prelay->lock));
+
+         if (!pbuf) {
+            pbuf = (MGWSRBUF *) mg_malloc(NULL, sizeof(MGWSRBUF), MG_MID_WSRELAY);
+         }
+         if (pbuf) {
+            rc = mg_websocket_relay_read(pweb, pbuf);
+         }
+         else {
+            rc = 0; /* try again when the socket is next reported */
+         }
+
+         pthread_mutex_lock(&(prelay->lock));
+         prelay->slots[slot_no].busy = 0;
+         if (prelay->slots[slot_no].removing) {
+            pthread_cond_broadcast(&(prelay->cond));
+         }
+         else {
+            mg_websocket_relay_queue(prelay, slot_no, (pbuf && pbuf->len >= 0) ? pbuf : NULL, rc);
+            if (pbuf && pbuf->len >= 0) {
+               pbuf = NULL;
+            }
+         }
+         pthread_mutex_unlock(&(prelay->lock));
+      }
+   }
+
+   if (pbuf) {
+      mg_free(NULL, (void *) pbuf, MG_MID_WSRELAY);
+   }
+
+   return DBX_THR_RETURN;
+}
+
+
+/* CMT82 writer thread: writes the data queued for each client in turn, so a client that is slow to read holds up only this thread */
+DBX_THR_TYPE mg_websocket_relay_write(void *arg)
+{
+   int slot_no;
+   struct epoll_event event;
+   MGWEB *pweb;
+   MGWSRBUF *pbuf, *pnext;
+   MGWSRSLOT *pslot;
+   MGWSRELAY *prelay;
+
+   prelay = (MGWSRELAY *) arg;
+
+   pthread_mutex_lock(&(prelay->lock));
+   for (;;) {
+      while (prelay->status == 1 && prelay->write_head < 0) {
+         pthread_cond_wait(&(prelay->cond_write), &(prelay->lock));
+      }
+      if (prelay->status != 1) {
+         break;
+      }
+      slot_no = prelay->write_head;
+      pslot = &(prelay->slots[slot_no]);
+      prelay->write_head = pslot->next_write;
+      if (prelay->write_head < 0) {
+         prelay->write_tail = -1;
+      }
+
+      pweb = pslot->pweb;
+      pbuf = pslot->pout_head;
+      pslot->pout_head = NULL;
+      pslot->pout_tail = NULL;
+      pslot->out_bytes = 0;
+      if (pslot->removing) {
+         pweb = NULL;
+      }
+      pthread_mutex_unlock(&(prelay->lock));
+
+      while (pbuf) {
+         pnext = pbuf->pnext;
+         if (pweb) {
+            if (pbuf->type == MG_WS_MESSAGE_TYPE_CLOSE)
+               mg_websocket_write_block(pweb, MG_WS_MESSAGE_TYPE_CLOSE, (unsigned char *) "", 0);
+            else
+               mg_websocket_write_message(pweb, pbuf->type, pbuf->data, (size_t) pbuf->len);
+         }
+         mg_free(NULL, (void *) pbuf, MG_MID_WSRELAY);
+         pbuf = pnext;
+      }
+
+      pthread_mutex_lock(&(prelay->lock));
+      pslot = &(prelay->slots[slot_no]); /* the slot table may have grown in the meantime */
+      if (pslot->pout_head && !pslot->removing) { /* more arrived while writing: go to the back of the queue */
+         pslot->next_write = -1;
+         if (prelay->write_tail >= 0)
+            prelay->slots[prelay->write_tail].next_write = slot_no;
+         else
+            prelay->write_head = slot_no;
+         prelay->write_tail = slot_no;
+      }
+      else {
+         pslot->writing = 0;
+         if (pslot->removing) {
+            pthread_cond_broadcast(&(prelay->cond));
+         }
+      }
+      if (pslot->paused && !pslot->removing && !pslot->closed && pslot->out_bytes < MG_WS_RELAY_QUEUE_MAX) {
+         pslot->paused = 0;
+         event.events = EPOLLIN | EPOLLONESHOT;
+         event.data.u64 = (((uint64_t) pslot->gen) << 32) | (uint64_t) slot_no;
+         epoll_ctl(prelay->epfd, EPOLL_CTL_MOD, (int) pslot->pweb->pcon->cli_socket, &event);
+      }
+   }
+   pthread_mutex_unlock(&(prelay->lock));
+
+   return DBX_THR_RETURN;
+}
+
+#endif
+
+
+/* CMT79 subscribe a client to its channel: 0 if this client is to start the channel's publisher; 1 if it joins an existing channel */
+int mg_websocket_channel_subscribe(MGWEB *pweb)
+{
+   int rc;
+   MGWSCHANNEL *pchannel;
+
+   rc = 1;
+   mg_enter_critical_section((void *) &mg_global_mutex);
+
+   pchannel = mg_system.pwschannel;
+   while (pchannel) {
+      if (pchannel->status != MG_WSCHANNEL_CLOSED && !strcmp(pchannel->name, pweb->pwsock->channel_name)) {
+         break;
+      }
+      pchannel = pchannel->pnext;
+   }
+
+   if (!pchannel) {
+      pchannel = (MGWSCHANNEL *) mg_malloc(NULL, sizeof(MGWSCHANNEL), MG_MID_WSCHANNEL);
+      if (!pchannel) { /* serve this client with its own connection */
+         mg_leave_critical_section((void *) &mg_global_mutex);
+         pweb->pwsock->channel = 0;
+         return 0;
+      }
+      memset((void *) pchannel, 0, sizeof(MGWSCHANNEL));
+      strcpy(pchannel->name, pweb->pwsock->channel_name);
+      pchannel->status = MG_WSCHANNEL_WAITING;
+      mg_mutex_create(&(pchannel->lock));
+      mg_mutex_create(&(pchannel->send_lock));
+      if (mg_system.ws_deflate > 0) { /* CMT80 messages are compressed independently so that they can be sent to any subscriber */
+         mg_websocket_deflate_init(&(pchannel->deflate), 0, 0, mg_system.ws_deflate_window_bits, 15);
+      }
+
+      pchannel->listed = 1;
+      pchannel->pnext = mg_system.pwschannel;
+      mg_system.pwschannel = pchannel;
+      mg_system.ws_channels ++;
+      rc = 0;
+   }
+
+   pchannel->no_subscribers ++; /* CMT82 holds the channel open until this client unsubscribes */
+   pweb->pwsock->pchannel = pchannel;
+   mg_system.ws_channel_subscribers ++;
+
+   mg_leave_critical_section((void *) &mg_global_mutex);
+
+   mg_mutex_lock(&(pchannel->lock), 0); /* CMT82 never taken with mg_global_mutex held */
+   pweb->pwsock->channel_refs = 0;
+   pweb->pwsock->pnext_sub = pchannel->psub;
+   pchannel->psub = pweb;
+   mg_mutex_unlock(&(pchannel->lock));
+
+   return rc;
+}
+
+
+/* CMT79 remove a client from its channel: the last to leave closes the publisher's connection and frees the channel */
+int mg_websocket_channel_unsubscribe(MGWEB *pweb)
+{
+   int rc, last;
+   MGWEB *psub, *pprev, *ppub;
+   MGWSCHANNEL *pchannel;
+
+   pchannel = pweb->pwsock->pchannel;
+   if (!pchannel) {
+      return CACHE_SUCCESS;
+   }
+
+   mg_mutex_lock(&(pchannel->lock), 0);
+   pprev = NULL;
+   psub = pchannel->psub;
+   while (psub) {
+      if (psub == pweb) {
+         if (pprev)
+            pprev->pwsock->pnext_sub = psub->pwsock->pnext_sub;
+         else
+            pchannel->psub = psub->pwsock->pnext_sub;
+         break;
+      }
+      pprev = psub;
+      psub = psub->pwsock->pnext_sub;
+   }
+   while (pweb->pwsock->channel_refs > 0) { /* CMT82 wait for a write to this client from a snapshot of the list to finish */
+      mg_mutex_unlock(&(pchannel->lock));
+      mg_sleep(1);
+      mg_mutex_lock(&(pchannel->lock), 0);
+   }
+   mg_mutex_unlock(&(pchannel->lock));
+
+   mg_enter_critical_section((void *) &mg_global_mutex);
+   pchannel->no_subscribers --;
+   last = (pchannel->no_subscribers == 0);
+   mg_system.ws_channel_subscribers --;
+   if (last) {
+      mg_websocket_channel_unlist(pchannel);
+   }
+
+   mg_leave_critical_section((void *) &mg_global_mutex);
+
+   pweb->pwsock->pchannel = NULL;
+   pweb->pwsock->pnext_sub = NULL;
+
+   if (!last) {
+      return CACHE_SUCCESS;
+   }
+
+   ppub = pchannel->ppub;
+   if (ppub) {
+      /* CMT82 interrupt the publisher's read and wait for the reader to finish before its connection is released */
+      pchannel->stopping = 1;
+#if defined(_WIN32)
+      shutdown(ppub->pcon->cli_socket, SD_RECEIVE);
+#else
+      if (!ppub->pcon->ptlscon) {
+         rc = write(ppub->pcon->int_pipe[1], "exit", 4);
+      }
+      shutdown(ppub->pcon->cli_socket, SHUT_RD); /* TLS */
+#endif
+      mg_thread_join(&(pchannel->read_thread));
+
+#if !defined(_WIN32)
+      close(ppub->pcon->int_pipe[0]);
+      close(ppub->pcon->int_pipe[1]);
+      ppub->pcon->int_pipe[0] = 0;
+      ppub->pcon->int_pipe[1] = 0;
+#endif
+
+      mg_cleanup(ppub);
+      mg_release_connection(ppub, 1);
+      mg_free(NULL, (void *) ppub, MG_MID_WSCHANNEL);
+   }
+
+   mg_mutex_destroy(&(pchannel->lock));
+   mg_mutex_destroy(&(pchannel->send_lock));
+   mg_websocket_deflate_free(&(pchannel->deflate)); /* CMT80 */
+   mg_free(NULL, (void *) pchannel, MG_MID_WSCHANNEL);
+
+   rc = CACHE_SUCCESS;
+   return rc;
+}
+
+
+/* CMT79 remove a channel from the list of open channels: called with mg_global_mutex held */
+int mg_websocket_channel_unlist(MGWSCHANNEL *pchannel)
+{
+   MGWSCHANNEL *pch, *pprev;
+
+   if (!pchannel->listed) {
+      return CACHE_SUCCESS;
+   }
+
+   pprev = NULL;
+   pch = mg_system.pwschannel;
+   while (pch) {
+      if (pch == pchannel) {
+         if (pprev)
+            pprev->pnext = pch->pnext;
+         else
+            mg_system.pwschannel = pch->pnext;
+         break;
+      }
+      pprev = pch;
+      pch = pch->pnext;
+   }
+   pchannel->listed = 0;
+   mg_system.ws_channels --;
+
+   return CACHE_SUCCESS;
+}
+
+
+/* CMT82 copy the subscriber list so that it can be written to without holding the channel's lock: each subscriber copied is referenced until released */
+int mg_websocket_channel_snapshot(MGWSCHANNEL *pchannel, MGWEB ***ppsubs, int *psize)
+{
+   int no_subs, size;
+   MGWEB *psub;
+   MGWEB **psubs;
+
+   no_subs = 0;
+   mg_mutex_lock(&(pchannel->lock), 0);
+   for (psub = pchannel->psub; psub; psub = psub->pwsock->pnext_sub) {
+      if (no_subs == *psize) {
+         size = (*psize > 0) ? (*psize * 2) : 64;
+         psubs = (MGWEB **) mg_malloc(NULL, sizeof(MGWEB *) * size, MG_MID_WSCHANNEL);
+         if (!psubs) { /* serve those copied so far */
+            break;
+         }
+         if (*ppsubs) {
+            memcpy((void *) psubs, (void *) *ppsubs, sizeof(MGWEB *) * no_subs);
+            mg_free(NULL, (void *) *ppsubs, MG_MID_WSCHANNEL);
+         }
+         *ppsubs = psubs;
+         *psize = size;
+      }
+      psub->pwsock->channel_refs ++;
+      (*ppsubs)[no_subs ++] = psub;
+   }
+   mg_mutex_unlock(&(pchannel->lock));
+
+   return no_subs;
+}
+
+
+/* CMT82 release the subscribers referenced by mg_websocket_channel_snapshot() */
+int mg_websocket_channel_release(MGWSCHANNEL *pchannel, MGWEB **psubs, int no_subs)
+{
+   int n;
+
+   mg_mutex_lock(&(pchannel->lock), 0);
+   for (n = 0; n < no_subs; n ++) {
+      psubs[n]->pwsock->channel_refs --;
+   }
+   mg_mutex_unlock(&(pchannel->lock));
+
+   return CACHE_SUCCESS;
+}
+
+
+/* CMT79 the first subscriber's DB Server connection becomes the channel's publisher */
+int mg_websocket_channel_publish(MGWEB *pweb)
+{
+   int rc;
+   char *p, *pz;
+   MGWEB *ppub;
+   MGWSCHANNEL *pchannel;
+
+   pchannel = pweb->pwsock->pchannel;
+
+   if (pweb->plog->log_frames) {
+      mg_log_buffer(pweb->plog, pweb, pweb->response_headers, pweb->response_headers_len, "mg_web: start WebSocket channel", 0);
+   }
+
+   p = strstr(pweb->response_headers, "Error: ");
+   if (p) {
+      p += 7;
+      pz = strstr(p, "\r\n");
+      if (pz) {
+         *pz = '\0';
+      }
+      mg_log_event(pweb->plog, pweb, p, "mg_web: start WebSocket channel: Error", 0);
+      ppub = NULL;
+      goto mg_websocket_channel_publish_error;
+   }
+   if (strstr(pweb->response_headers, "Binary: 1")) {
+      pchannel->binary = 1;
+   }
+
+   ppub = (MGWEB *) mg_malloc(NULL, sizeof(MGWEB), MG_MID_WSCHANNEL);
+   if (!ppub) {
+      goto mg_websocket_channel_publish_error;
+   }
+   memset((void *) ppub, 0, sizeof(MGWEB));
+   ppub->wstype = pweb->wstype;
+   ppub->plog = pweb->plog;
+   ppub->ppath = pweb->ppath;
+   ppub->psrv = pweb->psrv;
+   ppub->pcon = pweb->pcon;
+
+#if !defined(_WIN32)
+   rc = pipe(ppub->pcon->int_pipe);
+   if (rc == -1) {
+      goto mg_websocket_channel_publish_error;
+   }
+#endif
+
+   pchannel->ppub = ppub;
+   rc = mg_thread_create(&(pchannel->read_thread), mg_websocket_channel_read, (void *) pchannel);
+   if (rc != 0) {
+      pchannel->ppub = NULL;
+#if !defined(_WIN32)
+      close(ppub->pcon->int_pipe[0]);
+      close(ppub->pcon->int_pipe[1]);
+      ppub->pcon->int_pipe[0] = 0;
+      ppub->pcon->int_pipe[1] = 0;
+#endif
+      goto mg_websocket_channel_publish_error;
+   }
+   pweb->pcon = NULL; /* the connection now belongs to the channel */
+
+   mg_enter_critical_section((void *) &mg_global_mutex);
+   mg_mutex_lock(&(pchannel->send_lock), 0);
+   if (pchannel->status == MG_WSCHANNEL_WAITING) {
+      pchannel->status = MG_WSCHANNEL_OPEN;
+   }
+   mg_mutex_unlock(&(pchannel->send_lock));
+   mg_leave_critical_section((void *) &mg_global_mutex);
+
+   return CACHE_SUCCESS;
+
+mg_websocket_channel_publish_error:
+
+   if (ppub) {
+      mg_free(NULL, (void *) ppub, MG_MID_WSCHANNEL);
+   }
+   mg_cleanup(pweb);
+   mg_release_connection(pweb, 1);
+   pweb->pcon = NULL;
+   mg_websocket_channel_close(pchannel);
+
+   return CACHE_FAILURE;
+}
+
+
+/* CMT79 the channel's publisher has gone: close all subscribers */
+int mg_websocket_channel_close(MGWSCHANNEL *pchannel)
+{
+   int n, no_subs, size;
+   MGWEB **psubs;
+
+   mg_enter_critical_section((void *) &mg_global_mutex);
+   mg_mutex_lock(&(pchannel->send_lock), 0);
+   pchannel->status = MG_WSCHANNEL_CLOSED;
+   mg_mutex_unlock(&(pchannel->send_lock));
+   mg_websocket_channel_unlist(pchannel);
+   mg_leave_critical_section((void *) &mg_global_mutex);
+
+   psubs = NULL;
+   size = 0;
+   no_subs = mg_websocket_channel_snapshot(pchannel, &psubs, &size);
+   for (n = 0; n < no_subs; n ++) {
+      mg_websocket_write_block(psubs[n], MG_WS_MESSAGE_TYPE_CLOSE, (unsigned char *) "", 0);
+      mg_websocket_channel_release(pchannel, &psubs[n], 1);
+   }
+   if (psubs) {
+      mg_free(NULL, (void *) psubs, MG_MID_WSCHANNEL);
+   }
+
+   return CACHE_SUCCESS;
+}
+
+
+/* CMT79 forward a message from a subscriber to the channel's publisher */
+int mg_websocket_channel_send(MGWEB *pweb, unsigned char *data, int len)
+{
+   int rc;
+   MGWSCHANNEL *pchannel;
+
+   pchannel = pweb->pwsock->pchannel;
+   rc = 0;
+
+   mg_mutex_lock(&(pchannel->send_lock), 0);
+   if (pchannel->status == MG_WSCHANNEL_OPEN && pchannel->ppub) { /* otherwise discarded */
+      rc = netx_tcp_write(pchannel->ppub, data, len);
+   }
+   mg_mutex_unlock(&(pchannel->send_lock));
+
+   return rc;
+}
+
+
+/* CMT79 serve a subscriber until it disconnects */
+int mg_websocket_channel_session(MGWEB *pweb)
+{
+   int rc, status;
+
+   mg_enter_critical_section((void *) &mg_global_mutex);
+   status = pweb->pwsock->pchannel->status;
+   mg_leave_critical_section((void *) &mg_global_mutex);
+
+   if (status != MG_WSCHANNEL_CLOSED) {
+      rc = mg_websocket_data_framing(pweb);
+   }
+
+   mg_websocket_channel_unsubscribe(pweb);
+   mg_websocket_destroy_lock(pweb);
+
+   rc = mg_websocket_exit(pweb);
+
+   return rc;
+}
+
+
+/* CMT79 the first subscriber failed before its connection could be handed to the channel */
+int mg_websocket_channel_abort(MGWEB *pweb)
+{
+   mg_websocket_channel_close(pweb->pwsock->pchannel);
+   mg_websocket_channel_unsubscribe(pweb);
+
+   return CACHE_SUCCESS;
+}
+
+
+/* CMT79 read from the publisher: each message is framed once and written to all subscribers */
+/* CMT82 the subscribers are written to from a snapshot of the list, so joining or leaving the channel does not wait for the writes */
+DBX_THR_TYPE mg_websocket_channel_read(void *arg)
+{
+   int n, len, type, deflated, no_subs, size;
+   size_t header_size, zheader_size, zlen;
+   unsigned char header[32], zheader[32];
+   unsigned char data[MG_WS_BLOCK_DATA_SIZE];
+   unsigned char *zdata;
+   MGWEB *psub;
+   MGWEB **psubs;
+   MGWSCHANNEL *pchannel;
+
+   pchannel = (MGWSCHANNEL *) arg;
+   psubs = NULL;
+   size = 0;
+
+   if (pchannel->binary)
+      type = MG_WS_MESSAGE_TYPE_BINARY;
+   else
+      type = MG_WS_MESSAGE_TYPE_TEXT;
+
+   for (;;) {
+      len = netx_tcp_read(pchannel->ppub, (unsigned char *) data, (int) sizeof(data), MG_WSCHANNEL_READ_TIMEOUT, 0);
+
+      if (len == NETX_READ_TIMEOUT) {
+         if (pchannel->stopping) { /* CMT82 in case the read was not interrupted */
+            break;
+         }
+         continue;
+      }
+      if (len < 0) { /* EOF, error or interrupted by the last subscriber leaving */
+         break;
+      }
+
+      if (len > 0) {
+         header_size = mg_websocket_create_header(pchannel->ppub, type, header, (mg_uint64_t) len);
+
+         deflated = 0; /* CMT80 compressed once, when first needed, for all subscribers that negotiated permessage-deflate */
+         zdata = NULL;
+         zlen = 0;
+         zheader_size = 0;
+
+         no_subs = mg_websocket_channel_snapshot(pchannel, &psubs, &size);
+         for (n = 0; n < no_subs; n ++) {
+            psub = psubs[n];
+            if (pchannel->deflate.enabled && psub->pwsock->deflate.enabled && len >= MG_WS_DEFLATE_MIN_SIZE && psub->pwsock->deflate.server_window_bits >= pchannel->deflate.server_window_bits) {
+               if (!deflated) {
+                  deflated = (mg_websocket_deflate(&(pchannel->deflate), data, (size_t) len, &zdata, &zlen) == CACHE_SUCCESS) ? 1 : -1;
+                  if (deflated == 1) {
+                     zheader_size = mg_websocket_create_header(pchannel->ppub, type | MG_WS_MESSAGE_DEFLATED, zheader, (mg_uint64_t) zlen);
+                  }
+               }
+               if (deflated == 1) {
+                  mg_websocket_write_frame(psub, zheader, zheader_size, zdata, zlen);
+                  mg_websocket_channel_release(pchannel, &psubs[n], 1);
+                  continue;
+               }
+            }
+            mg_websocket_write_frame(psub, header, header_size, data, (size_t) len);
+            mg_websocket_channel_release(pchannel, &psubs[n], 1); /* a client leaving waits only for its own write */
+         }
+         pchannel->no_messages ++;
+      }
+   }
+
+   if (psubs) {
+      mg_free(NULL, (void *) psubs, MG_MID_WSCHANNEL);
+   }
+   mg_websocket_channel_close(pchannel);
+
+   return DBX_THR_RETURN;
+}
+
+
+/* CMT80 load zlib for permessage-deflate: called once, at worker initialization */
+int mg_websocket_deflate_load(void)
+{
+#if DBX_WITH_ZLIB >= 1
+   int n, n1;
+   char libs[256];
+   char *libnam[16], *p1, *p2;
+
+   if (mg_zlib_so.loaded) {
+      return CACHE_SUCCESS;
+   }
+
+   strncpy(libs, DBX_ZLIB_LIB, 250);
+   libs[250] = '\0';
+   p1 = libs;
+   n1 = 0;
+   for (n = 0; n < 15; n ++) {
+      p2 = strstr(p1, " ");
+      if (p2)
+         *p2 = '\0';
+      if (p1[0]) {
+         libnam[n1 ++] = p1;
+      }
+      if (!p2)
+         break;
+      p1 = (p2 + 1);
+   }
+   libnam[n1] = NULL;
+
+   for (n = 0; libnam[n]; n ++) {
+      strcpy(mg_zlib_so.libnam, libnam[n]);
+      mg_zlib_so.p_library = mg_dso_load(mg_zlib_so.libnam);
+      if (mg_zlib_so.p_library) {
+         break;
+      }
+   }
+   if (!mg_zlib_so.p_library) {
+      return CACHE_FAILURE;
+   }
+
+   mg_zlib_so.p_deflateInit2_ = (int (*) (z_streamp, int, int, int, int, int, const char *, int)) mg_dso_sym(mg_zlib_so.p_library, (char *) "deflateInit2_");
+   mg_zlib_so.p_deflate = (int (*) (z_streamp, int)) mg_dso_sym(mg_zlib_so.p_library, (char *) "deflate");
+   mg_zlib_so.p_deflateReset = (int (*) (z_streamp)) mg_dso_sym(mg_zlib_so.p_library, (char *) "deflateReset");
+   mg_zlib_so.p_deflateEnd = (int (*) (z_streamp)) mg_dso_sym(mg_zlib_so.p_library, (char *) "deflateEnd");
+   mg_zlib_so.p_inflateInit2_ = (int (*) (z_streamp, int, const char *, int)) mg_dso_sym(mg_zlib_so.p_library, (char *) "inflateInit2_");
+   mg_zlib_so.p_inflate = (int (*) (z_streamp, int)) mg_dso_sym(mg_zlib_so.p_library, (char *) "inflate");
+   mg_zlib_so.p_inflateReset = (int (*) (z_streamp)) mg_dso_sym(mg_zlib_so.p_library, (char *) "inflateReset");
+   mg_zlib_so.p_inflateEnd = (int (*) (z_streamp)) mg_dso_sym(mg_zlib_so.p_library, (char *) "inflateEnd");
+
+   if (!mg_zlib_so.p_deflateInit2_ || !mg_zlib_so.p_deflate || !mg_zlib_so.p_deflateReset || !mg_zlib_so.p_deflateEnd || !mg_zlib_so.p_inflateInit2_ || !mg_zlib_so.p_inflate || !mg_zlib_so.p_inflateReset || !mg_zlib_so.p_inflateEnd) {
+      mg_dso_unload(mg_zlib_so.p_library);
+      mg_zlib_so.p_library = NULL;
+      return CACHE_FAILURE;
+   }
+
+   mg_zlib_so.loaded = 1;
+   return CACHE_SUCCESS;
+#else
+   return CACHE_FAILURE;
+#endif
+}
+
+
+/* CMT80 accept the first permessage-deflate offer (RFC 7692) that can be satisfied: 1 if accepted */
+int mg_websocket_deflate_negotiate(MGWEB *pweb, char *offers)
+{
+   int n, invalid, server_nct, client_nct, server_bits, client_bits, window_bits;
+   char *offer, *offer_next, *param, *param_next, *value, *p;
+   char response[128], buffer[64];
+
+   window_bits = mg_system.ws_deflate_window_bits;
+   mg_lcase(offers);
+
+   for (offer = offers; offer && *offer; offer = offer_next) {
+      offer_next = strstr(offer, ",");
+      if (offer_next) {
+         *offer_next ++ = '\0';
+      }
+
+      invalid = 0;
+      server_nct = 0;
+      client_nct = 0;
+      server_bits = 0;  /* 0: not offered */
+      client_bits = 0;  /* 0: not offered; -1: offered without a value */
+      for (n = 0, param = offer; param && !invalid; n ++, param = param_next) {
+         param_next = strstr(param, ";");
+         if (param_next) {
+            *param_next ++ = '\0';
+         }
+         while (*param == ' ' || *param == '\t')
+            param ++;
+         for (p = param + strlen(param); p > param && (*(p - 1) == ' ' || *(p - 1) == '\t'); p --)
+            *(p - 1) = '\0';
+         value = strstr(param, "=");
+         if (value) {
+            *value ++ = '\0';
+            while (*value == ' ' || *value == '"')
+               value ++;
+            for (p = value; *p >= '0' && *p <= '9'; p ++)
+               ;
+            *p = '\0';
+         }
+
+         if (n == 0) {
+            invalid = strcmp(param, "permessage-deflate") ? 1 : 0;
+         }
+         else if (!strcmp(param, "server_no_context_takeover") && !value && !server_nct) {
+            server_nct = 1;
+         }
+         else if (!strcmp(param, "client_no_context_takeover") && !value && !client_nct) {
+            client_nct = 1;
+         }
+         else if (!strcmp(param, "server_max_window_bits") && value && !server_bits) {
+            server_bits = (int) strtol(value, NULL, 10);
+            if (server_bits < 8 || server_bits > 15) {
+               invalid = 1;
+            }
+         }
+         else if (!strcmp(param, "client_max_window_bits") && !client_bits) {
+            client_bits = value ? (int) strtol(value, NULL, 10) : -1;
+            if (value && (client_bits < 8 || client_bits > 15)) {
+               invalid = 1;
+            }
+         }
+         else {
+            invalid = 1;
+         }
+      }
+      if (invalid || (server_bits && server_bits < 9)) { /* zlib cannot compress with a window of 256 bytes */
+         continue;
+      }
+
+      strcpy(response, "permessage-deflate");
+      if (server_nct || !mg_system.ws_deflate_context_takeover) {
+         strcat(response, "; server_no_context_takeover");
+      }
+      if (client_nct || !mg_system.ws_deflate_context_takeover) {
+         strcat(response, "; client_no_context_takeover");
+      }
+      if (server_bits) {
+         if (server_bits > window_bits) {
+            server_bits = window_bits;
+         }
+         sprintf(buffer, "; server_max_window_bits=%d", server_bits);
+         strcat(response, buffer);
+      }
+      else {
+         server_bits = window_bits;
+      }
+      if (client_bits) {
+         if (client_bits < 0 || client_bits > window_bits) {
+            client_bits = window_bits;
+         }
+         sprintf(buffer, "; client_max_window_bits=%d", client_bits);
+         strcat(response, buffer);
+      }
+      else {
+         client_bits = 15;
+      }
+
+      strcpy(pweb->pwsock->sec_websocket_extensions, response);
+      mg_websocket_deflate_init(&(pweb->pwsock->deflate), (server_nct || !mg_system.ws_deflate_context_takeover) ? 0 : 1, (client_nct || !mg_system.ws_deflate_context_takeover) ? 0 : 1, server_bits, client_bits);
+
+      if (pweb->plog->log_frames) {
+         mg_log_event(pweb->plog, pweb, response, "mg_web: WebSocket extensions accepted", 0);
+      }
+      return 1;
+   }
+
+   return 0;
+}
+
+
+int mg_websocket_deflate_init(MGWSDEFLATE *pdeflate, int server_takeover, int client_takeover, int server_window_bits, int client_window_bits)
+{
+   memset((void *) pdeflate, 0, sizeof(MGWSDEFLATE));
+   pdeflate->server_takeover = (short) server_takeover;
+   pdeflate->client_takeover = (short) client_takeover;
+   pdeflate->server_window_bits = (short) server_window_bits;
+   pdeflate->client_window_bits = (short) (client_window_bits < 9 ? 9 : client_window_bits); /* a larger window than the client's is harmless */
+   pdeflate->enabled = 1;
+
+   return CACHE_SUCCESS;
+}
+
+
+/* CMT80 make sure a buffer holds at least 'size' bytes, keeping the first 'used' bytes */
+int mg_websocket_deflate_buffer(unsigned char **pbuffer, size_t *pbuffer_size, size_t size, size_t used)
+{
+   unsigned char *p;
+
+   if (*pbuffer && *pbuffer_size >= size) {
+      return CACHE_SUCCESS;
+   }
+   p = (unsigned char *) mg_malloc(NULL, (int) size, MG_MID_WSDEFLATE);
+   if (!p) {
+      return CACHE_FAILURE;
+   }
+   if (*pbuffer) {
+      if (used > 0) {
+         memcpy((void *) p, (void *) *pbuffer, used);
+      }
+      mg_free(NULL, (void *) *pbuffer, MG_MID_WSDEFLATE);
+   }
+   *pbuffer = p;
+   *pbuffer_size = size;
+
+   return CACHE_SUCCESS;
+}
+
+
+/* CMT80 compress a message for the client: the result remains in the compressor's buffer until the next message */
+int mg_websocket_deflate(MGWSDEFLATE *pdeflate, unsigned char *data, size_t size, unsigned char **pout, size_t *pout_size)
+{
+#if DBX_WITH_ZLIB >= 1
+   int rc;
+   z_stream *pz;
+
+   if (!mg_zlib_so.loaded) {
+      return CACHE_FAILURE;
+   }
+
+   pz = (z_stream *) pdeflate->pdeflate;
+   if (pz && !pdeflate->server_takeover) { /* a compressor kept between messages that must not share context (channels) */
+      mg_zlib_so.p_deflateReset(pz);
+   }
+   if (!pz) {
+      pz = (z_stream *) mg_malloc(NULL, sizeof(z_stream), MG_MID_WSDEFLATE);
+      if (!pz) {
+         return CACHE_FAILURE;
+      }
+      memset((void *) pz, 0, sizeof(z_stream));
+      rc = mg_zlib_so.p_deflateInit2_(pz, mg_system.ws_deflate, Z_DEFLATED, -pdeflate->server_window_bits, mg_system.ws_deflate_memory_level, Z_DEFAULT_STRATEGY, ZLIB_VERSION, (int) sizeof(z_stream));
+      if (rc != Z_OK) {
+         mg_free(NULL, (void *) pz, MG_MID_WSDEFLATE);
+         return CACHE_FAILURE;
+      }
+      pdeflate->pdeflate = (void *) pz;
+   }
+
+   if (mg_websocket_deflate_buffer(&(pdeflate->dbuffer), &(pdeflate->dbuffer_size), size + (size >> 8) + 64, 0) != CACHE_SUCCESS) {
+      return CACHE_FAILURE;
+   }
+
+   pz->next_in = (Bytef *) data;
+   pz->avail_in = (uInt) size;
+   pz->next_out = (Bytef *) pdeflate->dbuffer;
+   pz->avail_out = (uInt) pdeflate->dbuffer_size;
+   rc = mg_zlib_so.p_deflate(pz, Z_SYNC_FLUSH);
+   *pout_size = pdeflate->dbuffer_size - pz->avail_out;
+
+   if (rc != Z_OK || pz->avail_in || !pz->avail_out || *pout_size < 4) {
+      mg_zlib_so.p_deflateReset(pz); /* this message will be sent uncompressed so it must not be referred to by those that follow */
+      return CACHE_FAILURE;
+   }
+
+   *pout_size -= 4; /* the empty block (00 00 ff ff) that ends the flush is not sent */
+   *pout = pdeflate->dbuffer;
+
+   return CACHE_SUCCESS;
+#else
+   (void) pdeflate; /* CMT82 */
+   (void) data;
+   (void) size;
+   (void) pout;
+   (void) pout_size;
+   return CACHE_FAILURE;
+#endif
+}
+
+
+/* CMT80 decompress a message from the client: 0 or the status code with which to close the WebSocket */
+int mg_websocket_inflate(MGWSDEFLATE *pdeflate, unsigned char *data, size_t size, mg_int64_t limit, unsigned char **pout, size_t *pout_size)
+{
+#if DBX_WITH_ZLIB >= 1
+   int rc, n;
+   size_t used, grow;
+   z_stream *pz;
+   static unsigned char tail[4] = {0x00, 0x00, 0xff, 0xff};
+
+   if (!mg_zlib_so.loaded) {
+      return MG_WS_STATUS_CODE_INTERNAL_ERROR;
+   }
+
+   pz = (z_stream *) pdeflate->pinflate;
+   if (!pz) {
+      pz = (z_stream *) mg_malloc(NULL, sizeof(z_stream), MG_MID_WSDEFLATE);
+      if (!pz) {
+         return MG_WS_STATUS_CODE_INTERNAL_ERROR;
+      }
+      memset((void *) pz, 0, sizeof(z_stream));
+      rc = mg_zlib_so.p_inflateInit2_(pz, -pdeflate->client_window_bits, ZLIB_VERSION, (int) sizeof(z_stream));
+      if (rc != Z_OK) {
+         mg_free(NULL, (void *) pz, MG_MID_WSDEFLATE);
+         return MG_WS_STATUS_CODE_INTERNAL_ERROR;
+      }
+      pdeflate->pinflate = (void *) pz;
+   }
+
+   grow = (size * 4) + 256;
+   if ((mg_int64_t) grow > limit) {
+      grow = (size_t) limit + 1; /* one byte more than permitted to detect messages that are too large */
+   }
+   if (mg_websocket_deflate_buffer(&(pdeflate->ibuffer), &(pdeflate->ibuffer_size), grow, 0) != CACHE_SUCCESS) {
+      return MG_WS_STATUS_CODE_INTERNAL_ERROR;
+   }
+
+   used = 0;
+   rc = Z_OK;
+   for (n = 0; n < 2 && rc != Z_STREAM_END; n ++) { /* the message then the empty block removed by the client */
+      pz->next_in = (Bytef *) (n ? tail : data);
+      pz->avail_in = (uInt) (n ? sizeof(tail) : size);
+      for (;;) {
+         if (used == pdeflate->ibuffer_size) {
+            if ((mg_int64_t) used > limit) {
+               mg_zlib_so.p_inflateReset(pz);
+               return MG_WS_STATUS_CODE_MESSAGE_TOO_LARGE;
+            }
+            grow = used * 2;
+            if ((mg_int64_t) grow > limit) {
+               grow = (size_t) limit + 1;
+            }
+            if (mg_websocket_deflate_buffer(&(pdeflate->ibuffer), &(pdeflate->ibuffer_size), grow, used) != CACHE_SUCCESS) {
+               mg_zlib_so.p_inflateReset(pz);
+               return MG_WS_STATUS_CODE_INTERNAL_ERROR;
+            }
+         }
+         pz->next_out = (Bytef *) (pdeflate->ibuffer + used);
+         pz->avail_out = (uInt) (pdeflate->ibuffer_size - used);
+         rc = mg_zlib_so.p_inflate(pz, Z_SYNC_FLUSH);
+         used = pdeflate->ibuffer_size - pz->avail_out;
+
+         if (rc == Z_STREAM_END) { /* a final block: anything that follows is ignored */
+            mg_zlib_so.p_inflateReset(pz);
+            break;
+         }
+         if (rc != Z_OK && rc != Z_BUF_ERROR) {
+            mg_zlib_so.p_inflateReset(pz);
+            return MG_WS_STATUS_CODE_PROTOCOL_ERROR;
+         }
+         if (pz->avail_out) { /* all input consumed */
+            break;
+         }
+      }
+   }
+
+   if ((mg_int64_t) used > limit) {
+      mg_zlib_so.p_inflateReset(pz);
+      return MG_WS_STATUS_CODE_MESSAGE_TOO_LARGE;
+   }
+
+   *pout = pdeflate->ibuffer;
+   *pout_size = used;
+
+   return 0;
+#else
+   (void) pdeflate; /* CMT82 */
+   (void) data;
+   (void) size;
+   (void) limit;
+   (void) pout;
+   (void) pout_size;
+   return MG_WS_STATUS_CODE_PROTOCOL_ERROR;
+#endif
+}
+
+
+/* CMT80 called once a message has been processed: keeps memory held between messages to a minimum */
+int mg_websocket_deflate_release(MGWSDEFLATE *pdeflate, int inflate)
+{
+#if DBX_WITH_ZLIB >= 1
+   if (inflate) {
+      if (!pdeflate->client_takeover && pdeflate->pinflate) { /* nothing is carried over to the next message */
+         mg_zlib_so.p_inflateEnd((z_stream *) pdeflate->pinflate);
+         mg_free(NULL, pdeflate->pinflate, MG_MID_WSDEFLATE);
+         pdeflate->pinflate = NULL;
+      }
+      if (pdeflate->ibuffer && pdeflate->ibuffer_size > MG_WS_DEFLATE_BUFFER_KEEP) {
+         mg_free(NULL, (void *) pdeflate->ibuffer, MG_MID_WSDEFLATE);
+         pdeflate->ibuffer = NULL;
+         pdeflate->ibuffer_size = 0;
+      }
+   }
+   else {
+      if (!pdeflate->server_takeover && pdeflate->pdeflate) {
+         mg_zlib_so.p_deflateEnd((z_stream *) pdeflate->pdeflate);
+         mg_free(NULL, pdeflate->pdeflate, MG_MID_WSDEFLATE);
+         pdeflate->pdeflate = NULL;
+      }
+      if (pdeflate->dbuffer && pdeflate->dbuffer_size > MG_WS_DEFLATE_BUFFER_KEEP) {
+         mg_free(NULL, (void *) pdeflate->dbuffer, MG_MID_WSDEFLATE);
+         pdeflate->dbuffer = NULL;
+         pdeflate->dbuffer_size = 0;
+      }
+   }
+#else
+   (void) pdeflate; /* CMT82 */
+   (void) inflate;
+#endif
+
+   return CACHE_SUCCESS;
+}
+
+
+int mg_websocket_deflate_free(MGWSDEFLATE *pdeflate)
+{
+#if DBX_WITH_ZLIB >= 1
+   if (pdeflate->pdeflate) {
+      mg_zlib_so.p_deflateEnd((z_stream *) pdeflate->pdeflate);
+      mg_free(NULL, pdeflate->pdeflate, MG_MID_WSDEFLATE);
+      pdeflate->pdeflate = NULL;
+   }
+   if (pdeflate->pinflate) {
+      mg_zlib_so.p_inflateEnd((z_stream *) pdeflate->pinflate);
+      mg_free(NULL, pdeflate->pinflate, MG_MID_WSDEFLATE);
+      pdeflate->pinflate = NULL;
+   }
+#endif
+   if (pdeflate->dbuffer) {
+      mg_free(NULL, (void *) pdeflate->dbuffer, MG_MID_WSDEFLATE);
+      pdeflate->dbuffer = NULL;
+      pdeflate->dbuffer_size = 0;
+   }
+   if (pdeflate->ibuffer) {
+      mg_free(NULL, (void *) pdeflate->ibuffer, MG_MID_WSDEFLATE);
+      pdeflate->ibuffer = NULL;
+      pdeflate->ibuffer_size = 0;
+   }
+
+   return CACHE_SUCCESS;
+}
+
+
+int mg_websocket_valid_utf8(unsigned char *data, size_t size)
+{
+   size_t n;
+   unsigned int utf8_state;
+
+   utf8_state = UTF8_VALID;
+   for (n = 0; n < size; n ++) {
+      utf8_state = validate_utf8[utf8_state + data[n]];
+      if (utf8_state == UTF8_INVALID) {
+         return 0;
+      }
+   }
+
+   return (utf8_state == UTF8_VALID);
+}
+
+
+/* CMT80 send a message from the DB Server to the client: compressed if permessage-deflate was negotiated */
+size_t mg_websocket_write_message(MGWEB *pweb, int type, unsigned char *buffer, size_t buffer_size)
+{
+   size_t written, out_size;
+   unsigned char *out;
+   MGWSDEFLATE *pdeflate;
+
+   pdeflate = &(pweb->pwsock->deflate);
+
+   if (pdeflate->enabled && buffer_size >= MG_WS_DEFLATE_MIN_SIZE && mg_websocket_deflate(pdeflate, buffer, buffer_size, &out, &out_size) == CACHE_SUCCESS) {
+      written = mg_websocket_write_block(pweb, type | MG_WS_MESSAGE_DEFLATED, out, out_size);
+      mg_websocket_deflate_release(pdeflate, 0);
+      return (written == out_size) ? buffer_size : 0;
+   }
+
+   return mg_websocket_write_block(pweb, type, buffer, buffer_size);
+}
+
+
+size_t mg_websocket_create_header(MGWEB *pweb, int type, unsigned char *header, mg_uint64_t payload_length)
+{
+   size_t pos;
+   unsigned char opcode, rsv1;
+
+   pos = 0;
+
+   rsv1 = 0;
+   if (type & MG_WS_MESSAGE_DEFLATED) { /* CMT80 */
+      rsv1 = 1;
+      type &= ~MG_WS_MESSAGE_DEFLATED;
+   }
 
    switch (type) {
       case MG_WS_MESSAGE_TYPE_TEXT:
@@ -756,7 +2354,7 @@ size_t mg_websocket_create_header(MGWEB *pweb, int type, unsigned char *header,
          opcode = MG_WS_OPCODE_CLOSE;
          break;
    }
-   header[pos ++] = MG_WS_FRAME_SET_FIN(1) | MG_WS_FRAME_SET_OPCODE(opcode);
+   header[pos ++] = MG_WS_FRAME_SET_FIN(1) | MG_WS_FRAME_SET_RSV1(rsv1) | MG_WS_FRAME_SET_OPCODE(opcode);
    if (payload_length < 126) {
       header[pos ++] = MG_WS_FRAME_SET_MASK(0) | MG_WS_FRAME_SET_LENGTH(payload_length, 0);
    }
@@ -28,6 +28,34 @@
 #ifndef MG_WEBSOCKET_H
 #define MG_WEBSOCKET_H
 
+#if DBX_WITH_ZLIB >= 1
+#include <zlib.h>
+
+/* CMT80 an ordered list of zlib libraries that mg_web will try to load, each name separated by a single white space */
+#if defined(_WIN32)
+#define DBX_ZLIB_LIB             "zlib1.dll zlib.dll"
+#elif defined(MACOSX)
+#define DBX_ZLIB_LIB             "libz.dylib libz.1.dylib"
+#else
+#define DBX_ZLIB_LIB             "libz.so.1 libz.so"
+#endif
+
+typedef struct tagDBXZLIBSO {
+   short             loaded;
+   char              libnam[256];
+   DBXPLIB           p_library;
+
+   int               (* p_deflateInit2_)  (z_streamp strm, int level, int method, int windowBits, int memLevel, int strategy, const char *version, int stream_size);
+   int               (* p_deflate)        (z_streamp strm, int flush);
+   int               (* p_deflateReset)   (z_streamp strm);
+   int               (* p_deflateEnd)     (z_streamp strm);
+   int               (* p_inflateInit2_)  (z_streamp strm, int windowBits, const char *version, int stream_size);
+   int               (* p_inflate)        (z_streamp strm, int flush);
+   int               (* p_inflateReset)   (z_streamp strm);
+   int               (* p_inflateEnd)     (z_streamp strm);
+} DBXZLIBSO, *PDBXZLIBSO;
+#endif
+
 #define MG_WS_DATA_FRAMING_MASK               0
 #define MG_WS_DATA_FRAMING_START              1
 #define MG_WS_DATA_FRAMING_PAYLOAD_LENGTH     2
@@ -45,6 +73,7 @@
 #define MG_WS_FRAME_GET_PAYLOAD_LEN(BYTE) ( (BYTE)       & 0x7F)
 
 #define MG_WS_FRAME_SET_FIN(BYTE)         (((BYTE) & 0x01) << 7)
+#define MG_WS_FRAME_SET_RSV1(BYTE)        (((BYTE) & 0x01) << 6)
 #define MG_WS_FRAME_SET_OPCODE(BYTE)       ((BYTE) & 0x0F)
 #define MG_WS_FRAME_SET_MASK(BYTE)        (((BYTE) & 0x01) << 7)
 #define MG_WS_FRAME_SET_LENGTH(X64, IDX)  (unsigned char)(((X64) >> ((IDX)*8)) & 0xFF)
@@ -74,6 +103,11 @@
 #define MG_WS_MESSAGE_TYPE_CLOSE   255
 #define MG_WS_MESSAGE_TYPE_PING    256
 #define MG_WS_MESSAGE_TYPE_PONG    257
+#define MG_WS_MESSAGE_DEFLATED    0x1000 /* CMT80 added to the message type: the payload is compressed (RSV1) */
+
+#define MG_WS_MESSAGE_BUFFER_MIN   4096 /* CMT81 smallest buffer allocated for messages from the client */
+#define MG_WS_MESSAGE_BUFFER_KEEP 65536 /* CMT81 larger buffers are freed once the message has been processed */
+#define MG_WS_FRAME_COALESCE_SIZE  8192 /* CMT81 smaller frames are copied to one buffer so that header and payload are sent in one write */
 
 
 #define S0 0x000
@@ -248,7 +282,42 @@ int            mg_websocket_connection       (MGWEB *pweb);
 int            mg_websocket_disconnect       (MGWEB *pweb);
 int            mg_websocket_data_framing     (MGWEB *pweb);
 void           mg_websocket_incoming_frame   (MGWEB *pweb, MGWSRSTATE *pread_state, char *block, mg_int64_t block_size);
+void           mg_websocket_unmask           (unsigned char *dst, unsigned char *src, size_t len, unsigned char *mask, mg_int64_t mask_offset);
 DBX_THR_TYPE   mg_websocket_dbserver_read    (void *arg);
+#if defined(MG_WS_RELAY)
+int            mg_websocket_relay_read       (MGWEB *pweb, MGWSRBUF *pbuf);
+int            mg_websocket_relay_start      (int threads);
+int            mg_websocket_relay_stop       (void);
+int            mg_websocket_relay_add        (MGWEB *pweb);
+int            mg_websocket_relay_remove     (MGWEB *pweb);
+MGWSRELAY *    mg_websocket_relay_ref        (void); /* CMT82 */
+void           mg_websocket_relay_unref      (MGWSRELAY *prelay);
+int            mg_websocket_relay_queue      (MGWSRELAY *prelay, int slot_no, MGWSRBUF *pbuf, int rc); /* CMT82 */
+void           mg_websocket_relay_discard    (MGWSRSLOT *pslot);
+DBX_THR_TYPE   mg_websocket_relay            (void *arg);
+DBX_THR_TYPE   mg_websocket_relay_write      (void *arg);
+#endif
+int            mg_websocket_channel_subscribe (MGWEB *pweb); /* CMT79 */
+int            mg_websocket_channel_unsubscribe (MGWEB *pweb);
+int            mg_websocket_channel_unlist   (MGWSCHANNEL *pchannel);
+int            mg_websocket_channel_snapshot (MGWSCHANNEL *pchannel, MGWEB ***ppsubs, int *psize);
+int            mg_websocket_channel_release  (MGWSCHANNEL *pchannel, MGWEB **psubs, int no_subs);
+int            mg_websocket_channel_publish  (MGWEB *pweb);
+int            mg_websocket_channel_close    (MGWSCHANNEL *pchannel);
+int            mg_websocket_channel_send     (MGWEB *pweb, unsigned char *data, int len);
+int            mg_websocket_channel_session  (MGWEB *pweb);
+int            mg_websocket_channel_abort    (MGWEB *pweb);
+DBX_THR_TYPE   mg_websocket_channel_read     (void *arg);
+int            mg_websocket_deflate_load     (void); /* CMT80 */
+int            mg_websocket_deflate_negotiate (MGWEB *pweb, char *offers);
+int            mg_websocket_deflate_init     (MGWSDEFLATE *pdeflate, int server_takeover, int client_takeover, int server_window_bits, int client_window_bits);
+int            mg_websocket_deflate_buffer   (unsigned char **pbuffer, size_t *pbuffer_size, size_t size, size_t used);
+int            mg_websocket_deflate          (MGWSDEFLATE *pdeflate, unsigned char *data, size_t size, unsigned char **pout, size_t *pout_size);
+int            mg_websocket_inflate          (MGWSDEFLATE *pdeflate, unsigned char *data, size_t size, mg_int64_t limit, unsigned char **pout, size_t *pout_size);
+int            mg_websocket_deflate_release  (MGWSDEFLATE *pdeflate, int inflate);
+int            mg_websocket_deflate_free     (MGWSDEFLATE *pdeflate);
+int            mg_websocket_valid_utf8       (unsigned char *data, size_t size);
+size_t         mg_websocket_write_message    (MGWEB *pweb, int type, unsigned char *buffer, size_t buffer_size);
 size_t         mg_websocket_create_header    (MGWEB *pweb, int type, unsigned char *header, mg_uint64_t payload_length);
 
 #ifdef __cplusplus
@@ -122,6 +122,9 @@ __try {
    if (!strcmp(script + (scriptlen - 8), "/status/")) {
       strcpy(op, "status");
    }
+   else if (scriptlen >= 9 && !strcmp(script + (scriptlen - 9), "/metrics/")) { /* CMT74 */
+      strcpy(op, "metrics");
+   }
    else if (!strcmp(script + (scriptlen - 11), "/conf/list/")) {
       strcpy(op, "conf");
       strcpy(subop, "list");
@@ -221,6 +224,9 @@ __try {
    if (!strcmp(op, "status")) {
       return mg_status(pweb, &adm, json);
    }
+   else if (!strcmp(op, "metrics")) { /* CMT74 */
+      return mg_metrics(pweb, &adm, 0);
+   }
    else if (!strcmp(op, "conf")) {
       adm.filename = mg_system.config_file;
       return mg_get_file(pweb, &adm, 0);
@@ -311,12 +317,13 @@ __except (EXCEPTION_EXECUTE_HANDLER) {
 int mg_status(MGWEB *pweb, MGADM *padm, int context)
 {
    DBX_TRACE_INIT(0)
-   int n, sn, json;
+   int n, sn, json, ws_relay_threads, sse_relay_threads, sb_processes;
    unsigned long no_requests, no_connections;
    char buffer[256], info[256];
    MGPATH *ppath;
    MGSRV *psrv;
    DBXCON *pcon;
+   MGSBGAUGE sb_total;
    time_t time_now;
 
 #ifdef _WIN32
@@ -364,11 +371,58 @@ __try {
    if (mg_system.log.log_tls == 2)
       strcat(buffer, "S");
    if (json)
-      strcat(buffer, "\"\r\n},\r\n\"locations\": [\r\n");
+      strcat(buffer, "\",\r\n");
    else
       strcat(buffer, "\r\n");
    mg_status_add(pweb, padm, buffer, 0, 0);
 
+   /* CMT62 asynchronous log writer (this worker process) */
+   if (json)
+      sprintf(buffer, "   \"log_buffer_size\": %lu,\r\n   \"log_messages_buffered\": %lu,\r\n   \"log_messages_dropped\": %lu,\r\n", mg_system.logbuf.size, mg_system.logbuf.no_written, mg_system.logbuf.no_dropped);
+   else
+      sprintf(buffer, "   Log-Buffer-Size: %lu\r\n   Log-Messages-Buffered: %lu\r\n   Log-Messages-Dropped: %lu\r\n", mg_system.logbuf.size, mg_system.logbuf.no_written, mg_system.logbuf.no_dropped);
+   mg_status_add(pweb, padm, buffer, 0, 0);
+
+   /* CMT77 WebSocket relay (this worker process) */
+   ws_relay_threads = 0;
+#if defined(MG_WS_RELAY)
+   if (mg_system.pwsrelay) {
+      ws_relay_threads = mg_system.pwsrelay->threads;
+   }
+#endif
+   if (json)
+      sprintf(buffer, "   \"websocket_relay_threads\": %d,\r\n   \"websocket_relay_sockets\": %d,\r\n", ws_relay_threads, mg_system.ws_relay_sockets);
+   else
+      sprintf(buffer, "   WebSocket-Relay-Threads: %d\r\n   WebSocket-Relay-Sockets: %d\r\n", ws_relay_threads, mg_system.ws_relay_sockets);
+   mg_status_add(pweb, padm, buffer, 0, 0);
+
+   /* CMT78 SSE relay (this worker process) */
+   sse_relay_threads = 0;
+#if defined(MG_SSE_RELAY)
+   if (mg_system.psserelay) {
+      sse_relay_threads = mg_system.psserelay->threads;
+   }
+#endif
+   if (json)
+      sprintf(buffer, "   \"sse_relay_threads\": %d,\r\n   \"sse_relay_streams\": %d,\r\n", sse_relay_threads, mg_system.sse_relay_streams);
+   else
+      sprintf(buffer, "   SSE-Relay-Threads: %d\r\n   SSE-Relay-Streams: %d\r\n", sse_relay_threads, mg_system.sse_relay_streams);
+   mg_status_add(pweb, padm, buffer, 0, 0);
+
+   /* CMT79 WebSocket channels (this worker process) */
+   if (json)
+      sprintf(buffer, "   \"websocket_channels\": %d,\r\n   \"websocket_channel_subscribers\": %d,\r\n", mg_system.ws_channels, mg_system.ws_channel_subscribers);
+   else
+      sprintf(buffer, "   WebSocket-Channels: %d\r\n   WebSocket-Channel-Subscribers: %d\r\n", mg_system.ws_channels, mg_system.ws_channel_subscribers);
+   mg_status_add(pweb, padm, buffer, 0, 0);
+
+   /* CMT63 request memory pool (this worker process) */
+   if (json)
+      sprintf(buffer, "   \"buffer_pool_size\": %lu,\r\n   \"buffer_pool_retained\": %lu,\r\n   \"buffer_pool_hits\": %lu,\r\n   \"buffer_pool_misses\": %lu\r\n},\r\n\"locations\": [\r\n", mg_system.mbpool.retain_max, mg_system.mbpool.retained, mg_system.mbpool.no_hits, mg_system.mbpool.no_misses);
+   else
+      sprintf(buffer, "   Buffer-Pool-Size: %lu\r\n   Buffer-Pool-Retained: %lu\r\n   Buffer-Pool-Hits: %lu\r\n   Buffer-Pool-Misses: %lu\r\n", mg_system.mbpool.retain_max, mg_system.mbpool.retained, mg_system.mbpool.no_hits, mg_system.mbpool.no_misses);
+   mg_status_add(pweb, padm, buffer, 0, 0);
+
    sn = 0;
    ppath = mg_path;
    while (ppath) {
@@ -406,6 +460,11 @@ __try {
                strcat(buffer, "],\r\n");
                mg_status_add(pweb, padm, buffer, 0, 0);
             }
+            if (ppath->prcache) { /* CMT71 */
+               sprintf(buffer, "      \"response_cache\": {\"size_max\": %lu, \"size\": %lu, \"entries\": %lu, \"hits\": %lu, \"hits_stale\": %lu, \"misses\": %lu, \"stores\": %lu, \"evictions\": %lu},\r\n",
+                        ppath->prcache->size_max, ppath->prcache->size, ppath->prcache->no_entries, ppath->prcache->no_hits, ppath->prcache->no_hits_stale, ppath->prcache->no_misses, ppath->prcache->no_stores, ppath->prcache->no_evictions);
+               mg_status_add(pweb, padm, buffer, 0, 0);
+            }
             strcpy(buffer, "      \"servers\": [\r\n");
             mg_status_add(pweb, padm, buffer, 0, 0);
             for (n = 0; ppath->servers[n].name; n ++) {
@@ -430,6 +489,11 @@ __try {
                mg_status_add(pweb, padm, buffer, 0, 0);
                mg_status_add(pweb, padm, "\r\n", 2, 0);
             }
+            if (ppath->prcache) { /* CMT71 */
+               sprintf(buffer, "   Response-Cache: Size=%lu/%lu; Entries=%lu; Hits=%lu; Stale-Hits=%lu; Misses=%lu; Stores=%lu; Evictions=%lu;\r\n",
+                        ppath->prcache->size, ppath->prcache->size_max, ppath->prcache->no_entries, ppath->prcache->no_hits, ppath->prcache->no_hits_stale, ppath->prcache->no_misses, ppath->prcache->no_stores, ppath->prcache->no_evictions);
+               mg_status_add(pweb, padm, buffer, 0, 0);
+            }
             for (n = 0; ppath->servers[n].name; n ++) {
                sprintf(buffer, "   Server-%d: %s%s%s\r\n", n, ppath->servers[n].name, ppath->servers[n].exclusive ? " Exclusive" : "", ppath->servers[n].psrv->offline ? " Offline" : "");
                mg_status_add(pweb, padm, buffer, 0, 0);
@@ -496,6 +560,13 @@ __try {
       no_connections = 0;
       no_requests = 0;
 
+      if (psrv->psb) { /* CMT73 */
+         mg_sb_publish(psrv, 0);
+         mg_enter_critical_section((void *) &mg_global_mutex);
+         mg_sb_get_offline(psrv);
+         mg_leave_critical_section((void *) &mg_global_mutex);
+      }
+
       if (psrv->offline == 1 && psrv->time_offline && psrv->health_check > 0) { /* check to see if offline server is ready for a heath-check */
          if ((int) difftime(time_now, psrv->time_offline) > psrv->health_check) {
             mg_server_online(pweb, psrv, info, 10);
@@ -523,6 +594,23 @@ __try {
             sprintf(buffer, "            \"status\": \"unknown\",\r\n            \"no_connections\": %lu,\r\n            \"no_requests\": %lu,\r\n", no_connections, no_requests);
          }
          mg_status_add(pweb, padm, buffer, 0, 0);
+         /* CMT58 */
+         sprintf(buffer, "            \"connections_inuse\": %d,\r\n            \"queue_depth\": %d,\r\n            \"queue_no_requests\": %lu,\r\n", psrv->pool.no_inuse, psrv->pool.no_waiting, psrv->pool.no_queued);
+         mg_status_add(pweb, padm, buffer, 0, 0);
+         sprintf(buffer, "            \"multiplex\": %d,\r\n            \"multiplexed_requests\": %lu,\r\n", psrv->multiplex, psrv->pool.no_mux_requests); /* CMT72 */
+         mg_status_add(pweb, padm, buffer, 0, 0);
+         sprintf(buffer, "            \"queue_timeouts\": %lu,\r\n            \"queue_wait_average_ms\": %lu,\r\n            \"queue_wait_max_ms\": %lu,\r\n", psrv->pool.no_queue_timeouts, psrv->pool.no_queued ? (psrv->pool.wait_time_total / psrv->pool.no_queued) : 0, psrv->pool.wait_time_max);
+         mg_status_add(pweb, padm, buffer, 0, 0);
+         /* CMT66 */
+         sprintf(buffer, "            \"dns_addresses\": %d,\r\n            \"dns_lookups\": %lu,\r\n            \"dns_cache_hits\": %lu,\r\n            \"dns_failures\": %lu,\r\n", psrv->dns.no_addr, psrv->dns.no_lookups, psrv->dns.no_hits, psrv->dns.no_failures);
+         mg_status_add(pweb, padm, buffer, 0, 0);
+         if (psrv->psb) { /* CMT73 totals for all worker processes */
+            sb_processes = mg_sb_read(psrv, &sb_total); /* CMT82 */
+            sprintf(buffer, "            \"all_processes\": {\r\n               \"no_processes\": %d,\r\n               \"status\": \"%s\",\r\n               \"no_connections\": %ld,\r\n               \"connections_inuse\": %ld,\r\n", sb_processes, psrv->psb->offline ? "offline" : "online", sb_total.no_connections, sb_total.no_inuse);
+            mg_status_add(pweb, padm, buffer, 0, 0);
+            sprintf(buffer, "               \"queue_depth\": %ld,\r\n               \"no_requests\": %ld,\r\n               \"queue_no_requests\": %ld,\r\n               \"queue_timeouts\": %ld\r\n            },\r\n", sb_total.no_waiting, psrv->psb->no_requests, psrv->psb->no_queued, psrv->psb->no_queue_timeouts);
+            mg_status_add(pweb, padm, buffer, 0, 0);
+         }
          if (psrv->offline == 1) {
             if (psrv->time_offline) {
                if (psrv->health_check > 0)
@@ -549,6 +637,23 @@ __try {
             sprintf(buffer, "      Status: Unknown\r\n      No-Connections: %lu\r\n      No-Requests: %lu\r\n", no_connections, no_requests);
          }
          mg_status_add(pweb, padm, buffer, 0, 0);
+         /* CMT58 */
+         sprintf(buffer, "      Connections-In-Use: %d\r\n      Queue-Depth: %d\r\n      Queue-No-Requests: %lu\r\n", psrv->pool.no_inuse, psrv->pool.no_waiting, psrv->pool.no_queued);
+         mg_status_add(pweb, padm, buffer, 0, 0);
+         sprintf(buffer, "      Multiplex: %d\r\n      Multiplexed-Requests: %lu\r\n", psrv->multiplex, psrv->pool.no_mux_requests); /* CMT72 */
+         mg_status_add(pweb, padm, buffer, 0, 0);
+         sprintf(buffer, "      Queue-Timeouts: %lu\r\n      Queue-Wait-Average-Ms: %lu\r\n      Queue-Wait-Max-Ms: %lu\r\n", psrv->pool.no_queue_timeouts, psrv->pool.no_queued ? (psrv->pool.wait_time_total / psrv->pool.no_queued) : 0, psrv->pool.wait_time_max);
+         mg_status_add(pweb, padm, buffer, 0, 0);
+         /* CMT66 */
+         sprintf(buffer, "      DNS-Addresses: %d\r\n      DNS-Lookups: %lu\r\n      DNS-Cache-Hits: %lu\r\n      DNS-Failures: %lu\r\n", psrv->dns.no_addr, psrv->dns.no_lookups, psrv->dns.no_hits, psrv->dns.no_failures);
+         mg_status_add(pweb, padm, buffer, 0, 0);
+         if (psrv->psb) { /* CMT73 totals for all worker processes */
+            sb_processes = mg_sb_read(psrv, &sb_total); /* CMT82 */
+            sprintf(buffer, "      All-Processes: %d\r\n      All-Status: %s\r\n      All-No-Connections: %ld\r\n      All-Connections-In-Use: %ld\r\n", sb_processes, psrv->psb->offline ? "Offline" : "Online", sb_total.no_connections, sb_total.no_inuse);
+            mg_status_add(pweb, padm, buffer, 0, 0);
+            sprintf(buffer, "      All-Queue-Depth: %ld\r\n      All-No-Requests: %ld\r\n      All-Queue-No-Requests: %ld\r\n      All-Queue-Timeouts: %ld\r\n", sb_total.no_waiting, psrv->psb->no_requests, psrv->psb->no_queued, psrv->psb->no_queue_timeouts);
+            mg_status_add(pweb, padm, buffer, 0, 0);
+         }
 
          if (psrv->offline == 1) {
             if (psrv->time_offline) {
@@ -605,6 +710,238 @@ __except (EXCEPTION_EXECUTE_HANDLER) {
 #endif
 }
 
+/* CMT74 metrics in the Prometheus text exposition format */
+/* CMT82 every series carries the process_id label: each worker process reports its own figures, and without it the series of different processes would collide */
+
+static int mg_metrics_label(char *label, char *name, char *value)
+{
+   int n;
+   char *p;
+
+   n = sprintf(label, "%s=\"", name);
+   for (p = value ? value : ""; *p && n < 120; p ++) {
+      if (*p == '\\' || *p == '"') {
+         label[n ++] = '\\';
+         label[n ++] = *p;
+      }
+      else if (*p == '\n') {
+         label[n ++] = '\\';
+         label[n ++] = 'n';
+      }
+      else {
+         label[n ++] = *p;
+      }
+   }
+   label[n ++] = '"';
+   n += sprintf(label + n, ",process_id=\"%lu\"", mg_current_process_id());
+   return n;
+}
+
+
+static int mg_metrics_family(MGWEB *pweb, MGADM *padm, char *name, char *type, char *help)
+{
+   char buffer[256];
+
+   sprintf(buffer, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+   mg_status_add(pweb, padm, buffer, 0, 0);
+   return 0;
+}
+
+
+static int mg_metrics_histogram(MGWEB *pweb, MGADM *padm, char *name, char *label, MGMSTRIPE *ptotal, int hist)
+{
+   int n;
+   char buffer[512];
+
+   for (n = 0; n < MG_METRICS_BUCKETS; n ++) {
+      if (n < (MG_METRICS_BUCKETS - 1))
+         sprintf(buffer, "%s_bucket{%s,le=\"%g\"} %lld\n", name, label, (double) mg_metrics_bounds[n] / 1000000.0, ptotal->hist_bucket[hist][n]);
+      else
+         sprintf(buffer, "%s_bucket{%s,le=\"+Inf\"} %lld\n", name, label, ptotal->hist_bucket[hist][n]);
+      mg_status_add(pweb, padm, buffer, 0, 0);
+   }
+   sprintf(buffer, "%s_sum{%s} %.6f\n%s_count{%s} %lld\n", name, label, (double) ptotal->hist_sum[hist] / 1000000.0, name, label, ptotal->hist_count[hist]);
+   mg_status_add(pweb, padm, buffer, 0, 0);
+   return 0;
+}
+
+
+int mg_metrics(MGWEB *pweb, MGADM *padm, int context)
+{
+   DBX_TRACE_INIT(0)
+   int n;
+   char buffer[512], label[160];
+   MGPATH *ppath;
+   MGSRV *psrv;
+   MGMSTRIPE total;
+   MGSBGAUGE sb_total;
+   static char *srv_counter[][3] = {
+      {"mg_web_server_requests_total", "counter", "Requests sent (or that failed to be sent) to the DB Server."},
+      {"mg_web_server_errors_total", "counter", "Requests for which mg_web returned an error (5xx) response."},
+      {"mg_web_server_failovers_total", "counter", "Requests moved to another DB Server after this one failed."},
+      {"mg_web_server_requests_in_flight", "gauge", "Requests currently being served by the DB Server."},
+      {"mg_web_server_up", "gauge", "Whether the DB Server is online (1) or offline (0)."},
+      {"mg_web_server_connections", "gauge", "Connections to the DB Server."},
+      {"mg_web_server_connections_in_use", "gauge", "Connections to the DB Server currently in use."},
+      {"mg_web_server_connections_max", "gauge", "The DB Server's max_connections setting (0 for no limit)."},
+      {"mg_web_server_queue_depth", "gauge", "Requests waiting for a connection to the DB Server."},
+      {"mg_web_server_queued_requests_total", "counter", "Requests that had to wait for a connection to the DB Server."},
+      {"mg_web_server_queue_timeouts_total", "counter", "Requests that gave up waiting for a connection to the DB Server."},
+      {"mg_web_server_queue_wait_seconds_total", "counter", "Total time spent waiting for a connection to the DB Server."},
+      {"mg_web_server_queue_wait_seconds_max", "gauge", "Longest time spent waiting for a connection to the DB Server."},
+      {NULL, NULL, NULL}};
+   static char *srv_hist[][3] = {
+      {"mg_web_server_connect_seconds", "histogram", "Time taken to obtain a connection to the DB Server."},
+      {"mg_web_server_execute_seconds", "histogram", "Time from sending a request to the DB Server to receiving its response (the first part of a streamed response)."},
+      {"mg_web_server_request_seconds", "histogram", "Time taken to serve requests sent to the DB Server."},
+      {NULL, NULL, NULL}};
+
+#ifdef _WIN32
+__try {
+#endif
+
+   (void) context;
+   pweb->response_headers = (char *) pweb->output_val.svalue.buf_addr;
+   strcpy(pweb->response_headers, "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n");
+   pweb->response_headers_len = (int) strlen(pweb->response_headers);
+
+   pweb->response_content = (char *) pweb->output_val.svalue.buf_addr + (pweb->response_headers_len + 64);
+   padm->len_alloc = pweb->output_val.svalue.len_alloc - (pweb->response_headers_len + 64);
+   padm->buf_addr = pweb->response_content;
+   padm->len_used = 0;
+
+   /* each worker process reports its own figures */
+   mg_metrics_family(pweb, padm, "mg_web_info", "gauge", "mg_web version and the worker process that served this report.");
+   sprintf(buffer, "mg_web_info{version=\"%s.%s.%s\",process_id=\"%lu\"} 1\n", (char *) DBX_VERSION_MAJOR, (char *) DBX_VERSION_MINOR, (char *) DBX_VERSION_BUILD, mg_current_process_id());
+   mg_status_add(pweb, padm, buffer, 0, 0);
+   mg_metrics_family(pweb, padm, "mg_web_requests_total", "counter", "Requests received by the worker process.");
+   sprintf(buffer, "mg_web_requests_total{process_id=\"%lu\"} %lu\n", mg_current_process_id(), mg_system.requestno);
+   mg_status_add(pweb, padm, buffer, 0, 0);
+
+   for (n = 0; srv_counter[n][0]; n ++) {
+      mg_metrics_family(pweb, padm, srv_counter[n][0], srv_counter[n][1], srv_counter[n][2]);
+      for (psrv = mg_server; psrv; psrv = psrv->pnext) {
+         mg_metrics_label(label, "server", psrv->name);
+         mg_metrics_collect(psrv->pmetrics, &total);
+         switch (n) {
+            case 0: sprintf(buffer, "%s{%s} %lld\n", srv_counter[n][0], label, total.no_requests); break;
+            case 1: sprintf(buffer, "%s{%s} %lld\n", srv_counter[n][0], label, total.no_errors); break;
+            case 2: sprintf(buffer, "%s{%s} %lld\n", srv_counter[n][0], label, total.no_failovers); break;
+            case 3: sprintf(buffer, "%s{%s} %lld\n", srv_counter[n][0], label, total.no_inflight); break;
+            case 4: sprintf(buffer, "%s{%s} %d\n", srv_counter[n][0], label, psrv->offline ? 0 : 1); break;
+            case 5: sprintf(buffer, "%s{%s} %d\n", srv_counter[n][0], label, psrv->pool.no_alloc); break;
+            case 6: sprintf(buffer, "%s{%s} %d\n", srv_counter[n][0], label, psrv->pool.no_inuse); break;
+            case 7: sprintf(buffer, "%s{%s} %d\n", srv_counter[n][0], label, psrv->max_connections); break;
+            case 8: sprintf(buffer, "%s{%s} %d\n", srv_counter[n][0], label, psrv->pool.no_waiting); break;
+            case 9: sprintf(buffer, "%s{%s} %lu\n", srv_counter[n][0], label, psrv->pool.no_queued); break;
+            case 10: sprintf(buffer, "%s{%s} %lu\n", srv_counter[n][0], label, psrv->pool.no_queue_timeouts); break;
+            case 11: sprintf(buffer, "%s{%s} %.3f\n", srv_counter[n][0], label, (double) psrv->pool.wait_time_total / 1000.0); break;
+            default: sprintf(buffer, "%s{%s} %.3f\n", srv_counter[n][0], label, (double) psrv->pool.wait_time_max / 1000.0); break;
+         }
+         mg_status_add(pweb, padm, buffer, 0, 0);
+      }
+   }
+   for (n = 0; srv_hist[n][0]; n ++) {
+      mg_metrics_family(pweb, padm, srv_hist[n][0], srv_hist[n][1], srv_hist[n][2]);
+      for (psrv = mg_server; psrv; psrv = psrv->pnext) {
+         mg_metrics_label(label, "server", psrv->name);
+         mg_metrics_collect(psrv->pmetrics, &total);
+         mg_metrics_histogram(pweb, padm, srv_hist[n][0], label, &total, n);
+      }
+   }
+
+   if (mg_system.psb) { /* CMT73 totals for all worker processes */
+      mg_metrics_family(pweb, padm, "mg_web_all_server_connections", "gauge", "Connections to the DB Server from all worker processes.");
+      for (psrv = mg_server; psrv; psrv = psrv->pnext) {
+         if (psrv->psb) {
+            mg_sb_read(psrv, &sb_total); /* CMT82 */
+            mg_metrics_label(label, "server", psrv->name);
+            sprintf(buffer, "mg_web_all_server_connections{%s} %ld\n", label, sb_total.no_connections);
+            mg_status_add(pweb, padm, buffer, 0, 0);
+         }
+      }
+      mg_metrics_family(pweb, padm, "mg_web_all_server_connections_in_use", "gauge", "Connections to the DB Server in use by all worker processes.");
+      for (psrv = mg_server; psrv; psrv = psrv->pnext) {
+         if (psrv->psb) {
+            mg_sb_read(psrv, &sb_total); /* CMT82 */
+            mg_metrics_label(label, "server", psrv->name);
+            sprintf(buffer, "mg_web_all_server_connections_in_use{%s} %ld\n", label, sb_total.no_inuse);
+            mg_status_add(pweb, padm, buffer, 0, 0);
+         }
+      }
+      mg_metrics_family(pweb, padm, "mg_web_all_server_queue_depth", "gauge", "Requests waiting for a connection to the DB Server in all worker processes.");
+      for (psrv = mg_server; psrv; psrv = psrv->pnext) {
+         if (psrv->psb) {
+            mg_sb_read(psrv, &sb_total); /* CMT82 */
+            mg_metrics_label(label, "server", psrv->name);
+            sprintf(buffer, "mg_web_all_server_queue_depth{%s} %ld\n", label, sb_total.no_waiting);
+            mg_status_add(pweb, padm, buffer, 0, 0);
+         }
+      }
+   }
+
+   mg_metrics_family(pweb, padm, "mg_web_location_requests_total", "counter", "Requests served for the location.");
+   for (ppath = mg_path; ppath; ppath = ppath->pnext) {
+      if (ppath->pmetrics) {
+         mg_metrics_label(label, "location", ppath->name);
+         mg_metrics_collect(ppath->pmetrics, &total);
+         sprintf(buffer, "mg_web_location_requests_total{%s} %lld\n", label, total.no_requests);
+         mg_status_add(pweb, padm, buffer, 0, 0);
+      }
+   }
+   mg_metrics_family(pweb, padm, "mg_web_location_errors_total", "counter", "Requests for the location for which mg_web returned an error (5xx) response.");
+   for (ppath = mg_path; ppath; ppath = ppath->pnext) {
+      if (ppath->pmetrics) {
+         mg_metrics_label(label, "location", ppath->name);
+         mg_metrics_collect(ppath->pmetrics, &total);
+         sprintf(buffer, "mg_web_location_errors_total{%s} %lld\n", label, total.no_errors);
+         mg_status_add(pweb, padm, buffer, 0, 0);
+      }
+   }
+   mg_metrics_family(pweb, padm, "mg_web_location_requests_in_flight", "gauge", "Requests for the location currently being served.");
+   for (ppath = mg_path; ppath; ppath = ppath->pnext) {
+      if (ppath->pmetrics) {
+         mg_metrics_label(label, "location", ppath->name);
+         mg_metrics_collect(ppath->pmetrics, &total);
+         sprintf(buffer, "mg_web_location_requests_in_flight{%s} %lld\n", label, total.no_inflight);
+         mg_status_add(pweb, padm, buffer, 0, 0);
+      }
+   }
+   mg_metrics_family(pweb, padm, "mg_web_location_request_seconds", "histogram", "Time taken to serve requests for the location (excluding WebSockets and Server-Sent Events).");
+   for (ppath = mg_path; ppath; ppath = ppath->pnext) {
+      if (ppath->pmetrics) {
+         mg_metrics_label(label, "location", ppath->name);
+         mg_metrics_collect(ppath->pmetrics, &total);
+         mg_metrics_histogram(pweb, padm, "mg_web_location_request_seconds", label, &total, MG_METRICS_TOTAL);
+      }
+   }
+
+   mg_status_add(pweb, padm, "", 0, 0); /* terminate response */
+
+   return CACHE_SUCCESS;
+
+#ifdef _WIN32
+}
+__except (EXCEPTION_EXECUTE_HANDLER) {
+
+   DWORD code;
+   char bufferx[256];
+
+   __try {
+      code = GetExceptionCode();
+      sprintf_s(bufferx, 255, "Exception caught in f:mg_metrics: %x:%d", code, DBX_TRACE_VAR);
+      mg_log_event(pweb->plog, pweb, bufferx, "Error Condition", 0);
+   }
+   __except (EXCEPTION_EXECUTE_HANDLER) {
+      ;
+   }
+
+   return 0;
+}
+#endif
+}
+
+
 int mg_get_file(MGWEB *pweb, MGADM *padm, int context)
 {
    DBX_TRACE_INIT(0)
@@ -40,6 +40,7 @@ typedef struct tagMGADM {
 
 int mg_admin      (MGWEB *pweb);
 int mg_status     (MGWEB *pweb, MGADM *padm, int context);
+int mg_metrics    (MGWEB *pweb, MGADM *padm, int context);
 int mg_get_file   (MGWEB *pweb, MGADM *padm, int context);
 int mg_status_add (MGWEB *pweb, MGADM *padm, char *data, int data_len, int context);
 int mg_get_value  (char *json, char *name, char *value);
@@ -31,6 +31,8 @@
 
 /* Set this symbol to 1 to include TLS functionality */
 #define DBX_WITH_TLS             0
+/* Set this symbol to 1 to include WebSocket compression (permessage-deflate): zlib is loaded at run time */
+#define DBX_WITH_ZLIB            0
 #if defined(_WIN32)
 /* Set this symbol to 1 to allocate memory from a private heap */
 #define MG_PRIVATE_HEAP          1
@@ -38,19 +40,19 @@
 
 #define MAJORVERSION             2
 #define MINORVERSION             8
-#define MAINTVERSION             43
+#define MAINTVERSION             44
 #define BUILDNUMBER              0
 
 #define DBX_VERSION_MAJOR        "2"
 #define DBX_VERSION_MINOR        "8"
-#define DBX_VERSION_BUILD        "43g"
+#define DBX_VERSION_BUILD        "44y"
 
 #define DBX_VERSION              DBX_VERSION_MAJOR "." DBX_VERSION_MINOR "." DBX_VERSION_BUILD
 #define DBX_COMPANYNAME          "MGateway Ltd\0"
 #define DBX_FILEDESCRIPTION      "HTTP Gateway for InterSystems IRIS/Cache and YottaDB\0"
 #define DBX_FILEVERSION          DBX_VERSION
 #define DBX_INTERNALNAME         "mg_web_iis\0"
-#define DBX_LEGALCOPYRIGHT       "Copyright 2017-2025, MGateway Ltd\0"
+#define DBX_LEGALCOPYRIGHT       "Copyright 2017-2026, MGateway Ltd\0"
 #define DBX_ORIGINALFILENAME     "mg_web_iis\0"
 #define DBX_PLATFORM             PROCESSOR_ARCHITECTURE
 #define DBX_PRODUCTNAME          "mg_web_iis\0"
@@ -36,22 +36,20 @@ static DBXCRYPTSO *  mg_crypt_so       = NULL;
 static DBXTLSSO *    mg_tls_so         = NULL;
 
 
-int mgtls_open_session(MGWEB *pweb)
+/* CMT60 create the SSL_CTX for a TLS configuration: it is created once and shared by all connections that use the configuration */
+int mgtls_create_context(MGWEB *pweb)
 {
    int rc;
-   char *subject, *issuer;
    char message_buffer[4096];
    SSL_CTX *ctx;
-   SSL *ssl;
-   X509 *server_cert;
    SSL_METHOD *method;
-   DBXTLSCON *ptlscon;
 
 #ifdef _WIN32
 __try {
 #endif
 
    rc = CACHE_SUCCESS;
+   ctx = NULL;
 
    if (pweb->plog->log_tls > 0) {
       sprintf(message_buffer, "cipher_list=%s; cert_file=%s; key_file=%s; CA_file=%s; CApath=%s; Password=%s; VerifyPeer=%d; KeyType=%d;", pweb->psrv->ptls->cipher_list, pweb->psrv->ptls->cert_file, pweb->psrv->ptls->key_file, pweb->psrv->ptls->ca_file, pweb->psrv->ptls->ca_path, pweb->psrv->ptls->password, pweb->psrv->ptls->verify_peer, pweb->psrv->ptls->key_type);
@@ -71,7 +69,7 @@ __try {
          sprintf(message_buffer, "%d = SSL_library_init();", rc);
          mg_log_event(pweb->plog, pweb, message_buffer, "TLS: SSL_library_init: Error", 0);
          rc = CACHE_NOCON;
-         goto mgtls_open_session_exit;
+         goto mgtls_create_context_exit;
       }
    }
 
@@ -129,7 +127,7 @@ __try {
    if (method == NULL) {
       mg_log_event(pweb->plog, pweb, message_buffer, "TLS: TLSv*_client_method OR SSLv*_client_method: Error", 0);
       rc = CACHE_NOCON;
-      goto mgtls_open_session_exit;
+      goto mgtls_create_context_exit;
    }
 
    if (mg_tls_so->p_SSL_load_error_strings) {
@@ -151,7 +149,7 @@ __try {
       sprintf(message_buffer, "%p = SSL_CTX_new(%p);", ctx, method);
       mg_log_event(pweb->plog, pweb, message_buffer, "TLS: SSL_CTX_new: Error", 0);
       rc = CACHE_NOCON;
-      goto mgtls_open_session_exit;
+      goto mgtls_create_context_exit;
    }
 
 #if defined(SSL_CTRL_OPTIONS)
@@ -182,7 +180,7 @@ __try {
       sprintf(message_buffer, "%d = SSL_CTX_set_cipher_list(%p, %s);", rc, ctx, pweb->psrv->ptls->cipher_list);
       mg_log_event(pweb->plog, pweb, message_buffer, "TLS: SSL_CTX_set_cipher_list: Error", 0);
       rc = CACHE_NOCON;
-      goto mgtls_open_session_exit;
+      goto mgtls_create_context_exit;
    }
 
    if (pweb->psrv->ptls->cert_file && pweb->psrv->ptls->cert_file[0]) {
@@ -198,7 +196,7 @@ __try {
          mg_log_event(pweb->plog, pweb, message_buffer, "TLS: SSL_CTX_use_certificate_file: Error", 0);
          mgtls_log_error(pweb);
          rc = CACHE_NOCON;
-         goto mgtls_open_session_exit;
+         goto mgtls_create_context_exit;
       }
 
       if (pweb->psrv->ptls->password && pweb->psrv->ptls->password[0]) {
@@ -222,7 +220,7 @@ __try {
             mg_log_event(pweb->plog, pweb, message_buffer, "TLS: SSL_CTX_use_RSAPrivateKey_file: Error", 0);
             mgtls_log_error(pweb);
             rc = CACHE_NOCON;
-            goto mgtls_open_session_exit;
+            goto mgtls_create_context_exit;
          }
 
       }
@@ -239,13 +237,13 @@ __try {
                mg_log_event(pweb->plog, pweb, message_buffer, "TLS: SSL_CTX_use_PrivateKey_file: Error", 0);
                mgtls_log_error(pweb);
                rc = CACHE_NOCON;
-               goto mgtls_open_session_exit;
+               goto mgtls_create_context_exit;
             }
          }
          else {
             mg_log_event(pweb->plog, pweb, "Certificate key file not specified in the configuration", "TLS: SSL_CTX_use_PrivateKey_file: Error", 0);
             rc = CACHE_NOCON;
-            goto mgtls_open_session_exit;
+            goto mgtls_create_context_exit;
          }
       }
 
@@ -260,7 +258,7 @@ __try {
          mg_log_event(pweb->plog, pweb, message_buffer, "TLS: SSL_CTX_check_private_key: Error", 0);
          mgtls_log_error(pweb);
          rc = CACHE_NOCON;
-         goto mgtls_open_session_exit;
+         goto mgtls_create_context_exit;
       }
 
       if (pweb->psrv->ptls->verify_peer == 1) {
@@ -284,9 +282,87 @@ __try {
          mg_log_event(pweb->plog, pweb, "Unable to verify locations for client authentication.  Details to follow ...", "TLS: SSL_CTX_load_verify_locations: Error", 0);
          mgtls_log_error(pweb);
          rc = CACHE_NOCON;
+         goto mgtls_create_context_exit;
+      }
+   }
+
+   /* CMT60 cache client sessions so that they can be offered for resumption on subsequent connections */
+#if defined(SSL_CTRL_SET_SESS_CACHE_MODE)
+   if (mg_tls_so->p_SSL_CTX_ctrl && mg_tls_so->p_SSL_get1_session && mg_tls_so->p_SSL_set_session && mg_tls_so->p_SSL_SESSION_free) {
+      mg_tls_so->p_SSL_CTX_ctrl(ctx, SSL_CTRL_SET_SESS_CACHE_MODE, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE, NULL);
+   }
+#endif
+
+   rc = CACHE_SUCCESS;
+
+mgtls_create_context_exit:
+
+   if (pweb->plog->log_tls > 0) {
+      sprintf(message_buffer, "result=%d; ctx=%p;", rc, ctx);
+      mg_log_event(pweb->plog, pweb, message_buffer, "TLS: mgtls_create_context", 0);
+   }
+
+   if (rc == CACHE_SUCCESS) {
+      pweb->psrv->ptls->pctx = (void *) ctx;
+   }
+   else if (ctx) {
+      mg_tls_so->p_SSL_CTX_free(ctx);
+   }
+
+   return rc;
+
+#ifdef _WIN32
+}
+__except (EXCEPTION_EXECUTE_HANDLER) {
+   DWORD code;
+   char buffer[256];
+
+   __try {
+      code = GetExceptionCode();
+      sprintf(buffer, "Exception caught in f:mgtls_create_context: %x", code);
+      mg_log_event(pweb->plog, pweb, buffer, "Error Condition", 0);
+   }
+   __except (EXCEPTION_EXECUTE_HANDLER ) {
+      ;
+   }
+
+   return CACHE_NOCON;
+}
+#endif
+
+}
+
+
+int mgtls_open_session(MGWEB *pweb)
+{
+   int rc;
+   char *subject, *issuer;
+   char message_buffer[4096];
+   SSL_CTX *ctx;
+   SSL *ssl;
+   SSL_SESSION *session;
+   X509 *server_cert;
+   DBXTLSCON *ptlscon;
+
+#ifdef _WIN32
+__try {
+#endif
+
+   rc = CACHE_SUCCESS;
+   ssl = NULL;
+
+   /* CMT60 the SSL_CTX is created on first use and then shared */
+   if (!pweb->psrv->ptls->pctx) {
+      mg_enter_critical_section((void *) &mg_global_mutex);
+      if (!pweb->psrv->ptls->pctx) {
+         rc = mgtls_create_context(pweb);
+      }
+      mg_leave_critical_section((void *) &mg_global_mutex);
+      if (rc != CACHE_SUCCESS) {
          goto mgtls_open_session_exit;
       }
    }
+   ctx = (SSL_CTX *) pweb->psrv->ptls->pctx;
 
    ssl = mg_tls_so->p_SSL_new(ctx);
 
@@ -308,6 +384,20 @@ __try {
       mg_log_event(pweb->plog, pweb, message_buffer, "TLS SSL_set_fd", 0);
    }
 
+   /* CMT60 offer the last session negotiated with this DB Server for resumption */
+   if (pweb->psrv->ptls_session && mg_tls_so->p_SSL_set_session) {
+      mg_enter_critical_section((void *) &mg_global_mutex);
+      if (pweb->psrv->ptls_session) {
+         rc = mg_tls_so->p_SSL_set_session(ssl, (SSL_SESSION *) pweb->psrv->ptls_session);
+      }
+      mg_leave_critical_section((void *) &mg_global_mutex);
+
+      if (pweb->plog->log_tls > 0) {
+         sprintf(message_buffer, "%d = SSL_set_session(%p, %p);", rc, ssl, pweb->psrv->ptls_session);
+         mg_log_event(pweb->plog, pweb, message_buffer, "TLS SSL_set_session", 0);
+      }
+   }
+
    rc = mg_tls_so->p_SSL_connect(ssl);
 
    if (pweb->plog->log_tls > 0) {
@@ -321,7 +411,25 @@ __try {
       rc = CACHE_NOCON;
       goto mgtls_open_session_exit;
    }
- 
+
+   if (mg_tls_so->p_SSL_session_reused && pweb->plog->log_tls > 0) {
+      sprintf(message_buffer, "%d = SSL_session_reused(%p);", mg_tls_so->p_SSL_session_reused(ssl), ssl);
+      mg_log_event(pweb->plog, pweb, message_buffer, "TLS SSL_session_reused", 0);
+   }
+
+   /* CMT60 keep the negotiated session for the next connection to this DB Server */
+   if (mg_tls_so->p_SSL_get1_session && mg_tls_so->p_SSL_SESSION_free) {
+      session = mg_tls_so->p_SSL_get1_session(ssl);
+      if (session) {
+         mg_enter_critical_section((void *) &mg_global_mutex);
+         if (pweb->psrv->ptls_session) {
+            mg_tls_so->p_SSL_SESSION_free((SSL_SESSION *) pweb->psrv->ptls_session);
+         }
+         pweb->psrv->ptls_session = (void *) session;
+         mg_leave_critical_section((void *) &mg_global_mutex);
+      }
+   }
+
    server_cert = mg_tls_so->p_SSL_get_peer_certificate(ssl);
 
    if (pweb->plog->log_tls > 0) {
@@ -371,6 +479,9 @@ mgtls_open_session_exit:
       pweb->pcon->ptlscon = ptlscon;
    }
    else {
+      if (ssl) {
+         mg_tls_so->p_SSL_free(ssl);
+      }
       pweb->pcon->ptlscon = NULL;
    }
 
@@ -400,13 +511,36 @@ __except (EXCEPTION_EXECUTE_HANDLER) {
 
 int mgtls_close_session(MGWEB *pweb)
 {
+
+   SSL_SESSION *session;
    DBXTLSCON *ptlscon;
 
    ptlscon = (DBXTLSCON *) pweb->pcon->ptlscon;
 
+   /* CMT60 with TLS v1.3 the resumable session (ticket) may only arrive after the handshake so capture it again here */
+   if (mg_tls_so->p_SSL_get1_session && mg_tls_so->p_SSL_SESSION_free && mg_tls_so->p_SSL_SESSION_is_resumable) {
+      session = mg_tls_so->p_SSL_get1_session(ptlscon->ssl);
+      if (session) {
+         if (mg_tls_so->p_SSL_SESSION_is_resumable(session)) {
+            mg_enter_critical_section((void *) &mg_global_mutex);
+            if (pweb->psrv->ptls_session) {
+               mg_tls_so->p_SSL_SESSION_free((SSL_SESSION *) pweb->psrv->ptls_session);
+            }
+            pweb->psrv->ptls_session = (void *) session;
+            mg_leave_critical_section((void *) &mg_global_mutex);
+         }
+         else {
+            mg_tls_so->p_SSL_SESSION_free(session);
+         }
+      }
+   }
+
    mg_tls_so->p_SSL_free(ptlscon->ssl);
 
-   mg_tls_so->p_SSL_CTX_free(ptlscon->ctx);
+   /* CMT60 the SSL_CTX is shared by all connections using this TLS configuration so is not freed here */
+
+   mg_free(NULL, (void *) ptlscon, MG_MID_TLSCONNECTION);
+   pweb->pcon->ptlscon = NULL;
 
    return CACHE_SUCCESS;
 }
@@ -1187,6 +1321,18 @@ int mgtls_tls_load_library(MGWEB *pweb)
    strcpy(fun, "SSL_get_ex_data_X509_STORE_CTX_idx");
    p_tls_so->p_SSL_get_ex_data_X509_STORE_CTX_idx = (int (*) (void)) mg_dso_sym(p_tls_so->p_library, (char *) fun);
 
+   /* CMT60 optional: session resumption is disabled if these are not available */
+   strcpy(fun, "SSL_get1_session");
+   p_tls_so->p_SSL_get1_session = (SSL_SESSION * (*) (SSL *)) mg_dso_sym(p_tls_so->p_library, (char *) fun);
+   strcpy(fun, "SSL_set_session");
+   p_tls_so->p_SSL_set_session = (int (*) (SSL *, SSL_SESSION *)) mg_dso_sym(p_tls_so->p_library, (char *) fun);
+   strcpy(fun, "SSL_SESSION_free");
+   p_tls_so->p_SSL_SESSION_free = (void (*) (SSL_SESSION *)) mg_dso_sym(p_tls_so->p_library, (char *) fun);
+   strcpy(fun, "SSL_session_reused");
+   p_tls_so->p_SSL_session_reused = (int (*) (const SSL *)) mg_dso_sym(p_tls_so->p_library, (char *) fun);
+   strcpy(fun, "SSL_SESSION_is_resumable");
+   p_tls_so->p_SSL_SESSION_is_resumable = (int (*) (const SSL_SESSION *)) mg_dso_sym(p_tls_so->p_library, (char *) fun);
+
    p_tls_so->loaded = 1;
    mg_tls_so = p_tls_so;
 
@@ -1214,6 +1360,38 @@ int mgtls_tls_unload_library(void)
 }
 
 
+/* CMT60 free the shared SSL_CTX objects and cached client sessions */
+int mgtls_free_resources(void)
+{
+   MGTLS *ptls;
+   MGSRV *psrv;
+
+   if (!mg_tls_so || !mg_tls_so->loaded) {
+      return CACHE_SUCCESS;
+   }
+
+   psrv = mg_server;
+   while (psrv) {
+      if (psrv->ptls_session && mg_tls_so->p_SSL_SESSION_free) {
+         mg_tls_so->p_SSL_SESSION_free((SSL_SESSION *) psrv->ptls_session);
+      }
+      psrv->ptls_session = NULL;
+      psrv = psrv->pnext;
+   }
+
+   ptls = mg_tls;
+   while (ptls) {
+      if (ptls->pctx) {
+         mg_tls_so->p_SSL_CTX_free((SSL_CTX *) ptls->pctx);
+      }
+      ptls->pctx = NULL;
+      ptls = ptls->pnext;
+   }
+
+   return CACHE_SUCCESS;
+}
+
+
 #else /* #if DBX_WITH_TLS >= 1 */
 
 
@@ -1262,4 +1440,9 @@ int mgtls_tls_unload_library(void)
    return CACHE_FAILURE;
 }
 
+int mgtls_free_resources(void)
+{
+   return CACHE_SUCCESS;
+}
+
 #endif /* #if DBX_WITH_TLS >= 1 */
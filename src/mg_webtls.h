@@ -161,10 +161,18 @@ typedef struct tagDBXTLSSO {
    int               (* p_SSL_get_ex_new_index)                   (long argl, void *argp, CRYPTO_EX_new *new_func, CRYPTO_EX_dup *dup_func, CRYPTO_EX_free *free_func);
    int               (* p_SSL_get_ex_data_X509_STORE_CTX_idx)     (void );
 
+   /* CMT60 client session resumption (optional) */
+   SSL_SESSION *     (* p_SSL_get1_session)                       (SSL *ssl);
+   int               (* p_SSL_set_session)                        (SSL *ssl, SSL_SESSION *session);
+   void              (* p_SSL_SESSION_free)                       (SSL_SESSION *session);
+   int               (* p_SSL_session_reused)                     (const SSL *ssl);
+   int               (* p_SSL_SESSION_is_resumable)               (const SSL_SESSION *session);
+
 } DBXTLSSO, *PDBXTLSSO;
 
 #endif /* #if DBX_WITH_TLS >= 1 */
 
+int mgtls_create_context         (MGWEB *pweb);
 int mgtls_open_session           (MGWEB *pweb);
 int mgtls_close_session          (MGWEB *pweb);
 int mgtls_recv                   (MGWEB *pweb, unsigned char *buffer, int size);
@@ -174,5 +182,6 @@ int mgtls_crypt_load_library     (MGWEB *pweb);
 int mgtls_crypt_unload_library   (void);
 int mgtls_tls_load_library       (MGWEB *pweb);
 int mgtls_tls_unload_library     (void);
+int mgtls_free_resources         (void);
 
 #endif
@@ -53,6 +53,14 @@
 #define MG_DEFAULT_TIMEOUT    300000
 #define MG_RBUFFER_SIZE       1024
 
+/* CMT64 module-owned worker thread pool (UNIX) */
+#define MG_NGX_WORKER_THREADS_MAX      1024
+#define MG_NGX_WORKER_QUEUE_FACTOR     4     /* default queue size: threads * factor */
+#define MG_NGX_WORKER_STACK_SIZE       0x70000
+
+/* CMT65 streamed responses for requests processed by the worker thread pool */
+#define MG_NGX_STREAM_BUFFER_SIZE      65536 /* default size of each of the two output buffers */
+
 /*
 #define MG_API_TRACE          1
 */
@@ -72,6 +80,9 @@ typedef struct {
    char  mg_config_file[256];
    char  mg_log_file[256];
    char  mg_thread_pool[64];
+   int   mg_worker_threads; /* CMT64 */
+   int   mg_worker_queue_size; /* CMT64 */
+   int   mg_stream_buffer_size; /* CMT65 */
 } ngx_http_mg_web_main_conf_t;
 
 typedef struct {
@@ -89,6 +100,12 @@ typedef struct {
    char  mg_thread_pool[64];
 } ngx_http_mg_web_loc_conf_t;
 
+/* CMT82 memory allocated for a request while a worker pool thread has it: nginx pools are not thread safe so it comes from the heap and is freed with the request pool */
+typedef struct tagMGNGXMEM {
+   struct tagMGNGXMEM            *pnext;
+   ngx_uint_t                    align; /* keep the data that follows aligned */
+} MGNGXMEM, *LPMGNGXMEM;
+
 typedef struct tagMGWEBNGINX {
    ngx_http_request_t            *r;
    ngx_http_mg_web_main_conf_t   *mconf;
@@ -107,11 +124,53 @@ typedef struct tagMGWEBNGINX {
    ngx_str_t                     thread_pool;
    char                          mg_thread_pool[64];
    int                           async;
+   int                           pooled; /* CMT64 request is being processed by the worker thread pool */
+   int                           blocked; /* CMT82 r->main->blocked is held while a worker or relay thread has the request */
+   int                           header_pending; /* CMT64 */
+   char                          *header_data; /* CMT82 copy of the response headers to be applied in the event loop */
+   MGNGXMEM                      *pmem; /* CMT82 */
+   struct tagMGWEBNGINX          *pnext_task; /* CMT64 */
+   int                           stream_size; /* CMT65 response streamed through two output buffers of this size */
+   int                           stream_error;
+   int                           stream_queued;
+   int                           stream_index; /* buffer being filled by the worker thread */
+   int                           stream_fill;
+   int                           stream_send; /* next buffer to pass to the output filter */
+   int                           stream_state[2]; /* 0: free; 1: full; 2: passed to the output filter */
+   unsigned long                 stream_total;
+   u_char                        *stream_data[2];
+   ngx_buf_t                     *stream_buf[2];
+   ngx_chain_t                   *stream_chain[2];
+   struct tagMGWEBNGINX          *pnext_stream;
    DBXMUTEX                      wsmutex;
    MGWEB                         *pweb;
 } MGWEBNGINX, *LPWEBNGINX;
 
 
+/* CMT64 requests are queued for a fixed set of worker threads; completed requests are handed back to the nginx event loop through a pipe */
+#if !defined(_WIN32)
+typedef struct tagMGNGXTPOOL {
+   pthread_mutex_t               lock;
+   pthread_cond_t                cond;
+   pthread_cond_t                cond_stream; /* CMT65 signalled when stream buffers are released */
+   int                           status; /* 1: running; 2: stop requested; 0: not running */
+   int                           no_threads;
+   int                           no_threads_running;
+   pthread_t                     *threads; /* CMT82 joined by mg_tpool_stop() */
+   int                           queue_size;
+   int                           no_queued;
+   unsigned long                 no_rejected;
+   int                           notify_fd[2];
+   ngx_connection_t              *notify_conn;
+   MGWEBNGINX                    *pqueue_head;
+   MGWEBNGINX                    *pqueue_tail;
+   MGWEBNGINX                    *pdone;
+   int                           stream_size; /* CMT65 */
+   MGWEBNGINX                    *pstream;
+} MGNGXTPOOL, *LPMGNGXTPOOL;
+#endif
+
+
 typedef struct {
    MGWEBNGINX  *pwebnginx;
 } mg_thread_ctx;
@@ -125,11 +184,24 @@ typedef struct {
 static ngx_int_t     ngx_http_mg_web_handler    (ngx_http_request_t *r);
 static void          mg_payload_handler         (ngx_http_request_t *r);
 static int           mg_execute                 (ngx_http_request_t *r, MGWEBNGINX *pwebnginx);
+static int           mg_execute_finish          (ngx_http_request_t *r, MGWEBNGINX *pwebnginx);
+static int           mg_execute_busy            (ngx_http_request_t *r, MGWEBNGINX *pwebnginx);
 static int           mg_execute_launch_thread   (MGWEBNGINX *pwebnginx);
 #if defined(_WIN32)
 DWORD WINAPI         mg_execute_detached_thread (LPVOID pargs);
 #else
-void *               mg_execute_detached_thread (void *pargs);
+static int           mg_tpool_start             (ngx_cycle_t *cycle, int no_threads, int queue_size, int stream_size);
+static int           mg_tpool_stop              (void);
+static void *        mg_tpool_worker            (void *arg);
+static void          mg_tpool_completion        (ngx_event_t *ev);
+static int           mg_sse_complete            (MGWEB *pweb);
+static int           mg_stream_init             (ngx_http_request_t *r, MGWEBNGINX *pwebnginx);
+static int           mg_stream_write            (MGWEBNGINX *pwebnginx, unsigned char *pbuffer, int buffer_size);
+static int           mg_stream_post             (MGWEBNGINX *pwebnginx);
+static int           mg_stream_send             (ngx_http_request_t *r, MGWEBNGINX *pwebnginx);
+static void          mg_stream_write_handler    (ngx_http_request_t *r);
+static void *        mg_pooled_alloc            (MGWEBNGINX *pwebnginx, size_t size);
+static void          mg_pooled_free             (void *data);
 #endif
 #if defined(MG_NGX_THREADS)
 static void          mg_execute_pool            (void *data, ngx_log_t *log);
@@ -140,6 +212,8 @@ static char *        mg_param_mgwebfiletypes    (ngx_conf_t *cf, ngx_command_t *
 static char *        mg_param_mgwebconfigfile   (ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *        mg_param_mgweblogfile      (ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *        mg_param_mgwebthreadpool   (ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static char *        mg_param_mgwebworkerthreads(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static char *        mg_param_mgwebstreambuffersize(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static ngx_int_t     mg_pre_conf                (ngx_conf_t *cf);
 static ngx_int_t     mg_post_conf               (ngx_conf_t *cf);
 static void *        mg_create_main_conf        (ngx_conf_t *cf);
@@ -159,10 +233,20 @@ int                  mg_check_file_type         (char *mg_file_types_main, char
 void *               mg_malloc_nginx            (void *pweb_server, unsigned long size);
 void *               mg_remalloc_nginx          (void *pweb_server, void *p, unsigned long size);
 int                  mg_free_nginx              (void *pweb_server, void *p);
+static void *        mg_pcalloc_nginx           (MGWEBNGINX *pwebnginx, unsigned long size);
+static int           mg_client_write_error      (MGWEBNGINX *pwebnginx, char *error);
+static int           mg_apply_headers           (MGWEB *pweb, MGWEBNGINX *pwebnginx, char *headers);
+static ngx_int_t     mg_send_pending_header     (ngx_http_request_t *r, MGWEBNGINX *pwebnginx);
+static size_t        mg_websocket_send_frame    (MGWEB *pweb, unsigned char *header, size_t header_size, unsigned char *buffer, size_t buffer_size);
+static int           mg_websocket_writev        (MGWEB *pweb, unsigned char *header, size_t header_size, unsigned char *buffer, size_t buffer_size);
 int                  mg_websocket_accept_key    (MGWEB *pweb, char * sec_websocket_accept);
 
 
 
+#if !defined(_WIN32)
+static MGNGXTPOOL    mg_tpool; /* CMT64 */
+#endif
+
 #if defined(MG_API_TRACE)
 #if defined(_WIN32)
 static DBXLOG debug_log = {"c:/temp/mgweb.log", "", "", 0, 0, 0, 0, 0, 0, 0, 0, "", ""};
@@ -238,6 +322,22 @@ static ngx_command_t  ngx_http_mg_web_commands[] = {
       0,
       NULL
    },
+   {
+      ngx_string("MGWEBWorkerThreads"), /* CMT64 */
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE12,
+      mg_param_mgwebworkerthreads,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL
+   },
+   {
+      ngx_string("MGWEBStreamBufferSize"), /* CMT65 */
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      mg_param_mgwebstreambuffersize,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL
+   },
 };
 
 
@@ -437,6 +537,7 @@ static ngx_int_t ngx_http_mg_web_handler(ngx_http_request_t *r)
 
    /* v2.5.31 */
    pwebnginx->async = 0;
+   pwebnginx->blocked = 0;
    strcpy(pwebnginx->mg_thread_pool, dconf->mg_thread_pool);
    pwebnginx->thread_pool.data = (u_char *) pwebnginx->mg_thread_pool;
    pwebnginx->thread_pool.len = (size_t) strlen(pwebnginx->mg_thread_pool);
@@ -466,8 +567,23 @@ static ngx_int_t ngx_http_mg_web_handler(ngx_http_request_t *r)
    pweb->evented = 1;
    pweb->wserver_chunks_response = 1;
 
+   /* CMT78 SSE streams may be passed to the core's relay: the worker thread pool's notification pipe brings them back to finish */
+#if !defined(_WIN32)
+   if (mg_tpool.status == 1) {
+      pweb->sse_complete = mg_sse_complete;
+      pweb->sse_client_fd = (int) r->connection->fd;
+   }
+#endif
+
    rc = mg_web((MGWEB *) pweb);
 
+   /* CMT64 use the worker thread pool if it is running: SSE and WebSocket requests hold their connection open so are not queued */
+#if !defined(_WIN32)
+   if (mg_tpool.status == 1 && !pweb->sse && !pweb->pwsock) {
+      pwebnginx->async = 1;
+   }
+#endif
+
    /* v2.2.18 */
 /*
    mg_add_block_size((unsigned char *) pweb->input_buf.buf_addr + pweb->input_buf.len_used, (unsigned long) 0, (unsigned long) pweb->request_clen, DBX_DSORT_WEBCONTENT, DBX_DTYPE_STR);
@@ -726,14 +842,56 @@ static void mg_payload_handler(ngx_http_request_t *r)
 
 static int mg_execute(ngx_http_request_t *r, MGWEBNGINX *pwebnginx)
 {
-   int rc;
    MGWEB *pweb;
 
    pweb = pwebnginx->pweb;
    pwebnginx->output_last = NULL;
    pwebnginx->output_buf_last = NULL;
 
-   rc = mg_web_process(pweb);
+   mg_web_process(pweb);
+
+   if (pweb->sse_relayed) { /* CMT78 the request is finished by mg_sse_complete() */
+      r->main->blocked ++; /* CMT82 nginx must not free the request (or close the client connection) while the relay is writing to it */
+      pwebnginx->blocked = 1;
+      return 1;
+   }
+
+   mg_execute_finish(r, pwebnginx);
+
+   return 1;
+}
+
+
+/* CMT64 send the response: this must run in the nginx event loop */
+static int mg_execute_finish(ngx_http_request_t *r, MGWEBNGINX *pwebnginx)
+{
+   int rc;
+
+#if !defined(_WIN32)
+   if (pwebnginx->stream_size) { /* CMT65 send any full buffers, then add the partly filled one to the output */
+      rc = mg_stream_send(r, pwebnginx);
+      if (rc == NGX_ERROR) {
+         ngx_http_finalize_request(r, NGX_ERROR);
+         return 1;
+      }
+      if (pwebnginx->stream_fill > 0) {
+         pwebnginx->stream_buf[pwebnginx->stream_index]->pos = pwebnginx->stream_data[pwebnginx->stream_index];
+         pwebnginx->stream_buf[pwebnginx->stream_index]->last = pwebnginx->stream_data[pwebnginx->stream_index] + pwebnginx->stream_fill;
+         pwebnginx->stream_chain[pwebnginx->stream_index]->next = NULL;
+         pwebnginx->output_head = pwebnginx->stream_chain[pwebnginx->stream_index];
+         pwebnginx->output_buf_last = pwebnginx->stream_buf[pwebnginx->stream_index];
+         pwebnginx->stream_fill = 0;
+      }
+      else if (!pwebnginx->output_head && pwebnginx->stream_total > 0) {
+         ngx_http_finalize_request(r, ngx_http_send_special(r, NGX_HTTP_LAST));
+         return 1;
+      }
+   }
+#endif
+
+   if (pwebnginx->header_pending) {
+      mg_send_pending_header(r, pwebnginx);
+   }
 
    if (pwebnginx->output_head) {
       /* v2.5.31 */
@@ -754,6 +912,30 @@ static int mg_execute(ngx_http_request_t *r, MGWEBNGINX *pwebnginx)
 }
 
 
+/* CMT64 the worker thread pool queue is full: reply with 503 Service Unavailable (or the custom page for a busy DB Server) */
+static int mg_execute_busy(ngx_http_request_t *r, MGWEBNGINX *pwebnginx)
+{
+   MGWEB *pweb;
+
+   pweb = pwebnginx->pweb;
+
+   if (mg_system.custompage_dbserver_busy) {
+      pweb->response_headers = mg_web_response_headers_buffer(pweb, DBX_HEADER_SIZE, 7);
+      if (pweb->response_headers) {
+         mg_web_http_error(pweb, 503, MG_CUSTOMPAGE_DBSERVER_BUSY);
+         MG_LOG_RESPONSE_HEADER(pweb);
+         mg_submit_headers(pweb);
+         ngx_http_finalize_request(r, ngx_http_send_special(r, NGX_HTTP_LAST));
+         return 1;
+      }
+   }
+
+   ngx_http_finalize_request(r, NGX_HTTP_SERVICE_UNAVAILABLE);
+
+   return 1;
+}
+
+
 static int mg_execute_launch_thread(MGWEBNGINX *pwebnginx)
 {
 #if defined(_WIN32)
@@ -774,27 +956,56 @@ static int mg_execute_launch_thread(MGWEBNGINX *pwebnginx)
    }
    CloseHandle(thread_handle);
 #else
-   int rc = 0;
-   pthread_attr_t attr;
-   pthread_t child_thread;
-
-   size_t stacksize, newstacksize;
-
-   pthread_attr_init(&attr);
+   int no_queued;
+   unsigned long no_rejected;
+   char buffer[256];
+   ngx_pool_cleanup_t *cln;
 
-   stacksize = 0;
-   pthread_attr_getstacksize(&attr, &stacksize);
+   /* CMT82 free the memory allocated by the worker thread with the request */
+   cln = ngx_pool_cleanup_add(pwebnginx->r->pool, 0);
+   if (cln == NULL) {
+      mg_execute(pwebnginx->r, pwebnginx);
+      return 0;
+   }
+   cln->handler = mg_pooled_free;
+   cln->data = (void *) pwebnginx;
 
-   newstacksize = 0x40000; /* 262144 */
-   newstacksize = 0x70000; /* 458752 */
-   pthread_attr_setstacksize(&attr, newstacksize);
+   /* CMT64 queue the request for the worker thread pool rather than creating a thread for it */
+   pthread_mutex_lock(&(mg_tpool.lock));
+   if (mg_tpool.status != 1) {
+      pthread_mutex_unlock(&(mg_tpool.lock));
+      mg_execute(pwebnginx->r, pwebnginx);
+      return 0;
+   }
+   if (mg_tpool.no_queued >= mg_tpool.queue_size) {
+      mg_tpool.no_rejected ++;
+      no_rejected = mg_tpool.no_rejected;
+      no_queued = mg_tpool.no_queued;
+      pthread_mutex_unlock(&(mg_tpool.lock));
 
-   rc = pthread_create(&child_thread, &attr, mg_execute_detached_thread, (void *) pwebnginx);
-   if (rc) {
-      ngx_log_error(NGX_LOG_ERR, pwebnginx->r->connection->log, 0, "Failed to create thread.");
-      ngx_http_finalize_request(pwebnginx->r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+      sprintf(buffer, "Worker thread pool queue full (threads=%d; queued=%d); request rejected; total rejected: %lu", mg_tpool.no_threads, no_queued, no_rejected);
+      mg_log_event(&(mg_system.log), pwebnginx->pweb, buffer, "mg_web: server busy", 0);
+      mg_execute_busy(pwebnginx->r, pwebnginx);
       return -1;
    }
+   pwebnginx->pooled = 1;
+   pwebnginx->pnext_task = NULL;
+   /* CMT82 hold the request until mg_tpool_completion(): if the client goes away nginx only marks the connection as failed instead of freeing the request under the worker thread */
+   pwebnginx->r->main->blocked ++;
+   pwebnginx->blocked = 1;
+   if (mg_tpool.stream_size > 0) {
+      mg_stream_init(pwebnginx->r, pwebnginx); /* CMT65 */
+   }
+   if (mg_tpool.pqueue_tail) {
+      mg_tpool.pqueue_tail->pnext_task = pwebnginx;
+   }
+   else {
+      mg_tpool.pqueue_head = pwebnginx;
+   }
+   mg_tpool.pqueue_tail = pwebnginx;
+   mg_tpool.no_queued ++;
+   pthread_cond_signal(&(mg_tpool.cond));
+   pthread_mutex_unlock(&(mg_tpool.lock));
 #endif
 
    return 0;
@@ -803,28 +1014,512 @@ static int mg_execute_launch_thread(MGWEBNGINX *pwebnginx)
 
 #if defined(_WIN32)
 DWORD WINAPI mg_execute_detached_thread(LPVOID pargs)
-#else
-void * mg_execute_detached_thread(void *pargs)
-#endif
 {
    MGWEBNGINX *pwebnginx;
 
    pwebnginx = (MGWEBNGINX *) pargs;
 
-#if !defined(_WIN32)
-   pthread_detach(pthread_self());
-#endif
-
    mg_execute(pwebnginx->r, pwebnginx);
 
-#if defined(_WIN32)
    return 0;
+}
+
 #else
+
+static int mg_tpool_start(ngx_cycle_t *cycle, int no_threads, int queue_size, int stream_size)
+{
+   int n, rc;
+   char buffer[256];
+   pthread_attr_t attr;
+   ngx_connection_t *c;
+
+   mg_tpool.threads = (pthread_t *) malloc(sizeof(pthread_t) * no_threads);
+   if (!mg_tpool.threads) {
+      return -1;
+   }
+   if (pipe(mg_tpool.notify_fd) != 0) {
+      free((void *) mg_tpool.threads);
+      mg_tpool.threads = NULL;
+      return -1;
+   }
+   ngx_nonblocking(mg_tpool.notify_fd[0]);
+   ngx_nonblocking(mg_tpool.notify_fd[1]);
+
+   c = ngx_get_connection(mg_tpool.notify_fd[0], cycle->log);
+   if (c == NULL) {
+      close(mg_tpool.notify_fd[0]);
+      close(mg_tpool.notify_fd[1]);
+      free((void *) mg_tpool.threads);
+      mg_tpool.threads = NULL;
+      return -1;
+   }
+   c->read->handler = mg_tpool_completion;
+   c->read->log = cycle->log;
+   if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+      ngx_free_connection(c);
+      close(mg_tpool.notify_fd[0]);
+      close(mg_tpool.notify_fd[1]);
+      free((void *) mg_tpool.threads);
+      mg_tpool.threads = NULL;
+      return -1;
+   }
+   mg_tpool.notify_conn = c;
+
+   pthread_mutex_init(&(mg_tpool.lock), NULL);
+   pthread_cond_init(&(mg_tpool.cond), NULL);
+   pthread_cond_init(&(mg_tpool.cond_stream), NULL); /* CMT65 */
+   mg_tpool.pstream = NULL;
+   mg_tpool.no_threads = no_threads;
+   mg_tpool.no_threads_running = 0;
+   mg_tpool.queue_size = queue_size;
+   mg_tpool.stream_size = stream_size;
+   mg_tpool.no_queued = 0;
+   mg_tpool.no_rejected = 0;
+   mg_tpool.pqueue_head = NULL;
+   mg_tpool.pqueue_tail = NULL;
+   mg_tpool.pdone = NULL;
+   mg_tpool.status = 1;
+
+   pthread_attr_init(&attr);
+   pthread_attr_setstacksize(&attr, MG_NGX_WORKER_STACK_SIZE);
+
+   for (n = 0; n < no_threads; n ++) {
+      rc = pthread_create(&(mg_tpool.threads[n]), &attr, mg_tpool_worker, NULL);
+      if (rc) {
+         break;
+      }
+      pthread_mutex_lock(&(mg_tpool.lock));
+      mg_tpool.no_threads_running ++;
+      pthread_mutex_unlock(&(mg_tpool.lock));
+   }
+   pthread_attr_destroy(&attr);
+
+   if (n == 0) {
+      mg_tpool.status = 0;
+      free((void *) mg_tpool.threads);
+      mg_tpool.threads = NULL;
+      return -1;
+   }
+   mg_tpool.no_threads = n;
+
+   sprintf(buffer, "Worker thread pool started: threads=%d; queue_size=%d; stream_buffer_size=%d;", n, queue_size, stream_size);
+   mg_log_event(&(mg_system.log), NULL, buffer, "mg_web: worker thread pool", 0);
+
+   return 0;
+}
+
+
+static int mg_tpool_stop(void)
+{
+   int n;
+
+   if (mg_tpool.status != 1) {
+      return 0;
+   }
+
+   pthread_mutex_lock(&(mg_tpool.lock));
+   mg_tpool.status = 2;
+   pthread_cond_broadcast(&(mg_tpool.cond));
+   pthread_cond_broadcast(&(mg_tpool.cond_stream));
+   pthread_mutex_unlock(&(mg_tpool.lock));
+
+   /* CMT82 wait for requests in progress: the worker threads must be finished before mg_worker_exit() frees the resources they use */
+   for (n = 0; n < mg_tpool.no_threads; n ++) {
+      pthread_join(mg_tpool.threads[n], NULL);
+   }
+   free((void *) mg_tpool.threads);
+   mg_tpool.threads = NULL;
+   mg_tpool.status = 0;
+
+   return 0;
+}
+
+
+static void * mg_tpool_worker(void *arg)
+{
+   MGWEBNGINX *pwebnginx;
+
+   (void) arg;
+   for (;;) {
+      pthread_mutex_lock(&(mg_tpool.lock));
+      while (mg_tpool.status == 1 && !mg_tpool.pqueue_head) {
+         pthread_cond_wait(&(mg_tpool.cond), &(mg_tpool.lock));
+      }
+      if (mg_tpool.status != 1) {
+         mg_tpool.no_threads_running --;
+         pthread_mutex_unlock(&(mg_tpool.lock));
+         break;
+      }
+      pwebnginx = mg_tpool.pqueue_head;
+      mg_tpool.pqueue_head = pwebnginx->pnext_task;
+      if (!mg_tpool.pqueue_head) {
+         mg_tpool.pqueue_tail = NULL;
+      }
+      mg_tpool.no_queued --;
+      pthread_mutex_unlock(&(mg_tpool.lock));
+
+      pwebnginx->output_last = NULL;
+      pwebnginx->output_buf_last = NULL;
+
+      mg_web_process(pwebnginx->pweb);
+
+      /* hand the request back to the event loop to send the response */
+      pthread_mutex_lock(&(mg_tpool.lock));
+      pwebnginx->pnext_task = mg_tpool.pdone;
+      mg_tpool.pdone = pwebnginx;
+      pthread_mutex_unlock(&(mg_tpool.lock));
+
+      if (write(mg_tpool.notify_fd[1], "r", 1) < 0) {
+         ; /* pipe full: the event loop has a notification pending already */
+      }
+   }
+
    return NULL;
-#endif
 }
 
 
+static void mg_tpool_completion(ngx_event_t *ev)
+{
+   char buffer[64];
+   ngx_connection_t *c;
+   MGWEBNGINX *pwebnginx, *pnext, *plist;
+
+   (void) ev;
+   while (read(mg_tpool.notify_fd[0], buffer, sizeof(buffer)) > 0) {
+      ;
+   }
+
+   /* CMT65 pass full stream buffers to the output filter */
+   pthread_mutex_lock(&(mg_tpool.lock));
+   plist = mg_tpool.pstream;
+   mg_tpool.pstream = NULL;
+   for (pwebnginx = plist; pwebnginx; pwebnginx = pwebnginx->pnext_stream) {
+      pwebnginx->stream_queued = 0;
+   }
+   pthread_mutex_unlock(&(mg_tpool.lock));
+
+   while (plist) {
+      pnext = plist->pnext_stream;
+      c = plist->r->connection;
+      mg_stream_send(plist->r, plist);
+      ngx_http_run_posted_requests(c);
+      plist = pnext;
+   }
+
+   pthread_mutex_lock(&(mg_tpool.lock));
+   pwebnginx = mg_tpool.pdone;
+   mg_tpool.pdone = NULL;
+   pthread_mutex_unlock(&(mg_tpool.lock));
+
+   /* restore the order of completion */
+   plist = NULL;
+   while (pwebnginx) {
+      pnext = pwebnginx->pnext_task;
+      pwebnginx->pnext_task = plist;
+      plist = pwebnginx;
+      pwebnginx = pnext;
+   }
+
+   while (plist) {
+      pnext = plist->pnext_task;
+      plist->pooled = 0;
+      c = plist->r->connection;
+      if (plist->blocked) { /* CMT82 */
+         plist->blocked = 0;
+         plist->r->main->blocked --;
+      }
+      mg_execute_finish(plist->r, plist);
+      ngx_http_run_posted_requests(c);
+      plist = pnext;
+   }
+
+   return;
+}
+
+
+/* CMT78 an SSE stream served by the core's relay has ended: called from a relay thread, the request is finished in the event loop */
+static int mg_sse_complete(MGWEB *pweb)
+{
+   MGWEBNGINX *pwebnginx;
+
+   pwebnginx = (MGWEBNGINX *) pweb->pweb_server;
+
+   pthread_mutex_lock(&(mg_tpool.lock));
+   pwebnginx->pnext_task = mg_tpool.pdone;
+   mg_tpool.pdone = pwebnginx;
+   pthread_mutex_unlock(&(mg_tpool.lock));
+
+   if (write(mg_tpool.notify_fd[1], "r", 1) < 0) {
+      ; /* pipe full: the event loop has a notification pending already */
+   }
+
+   return 0;
+}
+
+
+/* CMT65 allocate the two stream buffers for a request: called from the event loop before the request is queued */
+static int mg_stream_init(ngx_http_request_t *r, MGWEBNGINX *pwebnginx)
+{
+   int n;
+
+   for (n = 0; n < 2; n ++) {
+      pwebnginx->stream_data[n] = ngx_palloc(r->pool, mg_tpool.stream_size);
+      pwebnginx->stream_buf[n] = ngx_calloc_buf(r->pool);
+      pwebnginx->stream_chain[n] = ngx_alloc_chain_link(r->pool);
+      if (!pwebnginx->stream_data[n] || !pwebnginx->stream_buf[n] || !pwebnginx->stream_chain[n]) {
+         pwebnginx->stream_size = 0; /* buffer the whole response instead */
+         return -1;
+      }
+      pwebnginx->stream_buf[n]->memory = 1;
+      pwebnginx->stream_buf[n]->flush = 1;
+      pwebnginx->stream_chain[n]->buf = pwebnginx->stream_buf[n];
+      pwebnginx->stream_chain[n]->next = NULL;
+      pwebnginx->stream_state[n] = 0;
+   }
+   pwebnginx->stream_size = mg_tpool.stream_size;
+   pwebnginx->stream_index = 0;
+   pwebnginx->stream_send = 0;
+   pwebnginx->stream_fill = 0;
+   pwebnginx->stream_total = 0;
+   pwebnginx->stream_error = 0;
+   pwebnginx->stream_queued = 0;
+
+   return 0;
+}
+
+
+/* CMT65 copy response data into the current stream buffer: called from a worker thread */
+static int mg_stream_write(MGWEBNGINX *pwebnginx, unsigned char *pbuffer, int buffer_size)
+{
+   int len;
+
+   while (buffer_size > 0) {
+      if (pwebnginx->stream_error) {
+         return -1;
+      }
+      len = pwebnginx->stream_size - pwebnginx->stream_fill;
+      if (len > buffer_size) {
+         len = buffer_size;
+      }
+      memcpy((void *) (pwebnginx->stream_data[pwebnginx->stream_index] + pwebnginx->stream_fill), (void *) pbuffer, (size_t) len);
+      pwebnginx->stream_fill += len;
+      pwebnginx->stream_total += len;
+      pbuffer += len;
+      buffer_size -= len;
+
+      if (pwebnginx->stream_fill == pwebnginx->stream_size) {
+         if (mg_stream_post(pwebnginx) < 0) {
+            return -1;
+         }
+      }
+   }
+
+   return 0;
+}
+
+
+/* CMT65 hand a full stream buffer to the event loop then wait for the other buffer to be released by nginx (backpressure) */
+static int mg_stream_post(MGWEBNGINX *pwebnginx)
+{
+   int n, rc;
+   ngx_buf_t *b;
+
+   n = pwebnginx->stream_index;
+   b = pwebnginx->stream_buf[n];
+   b->pos = pwebnginx->stream_data[n];
+   b->last = pwebnginx->stream_data[n] + pwebnginx->stream_fill;
+   b->last_buf = 0;
+   b->last_in_chain = 0;
+
+   pthread_mutex_lock(&(mg_tpool.lock));
+   pwebnginx->stream_state[n] = 1;
+   if (!pwebnginx->stream_queued) {
+      pwebnginx->stream_queued = 1;
+      pwebnginx->pnext_stream = mg_tpool.pstream;
+      mg_tpool.pstream = pwebnginx;
+   }
+   pthread_mutex_unlock(&(mg_tpool.lock));
+
+   if (write(mg_tpool.notify_fd[1], "s", 1) < 0) {
+      ; /* pipe full: the event loop has a notification pending already */
+   }
+
+   n = n ? 0 : 1;
+   pwebnginx->stream_index = n;
+   pwebnginx->stream_fill = 0;
+
+   pthread_mutex_lock(&(mg_tpool.lock));
+   while (pwebnginx->stream_state[n] != 0 && !pwebnginx->stream_error && mg_tpool.status == 1) {
+      pthread_cond_wait(&(mg_tpool.cond_stream), &(mg_tpool.lock));
+   }
+   rc = (pwebnginx->stream_error || mg_tpool.status != 1) ? -1 : 0;
+   pthread_mutex_unlock(&(mg_tpool.lock));
+
+   return rc;
+}
+
+
+/* CMT65 pass full stream buffers to the output filter and release those that nginx has finished with: called from the event loop */
+static int mg_stream_send(ngx_http_request_t *r, MGWEBNGINX *pwebnginx)
+{
+   int n, rc, header_pending, released, pending;
+   ngx_connection_t *c;
+   ngx_http_core_loc_conf_t *clcf;
+
+   c = r->connection;
+   rc = NGX_OK;
+
+   if (pwebnginx->stream_error) {
+      return NGX_ERROR;
+   }
+
+   pthread_mutex_lock(&(mg_tpool.lock));
+   header_pending = pwebnginx->header_pending;
+   pthread_mutex_unlock(&(mg_tpool.lock));
+
+   if (header_pending) {
+      rc = mg_send_pending_header(r, pwebnginx);
+      if (rc == NGX_ERROR || rc > NGX_OK) {
+         rc = NGX_ERROR;
+      }
+   }
+
+   while (rc != NGX_ERROR && pwebnginx->stream_state[pwebnginx->stream_send] == 1) {
+      n = pwebnginx->stream_send;
+      pthread_mutex_lock(&(mg_tpool.lock));
+      pwebnginx->stream_state[n] = 2;
+      pthread_mutex_unlock(&(mg_tpool.lock));
+      pwebnginx->stream_send = n ? 0 : 1;
+      if (r->header_only) {
+         pwebnginx->stream_buf[n]->pos = pwebnginx->stream_buf[n]->last;
+         continue;
+      }
+      pwebnginx->stream_chain[n]->next = NULL;
+      rc = ngx_http_output_filter(r, pwebnginx->stream_chain[n]);
+   }
+
+   if (rc != NGX_ERROR && (pwebnginx->stream_state[0] == 2 || pwebnginx->stream_state[1] == 2) && (r->buffered || c->buffered)) {
+      rc = ngx_http_output_filter(r, NULL);
+   }
+
+   released = 0;
+   pthread_mutex_lock(&(mg_tpool.lock));
+   for (n = 0; n < 2; n ++) {
+      if (rc == NGX_ERROR || c->error) {
+         pwebnginx->stream_state[n] = 0;
+         released = 1;
+      }
+      else if (pwebnginx->stream_state[n] == 2 && (ngx_buf_size(pwebnginx->stream_buf[n]) == 0 || (!r->buffered && !c->buffered))) {
+         pwebnginx->stream_state[n] = 0;
+         released = 1;
+      }
+   }
+   if (rc == NGX_ERROR || c->error) {
+      pwebnginx->stream_error = 1;
+   }
+   if (released) {
+      pthread_cond_broadcast(&(mg_tpool.cond_stream));
+   }
+   pending = (pwebnginx->stream_state[0] == 2 || pwebnginx->stream_state[1] == 2);
+   pthread_mutex_unlock(&(mg_tpool.lock));
+
+   if (pwebnginx->stream_error) {
+      return NGX_ERROR;
+   }
+
+   /* wait for the client to accept the data held by nginx */
+   if (pending) {
+      clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+      r->write_event_handler = mg_stream_write_handler;
+      if (!c->write->ready) {
+         ngx_add_timer(c->write, clcf->send_timeout);
+      }
+      if (ngx_handle_write_event(c->write, clcf->send_lowat) != NGX_OK) {
+         pthread_mutex_lock(&(mg_tpool.lock));
+         pwebnginx->stream_error = 1;
+         pwebnginx->stream_state[0] = 0;
+         pwebnginx->stream_state[1] = 0;
+         pthread_cond_broadcast(&(mg_tpool.cond_stream));
+         pthread_mutex_unlock(&(mg_tpool.lock));
+         return NGX_ERROR;
+      }
+      return NGX_AGAIN;
+   }
+
+   r->write_event_handler = ngx_http_request_empty_handler;
+
+   return NGX_OK;
+}
+
+
+static void mg_stream_write_handler(ngx_http_request_t *r)
+{
+   ngx_event_t *wev;
+   MGWEBNGINX *pwebnginx;
+
+   pwebnginx = ngx_http_get_module_ctx(r, ngx_http_mg_web_module);
+   wev = r->connection->write;
+
+   if (pwebnginx == NULL || pwebnginx->stream_size == 0) {
+      return;
+   }
+
+   if (wev->timedout) {
+      r->connection->timedout = 1;
+      pthread_mutex_lock(&(mg_tpool.lock));
+      pwebnginx->stream_error = 1;
+      pwebnginx->stream_state[0] = 0;
+      pwebnginx->stream_state[1] = 0;
+      pthread_cond_broadcast(&(mg_tpool.cond_stream));
+      pthread_mutex_unlock(&(mg_tpool.lock));
+      return;
+   }
+
+   if (wev->timer_set) {
+      ngx_del_timer(wev);
+   }
+
+   mg_stream_send(r, pwebnginx);
+
+   return;
+}
+
+
+/* CMT82 allocate memory for a request held by a worker pool thread: nginx pools must only be used from the event loop */
+static void * mg_pooled_alloc(MGWEBNGINX *pwebnginx, size_t size)
+{
+   MGNGXMEM *pmem;
+
+   pmem = (MGNGXMEM *) calloc(1, sizeof(MGNGXMEM) + size);
+   if (!pmem) {
+      return NULL;
+   }
+   pmem->pnext = pwebnginx->pmem;
+   pwebnginx->pmem = pmem;
+
+   return (void *) (pmem + 1);
+}
+
+
+/* CMT82 request pool cleanup handler */
+static void mg_pooled_free(void *data)
+{
+   MGWEBNGINX *pwebnginx;
+   MGNGXMEM *pmem, *pnext;
+
+   pwebnginx = (MGWEBNGINX *) data;
+
+   for (pmem = pwebnginx->pmem; pmem; pmem = pnext) {
+      pnext = pmem->pnext;
+      free((void *) pmem);
+   }
+   pwebnginx->pmem = NULL;
+
+   return;
+}
+#endif
+
+
 #if defined(MG_NGX_THREADS)
 static void mg_execute_pool(void *data, ngx_log_t *log)
 {
@@ -1027,6 +1722,66 @@ static char * mg_param_mgwebthreadpool(ngx_conf_t *cf, ngx_command_t *cmd, void
 }
 
 
+/* CMT64 MGWEBWorkerThreads threads [queue_size] */
+static char * mg_param_mgwebworkerthreads(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+   ngx_int_t n;
+   ngx_str_t *value;
+   ngx_http_mg_web_main_conf_t *dconf = conf;
+
+#if defined(MG_API_TRACE)
+   mg_log_event(&debug_log, NULL, "mg_web: mg_param_mgwebworkerthreads()", "mg_web: trace", 0);
+#endif
+
+   (void) cmd;
+   value = cf->args->elts;
+
+   n = ngx_atoi(value[1].data, value[1].len);
+   if (n == NGX_ERROR || n > MG_NGX_WORKER_THREADS_MAX) {
+      ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid number of worker threads \"%V\"", &value[1]);
+      return NGX_CONF_ERROR;
+   }
+   dconf->mg_worker_threads = (int) n;
+   dconf->mg_worker_queue_size = (int) n * MG_NGX_WORKER_QUEUE_FACTOR;
+
+   if (cf->args->nelts > 2) {
+      n = ngx_atoi(value[2].data, value[2].len);
+      if (n == NGX_ERROR) {
+         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid worker thread queue size \"%V\"", &value[2]);
+         return NGX_CONF_ERROR;
+      }
+      dconf->mg_worker_queue_size = (int) n;
+   }
+
+   return NGX_CONF_OK;
+}
+
+
+/* CMT65 MGWEBStreamBufferSize size */
+static char * mg_param_mgwebstreambuffersize(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+   ssize_t size;
+   ngx_str_t *value;
+   ngx_http_mg_web_main_conf_t *dconf = conf;
+
+#if defined(MG_API_TRACE)
+   mg_log_event(&debug_log, NULL, "mg_web: mg_param_mgwebstreambuffersize()", "mg_web: trace", 0);
+#endif
+
+   (void) cmd;
+   value = cf->args->elts;
+
+   size = ngx_parse_size(&value[1]);
+   if (size == NGX_ERROR || size > 0x7fffffff) {
+      ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid stream buffer size \"%V\"", &value[1]);
+      return NGX_CONF_ERROR;
+   }
+   dconf->mg_stream_buffer_size = (int) size;
+
+   return NGX_CONF_OK;
+}
+
+
 static ngx_int_t mg_pre_conf(ngx_conf_t *cf)
 {
 #if defined(MG_API_TRACE)
@@ -1075,6 +1830,9 @@ static void * mg_create_main_conf(ngx_conf_t *cf)
    conf->mg_config_file[0] = '\0';
    conf->mg_log_file[0] = '\0';
    conf->mg_thread_pool[0] = '\0';
+   conf->mg_worker_threads = 0; /* CMT64 */
+   conf->mg_worker_queue_size = 0;
+   conf->mg_stream_buffer_size = MG_NGX_STREAM_BUFFER_SIZE; /* CMT65 */
 
 #if defined(MG_API_TRACE)
    {
@@ -1220,6 +1978,9 @@ ngx_int_t mg_module_init(ngx_cycle_t *cycle)
 
 ngx_int_t mg_worker_process_init(ngx_cycle_t *cycle)
 {
+#if !defined(_WIN32)
+   ngx_http_mg_web_main_conf_t  *pmain;
+#endif
 
 #if defined(MG_API_TRACE)
    mg_log_event(&debug_log, NULL, "mg_web: mg_worker_process_init()", "mg_web: trace", 0);
@@ -1232,6 +1993,16 @@ ngx_int_t mg_worker_process_init(ngx_cycle_t *cycle)
    mg_ext_realloc = mg_remalloc_nginx;
    mg_ext_free = mg_free_nginx;
 
+   /* CMT64 start the worker thread pool */
+#if !defined(_WIN32)
+   pmain = (ngx_http_mg_web_main_conf_t *) ngx_http_cycle_get_module_main_conf(cycle, ngx_http_mg_web_module);
+   if (pmain && pmain->mg_worker_threads > 0) {
+      if (mg_tpool_start(cycle, pmain->mg_worker_threads, pmain->mg_worker_queue_size, pmain->mg_stream_buffer_size) != 0) {
+         mg_log_event(&(mg_system.log), NULL, "Cannot start the worker thread pool: requests will be processed in the nginx event loop", "mg_web: error", 0);
+      }
+   }
+#endif
+
    return NGX_OK;
 }
 
@@ -1242,6 +2013,10 @@ void mg_worker_process_exit(ngx_cycle_t *cycle)
    mg_log_event(&debug_log, NULL, "mg_web: mg_worker_process_exit()", "mg_web: trace", 0);
 #endif
 
+#if !defined(_WIN32)
+   mg_tpool_stop(); /* CMT64 */
+#endif
+
    mg_worker_exit();
 
    return;
@@ -1299,13 +2074,30 @@ void * mg_malloc_nginx(void *pweb_server, unsigned long size)
    mg_log_event(&debug_log, NULL, buffer, "mg_web: trace", 0);
 }
 */
-   return ngx_pcalloc(((MGWEBNGINX *) pweb_server)->r->pool, size);
+   return mg_pcalloc_nginx((MGWEBNGINX *) pweb_server, size);
 }
 
 
 void * mg_remalloc_nginx(void *pweb_server, void *p, unsigned long size)
 {
-   return ngx_pcalloc(((MGWEBNGINX *) pweb_server)->r->pool, size);
+   return mg_pcalloc_nginx((MGWEBNGINX *) pweb_server, size);
+}
+
+
+/* CMT82 a worker pool thread must not allocate from the request pool while the event loop is using it */
+static void * mg_pcalloc_nginx(MGWEBNGINX *pwebnginx, unsigned long size)
+{
+   void *p;
+
+#if !defined(_WIN32)
+   if (pwebnginx->pooled) {
+      p = mg_pooled_alloc(pwebnginx, (size_t) size);
+      return p;
+   }
+#endif
+
+   p = ngx_pcalloc(pwebnginx->r->pool, size);
+   return p;
 }
 
 
@@ -1315,6 +2107,38 @@ int mg_free_nginx(void *pweb_server, void *p)
 }
 
 
+/* CMT68 index the request headers in one pass over headers_in */
+int mg_get_request_headers(MGWEB *pweb)
+{
+   unsigned int tn;
+   MGWEBNGINX *pwebnginx;
+   ngx_list_part_t  *part;
+   ngx_table_elt_t *hd;
+
+   pwebnginx = (MGWEBNGINX *) pweb->pweb_server;
+   part = &(pwebnginx->r->headers_in.headers.part);
+   hd = part->elts;
+   for (tn = 0 ;; tn++) {
+      if (tn >= part->nelts) {
+         if (part->next == NULL) {
+            break;
+         }
+         part = part->next;
+         hd = part->elts;
+         tn = 0;
+         if (part->nelts == 0) {
+            continue;
+         }
+      }
+      if (hd[tn].key.data && hd[tn].hash) {
+         mg_index_request_header(pweb, (char *) hd[tn].key.data, (int) hd[tn].key.len, (char *) hd[tn].value.data, (int) hd[tn].value.len, 0);
+      }
+   }
+
+   return CACHE_SUCCESS;
+}
+
+
 int mg_get_cgi_variable(MGWEB *pweb, char *name, char *pbuffer, int *pbuffer_size)
 {
    int rc, len, len1, n, offset;
@@ -1754,25 +2578,25 @@ __try {
 */
    pwebnginx = (MGWEBNGINX *) pweb->pweb_server;
 
-   c = ngx_pcalloc(pwebnginx->r->pool, sizeof(ngx_chain_t));
+#if !defined(_WIN32)
+   if (pwebnginx->pooled && pwebnginx->stream_size) { /* CMT65 */
+      return mg_stream_write(pwebnginx, pbuffer, buffer_size);
+   }
+#endif
+
+   c = (ngx_chain_t *) mg_pcalloc_nginx(pwebnginx, sizeof(ngx_chain_t));
    if (c == NULL) {
-      ngx_log_error(NGX_LOG_ERR, pwebnginx->r->connection->log, 0, "Failed to allocate response buffer (ngx_chain_t).");
-      ngx_http_finalize_request(pwebnginx->r, NGX_HTTP_INTERNAL_SERVER_ERROR);
-      return -1;
+      return mg_client_write_error(pwebnginx, "Failed to allocate response buffer (ngx_chain_t).");
    }
 
-   b = ngx_pcalloc(pwebnginx->r->pool, sizeof(ngx_buf_t));
+   b = (ngx_buf_t *) mg_pcalloc_nginx(pwebnginx, sizeof(ngx_buf_t));
    if (b == NULL) {
-      ngx_log_error(NGX_LOG_ERR, pwebnginx->r->connection->log, 0, "Failed to allocate response buffer (ngx_buf_t).");
-      ngx_http_finalize_request(pwebnginx->r, NGX_HTTP_INTERNAL_SERVER_ERROR);
-      return -1;
+      return mg_client_write_error(pwebnginx, "Failed to allocate response buffer (ngx_buf_t).");
    }
 
-   bx = ngx_pcalloc(pwebnginx->r->pool, buffer_size + 32);
+   bx = (u_char *) mg_pcalloc_nginx(pwebnginx, buffer_size + 32);
    if (bx == NULL) {
-      ngx_log_error(NGX_LOG_ERR, pwebnginx->r->connection->log, 0, "Failed to allocate response buffer (u_char).");
-      ngx_http_finalize_request(pwebnginx->r, NGX_HTTP_INTERNAL_SERVER_ERROR);
-      return -1;
+      return mg_client_write_error(pwebnginx, "Failed to allocate response buffer (u_char).");
    }
 
    memcpy((void *) bx, (void *) pbuffer, buffer_size);
@@ -1821,6 +2645,21 @@ __except (EXCEPTION_EXECUTE_HANDLER) {
 
 }
 
+/* CMT82 nginx functions are only called from the event loop: a pooled request is logged by mg_web and finalized by mg_execute_finish() */
+static int mg_client_write_error(MGWEBNGINX *pwebnginx, char *error)
+{
+   if (pwebnginx->pooled) {
+      mg_log_event(&(mg_system.log), pwebnginx->pweb, error, "mg_web: mg_client_write", 0);
+   }
+   else {
+      ngx_log_error(NGX_LOG_ERR, pwebnginx->r->connection->log, 0, "%s", error);
+      ngx_http_finalize_request(pwebnginx->r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+   }
+
+   return -1;
+}
+
+
 /* v2.7.33 */
 int mg_client_write_now(MGWEB *pweb, unsigned char *pbuffer, int buffer_size)
 {
@@ -1880,11 +2719,11 @@ __except (EXCEPTION_EXECUTE_HANDLER) {
 
 int mg_submit_headers(MGWEB *pweb)
 {
-   int n, rc, status, size;
-   char *pa, *pz, *p1, *p2;
-   char ab[32]; /* v2.7.33 */
+   int rc;
+#if !defined(_WIN32)
+   size_t size;
+#endif
    MGWEBNGINX *pwebnginx;
-   ngx_table_elt_t *h;
 
 #ifdef _WIN32
 __try {
@@ -1893,6 +2732,73 @@ __try {
    pwebnginx = (MGWEBNGINX *) pweb->pweb_server;
    rc = NGX_OK;
 
+#if !defined(_WIN32)
+   if (pwebnginx->pooled) { /* CMT82 running on a worker pool thread: the headers are applied to the request and sent from the event loop */
+      size = strlen(pweb->response_headers);
+      pwebnginx->header_data = (char *) mg_pooled_alloc(pwebnginx, size + 1);
+      if (!pwebnginx->header_data) {
+         return NGX_HTTP_INTERNAL_SERVER_ERROR;
+      }
+      memcpy((void *) pwebnginx->header_data, (void *) pweb->response_headers, size + 1);
+      pthread_mutex_lock(&(mg_tpool.lock));
+      pwebnginx->header_pending = 1;
+      pthread_mutex_unlock(&(mg_tpool.lock));
+      return NGX_OK;
+   }
+#endif
+
+   rc = mg_apply_headers(pweb, pwebnginx, pweb->response_headers);
+   if (rc != NGX_OK) {
+      return rc;
+   }
+
+   rc = ngx_http_send_header(pwebnginx->r);
+
+   if (pweb->sse) { /* v2.7.33 */
+      ngx_http_send_special(pwebnginx->r, NGX_HTTP_FLUSH);
+   }
+
+/*
+   {
+      char buffer[256];
+      sprintf(buffer, "rc=%d; clen=%d; status=%d; sse=%d;", n, pweb->response_clen, (int) pwebnginx->r->headers_out.status, pweb->sse);
+      mg_log_event(pweb->plog, NULL, buffer, "mgweb: headers result", 0);
+   }
+*/
+
+   return rc;
+
+#ifdef _WIN32
+}
+__except (EXCEPTION_EXECUTE_HANDLER) {
+
+   DWORD code;
+   char buffer[256];
+
+   __try {
+      code = GetExceptionCode();
+      sprintf_s(buffer, 255, "Exception caught in f:mg_submit_headers: %x", code);
+      mg_log_event(pweb->plog, NULL, buffer, "Error Condition", 0);
+   }
+   __except (EXCEPTION_EXECUTE_HANDLER ) {
+      ;
+   }
+
+   return NGX_ERROR;
+}
+#endif
+
+}
+
+
+/* CMT82 set the response status and headers for nginx from a copy of the headers: called from the event loop */
+static int mg_apply_headers(MGWEB *pweb, MGWEBNGINX *pwebnginx, char *headers)
+{
+   int n, status, size;
+   char *pa, *pz, *pe, *p1, *p2;
+   static char ab[32] = "X-Accel-Buffering: no"; /* v2.7.33 CMT82 static: the header is sent after this function returns */
+   ngx_table_elt_t *h;
+
    if (pweb->sse) { /* v2.7.33 */
       pwebnginx->r->main->count ++; /* prevent nginx close connection after upgrade */
       pwebnginx->r->keepalive = 1;
@@ -1939,10 +2845,11 @@ __try {
    }
 */
 
-   pa = pweb->response_headers;
+   pa = headers;
+   pe = pa + strlen(pa); /* CMT69 */
 
    for (n = 0; ;n ++) {
-      pz = strstr(pa, "\r\n");
+      pz = mg_scan_find(pa, (int) (pe - pa), "\r\n", 2);
       if (!pz)
          break;
 
@@ -2006,7 +2913,6 @@ __try {
    }
 
    if (pweb->sse) { /* v2.7.33 */
-      strcpy(ab, "X-Accel-Buffering: no");
       h = (ngx_table_elt_t *) ngx_list_push(&(pwebnginx->r->headers_out.headers));
       if (h == NULL) {
          return NGX_HTTP_INTERNAL_SERVER_ERROR;
@@ -2018,42 +2924,20 @@ __try {
       h->value.len = (int) 2;
    }
 
-   rc = ngx_http_send_header(pwebnginx->r);
-
-   if (pweb->sse) { /* v2.7.33 */
-      ngx_http_send_special(pwebnginx->r, NGX_HTTP_FLUSH);
-   }
-
-/*
-   {
-      char buffer[256];
-      sprintf(buffer, "rc=%d; clen=%d; status=%d; sse=%d;", n, pweb->response_clen, (int) pwebnginx->r->headers_out.status, pweb->sse);
-      mg_log_event(pweb->plog, NULL, buffer, "mgweb: headers result", 0);
-   }
-*/
-
-   return rc;
-
-#ifdef _WIN32
+   return NGX_OK;
 }
-__except (EXCEPTION_EXECUTE_HANDLER) {
 
-   DWORD code;
-   char buffer[256];
 
-   __try {
-      code = GetExceptionCode();
-      sprintf_s(buffer, 255, "Exception caught in f:mg_submit_headers: %x", code);
-      mg_log_event(pweb->plog, NULL, buffer, "Error Condition", 0);
-   }
-   __except (EXCEPTION_EXECUTE_HANDLER ) {
-      ;
-   }
+/* CMT82 send the headers submitted by a worker pool thread */
+static ngx_int_t mg_send_pending_header(ngx_http_request_t *r, MGWEBNGINX *pwebnginx)
+{
+   pwebnginx->header_pending = 0;
 
-   return NGX_ERROR;
-}
-#endif
+   if (mg_apply_headers(pwebnginx->pweb, pwebnginx, pwebnginx->header_data) != NGX_OK) {
+      return NGX_ERROR;
+   }
 
+   return ngx_http_send_header(r);
 }
 
 
@@ -2117,6 +3001,11 @@ int mg_websocket_init(MGWEB *pweb)
       strcat(header, pweb->pwsock->sec_websocket_protocol);
       strcat(header, "\r\n");
    }
+   if (pweb->pwsock->sec_websocket_extensions[0]) { /* CMT80 */
+      strcat(header, "Sec-WebSocket-Extensions: ");
+      strcat(header, pweb->pwsock->sec_websocket_extensions);
+      strcat(header, "\r\n");
+   }
    strcat(header, "\r\n");
 
    pwebnginx->r->main->count ++; /* prevent nginx close connection after upgrade */
@@ -2407,19 +3296,107 @@ size_t mg_websocket_write_block(MGWEB *pweb, int type, unsigned char *buffer, si
 
       pos = mg_websocket_create_header(pweb, type, header, payload_length);
 
-      mg_websocket_write(pweb, (char *) header, (int) pos); /* Header */
+      written = mg_websocket_send_frame(pweb, header, pos, buffer, (size_t) payload_length); /* CMT82 a close frame has set 'closing' by now */
+   }
+
+   return written;
+}
 
-      if (payload_length > 0) {
-         if (mg_websocket_write(pweb, (char *) buffer, (int) buffer_size) > 0) { /* Payload Data */
-            written = buffer_size;
-         }
+/* CMT79 write a frame whose header has already been created: used to send one message to all of a channel's subscribers */
+size_t mg_websocket_write_frame(MGWEB *pweb, unsigned char *header, size_t header_size, unsigned char *buffer, size_t buffer_size)
+{
+   size_t written;
+
+   written = 0;
+   if (!pweb->pwsock->closing) {
+      written = mg_websocket_send_frame(pweb, header, header_size, buffer, buffer_size);
+   }
+
+   return written;
+}
+
+
+/* CMT81 header and payload are sent with one write */
+/* CMT82 the caller has checked that the WebSocket is not closing */
+static size_t mg_websocket_send_frame(MGWEB *pweb, unsigned char *header, size_t header_size, unsigned char *buffer, size_t buffer_size)
+{
+   size_t written;
+   unsigned char frame[MG_WS_FRAME_COALESCE_SIZE];
+
+   written = 0;
+
+   if ((header_size + buffer_size) <= MG_WS_FRAME_COALESCE_SIZE) {
+      memcpy((void *) frame, (void *) header, header_size);
+      if (buffer_size > 0) {
+         memcpy((void *) (frame + header_size), (void *) buffer, buffer_size);
+      }
+      if (mg_websocket_write(pweb, (char *) frame, (int) (header_size + buffer_size)) > 0 && buffer_size > 0) {
+         written = buffer_size;
       }
    }
+   else if (mg_websocket_writev(pweb, header, header_size, buffer, buffer_size) > 0) {
+      written = buffer_size;
+   }
 
    return written;
 }
 
 
+/* CMT81 write a header and large payload: in one system call unless the connection uses SSL */
+static int mg_websocket_writev(MGWEB *pweb, unsigned char *header, size_t header_size, unsigned char *buffer, size_t buffer_size)
+{
+#if !defined(_WIN32)
+   int n, iov_no;
+   size_t total, sent;
+   struct iovec iov[2], *piov;
+   ngx_connection_t *c;
+   MGWEBNGINX *pwebnginx;
+
+   pwebnginx = (MGWEBNGINX *) pweb->pweb_server;
+   c = pwebnginx->r->connection;
+
+#if (NGX_SSL)
+   if (c->ssl == NULL)
+#endif
+   {
+      iov[0].iov_base = (void *) header;
+      iov[0].iov_len = header_size;
+      iov[1].iov_base = (void *) buffer;
+      iov[1].iov_len = buffer_size;
+      piov = iov;
+      iov_no = 2;
+      total = header_size + buffer_size;
+      sent = 0;
+
+      while (sent < total) {
+         n = (int) writev(c->fd, piov, iov_no);
+         if (n < 0 && ngx_socket_errno == NGX_EINTR) {
+            continue;
+         }
+         if (n < 1) { /* as for ngx_send() in mg_websocket_write() */
+            return 0;
+         }
+         sent += (size_t) n;
+         while (iov_no > 0 && (size_t) n >= piov->iov_len) { /* allow for a partial write */
+            n -= (int) piov->iov_len;
+            piov ++;
+            iov_no --;
+         }
+         if (iov_no > 0) {
+            piov->iov_base = (void *) (((unsigned char *) piov->iov_base) + n);
+            piov->iov_len -= (size_t) n;
+         }
+      }
+      return (int) total;
+   }
+#endif
+
+   mg_websocket_write(pweb, (char *) header, (int) header_size); /* Header */
+   return mg_websocket_write(pweb, (char *) buffer, (int) buffer_size); /* Payload Data */
+}
+
+
+
 int mg_websocket_write(MGWEB *pweb, char *buffer, int len)
 {
    int rc, bytes_sent;